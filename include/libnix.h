@@ -1,10 +1,27 @@
 #ifndef INCLUDE_libnix_h__
 #define INCLUDE_libnix_h__
 
+#include "libnix/ast.h"
 #include "libnix/buffer.h"
+#include "libnix/char.h"
 #include "libnix/common.h"
+#include "libnix/cst.h"
+#include "libnix/digest.h"
 #include "libnix/error.h"
+#include "libnix/intern.h"
+#include "libnix/keyword.h"
 #include "libnix/lexeme.h"
+#include "libnix/lex_files.h"
+#include "libnix/lexer.h"
+#include "libnix/number.h"
+#include "libnix/parse_cache.h"
+#include "libnix/parser.h"
+#include "libnix/pool.h"
 #include "libnix/position.h"
+#include "libnix/source.h"
+#include "libnix/source_cache.h"
+#include "libnix/source_map.h"
+#include "libnix/string.h"
+#include "libnix/tokens.h"
 
 #endif
\ No newline at end of file
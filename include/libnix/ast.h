@@ -0,0 +1,164 @@
+#ifndef INCLUDE_libnix_ast_h__
+#define INCLUDE_libnix_ast_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/common.h"
+#include "libnix/error.h"
+
+NIX_BEGIN_DECL
+
+// Stands for a missing child, such as the default of a select without one
+#define NIX_AST_NONE UINT32_MAX
+
+// What each node holds in data, where a list is a first index into lists
+// and a count, and nodes are indices into nodes
+enum nix_ast_kind {
+    // data[0..1]: the low and high halves of the value
+    NIX_AST_INT = 0,
+
+    // data[0..1]: the low and high halves of the bits of the value
+    NIX_AST_FLOAT,
+
+    // data[0..1]: offset and length of the decoded text in text
+    NIX_AST_TEXT,
+    NIX_AST_PATH,
+    NIX_AST_HPATH,
+    NIX_AST_SPATH,
+    NIX_AST_URI,
+
+    // data[0]: symbol id
+    NIX_AST_ID,
+
+    // data[0..1]: list of TEXT nodes and interpolated expressions
+    NIX_AST_STRING,
+
+    // data[0..1]: list of TEXT nodes and interpolated expressions, starting
+    // with the text before the first interpolation
+    NIX_AST_PATH_INTERP,
+
+    // data[0..1]: list of elements
+    NIX_AST_LIST,
+
+    // data[0..1]: list of BINDING and INHERIT nodes
+    NIX_AST_ATTRSET,
+
+    // data[0..1]: list of ID, STRING and DYNAMIC nodes naming attributes
+    NIX_AST_ATTRPATH,
+
+    // data[0]: the expression of a ${...} attribute name
+    NIX_AST_DYNAMIC,
+
+    // data[0]: ATTRPATH, data[1]: value
+    NIX_AST_BINDING,
+
+    // data[0]: the expression inherited from, or NIX_AST_NONE;
+    // data[1..2]: list of ID, STRING and DYNAMIC nodes
+    NIX_AST_INHERIT,
+
+    // data[0]: expression, data[1]: ATTRPATH, data[2]: default or
+    // NIX_AST_NONE
+    NIX_AST_SELECT,
+
+    // data[0]: expression, data[1]: ATTRPATH
+    NIX_AST_HAS_ATTR,
+
+    // data[0]: function, data[1]: argument
+    NIX_AST_APPLY,
+
+    // op: NIX_TOKEN_NOT or NIX_TOKEN_MINUS, data[0]: operand
+    NIX_AST_UNARY,
+
+    // op: the operator token, data[0..1]: operands
+    NIX_AST_BINARY,
+
+    // data[0]: condition, data[1]: then, data[2]: else
+    NIX_AST_IF,
+
+    // data[0]: argument symbol id or NIX_INTERN_NONE, data[1]: FORMALS or
+    // NIX_AST_NONE, data[2]: body
+    NIX_AST_LAMBDA,
+
+    // data[0..1]: list of FORMAL nodes
+    NIX_AST_FORMALS,
+
+    // data[0]: symbol id, data[1]: default or NIX_AST_NONE
+    NIX_AST_FORMAL,
+
+    // data[0..1]: list of BINDING and INHERIT nodes, data[2]: body
+    NIX_AST_LET,
+
+    // data[0]: attribute set, data[1]: body
+    NIX_AST_WITH,
+
+    // data[0]: condition, data[1]: body
+    NIX_AST_ASSERT,
+
+    NIX_AST_KIND_COUNT
+};
+
+enum nix_ast_flags {
+    // An ATTRSET written with rec, or with the old let { ... } syntax
+    NIX_AST_FLAG_REC = 1 << 0,
+    NIX_AST_FLAG_LET = 1 << 1,
+
+    // A STRING written as ''...''
+    NIX_AST_FLAG_INDENTED = 1 << 2,
+
+    // FORMALS ending in ...
+    NIX_AST_FLAG_ELLIPSIS = 1 << 3,
+
+    // A PATH_INTERP starting at ~/
+    NIX_AST_FLAG_HOME = 1 << 4
+};
+
+// Nodes are fixed-size and refer to each other by index, so a tree is a few
+// flat arrays that can be copied or written out as they are
+struct nix_ast_node {
+    uint8_t kind;
+    uint8_t op;
+    uint16_t flags;
+
+    // The code points the node was parsed from
+    uint32_t start;
+    uint32_t end;
+
+    uint32_t data[3];
+};
+
+struct nix_ast {
+    struct nix_ast_node *nodes;
+    uint32_t count;
+
+    // Every child list, each stored contiguously
+    uint32_t *lists;
+    uint32_t list_count;
+
+    // Decoded strings and paths, in UTF-8
+    char *text;
+    size_t text_size;
+
+    uint32_t root;
+};
+
+NIX_EXTERN(int64_t)
+nix_ast__int(const struct nix_ast *ast, uint32_t node);
+
+NIX_EXTERN(double)
+nix_ast__float(const struct nix_ast *ast, uint32_t node);
+
+// The children of a node with a list, and how many there are. Lists are in
+// data[0..1], except for INHERIT where they're in data[1..2].
+NIX_EXTERN(const uint32_t *)
+nix_ast__list(const struct nix_ast *ast, uint32_t node, uint32_t *count);
+
+NIX_EXTERN(const char *)
+nix_ast__kind_name(enum nix_ast_kind kind);
+
+NIX_EXTERN(void)
+nix_ast__free(struct nix_ast **out);
+
+NIX_END_DECL
+
+#endif
@@ -1,14 +1,53 @@
 #ifndef INCLUDE_libnix_buffer_h__
 #define INCLUDE_libnix_buffer_h__
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
 #include "libnix/common.h"
+#include "libnix/digest.h"
+#include "libnix/intern.h"
 #include "libnix/lexeme.h"
 #include "libnix/position.h"
+#include "libnix/source.h"
 
 NIX_BEGIN_DECL
 
+enum nix_buffer_flags {
+    // Compute a digest of the input as it's loaded
+    NIX_BUFFER_HASH = 1 << 0,
+
+    // Read ahead of the cursor on a thread of its own, so decoding doesn't
+    // wait on the file. The file mustn't be touched until the buffer is
+    // freed, released or reset.
+    NIX_BUFFER_PREFETCH = 1 << 1,
+
+    // Read files through an io_uring shared by the buffers on each thread,
+    // keeping several reads in flight ahead of the cursor. Falls back to
+    // the other modes for input which can't be read this way. The file is
+    // left alone as with prefetching, and the buffer must stay on the
+    // thread that started it.
+    NIX_BUFFER_URING = 1 << 2,
+
+    // For buffers reading a descriptor: read around the page cache with
+    // O_DIRECT, which is set on the descriptor while the buffer reads it.
+    // Needs a size and a starting offset which are multiples of
+    // NIX_BUFFER_DIRECT_ALIGN, and is skipped otherwise or if the
+    // filesystem won't have it.
+    NIX_BUFFER_DIRECT = 1 << 3,
+
+    // For buffers reading a descriptor: tell the kernel the input won't be
+    // read again, and drop it from the cache once it has been
+    NIX_BUFFER_NOREUSE = 1 << 4
+};
+
+// The alignment direct reads need, which suits any common block size
+#define NIX_BUFFER_DIRECT_ALIGN 4096
+
 struct nix_buffer {
     size_t buffer_size;
+    unsigned int flags;
 
     struct nix_position *lexeme;
     struct nix_position *read;
@@ -21,6 +60,132 @@ nix_buffer__init(struct nix_buffer *out, FILE *in, size_t buffer_size);
 NIX_EXTERN(enum nix_err)
 nix_buffer__construct(struct nix_buffer **out, FILE *in, size_t buffer_size);
 
+NIX_EXTERN(enum nix_err)
+nix_buffer__init_flags(
+    struct nix_buffer *out,
+    FILE *in,
+    size_t buffer_size,
+    unsigned int flags);
+
+NIX_EXTERN(enum nix_err)
+nix_buffer__construct_flags(
+    struct nix_buffer **out,
+    FILE *in,
+    size_t buffer_size,
+    unsigned int flags);
+
+// Read from a descriptor straight into the buffer, without going through
+// stdio's own copy of the input. Reading starts at the descriptor's offset,
+// which is left alone if it can seek. The descriptor must stay open until
+// the buffer is freed, released or reset.
+NIX_EXTERN(enum nix_err)
+nix_buffer__init_fd(
+    struct nix_buffer *out,
+    int fd,
+    size_t buffer_size,
+    unsigned int flags);
+
+NIX_EXTERN(enum nix_err)
+nix_buffer__construct_fd(
+    struct nix_buffer **out,
+    int fd,
+    size_t buffer_size,
+    unsigned int flags);
+
+// Read input the caller already has in memory, decoding straight from it.
+// Without a copy, the memory must outlive the buffer. Buffers over memory
+// can't be reset, and are freed rather than kept when released.
+NIX_EXTERN(enum nix_err)
+nix_buffer__init_mem(
+    struct nix_buffer *out,
+    const uint8_t *data,
+    size_t length,
+    bool copy);
+
+NIX_EXTERN(enum nix_err)
+nix_buffer__construct_mem(
+    struct nix_buffer **out,
+    const uint8_t *data,
+    size_t length,
+    bool copy);
+
+// Read from any source of input. If the source can lend blocks and says
+// how big the input is, and the first block is all of it, the block is
+// decoded in place as with nix_buffer__init_mem, and must stay valid until
+// the buffer is freed.
+NIX_EXTERN(enum nix_err)
+nix_buffer__init_source(
+    struct nix_buffer *out,
+    const struct nix_source *source,
+    size_t buffer_size,
+    unsigned int flags);
+
+NIX_EXTERN(enum nix_err)
+nix_buffer__construct_source(
+    struct nix_buffer **out,
+    const struct nix_source *source,
+    size_t buffer_size,
+    unsigned int flags);
+
+// Start the buffer over on new input, keeping its size and flags and the
+// memory that came with them
+NIX_EXTERN(enum nix_err)
+nix_buffer__reset(struct nix_buffer *buf, FILE *in);
+
+NIX_EXTERN(enum nix_err)
+nix_buffer__reset_fd(struct nix_buffer *buf, int fd);
+
+NIX_EXTERN(enum nix_err)
+nix_buffer__reset_source(
+    struct nix_buffer *buf,
+    const struct nix_source *source);
+
+// Read input which the caller feeds in as it arrives. Where the input runs
+// out before it's finished, reading gives NIXERR_BUF_WOULDBLOCK instead of
+// NIXERR_BUF_EOF and leaves the cursor where it was, so the same call can be
+// made again once more has been fed.
+NIX_EXTERN(enum nix_err)
+nix_buffer__init_feed(
+    struct nix_buffer *out,
+    size_t buffer_size,
+    unsigned int flags);
+
+NIX_EXTERN(enum nix_err)
+nix_buffer__construct_feed(
+    struct nix_buffer **out,
+    size_t buffer_size,
+    unsigned int flags);
+
+// Start again on new fed input
+NIX_EXTERN(enum nix_err)
+nix_buffer__reset_feed(struct nix_buffer *buf);
+
+// The bytes are copied, and can be split anywhere, even inside a character
+NIX_EXTERN(enum nix_err)
+nix_buffer__feed(struct nix_buffer *buf, const uint8_t *data, size_t length);
+
+// No more will be fed, so running out is the end of the input
+NIX_EXTERN(enum nix_err)
+nix_buffer__finish(struct nix_buffer *buf);
+
+// Like construct, but reusing a buffer of the same size which the calling
+// thread released earlier if there is one
+NIX_EXTERN(enum nix_err)
+nix_buffer__acquire(
+    struct nix_buffer **out,
+    FILE *in,
+    size_t buffer_size,
+    unsigned int flags);
+
+// Keep a buffer from acquire or construct for the calling thread to reuse.
+// Each thread keeps a few, freed when it exits or by nix_buffer__trim.
+NIX_EXTERN(void)
+nix_buffer__release(struct nix_buffer **out);
+
+// Free the buffers the calling thread is keeping
+NIX_EXTERN(void)
+nix_buffer__trim(void);
+
 NIX_EXTERN(enum nix_err)
 nix_buffer__read(struct nix_buffer *buf, uint32_t *out);
 
@@ -30,6 +195,9 @@ nix_buffer__peek(struct nix_buffer *buf, uint32_t *out);
 NIX_EXTERN(enum nix_err)
 nix_buffer__reset_peek(struct nix_buffer *buf);
 
+NIX_EXTERN(enum nix_err)
+nix_buffer__commit_peek(struct nix_buffer *buf);
+
 NIX_EXTERN(enum nix_err)
 nix_buffer__get_lexeme(
     struct nix_buffer *buf,
@@ -42,9 +210,27 @@ nix_buffer__peek_lexeme(
     struct nix_lexeme **out,
     size_t exclude);
 
+NIX_EXTERN(enum nix_err)
+nix_buffer__intern_lexeme(
+    struct nix_buffer *buf,
+    struct nix_intern *intern,
+    uint32_t *out,
+    size_t exclude);
+
 NIX_EXTERN(enum nix_err)
 nix_buffer__discard_lexeme(struct nix_buffer *buf, size_t exclude);
 
+// Move the read and peek cursors back to the start of the lexeme, to scan
+// it again
+NIX_EXTERN(enum nix_err)
+nix_buffer__rewind(struct nix_buffer *buf);
+
+// The digest of every byte of the input, including any byte-order mark.
+// Fails with NIXERR_BUF_INCOMPLETE until the end of the input has been
+// loaded, or if the buffer wasn't made with NIX_BUFFER_HASH.
+NIX_EXTERN(enum nix_err)
+nix_buffer__content_hash(struct nix_buffer *buf, struct nix_digest *out);
+
 NIX_EXTERN(void)
 nix_buffer__free(struct nix_buffer **out);
 
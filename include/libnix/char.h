@@ -0,0 +1,22 @@
+#ifndef INCLUDE_libnix_char_h__
+#define INCLUDE_libnix_char_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "libnix/common.h"
+
+NIX_BEGIN_DECL
+
+NIX_EXTERN(bool)
+nix_char__is_ident_start(uint32_t c);
+
+NIX_EXTERN(bool)
+nix_char__is_ident_continue(uint32_t c);
+
+NIX_EXTERN(bool)
+nix_char__is_whitespace(uint32_t c);
+
+NIX_END_DECL
+
+#endif
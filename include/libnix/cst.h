@@ -0,0 +1,152 @@
+#ifndef INCLUDE_libnix_cst_h__
+#define INCLUDE_libnix_cst_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/buffer.h"
+#include "libnix/common.h"
+#include "libnix/error.h"
+#include "libnix/lexer.h"
+
+NIX_BEGIN_DECL
+
+// Kinds of interior nodes, numbered after the token kinds so that one kind
+// field covers both
+enum nix_cst_kind {
+    // A whole file
+    NIX_CST_ROOT = NIX_TOKEN_KIND_COUNT,
+
+    // Everything from an opening delimiter to its closing one, inclusive
+    NIX_CST_PAREN,
+    NIX_CST_BRACE,
+    NIX_CST_BRACKET,
+    NIX_CST_STRING,
+    NIX_CST_IND_STRING,
+    NIX_CST_INTERPOLATION,
+
+    // A path with interpolations, up to its empty PATH_END
+    NIX_CST_PATH,
+
+    // From let up to and including its in
+    NIX_CST_LET,
+
+    // A binding, inherit, with or assert: from its first token up to and
+    // including the ; ending it, without the trivia around it
+    NIX_CST_STATEMENT,
+
+    NIX_CST_KIND_COUNT
+};
+
+// An immutable node of a lossless syntax tree. A token holds its text,
+// including trivia tokens, and an interior node holds its children, so
+// writing out the leaves gives back the source exactly. Green nodes know
+// their width but not their position, and identical ones are the same
+// object, so equal subtrees can be compared by pointer.
+struct nix_green {
+    uint8_t kind;
+
+    // In code points and UTF-8 bytes
+    uint32_t width;
+    uint32_t size;
+
+    // Children of an interior node, always 0 for tokens
+    uint32_t count;
+
+    uint64_t hash;
+};
+
+// Owns every green node built with it, deduplicating them as they are made.
+// Trees of many files may share one cache, which is not thread-safe.
+struct nix_green_cache {
+    // Distinct nodes stored and the bytes they take
+    size_t count;
+    size_t size;
+
+    // Requests answered with a node already stored
+    size_t hits;
+};
+
+NIX_EXTERN(enum nix_err)
+nix_green_cache__init(struct nix_green_cache *out);
+
+NIX_EXTERN(enum nix_err)
+nix_green_cache__construct(struct nix_green_cache **out);
+
+NIX_EXTERN(void)
+nix_green_cache__free(struct nix_green_cache **out);
+
+NIX_EXTERN(enum nix_err)
+nix_green__token(
+    struct nix_green_cache *cache,
+    enum nix_token_kind kind,
+    const char *text,
+    size_t size,
+    const struct nix_green **out);
+
+NIX_EXTERN(enum nix_err)
+nix_green__node(
+    struct nix_green_cache *cache,
+    enum nix_cst_kind kind,
+    const struct nix_green *const *children,
+    size_t count,
+    const struct nix_green **out);
+
+NIX_EXTERN(bool)
+nix_green__is_token(const struct nix_green *green);
+
+// The NUL-terminated text of a token
+NIX_EXTERN(const char *)
+nix_green__text(const struct nix_green *green);
+
+NIX_EXTERN(const struct nix_green *const *)
+nix_green__children(const struct nix_green *green);
+
+// Write the source text under a node, which fails with NIXERR_BUF_INVLEN
+// unless there is room for the text and a terminating NUL
+NIX_EXTERN(enum nix_err)
+nix_green__write(
+    const struct nix_green *green,
+    char *out,
+    size_t size,
+    size_t *length);
+
+NIX_EXTERN(const char *)
+nix_cst__kind_name(unsigned int kind);
+
+// Build the tree of the rest of the input. The structure follows
+// delimiters, let/in and statements ending in ;, and tolerates any input:
+// unmatched closing delimiters are kept as plain tokens, and unclosed
+// nodes end where their parent does.
+NIX_EXTERN(enum nix_err)
+nix_cst__parse(
+    struct nix_green_cache *cache,
+    struct nix_buffer *buf,
+    const struct nix_green **out);
+
+// Find the token covering a code point offset, as the child index to take
+// at each level from the root. Fails with NIXERR_BUF_INVLEN if the path is
+// deeper than max_depth.
+NIX_EXTERN(enum nix_err)
+nix_cst__path(
+    const struct nix_green *root,
+    uint32_t offset,
+    uint32_t *path,
+    size_t max_depth,
+    size_t *depth);
+
+// Replace the node at the end of a path, rebuilding only the nodes from it
+// up to the root. Everything off that path is shared with the old tree.
+NIX_EXTERN(enum nix_err)
+nix_cst__replace(
+    struct nix_green_cache *cache,
+    const struct nix_green *root,
+    const uint32_t *path,
+    size_t depth,
+    const struct nix_green *replacement,
+    const struct nix_green **out);
+
+NIX_END_DECL
+
+#endif
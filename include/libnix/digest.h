@@ -0,0 +1,53 @@
+#ifndef INCLUDE_libnix_digest_h__
+#define INCLUDE_libnix_digest_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/common.h"
+#include "libnix/error.h"
+
+NIX_BEGIN_DECL
+
+#define NIX_DIGEST_SIZE 32
+
+// Enough for the digest in hex and a terminating NUL
+#define NIX_DIGEST_HEX_SIZE (NIX_DIGEST_SIZE * 2 + 1)
+
+// A BLAKE3 hash of some content. Unlike the hashes of in-memory tables it
+// is stable, so it may be stored and used to recognize content later.
+struct nix_digest {
+    uint8_t bytes[NIX_DIGEST_SIZE];
+};
+
+// Computes a digest of content given in any number of pieces
+struct nix_hasher {
+    // Bytes hashed so far
+    uint64_t length;
+};
+
+NIX_EXTERN(enum nix_err)
+nix_hasher__init(struct nix_hasher *out);
+
+NIX_EXTERN(enum nix_err)
+nix_hasher__construct(struct nix_hasher **out);
+
+NIX_EXTERN(void)
+nix_hasher__update(struct nix_hasher *hasher, const void *data, size_t size);
+
+// The digest of everything hashed so far. More may be hashed afterwards.
+NIX_EXTERN(void)
+nix_hasher__final(const struct nix_hasher *hasher, struct nix_digest *out);
+
+NIX_EXTERN(void)
+nix_hasher__free(struct nix_hasher **out);
+
+NIX_EXTERN(void)
+nix_digest__bytes(const void *data, size_t size, struct nix_digest *out);
+
+NIX_EXTERN(void)
+nix_digest__hex(const struct nix_digest *digest, char *out);
+
+NIX_END_DECL
+
+#endif
@@ -8,6 +8,7 @@ NIX_BEGIN_DECL
 enum nix_err {
     NIXERR_NONE = 0,
     NIXERR_NOMEMORY,
+    NIXERR_THREAD,
 
     NIXERR_BUF = 0x0100,
     NIXERR_BUF_INVPTR,
@@ -16,7 +17,31 @@ enum nix_err {
     NIXERR_BUF_INVCHAR,
     NIXERR_BUF_FILE,
     NIXERR_BUF_EOF,
-    NIXERR_BUF_PAST_EOF
+    NIXERR_BUF_PAST_EOF,
+    NIXERR_BUF_INCOMPLETE,
+    NIXERR_BUF_WOULDBLOCK,
+
+    NIXERR_INTERN = 0x0200,
+    NIXERR_INTERN_INVID,
+    NIXERR_INTERN_FULL,
+
+    NIXERR_LEX = 0x0300,
+    NIXERR_LEX_DEPTH,
+
+    NIXERR_NUM = 0x0400,
+    NIXERR_NUM_SYNTAX,
+    NIXERR_NUM_RANGE,
+
+    NIXERR_PARSE = 0x0500,
+    NIXERR_PARSE_SYNTAX,
+    NIXERR_PARSE_DEPTH,
+
+    NIXERR_CACHE = 0x0600,
+    NIXERR_CACHE_MISS,
+
+    NIXERR_MAP = 0x0700,
+    NIXERR_MAP_FULL,
+    NIXERR_MAP_INVADDR
 };
 
 NIX_END_DECL
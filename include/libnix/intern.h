@@ -0,0 +1,59 @@
+#ifndef INCLUDE_libnix_intern_h__
+#define INCLUDE_libnix_intern_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/common.h"
+#include "libnix/error.h"
+
+NIX_BEGIN_DECL
+
+// Never returned as a symbol id; usable as a sentinel by callers
+#define NIX_INTERN_NONE UINT32_MAX
+
+enum nix_intern_flags {
+    // Allow the table to be shared between threads
+    NIX_INTERN_CONCURRENT = 1 << 0
+};
+
+struct nix_intern {
+    unsigned int flags;
+};
+
+NIX_EXTERN(enum nix_err)
+nix_intern__init(struct nix_intern *out, unsigned int flags);
+
+NIX_EXTERN(enum nix_err)
+nix_intern__construct(struct nix_intern **out, unsigned int flags);
+
+NIX_EXTERN(enum nix_err)
+nix_intern__intern(
+    struct nix_intern *in,
+    const char *text,
+    size_t length,
+    uint32_t *out);
+
+NIX_EXTERN(enum nix_err)
+nix_intern__intern_utf32(
+    struct nix_intern *in,
+    const uint32_t *text,
+    size_t length,
+    uint32_t *out);
+
+NIX_EXTERN(enum nix_err)
+nix_intern__lookup(
+    struct nix_intern *in,
+    uint32_t id,
+    const char **text,
+    size_t *length);
+
+NIX_EXTERN(uint32_t)
+nix_intern__count(struct nix_intern *in);
+
+NIX_EXTERN(void)
+nix_intern__free(struct nix_intern **out);
+
+NIX_END_DECL
+
+#endif
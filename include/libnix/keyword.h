@@ -0,0 +1,40 @@
+#ifndef INCLUDE_libnix_keyword_h__
+#define INCLUDE_libnix_keyword_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/common.h"
+#include "libnix/lexeme.h"
+
+NIX_BEGIN_DECL
+
+enum nix_keyword {
+    NIX_KEYWORD_NONE = 0,
+    NIX_KEYWORD_LET,
+    NIX_KEYWORD_IN,
+    NIX_KEYWORD_REC,
+    NIX_KEYWORD_WITH,
+    NIX_KEYWORD_INHERIT,
+    NIX_KEYWORD_IF,
+    NIX_KEYWORD_THEN,
+    NIX_KEYWORD_ELSE,
+    NIX_KEYWORD_ASSERT,
+    NIX_KEYWORD_OR
+};
+
+NIX_EXTERN(enum nix_keyword)
+nix_keyword__lookup(const char *text, size_t length);
+
+NIX_EXTERN(enum nix_keyword)
+nix_keyword__lookup_utf32(const uint32_t *text, size_t length);
+
+NIX_EXTERN(enum nix_keyword)
+nix_keyword__lookup_lexeme(struct nix_lexeme *lexeme);
+
+NIX_EXTERN(const char *)
+nix_keyword__name(enum nix_keyword keyword);
+
+NIX_END_DECL
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef INCLUDE_libnix_lex_files_h__
+#define INCLUDE_libnix_lex_files_h__
+
+#include <stdlib.h>
+
+#include "libnix/common.h"
+#include "libnix/error.h"
+#include "libnix/intern.h"
+#include "libnix/pool.h"
+#include "libnix/tokens.h"
+
+NIX_BEGIN_DECL
+
+enum nix_lex_flags {
+    // Deliver results in the order the files were given rather than as they
+    // finish
+    NIX_LEX_ORDERED = 1 << 0,
+
+    // Read files lexed in one piece through each thread's io_uring, so the
+    // files a thread works through share its ring and its segment memory
+    NIX_LEX_URING = 1 << 1
+};
+
+// The outcome for one file. A file which failed has a NULL table and the
+// error that stopped it; the rest of the batch carries on regardless.
+struct nix_lex_result {
+    size_t index;
+    const char *path;
+
+    enum nix_err err;
+
+    // Owned by the callback, which must free it
+    struct nix_token_table *table;
+};
+
+typedef void (*nix_lex_callback)(
+    void *context,
+    const struct nix_lex_result *result);
+
+struct nix_lex_options {
+    // Ignored when a pool is given; 0 uses one per online processor
+    unsigned int threads;
+    unsigned int flags;
+
+    // Optional. Unless it was created with NIX_INTERN_CONCURRENT, the files
+    // are lexed one at a time on the calling thread.
+    struct nix_intern *intern;
+
+    // Optional; a pool is made for the batch otherwise
+    struct nix_pool *pool;
+
+    void *context;
+};
+
+// Tokenize every file, largest first so that one big file doesn't hold up
+// the end of the batch, and files much bigger than the rest are themselves
+// split into more jobs on the same pool. The callback is never run by two
+// threads at once. Options may be NULL for the defaults.
+NIX_EXTERN(enum nix_err)
+nix_lex_files(
+    const char *const *paths,
+    size_t count,
+    const struct nix_lex_options *options,
+    nix_lex_callback callback);
+
+NIX_END_DECL
+
+#endif
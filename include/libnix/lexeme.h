@@ -1,6 +1,7 @@
 #ifndef INCLUDE_libnix_lexeme_h__
 #define INCLUDE_libnix_lexeme_h__
 
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "libnix/common.h"
@@ -0,0 +1,122 @@
+#ifndef INCLUDE_libnix_lexer_h__
+#define INCLUDE_libnix_lexer_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "libnix/buffer.h"
+#include "libnix/common.h"
+#include "libnix/error.h"
+#include "libnix/position.h"
+
+NIX_BEGIN_DECL
+
+// Token kinds fit in a byte so they can be stored compactly
+enum nix_token_kind {
+    NIX_TOKEN_EOF = 0,
+    NIX_TOKEN_ERROR,
+    NIX_TOKEN_WHITESPACE,
+    NIX_TOKEN_COMMENT,
+
+    NIX_TOKEN_ID,
+    NIX_TOKEN_INT,
+    NIX_TOKEN_FLOAT,
+    NIX_TOKEN_PATH,
+    NIX_TOKEN_HPATH,
+    NIX_TOKEN_SPATH,
+    NIX_TOKEN_URI,
+
+    NIX_TOKEN_STRING_OPEN,
+    NIX_TOKEN_STRING_CLOSE,
+    NIX_TOKEN_STR,
+    NIX_TOKEN_IND_STRING_OPEN,
+    NIX_TOKEN_IND_STRING_CLOSE,
+    NIX_TOKEN_IND_STR,
+    NIX_TOKEN_DOLLAR_CURLY,
+
+    // A path with interpolations is its text up to the first ${, then text
+    // and interpolations as in strings, then an empty PATH_END where the
+    // path stops
+    NIX_TOKEN_PATH_START,
+    NIX_TOKEN_PATH_STR,
+    NIX_TOKEN_PATH_END,
+
+    // Keywords, in the same order as enum nix_keyword
+    NIX_TOKEN_KW_LET,
+    NIX_TOKEN_KW_IN,
+    NIX_TOKEN_KW_REC,
+    NIX_TOKEN_KW_WITH,
+    NIX_TOKEN_KW_INHERIT,
+    NIX_TOKEN_KW_IF,
+    NIX_TOKEN_KW_THEN,
+    NIX_TOKEN_KW_ELSE,
+    NIX_TOKEN_KW_ASSERT,
+    NIX_TOKEN_KW_OR,
+
+    NIX_TOKEN_ELLIPSIS,
+    NIX_TOKEN_EQ,
+    NIX_TOKEN_NEQ,
+    NIX_TOKEN_LEQ,
+    NIX_TOKEN_GEQ,
+    NIX_TOKEN_AND,
+    NIX_TOKEN_OR,
+    NIX_TOKEN_IMPL,
+    NIX_TOKEN_UPDATE,
+    NIX_TOKEN_CONCAT,
+
+    NIX_TOKEN_LBRACE,
+    NIX_TOKEN_RBRACE,
+    NIX_TOKEN_LPAREN,
+    NIX_TOKEN_RPAREN,
+    NIX_TOKEN_LBRACKET,
+    NIX_TOKEN_RBRACKET,
+    NIX_TOKEN_SEMICOLON,
+    NIX_TOKEN_COLON,
+    NIX_TOKEN_COMMA,
+    NIX_TOKEN_DOT,
+    NIX_TOKEN_ASSIGN,
+    NIX_TOKEN_QUESTION,
+    NIX_TOKEN_NOT,
+    NIX_TOKEN_PLUS,
+    NIX_TOKEN_MINUS,
+    NIX_TOKEN_MUL,
+    NIX_TOKEN_DIV,
+    NIX_TOKEN_LT,
+    NIX_TOKEN_GT,
+    NIX_TOKEN_AT,
+
+    NIX_TOKEN_KIND_COUNT
+};
+
+struct nix_token {
+    enum nix_token_kind kind;
+
+    struct nix_position start;
+    struct nix_position end;
+};
+
+struct nix_lexer {
+    struct nix_buffer *buffer;
+};
+
+NIX_EXTERN(enum nix_err)
+nix_lexer__init(struct nix_lexer *out, struct nix_buffer *buf);
+
+NIX_EXTERN(enum nix_err)
+nix_lexer__construct(struct nix_lexer **out, struct nix_buffer *buf);
+
+NIX_EXTERN(enum nix_err)
+nix_lexer__next(struct nix_lexer *lex, struct nix_token *out);
+
+NIX_EXTERN(void)
+nix_lexer__free(struct nix_lexer **out);
+
+NIX_EXTERN(const char *)
+nix_token__name(enum nix_token_kind kind);
+
+NIX_EXTERN(bool)
+nix_token__is_trivia(enum nix_token_kind kind);
+
+NIX_END_DECL
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef INCLUDE_libnix_number_h__
+#define INCLUDE_libnix_number_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/common.h"
+#include "libnix/error.h"
+#include "libnix/lexeme.h"
+
+NIX_BEGIN_DECL
+
+// Enough for any double in any format, including the terminator: the
+// longest is -DBL_MAX in fixed notation
+#define NIX_NUMBER_FLOAT_SIZE 320
+
+// How nix_number__format_float lays out a double
+enum nix_float_format {
+    // As builtins.toJSON writes it: the shortest digits that read back to
+    // the same double, in fixed notation from 1e-4 up to 1e15 and scientific
+    // otherwise, with a trailing .0 on whole numbers. NaN and
+    // infinities have no JSON form and are written as null.
+    NIX_FLOAT_FORMAT_JSON = 0,
+
+    // As builtins.toString writes it: fixed notation with six decimals
+    NIX_FLOAT_FORMAT_TO_STRING
+};
+
+// Parse decimal digits, with an optional leading minus sign. Values that
+// don't fit in 64 bits give NIXERR_NUM_RANGE.
+NIX_EXTERN(enum nix_err)
+nix_number__parse_int(const char *text, size_t length, int64_t *out);
+
+// Parse a decimal float such as 1.5, .5, 1. or 1e3, with an optional leading
+// minus sign. The result is correctly rounded; values too large for a
+// double give NIXERR_NUM_RANGE.
+NIX_EXTERN(enum nix_err)
+nix_number__parse_float(const char *text, size_t length, double *out);
+
+NIX_EXTERN(enum nix_err)
+nix_number__parse_int_lexeme(struct nix_lexeme *lexeme, int64_t *out);
+
+NIX_EXTERN(enum nix_err)
+nix_number__parse_float_lexeme(struct nix_lexeme *lexeme, double *out);
+
+// Write value into out, which holds size bytes, with a terminator. The
+// length written, not counting the terminator, goes to length when that
+// isn't NULL. Gives NIXERR_BUF_INVLEN when out is too small.
+NIX_EXTERN(enum nix_err)
+nix_number__format_float(
+    double value,
+    enum nix_float_format format,
+    char *out,
+    size_t size,
+    size_t *length);
+
+NIX_END_DECL
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef INCLUDE_libnix_parse_cache_h__
+#define INCLUDE_libnix_parse_cache_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/ast.h"
+#include "libnix/common.h"
+#include "libnix/digest.h"
+#include "libnix/error.h"
+#include "libnix/intern.h"
+
+NIX_BEGIN_DECL
+
+// Bumped whenever the file layout or the tree stored in it changes, so
+// entries written by other versions are treated as missing
+#define NIX_PARSE_CACHE_VERSION 2
+
+// A directory of parsed files, each named by the digest of its source
+struct nix_parse_cache {
+    const char *directory;
+};
+
+// A parsed file mapped from the cache. The tree's arrays point into a
+// read-only mapping, so it must not be modified or given to nix_ast__free.
+// Its symbol ids index the entry's own symbols rather than an interner.
+struct nix_cached_ast {
+    struct nix_ast ast;
+    uint32_t symbol_count;
+};
+
+// The directory is created if it doesn't exist
+NIX_EXTERN(enum nix_err)
+nix_parse_cache__init(struct nix_parse_cache *out, const char *directory);
+
+NIX_EXTERN(enum nix_err)
+nix_parse_cache__construct(
+    struct nix_parse_cache **out,
+    const char *directory);
+
+NIX_EXTERN(void)
+nix_parse_cache__free(struct nix_parse_cache **out);
+
+// Write a tree under the digest of its source, with its symbols looked up
+// in the interner it was parsed with. The entry is written to a temporary
+// file and renamed into place, so concurrent writers and readers never see
+// a partial entry.
+NIX_EXTERN(enum nix_err)
+nix_parse_cache__store(
+    struct nix_parse_cache *cache,
+    const struct nix_digest *key,
+    const struct nix_ast *ast,
+    struct nix_intern *intern);
+
+// Map the tree stored under a digest, checking only its header. Missing
+// entries and ones written by another version give NIXERR_CACHE_MISS.
+NIX_EXTERN(enum nix_err)
+nix_parse_cache__load(
+    struct nix_parse_cache *cache,
+    const struct nix_digest *key,
+    struct nix_cached_ast **out);
+
+NIX_EXTERN(enum nix_err)
+nix_cached_ast__symbol(
+    const struct nix_cached_ast *entry,
+    uint32_t id,
+    const char **text,
+    size_t *length);
+
+NIX_EXTERN(void)
+nix_cached_ast__free(struct nix_cached_ast **out);
+
+NIX_END_DECL
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef INCLUDE_libnix_parser_h__
+#define INCLUDE_libnix_parser_h__
+
+#include <stdint.h>
+
+#include "libnix/ast.h"
+#include "libnix/buffer.h"
+#include "libnix/common.h"
+#include "libnix/error.h"
+#include "libnix/intern.h"
+#include "libnix/lexer.h"
+
+NIX_BEGIN_DECL
+
+struct nix_parser {
+    struct nix_buffer *buffer;
+    struct nix_intern *intern;
+
+    // The token parsing stopped at when it failed, in code points
+    enum nix_token_kind error_kind;
+    uint32_t error_start;
+    uint32_t error_end;
+};
+
+NIX_EXTERN(enum nix_err)
+nix_parser__init(
+    struct nix_parser *out,
+    struct nix_buffer *buf,
+    struct nix_intern *intern);
+
+NIX_EXTERN(enum nix_err)
+nix_parser__construct(
+    struct nix_parser **out,
+    struct nix_buffer *buf,
+    struct nix_intern *intern);
+
+// Parse the rest of the input as a single expression. Identifiers and
+// attribute names are interned, and strings are stored decoded. A syntax
+// error gives NIXERR_PARSE_SYNTAX, with the offending token recorded in the
+// parser.
+NIX_EXTERN(enum nix_err)
+nix_parser__parse(struct nix_parser *parser, struct nix_ast **out);
+
+NIX_EXTERN(void)
+nix_parser__free(struct nix_parser **out);
+
+NIX_END_DECL
+
+#endif
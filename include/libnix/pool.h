@@ -0,0 +1,72 @@
+#ifndef INCLUDE_libnix_pool_h__
+#define INCLUDE_libnix_pool_h__
+
+#include <stdlib.h>
+
+#include "libnix/common.h"
+#include "libnix/error.h"
+
+NIX_BEGIN_DECL
+
+enum nix_pool_flags {
+    // Bind each worker to its own processor, where the platform allows
+    NIX_POOL_PIN = 1 << 0
+};
+
+typedef void (*nix_pool_job)(void *arg);
+
+// Worker threads which each keep a deque of jobs, taking their own newest
+// jobs first and stealing the oldest from each other when they run out
+struct nix_pool {
+    unsigned int threads;
+    unsigned int flags;
+};
+
+// Counts the jobs submitted under it which haven't finished yet
+struct nix_wait_group {
+    struct nix_pool *pool;
+};
+
+// A thread count of 0 starts one worker per online processor
+NIX_EXTERN(enum nix_err)
+nix_pool__init(struct nix_pool *out, unsigned int threads, unsigned int flags);
+
+NIX_EXTERN(enum nix_err)
+nix_pool__construct(
+    struct nix_pool **out,
+    unsigned int threads,
+    unsigned int flags);
+
+// Jobs submitted from inside another job go to the front of that worker's
+// own deque; others are queued for whichever worker is free first. The
+// group may be NULL, and must belong to the same pool otherwise.
+NIX_EXTERN(enum nix_err)
+nix_pool__submit(
+    struct nix_pool *pool,
+    struct nix_wait_group *group,
+    nix_pool_job job,
+    void *arg);
+
+// Queued jobs are finished before the workers stop
+NIX_EXTERN(void)
+nix_pool__free(struct nix_pool **out);
+
+NIX_EXTERN(enum nix_err)
+nix_wait_group__init(struct nix_wait_group *out, struct nix_pool *pool);
+
+NIX_EXTERN(enum nix_err)
+nix_wait_group__construct(
+    struct nix_wait_group **out,
+    struct nix_pool *pool);
+
+// Help run the pool's jobs until every job in the group has finished. Safe
+// to call from inside a job.
+NIX_EXTERN(enum nix_err)
+nix_wait_group__wait(struct nix_wait_group *group);
+
+NIX_EXTERN(void)
+nix_wait_group__free(struct nix_wait_group **out);
+
+NIX_END_DECL
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef INCLUDE_libnix_source_h__
+#define INCLUDE_libnix_source_h__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libnix/common.h"
+#include "libnix/error.h"
+
+NIX_BEGIN_DECL
+
+// Where a buffer's input comes from. Nothing is ever sought, so pipes,
+// sockets and the like read as well as files do. Only read is required.
+struct nix_source {
+    void *context;
+
+    // Read up to size bytes, giving how many were read. Fewer than asked
+    // for is fine; none means the end of the input.
+    enum nix_err (*read)(
+        void *context,
+        uint8_t *out,
+        size_t size,
+        size_t *length);
+
+    // How many bytes are left to read, if known
+    enum nix_err (*size_hint)(void *context, size_t *out);
+
+    // Lend the next block of input instead of copying it out, which is used
+    // in place of read when given. A block stays valid until the next call;
+    // an empty one means the end of the input.
+    enum nix_err (*borrow)(
+        void *context,
+        const uint8_t **out,
+        size_t *length);
+};
+
+// A source reading from a file, from wherever it has got to
+NIX_EXTERN(void)
+nix_source__file(struct nix_source *out, FILE *in);
+
+NIX_END_DECL
+
+#endif
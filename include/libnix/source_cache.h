@@ -0,0 +1,57 @@
+#ifndef INCLUDE_libnix_source_cache_h__
+#define INCLUDE_libnix_source_cache_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/common.h"
+#include "libnix/error.h"
+
+NIX_BEGIN_DECL
+
+// Files mapped once and shared between every reader in the process. Safe to
+// use from any number of threads.
+struct nix_source_cache {
+    // Bytes of files kept mapped, in use or not, before the least recently
+    // used of the unused ones are dropped. Files in use are never dropped,
+    // so this can be exceeded.
+    size_t budget;
+
+    size_t size;
+    size_t count;
+    size_t hits;
+};
+
+// A read-only view of a file's contents, mapped rather than read. Stays valid
+// until released, even if the file is replaced or dropped from the cache in
+// the meantime; a file written over in place shows through instead.
+struct nix_source_view {
+    const char *path;
+    const uint8_t *data;
+    size_t size;
+};
+
+NIX_EXTERN(enum nix_err)
+nix_source_cache__init(struct nix_source_cache *out, size_t budget);
+
+NIX_EXTERN(enum nix_err)
+nix_source_cache__construct(struct nix_source_cache **out, size_t budget);
+
+// Give a view of a file, mapping it only if the cached copy is missing or the
+// file's device, inode, modification time or size have changed since
+NIX_EXTERN(enum nix_err)
+nix_source_cache__open(
+    struct nix_source_cache *cache,
+    const char *path,
+    const struct nix_source_view **out);
+
+// Views must all be released before the cache is freed
+NIX_EXTERN(void)
+nix_source_cache__free(struct nix_source_cache **out);
+
+NIX_EXTERN(void)
+nix_source_view__release(const struct nix_source_view **out);
+
+NIX_END_DECL
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef INCLUDE_libnix_source_map_h__
+#define INCLUDE_libnix_source_map_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/common.h"
+#include "libnix/error.h"
+#include "libnix/lexeme.h"
+
+NIX_BEGIN_DECL
+
+// Files laid end to end in a single address space of code points, so that a
+// span anywhere in any of them fits in 8 bytes. Rows and columns are only
+// worked out when a span is resolved.
+struct nix_source_map {
+    size_t file_count;
+
+    // The next address to be given out
+    uint32_t size;
+};
+
+struct nix_span {
+    uint32_t start;
+    uint32_t length;
+};
+
+// Where an address falls. Rows and columns count from 1, columns in code
+// points, and each of \r\n, \r and \n ends a line.
+struct nix_source_location {
+    size_t file;
+    const char *name;
+
+    size_t row;
+    size_t col;
+};
+
+NIX_EXTERN(enum nix_err)
+nix_source_map__init(struct nix_source_map *out);
+
+NIX_EXTERN(enum nix_err)
+nix_source_map__construct(struct nix_source_map **out);
+
+NIX_EXTERN(void)
+nix_source_map__free(struct nix_source_map **out);
+
+// Register a UTF-8 file, giving the address of its first code point. Any
+// byte-order mark is skipped, as the buffer does, so positions from the
+// lexer can be added to the base as they are. Fails with NIXERR_MAP_FULL
+// once the address space runs out.
+NIX_EXTERN(enum nix_err)
+nix_source_map__add(
+    struct nix_source_map *map,
+    const char *name,
+    const char *text,
+    size_t size,
+    uint32_t *base);
+
+NIX_EXTERN(enum nix_err)
+nix_source_map__resolve(
+    struct nix_source_map *map,
+    uint32_t address,
+    struct nix_source_location *out);
+
+// The span of a lexeme from a file registered at the given base
+NIX_EXTERN(void)
+nix_span__from_lexeme(
+    uint32_t base,
+    const struct nix_lexeme *lexeme,
+    struct nix_span *out);
+
+NIX_END_DECL
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef INCLUDE_libnix_string_h__
+#define INCLUDE_libnix_string_h__
+
+#include <stdlib.h>
+
+#include "libnix/common.h"
+#include "libnix/error.h"
+#include "libnix/lexeme.h"
+
+NIX_BEGIN_DECL
+
+enum nix_string_kind {
+    // "...", where \n, \r and \t are control characters, a backslash
+    // before anything else stands for that character, and line breaks are
+    // normalised to \n
+    NIX_STRING_NORMAL = 0,
+
+    // ''...'', where ''$, ''' and ''\ escape, and the indentation common to
+    // every line is removed
+    NIX_STRING_INDENTED
+};
+
+// The text of a string between its quotes and interpolations, so a string
+// with n interpolations has n + 1 parts, some of which may be empty
+struct nix_string_part {
+    // The source text, in UTF-8
+    const char *text;
+    size_t length;
+
+    // Where the decoded text of this part was written in the output
+    char *decoded;
+    size_t decoded_length;
+};
+
+// Decode every part of a string into out, which holds size bytes. Decoded
+// text is never longer than the source, so out may also be the text of the
+// first part to decode in place, when the parts come in order from the same
+// piece of memory. Gives NIXERR_BUF_INVLEN when out is too small.
+NIX_EXTERN(enum nix_err)
+nix_string__decode(
+    enum nix_string_kind kind,
+    struct nix_string_part *parts,
+    size_t count,
+    char *out,
+    size_t size);
+
+// Decode the string or indented string lexemes making up a string. Their
+// text is encoded straight into out and decoded there, so out must have
+// room for them as UTF-8. Each part is filled in, pointing into out, and a
+// NULL lexeme stands for an empty part.
+NIX_EXTERN(enum nix_err)
+nix_string__decode_lexemes(
+    enum nix_string_kind kind,
+    struct nix_lexeme **lexemes,
+    struct nix_string_part *parts,
+    size_t count,
+    char *out,
+    size_t size);
+
+NIX_END_DECL
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef INCLUDE_libnix_tokens_h__
+#define INCLUDE_libnix_tokens_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libnix/common.h"
+#include "libnix/error.h"
+#include "libnix/intern.h"
+
+NIX_BEGIN_DECL
+
+enum nix_token_flags {
+    // The lexer was in a state a fresh lexer would also be in at the start
+    // of this token, so lexing may safely restart here
+    NIX_TOKEN_FLAG_CLEAN = 1 << 0
+};
+
+// Every token of a file, including trivia, stored as parallel arrays. Starts
+// and lengths are counted in code points, and adjacent pieces of text or
+// whitespace of the same kind are kept as a single token.
+struct nix_token_table {
+    size_t count;
+
+    uint8_t *kinds;
+    uint8_t *flags;
+    uint32_t *starts;
+    uint32_t *lengths;
+
+    // Symbol ids of identifier tokens, with NIX_INTERN_NONE for the rest;
+    // NULL when the table was built without an interner
+    uint32_t *ids;
+};
+
+// A replacement of the code points [start, end) of the old text. The offset
+// is where the edit starts in bytes, which is the same in the old and new
+// text.
+struct nix_token_edit {
+    uint32_t start;
+    uint32_t end;
+    size_t offset;
+
+    const char *text;
+    size_t length;
+};
+
+// The tokens [start, start + removed) of the old table were replaced by
+// [start, start + inserted) in the new one; later tokens were only moved
+struct nix_token_diff {
+    size_t start;
+    size_t removed;
+    size_t inserted;
+};
+
+NIX_EXTERN(enum nix_err)
+nix_token_table__init(struct nix_token_table *out, bool with_ids);
+
+NIX_EXTERN(enum nix_err)
+nix_token_table__construct(struct nix_token_table **out, bool with_ids);
+
+NIX_EXTERN(void)
+nix_token_table__free(struct nix_token_table **out);
+
+// Tokenize the rest of the file. With more than one thread, large UTF-8
+// files are split at line starts and the pieces are lexed in parallel; a
+// thread count of 0 uses one per online processor. Interning from several
+// threads requires an interner created with NIX_INTERN_CONCURRENT, and is
+// done on one thread otherwise.
+NIX_EXTERN(enum nix_err)
+nix_tokenize_file(
+    struct nix_token_table **out,
+    FILE *in,
+    struct nix_intern *intern,
+    unsigned int threads);
+
+// Like nix_tokenize_file, with flags for the buffer a file lexed in one
+// piece is read through
+NIX_EXTERN(enum nix_err)
+nix_tokenize_file_flags(
+    struct nix_token_table **out,
+    FILE *in,
+    struct nix_intern *intern,
+    unsigned int threads,
+    unsigned int buffer_flags);
+
+// Update the table for an edit, given the full text after the edit. Only the
+// tokens from shortly before the edit up to where the new tokens line up
+// with the old ones again are lexed. The interner must be given if the table
+// has symbol ids.
+NIX_EXTERN(enum nix_err)
+nix_token_table__relex(
+    struct nix_token_table *table,
+    struct nix_intern *intern,
+    const char *text,
+    size_t size,
+    const struct nix_token_edit *edit,
+    struct nix_token_diff *out);
+
+NIX_END_DECL
+
+#endif
@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""Generate src/char_tables.h, the Unicode property tables behind
+nix_char__is_ident_start, nix_char__is_ident_continue and
+nix_char__is_whitespace.
+
+Properties are derived from the Unicode database bundled with Python, or read
+from DerivedCoreProperties.txt and PropList.txt when --ucd points at a copy of
+the UCD. The output is a two-level table: the high bits of a code point select
+a deduplicated block, and the low bits index a property byte inside it.
+
+    python3 scripts/gen_char_tables.py > src/char_tables.h
+"""
+
+import argparse
+import os
+import sys
+import unicodedata
+
+MAX_CODE_POINT = 0x110000
+
+PROP_ID_START = 1 << 0
+PROP_ID_CONTINUE = 1 << 1
+PROP_WHITESPACE = 1 << 2
+
+# Properties from PropList.txt which unicodedata does not expose
+OTHER_ID_START = [(0x1885, 0x1886), (0x2118, 0x2118), (0x212E, 0x212E),
+                  (0x309B, 0x309C)]
+
+OTHER_ID_CONTINUE = [(0x00B7, 0x00B7), (0x0387, 0x0387), (0x1369, 0x1371),
+                     (0x19DA, 0x19DA)]
+
+PATTERN_SYNTAX = [
+    (0x0021, 0x002F), (0x003A, 0x0040), (0x005B, 0x005E), (0x0060, 0x0060),
+    (0x007B, 0x007E), (0x00A1, 0x00A7), (0x00A9, 0x00A9), (0x00AB, 0x00AC),
+    (0x00AE, 0x00AE), (0x00B0, 0x00B1), (0x00B6, 0x00B6), (0x00BB, 0x00BB),
+    (0x00BF, 0x00BF), (0x00D7, 0x00D7), (0x00F7, 0x00F7), (0x2010, 0x2027),
+    (0x2030, 0x203E), (0x2041, 0x2053), (0x2055, 0x205E), (0x2190, 0x245F),
+    (0x2500, 0x2775), (0x2794, 0x2BFF), (0x2E00, 0x2E7F), (0x3001, 0x3003),
+    (0x3008, 0x3020), (0x3030, 0x3030), (0xFD3E, 0xFD3F), (0xFE45, 0xFE46),
+]
+
+PATTERN_WHITE_SPACE = [(0x0009, 0x000D), (0x0020, 0x0020), (0x0085, 0x0085),
+                       (0x200E, 0x200F), (0x2028, 0x2029)]
+
+WHITE_SPACE = [
+    (0x0009, 0x000D), (0x0020, 0x0020), (0x0085, 0x0085), (0x00A0, 0x00A0),
+    (0x1680, 0x1680), (0x2000, 0x200A), (0x2028, 0x2029), (0x202F, 0x202F),
+    (0x205F, 0x205F), (0x3000, 0x3000),
+]
+
+ID_START_CATEGORIES = {"Lu", "Ll", "Lt", "Lm", "Lo", "Nl"}
+ID_CONTINUE_CATEGORIES = ID_START_CATEGORIES | {"Mn", "Mc", "Nd", "Pc"}
+
+
+def expand(ranges):
+    points = set()
+    for first, last in ranges:
+        points.update(range(first, last + 1))
+    return points
+
+
+def parse_ucd(path, wanted):
+    """Read the code points of each wanted property from a UCD data file"""
+    props = {name: set() for name in wanted}
+    with open(path, encoding="utf-8") as f:
+        for line in f:
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+
+            points, name = [field.strip() for field in line.split(";")[:2]]
+            if name not in props:
+                continue
+
+            if ".." in points:
+                first, last = points.split("..")
+            else:
+                first = last = points
+
+            props[name].update(range(int(first, 16), int(last, 16) + 1))
+
+    return props
+
+
+def derive_properties(ucd):
+    if ucd is not None:
+        derived = parse_ucd(os.path.join(ucd, "DerivedCoreProperties.txt"),
+                            ["ID_Start", "ID_Continue"])
+        listed = parse_ucd(os.path.join(ucd, "PropList.txt"), ["White_Space"])
+        return (derived["ID_Start"], derived["ID_Continue"],
+                listed["White_Space"], "UCD files in " + ucd)
+
+    excluded = expand(PATTERN_SYNTAX) | expand(PATTERN_WHITE_SPACE)
+    start = set(expand(OTHER_ID_START))
+    cont = set(expand(OTHER_ID_CONTINUE))
+
+    for c in range(MAX_CODE_POINT):
+        category = unicodedata.category(chr(c))
+        if category in ID_START_CATEGORIES:
+            start.add(c)
+        if category in ID_CONTINUE_CATEGORIES:
+            cont.add(c)
+
+    start -= excluded
+    cont = (cont | start) - excluded
+
+    return (start, cont, expand(WHITE_SPACE),
+            "Unicode " + unicodedata.unidata_version)
+
+
+def build_tables(props, shift):
+    block_size = 1 << shift
+    blocks = {}
+    stage1 = []
+    stage2 = []
+
+    for base in range(0, MAX_CODE_POINT, block_size):
+        block = tuple(props[base:base + block_size])
+        if block not in blocks:
+            blocks[block] = len(blocks)
+            stage2.extend(block)
+        stage1.append(blocks[block])
+
+    return stage1, stage2
+
+
+def table_size(stage1, stage2, shift):
+    index_size = 1 if len(stage2) >> shift <= 0x100 else 2
+    return len(stage1) * index_size + len(stage2)
+
+
+def emit_array(out, ctype, name, values, per_line):
+    out.write("static const %s %s[%d] = {\n" % (ctype, name, len(values)))
+    for i in range(0, len(values), per_line):
+        chunk = values[i:i + per_line]
+        out.write("    " + ", ".join(str(v) for v in chunk) + ",\n")
+    out.write("};\n\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--ucd", help="directory containing UCD data files")
+    args = parser.parse_args()
+
+    start, cont, space, source = derive_properties(args.ucd)
+
+    props = [0] * MAX_CODE_POINT
+    for c in start:
+        props[c] |= PROP_ID_START
+    for c in cont:
+        props[c] |= PROP_ID_CONTINUE
+    for c in space:
+        props[c] |= PROP_WHITESPACE
+
+    # Pick the block size which gives the smallest pair of tables
+    best = None
+    for shift in range(4, 11):
+        stage1, stage2 = build_tables(props, shift)
+        size = table_size(stage1, stage2, shift)
+        if best is None or size < best[0]:
+            best = (size, shift, stage1, stage2)
+
+    size, shift, stage1, stage2 = best
+    blocks = len(stage2) >> shift
+    index_type = "uint8_t" if blocks <= 0x100 else "uint16_t"
+
+    out = sys.stdout
+    out.write("// Generated by scripts/gen_char_tables.py from %s.\n" % source)
+    out.write("// Do not edit by hand.\n\n")
+    out.write("#ifndef INCLUDE_char_tables_h__\n")
+    out.write("#define INCLUDE_char_tables_h__\n\n")
+    out.write("#include <stdint.h>\n\n")
+    out.write("#define CHAR_TABLE_SHIFT %d\n" % shift)
+    out.write("#define CHAR_TABLE_MASK 0x%X\n\n" % ((1 << shift) - 1))
+    out.write("// %d blocks, %d bytes in total\n" % (blocks, size))
+    emit_array(out, index_type, "char_table_blocks", stage1, 16)
+    emit_array(out, "uint8_t", "char_table_props", stage2, 32)
+    out.write("#endif\n")
+
+
+if __name__ == "__main__":
+    main()
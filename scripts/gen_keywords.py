@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Generate src/keyword_table.h, the perfect hash behind nix_keyword__lookup.
+
+Each keyword is packed into a 64-bit word - one byte per character starting
+from the least significant byte, with the length in the top byte - and a
+multiplier is searched for so that the top bits of word * multiplier are
+distinct for every keyword. A lookup is then one multiply, one table load and
+one word comparison.
+
+    python3 scripts/gen_keywords.py > src/keyword_table.h
+"""
+
+import random
+import sys
+
+# In the order of enum nix_keyword, starting from NIX_KEYWORD_LET
+KEYWORDS = ["let", "in", "rec", "with", "inherit", "if", "then", "else",
+            "assert", "or"]
+
+MASK = (1 << 64) - 1
+SEED = 0x6E6978
+
+
+def pack(word):
+    assert len(word) < 8
+    packed = len(word) << 56
+    for i, c in enumerate(word.encode("ascii")):
+        packed |= c << (8 * i)
+    return packed
+
+
+def search(words, bits):
+    rng = random.Random(SEED)
+    for _ in range(1000000):
+        multiplier = rng.getrandbits(64) | 1
+        slots = {((w * multiplier) & MASK) >> (64 - bits) for w in words}
+        if len(slots) == len(words):
+            return multiplier
+    return None
+
+
+def main():
+    words = [pack(k) for k in KEYWORDS]
+
+    bits = max(len(KEYWORDS) - 1, 1).bit_length()
+    multiplier = search(words, bits)
+    while multiplier is None:
+        bits += 1
+        multiplier = search(words, bits)
+
+    table = [(0, "NIX_KEYWORD_NONE")] * (1 << bits)
+    for keyword, word in zip(KEYWORDS, words):
+        slot = ((word * multiplier) & MASK) >> (64 - bits)
+        table[slot] = (word, "NIX_KEYWORD_" + keyword.upper())
+
+    out = sys.stdout
+    out.write("// Generated by scripts/gen_keywords.py. Do not edit by hand.\n\n")
+    out.write("#ifndef INCLUDE_keyword_table_h__\n")
+    out.write("#define INCLUDE_keyword_table_h__\n\n")
+    out.write("#include <stdint.h>\n\n")
+    out.write('#include "libnix/keyword.h"\n\n')
+    out.write("#define KEYWORD_TABLE_BITS %d\n" % bits)
+    out.write("#define KEYWORD_MULTIPLIER 0x%016XULL\n\n" % multiplier)
+    out.write("struct keyword_slot {\n")
+    out.write("    uint64_t word;\n")
+    out.write("    enum nix_keyword keyword;\n")
+    out.write("};\n\n")
+    out.write("static const struct keyword_slot keyword_table[%d] = {\n"
+              % len(table))
+    for word, name in table:
+        out.write("    { 0x%016XULL, %s },\n" % (word, name))
+    out.write("};\n\n")
+    out.write("#endif\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+"""Generate src/pow10_table.h, the powers of ten used by the Schubfach
+algorithm in nix_number__format_float.
+
+Each entry is g = floor(10^e * 2^-r) + 1 for the r which puts g in
+[2^127, 2^128), stored as a high and a low word. This over-approximation
+of 10^e is what the round-to-odd products in Schubfach are proven
+correct for.
+
+    python3 scripts/gen_pow10_table.py > src/pow10_table.h
+"""
+
+import sys
+
+# The decimal exponents -k needed for every double
+SMALLEST_POWER = -292
+LARGEST_POWER = 324
+
+
+def scaled_power(e):
+    if e >= 0:
+        power = 10 ** e
+        r = power.bit_length() - 128
+        if r >= 0:
+            return (power >> r) + 1
+        return (power << -r) + 1
+
+    power = 10 ** -e
+    return (1 << (power.bit_length() + 127)) // power + 1
+
+
+def main():
+    out = sys.stdout
+    out.write("// Generated by scripts/gen_pow10_table.py. Do not edit by hand.\n\n")
+    out.write("#ifndef INCLUDE_pow10_table_h__\n")
+    out.write("#define INCLUDE_pow10_table_h__\n\n")
+    out.write("#include <stdint.h>\n\n")
+    out.write("#define POW10_SMALLEST_POWER %d\n" % SMALLEST_POWER)
+    out.write("#define POW10_LARGEST_POWER %d\n\n" % LARGEST_POWER)
+
+    count = LARGEST_POWER - SMALLEST_POWER + 1
+    out.write("static const uint64_t pow10_table[%d] = {\n" % (count * 2))
+    for e in range(SMALLEST_POWER, LARGEST_POWER + 1):
+        g = scaled_power(e)
+        assert (1 << 127) <= g < (1 << 128)
+        out.write("    0x%016XULL, 0x%016XULL,\n" %
+                  (g >> 64, g & ((1 << 64) - 1)))
+    out.write("};\n\n#endif\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""Generate src/pow5_table.h, the powers of five used by the Eisel-Lemire
+algorithm in nix_number__parse_float.
+
+Each entry is 5^q scaled by a power of two so that its most significant bit
+is bit 127, then truncated (or, for negative powers, rounded up) to 128 bits
+and stored as a high and a low word. Decimal exponents outside the table
+always round to zero or infinity for a double.
+
+    python3 scripts/gen_pow5_table.py > src/pow5_table.h
+"""
+
+import sys
+
+SMALLEST_POWER = -342
+LARGEST_POWER = 308
+
+
+def scaled_power(q):
+    if q >= 0:
+        power = 5 ** q
+        while power < (1 << 127):
+            power *= 2
+        while power >= (1 << 128):
+            power //= 2
+        return power
+
+    power = 5 ** -q
+    z = power.bit_length()
+    if q >= -27:
+        return (1 << (z + 127)) // power + 1
+
+    c = (1 << (2 * z + 128)) // power + 1
+    while c >= (1 << 128):
+        c //= 2
+    return c
+
+
+def main():
+    out = sys.stdout
+    out.write("// Generated by scripts/gen_pow5_table.py. Do not edit by hand.\n\n")
+    out.write("#ifndef INCLUDE_pow5_table_h__\n")
+    out.write("#define INCLUDE_pow5_table_h__\n\n")
+    out.write("#include <stdint.h>\n\n")
+    out.write("#define POW5_SMALLEST_POWER %d\n" % SMALLEST_POWER)
+    out.write("#define POW5_LARGEST_POWER %d\n\n" % LARGEST_POWER)
+
+    count = LARGEST_POWER - SMALLEST_POWER + 1
+    out.write("static const uint64_t pow5_table[%d] = {\n" % (count * 2))
+    for q in range(SMALLEST_POWER, LARGEST_POWER + 1):
+        c = scaled_power(q)
+        out.write("    0x%016XULL, 0x%016XULL,\n" %
+                  (c >> 64, c & ((1 << 64) - 1)))
+    out.write("};\n\n#endif\n")
+
+
+if __name__ == "__main__":
+    main()
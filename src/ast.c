@@ -0,0 +1,198 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "common.h"
+#include "error.h"
+
+enum nix_err
+__ast_construct(struct ast **out) {
+    struct ast *a = NULL;
+    ALLOC(a, sizeof(struct ast));
+    memset(a, 0, sizeof(struct ast));
+
+    a->p.root = NIX_AST_NONE;
+
+    ALLOC(a->p.nodes, sizeof(struct nix_ast_node) * AST_INITIAL_NODES);
+    a->node_capacity = AST_INITIAL_NODES;
+
+    ALLOC(a->p.lists, sizeof(uint32_t) * AST_INITIAL_LISTS);
+    a->list_capacity = AST_INITIAL_LISTS;
+
+    ALLOC(a->p.text, AST_INITIAL_TEXT);
+    a->text_capacity = AST_INITIAL_TEXT;
+
+    *out = a;
+
+    EXCEPT(err)
+    nix_ast__free((struct nix_ast **)&a);
+    return err;
+}
+
+enum nix_err
+__ast_push(struct ast *a, const struct nix_ast_node *node, uint32_t *out) {
+    // The largest index is kept free to mean no node
+    if (a->p.count == NIX_AST_NONE - 1) {
+        return NIXERR_NOMEMORY;
+    }
+
+    if (a->p.count == a->node_capacity) {
+        uint32_t capacity = a->node_capacity * 2;
+        if (capacity < a->node_capacity) {
+            capacity = NIX_AST_NONE;
+        }
+
+        void *nodes = realloc(a->p.nodes,
+            sizeof(struct nix_ast_node) * capacity);
+        if (nodes == NULL) return NIXERR_NOMEMORY;
+
+        a->p.nodes = nodes;
+        a->node_capacity = capacity;
+    }
+
+    *out = a->p.count;
+    a->p.nodes[a->p.count++] = *node;
+
+    return NIXERR_NONE;
+}
+
+// Copy a finished list of children in, so each list is contiguous however
+// its children were nested while parsing
+enum nix_err
+__ast_push_list(
+    struct ast *a,
+    const uint32_t *children,
+    uint32_t count,
+    uint32_t *first)
+{
+    if (count > NIX_AST_NONE - 1 - a->p.list_count) {
+        return NIXERR_NOMEMORY;
+    }
+
+    uint32_t needed = a->p.list_count + count;
+    if (needed > a->list_capacity) {
+        uint32_t capacity = a->list_capacity * 2;
+        if (capacity < needed) {
+            capacity = needed;
+        }
+
+        void *lists = realloc(a->p.lists, sizeof(uint32_t) * capacity);
+        if (lists == NULL) return NIXERR_NOMEMORY;
+
+        a->p.lists = lists;
+        a->list_capacity = capacity;
+    }
+
+    *first = a->p.list_count;
+    if (count > 0) {
+        memcpy(a->p.lists + a->p.list_count, children,
+            sizeof(uint32_t) * count);
+    }
+
+    a->p.list_count += count;
+
+    return NIXERR_NONE;
+}
+
+// Make room for size more bytes of text. Offsets into the text stay valid,
+// but pointers may not.
+enum nix_err
+__ast_reserve_text(struct ast *a, size_t size) {
+    size_t needed = a->p.text_size + size;
+    if (needed <= a->text_capacity) {
+        return NIXERR_NONE;
+    }
+
+    size_t capacity = a->text_capacity * 2;
+    if (capacity < needed) {
+        capacity = needed;
+    }
+
+    void *text = realloc(a->p.text, capacity);
+    if (text == NULL) return NIXERR_NOMEMORY;
+
+    a->p.text = text;
+    a->text_capacity = capacity;
+
+    return NIXERR_NONE;
+}
+
+int64_t
+nix_ast__int(const struct nix_ast *ast, uint32_t node) {
+    const struct nix_ast_node *n = &ast->nodes[node];
+    return (int64_t)((uint64_t)n->data[0] | ((uint64_t)n->data[1] << 32));
+}
+
+double
+nix_ast__float(const struct nix_ast *ast, uint32_t node) {
+    const struct nix_ast_node *n = &ast->nodes[node];
+    uint64_t bits = (uint64_t)n->data[0] | ((uint64_t)n->data[1] << 32);
+
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+const uint32_t *
+nix_ast__list(const struct nix_ast *ast, uint32_t node, uint32_t *count) {
+    const struct nix_ast_node *n = &ast->nodes[node];
+    size_t at = n->kind == NIX_AST_INHERIT ? 1 : 0;
+
+    *count = n->data[at + 1];
+    return ast->lists + n->data[at];
+}
+
+const char *
+nix_ast__kind_name(enum nix_ast_kind kind) {
+    static const char *names[NIX_AST_KIND_COUNT] = {
+        [NIX_AST_INT] = "INT",
+        [NIX_AST_FLOAT] = "FLOAT",
+        [NIX_AST_TEXT] = "TEXT",
+        [NIX_AST_PATH] = "PATH",
+        [NIX_AST_HPATH] = "HPATH",
+        [NIX_AST_SPATH] = "SPATH",
+        [NIX_AST_URI] = "URI",
+        [NIX_AST_ID] = "ID",
+        [NIX_AST_STRING] = "STRING",
+        [NIX_AST_PATH_INTERP] = "PATH_INTERP",
+        [NIX_AST_LIST] = "LIST",
+        [NIX_AST_ATTRSET] = "ATTRSET",
+        [NIX_AST_ATTRPATH] = "ATTRPATH",
+        [NIX_AST_DYNAMIC] = "DYNAMIC",
+        [NIX_AST_BINDING] = "BINDING",
+        [NIX_AST_INHERIT] = "INHERIT",
+        [NIX_AST_SELECT] = "SELECT",
+        [NIX_AST_HAS_ATTR] = "HAS_ATTR",
+        [NIX_AST_APPLY] = "APPLY",
+        [NIX_AST_UNARY] = "UNARY",
+        [NIX_AST_BINARY] = "BINARY",
+        [NIX_AST_IF] = "IF",
+        [NIX_AST_LAMBDA] = "LAMBDA",
+        [NIX_AST_FORMALS] = "FORMALS",
+        [NIX_AST_FORMAL] = "FORMAL",
+        [NIX_AST_LET] = "LET",
+        [NIX_AST_WITH] = "WITH",
+        [NIX_AST_ASSERT] = "ASSERT"
+    };
+
+    if ((unsigned)kind >= NIX_AST_KIND_COUNT) {
+        return "UNKNOWN";
+    }
+
+    return names[kind];
+}
+
+// The whole tree is three arrays, whatever its size
+void
+nix_ast__free(struct nix_ast **out) {
+    if (*out == NULL) return;
+
+    FREE((*out)->nodes);
+    FREE((*out)->lists);
+    FREE((*out)->text);
+    FREE(*out);
+
+    *out = NULL;
+}
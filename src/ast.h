@@ -0,0 +1,48 @@
+#ifndef INCLUDE_ast_h__
+#define INCLUDE_ast_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/ast.h"
+
+#define AST_INITIAL_NODES 256
+#define AST_INITIAL_LISTS 256
+#define AST_INITIAL_TEXT 1024
+
+struct ast {
+    struct nix_ast p;
+
+    uint32_t node_capacity;
+    uint32_t list_capacity;
+    size_t text_capacity;
+};
+
+enum nix_err
+__ast_construct(struct ast **);
+
+enum nix_err
+__ast_push(struct ast *, const struct nix_ast_node *, uint32_t *);
+
+enum nix_err
+__ast_push_list(struct ast *, const uint32_t *, uint32_t, uint32_t *);
+
+enum nix_err
+__ast_reserve_text(struct ast *, size_t);
+
+// A node of the given kind over [start, end), with no children yet
+static inline struct nix_ast_node
+__ast_node(enum nix_ast_kind kind, uint32_t start, uint32_t end) {
+    struct nix_ast_node node = {
+        .kind = (uint8_t)kind,
+        .op = 0,
+        .flags = 0,
+        .start = start,
+        .end = end,
+        .data = { NIX_AST_NONE, NIX_AST_NONE, NIX_AST_NONE }
+    };
+
+    return node;
+}
+
+#endif
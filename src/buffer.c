@@ -1,149 +1,1064 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "lexeme.h"
+#include "common.h"
+#include "error.h"
+#include "position.h"
+#include "source.h"
+#include "utf8.h"
+
+// Lexemes up to this many code points are encoded on the stack when being
+// interned
+#define LEXEME_SCRATCH_SIZE 128
+
+// Finds each thread's free list, and frees it when the thread exits
+static pthread_key_t __buffer_free_key;
+static pthread_once_t __buffer_free_once = PTHREAD_ONCE_INIT;
+static bool __buffer_free_ready = false;
+
+static void
+__buffer_free_key_create(void) {
+    __buffer_free_ready =
+        pthread_key_create(&__buffer_free_key, &__buffer_free_list_free) == 0;
+}
+
+// The size of the byte-order mark the input starts with, if any, and the
+// encoding it gives
+static inline size_t
+__bom_from_bytes(
+    const uint8_t *data,
+    size_t size,
+    bool *is_utf16,
+    bool *reverse_order)
+{
+    *is_utf16 = false;
+    *reverse_order = false;
+
+    if (size >= 2 && data[0] == 0xFE && data[1] == 0xFF) {
+        *is_utf16 = true;
+        return 2;
+    }
+
+    if (size >= 2 && data[0] == 0xFF && data[1] == 0xFE) {
+        *is_utf16 = true;
+        *reverse_order = true;
+        return 2;
+    }
+
+    if (size >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF) {
+        return 3;
+    }
+
+    return 0;
+}
+
+// Whether the bytes so far could be the start of a byte-order mark
+static inline bool
+__bom_prefix(const uint8_t *data, size_t size) {
+    static const uint8_t *marks[] = {
+        (const uint8_t *)"\xFE\xFF",
+        (const uint8_t *)"\xFF\xFE",
+        (const uint8_t *)"\xEF\xBB\xBF"
+    };
+
+    for (size_t i = 0; i < sizeof(marks) / sizeof(marks[0]); i++) {
+        if (memcmp(data, marks[i], size) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+enum nix_err
+nix_buffer__init(struct nix_buffer *out, FILE *in, size_t buffer_size) {
+    return nix_buffer__init_flags(out, in, buffer_size, 0);
+}
+
+enum nix_err
+nix_buffer__init_flags(
+    struct nix_buffer *out,
+    FILE *in,
+    size_t buffer_size,
+    unsigned int flags)
+{
+    struct buffer *b = (struct buffer *)out;
+
+    TRY(__buffer_setup(b, buffer_size, flags));
+    TRY(__buffer_start(b, in));
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_buffer__init_fd(
+    struct nix_buffer *out,
+    int fd,
+    size_t buffer_size,
+    unsigned int flags)
+{
+    struct buffer *b = (struct buffer *)out;
+
+    TRY(__buffer_setup(b, buffer_size, flags));
+    TRY(__buffer_start_fd(b, fd));
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_buffer__init_mem(
+    struct nix_buffer *out,
+    const uint8_t *data,
+    size_t length,
+    bool copy)
+{
+    struct buffer *b = (struct buffer *)out;
+
+    TRY(__buffer_setup(b, 0, 0));
+    TRY(__buffer_start_mem(b, data, length, copy));
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_buffer__init_source(
+    struct nix_buffer *out,
+    const struct nix_source *source,
+    size_t buffer_size,
+    unsigned int flags)
+{
+    struct buffer *b = (struct buffer *)out;
+    const uint8_t *block = NULL;
+    size_t block_length = 0, hint;
+
+    TRY(__buffer_setup(b, 0, flags));
+
+    // Input lent in one piece can be decoded where it is, like memory
+    if (source->borrow != NULL && source->size_hint != NULL &&
+            source->size_hint(source->context, &hint) == NIXERR_NONE) {
+        TRY(source->borrow(source->context, &block, &block_length));
+
+        if (block_length == hint) {
+            TRY(__buffer_start_mem(b, block, block_length, false));
+            return NIXERR_NONE;
+        }
+    }
+
+    TRY(__buffer_alloc(b, buffer_size));
+    TRY(__buffer_start_source(b, source, block, block_length));
+
+    EXCEPT(err)
+    return err;
+}
+
+// Allocate what the buffer needs whatever its input
+enum nix_err
+__buffer_setup(struct buffer *b, size_t buffer_size, unsigned int flags) {
+    b->p.flags = flags;
+    b->p.lexeme = NULL;
+    b->p.read = NULL;
+    b->p.peek = NULL;
+
+    b->buffer = NULL;
+    b->mem = false;
+    b->borrowed = false;
+    b->feed = false;
+    b->sniffed = true;
+    b->pending = NULL;
+    b->pending_capacity = 0;
+    b->input = NULL;
+    b->fd = -1;
+    b->fd_restore = false;
+    b->hasher = NULL;
+    b->prefetch = NULL;
+    b->uring = NULL;
+    b->next_free = NULL;
+
+    TRY(__buffer_alloc(b, buffer_size));
+
+    TRY(nix_position__construct(&b->p.read));
+    TRY(nix_position__construct(&b->p.peek));
+    TRY(nix_position__construct(&b->p.lexeme));
+
+    EXCEPT(err)
+    return err;
+}
+
+// Give the buffer halves of its own of the given size
+enum nix_err
+__buffer_alloc(struct buffer *b, size_t buffer_size) {
+    b->p.buffer_size = buffer_size;
+
+    // Aligned whenever the size allows, so any buffer can read direct
+    if (buffer_size == 0) {
+        // Given memory by the caller
+    } else if (buffer_size % NIX_BUFFER_DIRECT_ALIGN == 0) {
+        b->buffer = aligned_alloc(NIX_BUFFER_DIRECT_ALIGN, buffer_size * 2);
+        if (b->buffer == NULL) {
+            TRY(NIXERR_NOMEMORY);
+        }
+    } else {
+        ALLOC(b->buffer, sizeof(uint8_t) * buffer_size * 2);
+    }
+
+    b->left = b->buffer;
+    b->right = b->buffer + buffer_size;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_buffer__reset(struct nix_buffer *buf, FILE *in) {
+    // Buffers over memory have no halves of their own to load into
+    if (((struct buffer *)buf)->mem) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    return __buffer_start((struct buffer *)buf, in);
+}
+
+enum nix_err
+nix_buffer__reset_source(
+    struct nix_buffer *buf,
+    const struct nix_source *source)
+{
+    if (((struct buffer *)buf)->mem) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    return __buffer_start_source((struct buffer *)buf, source, NULL, 0);
+}
+
+enum nix_err
+nix_buffer__reset_fd(struct nix_buffer *buf, int fd) {
+    if (((struct buffer *)buf)->mem) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    return __buffer_start_fd((struct buffer *)buf, fd);
+}
+
+// Point the buffer at the start of new input, reusing everything allocated
+// for the last one
+enum nix_err
+__buffer_start(struct buffer *b, FILE *in) {
+    struct nix_source source;
+    nix_source__file(&source, in);
+
+    __buffer_stop(b);
+
+    b->input = in;
+    b->fd = -1;
+    b->source = source;
+    b->feed = false;
+    b->block = NULL;
+    b->block_length = 0;
+
+    TRY(__buffer_begin(b));
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__buffer_start_fd(struct buffer *b, int fd) {
+    // Loading would take the buffer for one reading from a source otherwise
+    if (fd < 0) {
+        return NIXERR_BUF_FILE;
+    }
+
+    __buffer_stop(b);
+
+    b->input = NULL;
+    b->fd = fd;
+    b->feed = false;
+
+    __buffer_open_fd(b);
+    TRY(__buffer_begin(b));
+
+    EXCEPT(err)
+    return err;
+}
+
+// Start on a source, which may already have lent the first block
+enum nix_err
+__buffer_start_source(
+    struct buffer *b,
+    const struct nix_source *source,
+    const uint8_t *block,
+    size_t block_length)
+{
+    __buffer_stop(b);
+
+    b->input = NULL;
+    b->fd = -1;
+    b->source = *source;
+    b->feed = false;
+    b->block = block;
+    b->block_length = block_length;
+
+    TRY(__buffer_begin(b));
+
+    EXCEPT(err)
+    return err;
+}
+
+// Start on input which is fed in as it arrives, with nothing of it yet
+enum nix_err
+__buffer_start_feed(struct buffer *b) {
+    __buffer_stop(b);
+
+    b->input = NULL;
+    b->fd = -1;
+    b->feed = true;
+    b->finished = false;
+    b->fill = NULL;
+    b->pending_start = 0;
+    b->pending_size = 0;
+
+    TRY(__buffer_begin(b));
+
+    EXCEPT(err)
+    return err;
+}
+
+// The whole input is one half, with the end of the input inside it, so the
+// end is always found before another half would be loaded
+enum nix_err
+__buffer_start_mem(
+    struct buffer *b,
+    const uint8_t *data,
+    size_t length,
+    bool copy)
+{
+    if (copy) {
+        ALLOC(b->buffer, length > 0 ? length : 1);
+        memcpy(b->buffer, data, length);
+    } else {
+        // Only ever read from
+        b->buffer = (uint8_t *)data;
+        b->borrowed = true;
+    }
+
+    b->mem = true;
+    b->feed = false;
+    b->sniffed = true;
+    b->fill = NULL;
+    b->p.buffer_size = length + 1;
+    b->left = b->buffer;
+    b->right = b->buffer + length + 1;
+    b->eof = b->buffer + length;
+    b->at_eof = false;
+
+    b->buffer_ready[BUFFER_LEFT] = true;
+    b->buffer_ready[BUFFER_RIGHT] = true;
+
+    if (b->p.flags & NIX_BUFFER_HASH) {
+        TRY(nix_hasher__construct(&b->hasher));
+        nix_hasher__update(b->hasher, b->buffer, length);
+    }
+
+    size_t skip = __bom_from_bytes(b->buffer, length, &b->utf16,
+        &b->reverse_order);
+
+    if (b->utf16 == true) {
+        b->reader = &__read_utf16;
+    } else {
+        b->reader = &__read_utf8;
+    }
+
+    b->lexeme = b->left + skip;
+    b->read = b->left + skip;
+    b->peek = b->left + skip;
+
+    nix_position__init(b->p.read);
+    nix_position__init(b->p.peek);
+    nix_position__init(b->p.lexeme);
+
+    b->last_lexeme = 0;
+    b->last_read = 0;
+    b->last_peek = 0;
+
+    EXCEPT(err)
+    return err;
+}
+
+// Stop whatever was reading the last input, which has to happen before
+// anything else touches it
+void
+__buffer_stop(struct buffer *b) {
+    // Loading the first half checks these, and stale values left in reused
+    // memory could point into the new buffer
+    b->lexeme = NULL;
+    b->read = NULL;
+    b->peek = NULL;
+
+    __prefetch_stop(&b->prefetch);
+    __uring_reader_stop(&b->uring);
+
+    if (b->fd >= 0) {
+        __buffer_drop_fd(b, true);
+
+        if (b->fd_restore) {
+            fcntl(b->fd, F_SETFL, b->fd_status);
+            b->fd_restore = false;
+        }
+    }
+}
+
+// Load the first half of the input and look for a byte-order mark at the
+// start of it. Nothing has to be sought back to if there isn't one, so any
+// input can be read this way.
+enum nix_err
+__buffer_begin(struct buffer *b) {
+    // Hash the input from its first byte, so the digest matches one of the
+    // whole file
+    if (b->p.flags & NIX_BUFFER_HASH) {
+        if (b->hasher == NULL) {
+            TRY(nix_hasher__construct(&b->hasher));
+        } else {
+            nix_hasher__init(b->hasher);
+        }
+    } else {
+        nix_hasher__free(&b->hasher);
+    }
+
+    b->buffer_ready[BUFFER_LEFT] = false;
+    b->buffer_ready[BUFFER_RIGHT] = false;
+
+    b->eof = NULL;
+    b->at_eof = false;
+
+    if (b->input != NULL && (b->p.flags & NIX_BUFFER_URING)) {
+        TRY(__uring_reader_start(&b->uring, b->input, b->buffer,
+                    b->p.buffer_size));
+    }
+
+    if (b->input != NULL && b->uring == NULL &&
+            (b->p.flags & NIX_BUFFER_PREFETCH)) {
+        TRY(__prefetch_start(&b->prefetch, b->input, b->buffer,
+                    b->p.buffer_size));
+    }
+
+    b->fill = NULL;
+    TRY(__load_buffer(b, BUFFER_LEFT));
+
+    b->lexeme = b->left;
+    b->read = b->left;
+    b->peek = b->left;
+
+    // Fed input mightn't have enough of itself yet to tell
+    b->sniffed = false;
+    if (!b->feed) {
+        TRY(__buffer_sniff(b));
+    }
+
+    nix_position__init(b->p.read);
+    nix_position__init(b->p.peek);
+    nix_position__init(b->p.lexeme);
+
+    b->last_lexeme = 0;
+    b->last_read = 0;
+    b->last_peek = 0;
+
+    EXCEPT(err)
+    return err;
+}
+
+// Look for a byte-order mark at the start of the first half, before
+// anything has been read
+enum nix_err
+__buffer_sniff(struct buffer *b) {
+    size_t available = b->p.buffer_size;
+    if (b->fill != NULL) {
+        available = b->fill - b->left;
+    } else if (b->eof != NULL) {
+        available = b->eof - b->left;
+    }
+
+    if (b->feed && !b->finished && available < 3 &&
+            __bom_prefix(b->left, available)) {
+        return NIXERR_BUF_WOULDBLOCK;
+    }
+
+    size_t skip = __bom_from_bytes(b->left, available, &b->utf16,
+        &b->reverse_order);
+
+    if (b->utf16 == true) {
+        b->reader = &__read_utf16;
+    } else {
+        b->reader = &__read_utf8;
+    }
+
+    b->lexeme = b->left + skip;
+    b->read = b->left + skip;
+    b->peek = b->left + skip;
+    b->sniffed = true;
+
+    return NIXERR_NONE;
+}
+
+enum nix_err
+nix_buffer__init_feed(
+    struct nix_buffer *out,
+    size_t buffer_size,
+    unsigned int flags)
+{
+    struct buffer *b = (struct buffer *)out;
+
+    TRY(__buffer_setup(b, buffer_size, flags));
+    TRY(__buffer_start_feed(b));
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_buffer__construct_feed(
+    struct nix_buffer **out,
+    size_t buffer_size,
+    unsigned int flags)
+{
+    struct buffer *b = 0;
+    ALLOC(b, sizeof(struct buffer));
+
+    TRY(nix_buffer__init_feed((struct nix_buffer *)b, buffer_size, flags));
+    *out = (struct nix_buffer *)b;
+
+    EXCEPT(err)
+    nix_buffer__free((struct nix_buffer **)&b);
+    return err;
+}
+
+enum nix_err
+nix_buffer__reset_feed(struct nix_buffer *buf) {
+    if (((struct buffer *)buf)->mem) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    return __buffer_start_feed((struct buffer *)buf);
+}
+
+enum nix_err
+nix_buffer__feed(struct nix_buffer *buf, const uint8_t *data, size_t length) {
+    struct buffer *b = (struct buffer *)buf;
+
+    if (!b->feed) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    if (b->finished) {
+        return NIXERR_BUF_PAST_EOF;
+    }
+
+    if (length == 0) {
+        return NIXERR_NONE;
+    }
+
+    // Make room at the end, moving what's left to the front first
+    if (b->pending_start > 0) {
+        memmove(b->pending, b->pending + b->pending_start, b->pending_size);
+        b->pending_start = 0;
+    }
+
+    if (b->pending_size + length > b->pending_capacity) {
+        size_t capacity = b->pending_capacity > 0 ?
+            b->pending_capacity : b->p.buffer_size;
+
+        while (capacity < b->pending_size + length) {
+            capacity *= 2;
+        }
+
+        uint8_t *pending = realloc(b->pending, capacity);
+        if (pending == NULL) {
+            return NIXERR_NOMEMORY;
+        }
+
+        b->pending = pending;
+        b->pending_capacity = capacity;
+    }
+
+    memcpy(b->pending + b->pending_size, data, length);
+    b->pending_size += length;
+
+    // A half which is only partly loaded takes what it can straight away
+    if (b->fill != NULL) {
+        TRY(__feed_top_up(b));
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_buffer__finish(struct nix_buffer *buf) {
+    struct buffer *b = (struct buffer *)buf;
+
+    if (!b->feed) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    b->finished = true;
+
+    // Whatever has been fed is all loaded, so the end is where it stops
+    if (b->fill != NULL && b->pending_size == 0) {
+        b->eof = b->fill;
+        b->fill = NULL;
+    }
+
+    return NIXERR_NONE;
+}
+
+// Take as much of what has been fed as will fit
+size_t
+__feed_take(struct buffer *b, uint8_t *target, size_t count) {
+    size_t length = b->pending_size;
+    if (length > count) {
+        length = count;
+    }
+
+    if (length == 0) {
+        return 0;
+    }
+
+    memcpy(target, b->pending + b->pending_start, length);
+    b->pending_start += length;
+    b->pending_size -= length;
+
+    return length;
+}
+
+// Load more of what has been fed into the half being filled. With nothing
+// fed, that's the end if the input is finished and has to wait otherwise.
+enum nix_err
+__feed_top_up(struct buffer *b) {
+    uint8_t *end = b->right + b->p.buffer_size;
+    if (b->fill < b->right) {
+        end = b->right;
+    }
+
+    size_t length = __feed_take(b, b->fill, end - b->fill);
+
+    if (b->hasher != NULL) {
+        nix_hasher__update(b->hasher, b->fill, length);
+    }
+
+    b->fill += length;
+
+    if (b->fill == end) {
+        b->fill = NULL;
+    } else if (length == 0) {
+        if (!b->finished) {
+            return NIXERR_BUF_WOULDBLOCK;
+        }
+
+        b->eof = b->fill;
+        b->fill = NULL;
+    }
+
+    return NIXERR_NONE;
+}
+
+enum nix_err
+nix_buffer__rewind(struct nix_buffer *buf) {
+    struct buffer *b = (struct buffer *)buf;
+
+    if (b == NULL || b->lexeme == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    b->read = b->lexeme;
+    b->peek = b->lexeme;
+    b->last_read = b->last_lexeme;
+    b->last_peek = b->last_lexeme;
+    b->at_eof = false;
+
+    TRY(nix_position__copy(b->p.read, b->p.lexeme));
+    TRY(nix_position__copy(b->p.peek, b->p.lexeme));
+
+    EXCEPT(err)
+    return err;
+}
+
+// Work out how the descriptor can be read, and give the kernel its hints
+void
+__buffer_open_fd(struct buffer *b) {
+    unsigned int flags = b->p.flags;
+    int fd = b->fd;
+
+    b->fd_offset = lseek(fd, 0, SEEK_CUR);
+    b->fd_seekable = b->fd_offset >= 0;
+    if (!b->fd_seekable) {
+        b->fd_offset = 0;
+    }
+
+    b->fd_dropped = b->fd_offset;
+    b->fd_direct = false;
+
+    int status = fcntl(fd, F_GETFL);
+    bool aligned = b->fd_seekable &&
+        b->fd_offset % NIX_BUFFER_DIRECT_ALIGN == 0 &&
+        b->p.buffer_size % NIX_BUFFER_DIRECT_ALIGN == 0;
+
+    if (status >= 0 && (status & O_DIRECT)) {
+        b->fd_direct = true;
+    } else if (status >= 0 && aligned && (flags & NIX_BUFFER_DIRECT)) {
+        // Not every filesystem takes it, in which case reads are cached
+        if (fcntl(fd, F_SETFL, status | O_DIRECT) == 0) {
+            b->fd_status = status;
+            b->fd_restore = true;
+            b->fd_direct = true;
+        }
+    }
+
+    if (b->fd_seekable) {
+        posix_fadvise(fd, b->fd_offset, 0, POSIX_FADV_SEQUENTIAL);
+
+        if (flags & NIX_BUFFER_NOREUSE) {
+            posix_fadvise(fd, b->fd_offset, 0, POSIX_FADV_NOREUSE);
+        }
+    }
+}
+
+// Read as much of a half as the input has left, straight into it
+enum nix_err
+__read_fd(struct buffer *b, uint8_t *target, size_t count, size_t *out) {
+    size_t total = 0;
+
+    while (total < count) {
+        ssize_t n;
+        if (b->fd_seekable) {
+            n = pread(b->fd, target + total, count - total, b->fd_offset);
+        } else {
+            n = read(b->fd, target + total, count - total);
+        }
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // Direct reads are refused when something isn't aligned, or by
+            // filesystems which only say so now; read through the cache
+            if (errno == EINVAL && b->fd_direct) {
+                __buffer_cached_fd(b);
+                continue;
+            }
+
+            return NIXERR_BUF_FILE;
+        }
 
-#include "buffer.h"
-#include "lexeme.h"
-#include "common.h"
-#include "error.h"
-#include "position.h"
+        if (n == 0) {
+            break;
+        }
+
+        total += n;
+        b->fd_offset += n;
+
+        // Direct reads only come up short at the end, and couldn't carry on
+        // from an unaligned offset anyway
+        if (b->fd_direct && n % NIX_BUFFER_DIRECT_ALIGN != 0) {
+            break;
+        }
+    }
+
+    *out = total;
+    __buffer_drop_fd(b, false);
+
+    return NIXERR_NONE;
+}
 
+// Fill as much of a half as the source has left. Sources can give less
+// than asked for without being at the end, so they're asked until they
+// give nothing.
 enum nix_err
-nix_buffer__init(struct nix_buffer *out, FILE *in, size_t buffer_size) {
-    struct buffer *b = (struct buffer *)out;
+__read_source(struct buffer *b, uint8_t *target, size_t count, size_t *out) {
+    struct nix_source *source = &b->source;
+    size_t total = 0;
 
-    ALLOC(b->buffer, sizeof(uint8_t) * buffer_size * 2);
-    b->left = b->buffer;
-    b->right = b->buffer + buffer_size;
+    while (total < count) {
+        size_t length;
 
-    // Do a simple encoding check on the file by looking for a BOM
-    b->input = in;
-    TRY(__read_bom(in, &b->utf16, &b->reverse_order));
+        if (source->borrow != NULL) {
+            if (b->block_length == 0) {
+                TRY(source->borrow(source->context, &b->block,
+                            &b->block_length));
 
-    if (b->utf16 == true) {
-        b->reader = &__read_utf16;
-    } else {
-        b->reader = &__read_utf8;
+                if (b->block_length == 0) {
+                    break;
+                }
+            }
+
+            length = b->block_length;
+            if (length > count - total) {
+                length = count - total;
+            }
+
+            memcpy(target + total, b->block, length);
+            b->block += length;
+            b->block_length -= length;
+        } else {
+            TRY(source->read(source->context, target + total, count - total,
+                        &length));
+
+            if (length == 0) {
+                break;
+            }
+        }
+
+        total += length;
     }
 
-    b->p.buffer_size = buffer_size;
+    *out = total;
 
-    b->buffer_ready[BUFFER_LEFT] = false;
-    b->buffer_ready[BUFFER_RIGHT] = false;
+    EXCEPT(err)
+    return err;
+}
 
-    b->eof = NULL;
-    b->at_eof = false;
+// Take O_DIRECT off the descriptor, restoring the caller's flags after
+void
+__buffer_cached_fd(struct buffer *b) {
+    int status = fcntl(b->fd, F_GETFL);
 
-    TRY(__load_buffer(b, BUFFER_LEFT));
+    if (status >= 0 && fcntl(b->fd, F_SETFL, status & ~O_DIRECT) == 0 &&
+            !b->fd_restore) {
+        b->fd_status = status;
+        b->fd_restore = true;
+    }
 
-    b->lexeme = b->left;
-    b->read = b->left;
-    b->peek = b->left;
+    b->fd_direct = false;
+}
 
-    TRY(nix_position__construct(&b->p.read));
-    TRY(nix_position__construct(&b->p.peek));
-    TRY(nix_position__construct(&b->p.lexeme));
+// Tell the kernel the pages read so far won't be needed again, so a long
+// scan doesn't push everything else out of the cache. It's done in batches
+// to keep the calls down, unless all of the rest is asked for.
+void
+__buffer_drop_fd(struct buffer *b, bool all) {
+    if (!(b->p.flags & NIX_BUFFER_NOREUSE) || !b->fd_seekable ||
+            b->fd_direct) {
+        return;
+    }
 
-    b->last_lexeme = 0;
-    b->last_read = 0;
-    b->last_peek = 0;
+    off_t length = b->fd_offset - b->fd_dropped;
+    if (length > 0 && (all || length >= BUFFER_DROP_SIZE)) {
+        posix_fadvise(b->fd, b->fd_dropped, length, POSIX_FADV_DONTNEED);
+        b->fd_dropped = b->fd_offset;
+    }
+}
+
+enum nix_err
+nix_buffer__construct(struct nix_buffer **out, FILE *in, size_t buffer_size) {
+    return nix_buffer__construct_flags(out, in, buffer_size, 0);
+}
+
+enum nix_err
+nix_buffer__construct_flags(
+    struct nix_buffer **out,
+    FILE *in,
+    size_t buffer_size,
+    unsigned int flags)
+{
+    struct buffer *b = 0;
+    ALLOC(b, sizeof(struct buffer));
+
+    TRY(nix_buffer__init_flags((struct nix_buffer *)b, in, buffer_size,
+        flags));
+    *out = (struct nix_buffer *)b;
 
+    // Setup leaves the buffer safe to free whichever step failed, and a
+    // failed start can leave a reader running
     EXCEPT(err)
+    nix_buffer__free((struct nix_buffer **)&b);
     return err;
 }
 
-static inline enum nix_err
-__read_bom(FILE *input, bool *is_utf16, bool *reverse_order) {
-    uint8_t c;
+enum nix_err
+nix_buffer__construct_fd(
+    struct nix_buffer **out,
+    int fd,
+    size_t buffer_size,
+    unsigned int flags)
+{
+    struct buffer *b = 0;
+    ALLOC(b, sizeof(struct buffer));
+
+    TRY(nix_buffer__init_fd((struct nix_buffer *)b, fd, buffer_size, flags));
+    *out = (struct nix_buffer *)b;
+
+    EXCEPT(err)
+    nix_buffer__free((struct nix_buffer **)&b);
+    return err;
+}
+
+enum nix_err
+nix_buffer__construct_mem(
+    struct nix_buffer **out,
+    const uint8_t *data,
+    size_t length,
+    bool copy)
+{
+    struct buffer *b = 0;
+    ALLOC(b, sizeof(struct buffer));
 
-    TRY(__read_bom_byte(input, &c));
+    TRY(nix_buffer__init_mem((struct nix_buffer *)b, data, length, copy));
+    *out = (struct nix_buffer *)b;
 
-    // Detect the FEFF byte-order mark for a UTF-16 document
-    if (c == u'\xFE') {
-        TRY(__read_bom_byte(input, &c));
+    EXCEPT(err)
+    nix_buffer__free((struct nix_buffer **)&b);
+    return err;
+}
 
-        if (c == u'\xFF') {
-            *is_utf16 = true;
-            *reverse_order = false;
-            return NIXERR_NONE;
+enum nix_err
+nix_buffer__construct_source(
+    struct nix_buffer **out,
+    const struct nix_source *source,
+    size_t buffer_size,
+    unsigned int flags)
+{
+    struct buffer *b = 0;
+    ALLOC(b, sizeof(struct buffer));
+
+    TRY(nix_buffer__init_source((struct nix_buffer *)b, source, buffer_size,
+        flags));
+    *out = (struct nix_buffer *)b;
+
+    EXCEPT(err)
+    nix_buffer__free((struct nix_buffer **)&b);
+    return err;
+}
+
+enum nix_err
+nix_buffer__acquire(
+    struct nix_buffer **out,
+    FILE *in,
+    size_t buffer_size,
+    unsigned int flags)
+{
+    struct buffer_free_list *list = __buffer_free_list();
+    struct buffer **link = list != NULL ? &list->head : NULL;
+    struct buffer *b = NULL;
+
+    while (link != NULL && *link != NULL) {
+        if ((*link)->p.buffer_size == buffer_size) {
+            b = *link;
+            *link = b->next_free;
+            b->next_free = NULL;
+            list->count--;
+            break;
         }
 
-        goto no_bom;
+        link = &(*link)->next_free;
+    }
+
+    if (b == NULL) {
+        return nix_buffer__construct_flags(out, in, buffer_size, flags);
     }
 
-    // Detect the FFFE reverse byte-order mark for a UTF-16 document
-    if (c == u'\xFF') {
-        TRY(__read_bom_byte(input, &c));
+    b->p.flags = flags;
+    TRY(__buffer_start(b, in));
 
-        if (c == u'\xFE') {
-            *is_utf16 = true;
-            *reverse_order = true;
-            return NIXERR_NONE;
-        }
+    *out = (struct nix_buffer *)b;
 
-        goto no_bom;
+    EXCEPT(err)
+    nix_buffer__free((struct nix_buffer **)&b);
+    return err;
+}
+
+void
+nix_buffer__release(struct nix_buffer **out) {
+    if (*out == NULL) return;
+
+    struct buffer *b = (struct buffer *)*out;
+    struct buffer_free_list *list = __buffer_free_list();
+
+    if (list == NULL || list->count >= BUFFER_FREE_LIST_MAX || b->mem) {
+        nix_buffer__free(out);
+        return;
     }
 
-    // Detect the EFBBBF byte-order mark for a UTF-8 document
-    if (c == u'\xEF') {
-        TRY(__read_bom_byte(input, &c));
+    // The input belongs to the caller, who may close it as soon as this
+    // returns
+    __buffer_stop(b);
+    b->input = NULL;
+    b->fd = -1;
 
-        if (c == u'\xBB') {
-            TRY(__read_bom_byte(input, &c));
+    b->next_free = list->head;
+    list->head = b;
+    list->count++;
 
-            if (c == u'\xBF') {
-                *is_utf16 = false;
-                *reverse_order = false;
-                return NIXERR_NONE;
-            }
-        }
+    *out = NULL;
+}
+
+void
+nix_buffer__trim(void) {
+    struct buffer_free_list *list = __buffer_free_list();
+    if (list == NULL) return;
+
+    while (list->head != NULL) {
+        struct buffer *b = list->head;
+        list->head = b->next_free;
+        nix_buffer__free((struct nix_buffer **)&b);
     }
 
-    goto no_bom;
+    list->count = 0;
+}
 
-    EXCEPT(err)
-    CATCH(NIXERR_BUF_EOF) {
-        goto no_bom;
-    } else {
-        return err;
+// The calling thread's free list, made the first time it's needed. NULL if
+// it can't be made, in which case buffers are simply freed.
+struct buffer_free_list *
+__buffer_free_list(void) {
+    pthread_once(&__buffer_free_once, &__buffer_free_key_create);
+    if (!__buffer_free_ready) {
+        return NULL;
     }
 
-no_bom:
-    *is_utf16 = false;
-    *reverse_order = false;
-    fseek(input, 0, SEEK_SET);
+    struct buffer_free_list *list = pthread_getspecific(__buffer_free_key);
+    if (list != NULL) {
+        return list;
+    }
 
-    return NIXERR_NONE;
-}
+    list = malloc(sizeof(struct buffer_free_list));
+    if (list == NULL) {
+        return NULL;
+    }
 
-static inline enum nix_err
-__read_bom_byte(FILE *input, uint8_t *out) {
-    size_t read = fread(out, sizeof(uint8_t), 1, input);
-    if (read != 1) {
-        if (feof(input)) {
-            return NIXERR_BUF_EOF;
-        } else {
-            return NIXERR_BUF_FILE;
-        }
+    list->head = NULL;
+    list->count = 0;
+
+    if (pthread_setspecific(__buffer_free_key, list) != 0) {
+        free(list);
+        return NULL;
     }
 
-    return NIXERR_NONE;
+    return list;
 }
 
-enum nix_err
-nix_buffer__construct(struct nix_buffer **out, FILE *in, size_t buffer_size) {
-    struct buffer *b = 0;
-    ALLOC(b, sizeof(struct buffer));
+void
+__buffer_free_list_free(void *arg) {
+    struct buffer_free_list *list = arg;
 
-    TRY(nix_buffer__init((struct nix_buffer *)b, in, buffer_size));
-    *out = (struct nix_buffer *)b;
-    
-    EXCEPT(err)
-    CATCH(NIXERR_NOMEMORY)
+    while (list->head != NULL) {
+        struct buffer *b = list->head;
+        list->head = b->next_free;
         nix_buffer__free((struct nix_buffer **)&b);
+    }
 
-    return err;
+    free(list);
 }
 
 enum nix_err
@@ -158,6 +1073,12 @@ nix_buffer__read(struct nix_buffer *buf, uint32_t *out) {
     struct nix_position original_position;
     TRY(nix_position__copy(&original_position, b->p.read));
 
+    // Skipping a byte-order mark isn't undone if the read is
+    if (!b->sniffed) {
+        TRY(__buffer_sniff(b));
+        original_ptr = b->read;
+    }
+
     TRY(__read(b, out, &b->read, b->p.read, b->last_read, true));
 
     b->last_read = *out;
@@ -165,7 +1086,7 @@ nix_buffer__read(struct nix_buffer *buf, uint32_t *out) {
     TRY(nix_buffer__reset_peek(buf));
 
     EXCEPT(err)
-    CATCH(NIXERR_BUF_EXHAUST) {
+    if (err == NIXERR_BUF_EXHAUST || err == NIXERR_BUF_WOULDBLOCK) {
         b->read = original_ptr;
         nix_position__copy(b->p.read, &original_position);
     }
@@ -182,11 +1103,17 @@ nix_buffer__peek(struct nix_buffer *buf, uint32_t *out) {
     struct nix_position original_position;
     TRY(nix_position__copy(&original_position, b->p.peek));
 
+    // Skipping a byte-order mark isn't undone if the read is
+    if (!b->sniffed) {
+        TRY(__buffer_sniff(b));
+        original_ptr = b->peek;
+    }
+
     TRY(__read(b, out, &b->peek, b->p.peek, b->last_peek, true));
     b->last_peek = *out;
 
     EXCEPT(err)
-    CATCH(NIXERR_BUF_EXHAUST) {
+    if (err == NIXERR_BUF_EXHAUST || err == NIXERR_BUF_WOULDBLOCK) {
         b->peek = original_ptr;
         nix_position__copy(b->p.peek, &original_position);
     }
@@ -244,6 +1171,10 @@ __check_bounds(struct buffer *b, uint8_t **ptr) {
         other_side = BUFFER_LEFT;
     }
 
+    if (*ptr == b->fill) {
+        TRY(__feed_top_up(b));
+    }
+
     if (*ptr == b->eof) {
         if (b->at_eof) {
             return NIXERR_BUF_PAST_EOF;
@@ -414,6 +1345,7 @@ nix_buffer__reset_peek(struct nix_buffer *buf) {
     }
 
     b->peek = b->read;
+    b->last_peek = b->last_read;
     b->p.peek->row = b->p.read->row;
     b->p.peek->col = b->p.read->col;
     b->p.peek->abs = b->p.read->abs;
@@ -421,6 +1353,25 @@ nix_buffer__reset_peek(struct nix_buffer *buf) {
     return NIXERR_NONE;
 }
 
+enum nix_err
+nix_buffer__commit_peek(struct nix_buffer *buf) {
+    struct buffer *b = (struct buffer *)buf;
+
+    if (b == NULL || b->peek == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    // Everything peeked so far becomes read, as if each character had been
+    // passed to nix_buffer__read
+    b->read = b->peek;
+    b->last_read = b->last_peek;
+    b->p.read->row = b->p.peek->row;
+    b->p.read->col = b->p.peek->col;
+    b->p.read->abs = b->p.peek->abs;
+
+    return NIXERR_NONE;
+}
+
 static inline enum nix_err
 __buffer_side(struct buffer *b, enum buffer_side *out, uint8_t *ptr) {
     if (ptr >= b->left && ptr < b->right) {
@@ -440,6 +1391,32 @@ __at_end(struct buffer *b, uint8_t *ptr) {
     return ptr == b->left + offset || ptr == b->right + offset;
 }
 
+// Give the prefetch thread or the ring back the half every position has
+// left, so it can read ahead into it while the other half is decoded
+static inline void
+__buffer_vacate(struct buffer *b) {
+    size_t oldest;
+    if (b->prefetch != NULL && __prefetch_holding(b->prefetch)) {
+        oldest = __prefetch_oldest(b->prefetch);
+    } else if (b->uring != NULL && __uring_reader_holding(b->uring)) {
+        oldest = __uring_reader_oldest(b->uring);
+    } else {
+        return;
+    }
+
+    bool occupied;
+    __buffer_occupied(b, &occupied, (enum buffer_side)oldest);
+    if (occupied) {
+        return;
+    }
+
+    if (b->prefetch != NULL) {
+        __prefetch_release(b->prefetch);
+    } else {
+        __uring_reader_release(b->uring);
+    }
+}
+
 enum nix_err
 __load_buffer(struct buffer *b, enum buffer_side side) {
     bool buf_exhausted;
@@ -455,16 +1432,33 @@ __load_buffer(struct buffer *b, enum buffer_side side) {
         target = b->right;
     }
     
-    size_t i_size = sizeof(uint8_t);
     size_t count = b->p.buffer_size;
-    size_t result = fread(target, i_size, count, b->input);
+    size_t result;
+
+    if (b->feed) {
+        result = __feed_take(b, target, count);
+    } else if (b->uring != NULL) {
+        // Both read straight into the half, so there's nothing to copy
+        __buffer_vacate(b);
+        TRY(__uring_reader_take(b->uring, &result));
+    } else if (b->prefetch != NULL) {
+        __buffer_vacate(b);
+        TRY(__prefetch_take(b->prefetch, &result));
+    } else if (b->fd >= 0) {
+        TRY(__read_fd(b, target, count, &result));
+    } else {
+        TRY(__read_source(b, target, count, &result));
+    }
 
-    if (result != count * i_size) {
-        if (ferror(b->input) || !feof(b->input)) {
-            return NIXERR_BUF_FILE;
-        } else {
-            b->eof = target + result;
-        }
+    if (result != count && b->feed && !b->finished) {
+        b->fill = target + result;
+    } else if (result != count) {
+        b->eof = target + result;
+    }
+
+    // Each byte is loaded exactly once, so hashing here costs no extra pass
+    if (b->hasher != NULL) {
+        nix_hasher__update(b->hasher, target, result);
     }
 
     enum buffer_side other_side = BUFFER_LEFT;
@@ -533,6 +1527,7 @@ nix_buffer__get_lexeme(
 
     b->lexeme = new_ptr;
     TRY(nix_position__copy(b->p.lexeme, lexeme->end));
+    __buffer_vacate(b);
 
     *out = lexeme;
 
@@ -567,7 +1562,9 @@ nix_buffer__discard_lexeme(struct nix_buffer *buf, size_t exclude) {
 
     if (exclude == 0) {
         b->lexeme = b->read;
+        b->last_lexeme = b->last_read;
         TRY(nix_position__copy(b->p.lexeme, b->p.read));
+        __buffer_vacate(b);
 
         return NIXERR_NONE;
     }
@@ -579,6 +1576,7 @@ nix_buffer__discard_lexeme(struct nix_buffer *buf, size_t exclude) {
 
     b->lexeme = new_ptr;
     TRY(nix_position__copy(b->p.lexeme, lexeme->end));
+    __buffer_vacate(b);
 
     nix_lexeme__free(&lexeme);
 
@@ -594,6 +1592,16 @@ __get_lexeme(
         uint8_t **new_ptr,
         size_t exclude)
 {
+    size_t length;
+    TRY(__lexeme_length(b, &length, exclude));
+    TRY(__read_lexeme(b, out, new_ptr, length));
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__lexeme_length(struct buffer *b, size_t *out, size_t exclude) {
     if (b == NULL || b->lexeme == NULL || b->read == NULL) {
         return NIXERR_BUF_INVPTR;
     }
@@ -602,27 +1610,13 @@ __get_lexeme(
         return NIXERR_BUF_INVLEN;
     }
 
-    uint8_t *buffer_end = b->right + b->p.buffer_size;
-    size_t byte_length;
-
-    if (b->read > b->lexeme) {
-        size_t byte_start_length = buffer_end - b->lexeme;
-        size_t byte_end_length = b->read - b->left;
-        byte_length = byte_start_length + byte_end_length;
-    } else {
-        byte_length = b->read - b->lexeme;
-    }
-
     size_t length = b->p.read->abs - b->p.lexeme->abs;
     if (exclude >= length) {
         return NIXERR_BUF_INVLEN;
     }
 
-    length -= exclude;
-    TRY(__read_lexeme(b, out, new_ptr, length));
-
-    EXCEPT(err)
-    return err;
+    *out = length - exclude;
+    return NIXERR_NONE;
 }
 
 enum nix_err
@@ -664,16 +1658,105 @@ __read_lexeme(
     return err;
 }
 
+enum nix_err
+nix_buffer__intern_lexeme(
+    struct nix_buffer *buf,
+    struct nix_intern *intern,
+    uint32_t *out,
+    size_t exclude)
+{
+    struct buffer *b = (struct buffer *)buf;
+
+    uint8_t scratch[LEXEME_SCRATCH_SIZE * UTF8_MAX_BYTES];
+    uint8_t *text = scratch;
+    uint8_t *new_ptr = NULL;
+    struct nix_position end;
+    size_t length;
+    size_t size;
+
+    TRY(__lexeme_length(b, &length, exclude));
+
+    // The text goes straight from the buffer into the intern table as UTF-8,
+    // without building a lexeme
+    if (length > LEXEME_SCRATCH_SIZE) {
+        ALLOC(text, length * UTF8_MAX_BYTES);
+    }
+
+    TRY(__encode_lexeme(b, text, &size, &new_ptr, &end, length));
+    TRY(nix_intern__intern(intern, (const char *)text, size, out));
+
+    b->lexeme = new_ptr;
+    TRY(nix_position__copy(b->p.lexeme, &end));
+    __buffer_vacate(b);
+
+    if (text != scratch) {
+        free(text);
+    }
+
+    EXCEPT(err)
+    if (text != scratch) {
+        FREE(text);
+    }
+
+    return err;
+}
+
+enum nix_err
+__encode_lexeme(
+        struct buffer *b,
+        uint8_t *out,
+        size_t *size,
+        uint8_t **new_ptr,
+        struct nix_position *end,
+        size_t length)
+{
+    TRY(nix_position__copy(end, b->p.lexeme));
+
+    *new_ptr = b->lexeme;
+    *size = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        uint32_t c;
+        TRY(__read(b, &c, new_ptr, end, b->last_lexeme, false));
+        b->last_lexeme = c;
+
+        *size += __utf8_encode(c, out + *size);
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_buffer__content_hash(struct nix_buffer *buf, struct nix_digest *out) {
+    struct buffer *b = (struct buffer *)buf;
+
+    if (b->hasher == NULL || b->eof == NULL) {
+        return NIXERR_BUF_INCOMPLETE;
+    }
+
+    nix_hasher__final(b->hasher, out);
+
+    return NIXERR_NONE;
+}
+
 void
 nix_buffer__free(struct nix_buffer **out) {
     if (*out == NULL) return;
 
     struct buffer *b = (struct buffer *)*out;
 
-    FREE(b->buffer);
+    __buffer_stop(b);
+
+    if (!b->borrowed) {
+        FREE(b->buffer);
+    }
+
+    FREE(b->pending);
     FREE(b->p.lexeme);
     FREE(b->p.read);
     FREE(b->p.peek);
+    nix_hasher__free(&b->hasher);
     FREE(b);
 
     *out = NULL;
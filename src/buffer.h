@@ -5,13 +5,57 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 #include "libnix/buffer.h"
+#include "libnix/source.h"
+#include "prefetch.h"
+#include "uring.h"
 
 struct buffer {
     struct nix_buffer p;
 
+    // Reading the caller's memory as one half which is never reloaded, and
+    // not freeing it if it wasn't copied
+    bool mem;
+    bool borrowed;
+
+    // Read from unless another way of reading the input is in use, with
+    // what's left of the block it last lent
+    struct nix_source source;
+    const uint8_t *block;
+    size_t block_length;
+
+    // Fed by the caller, with what's been fed but not yet loaded. Loading
+    // stops at the fill pointer until more is fed or the input is finished,
+    // and the byte-order mark waits to be sniffed until there's enough.
+    bool feed;
+    bool finished;
+    bool sniffed;
+    uint8_t *fill;
+    uint8_t *pending;
+    size_t pending_start;
+    size_t pending_size;
+    size_t pending_capacity;
+
+    // The file behind the source, if it has one, for the ways of reading
+    // ahead which need it
     FILE *input;
+
+    // Read from instead of the file when it's not negative. Reads are at
+    // the offset, unless the descriptor can't seek.
+    int fd;
+    off_t fd_offset;
+    bool fd_seekable;
+    bool fd_direct;
+
+    // Up to where the cache has been told the input won't be read again
+    off_t fd_dropped;
+
+    // The descriptor's flags before they were changed for reading direct
+    int fd_status;
+    bool fd_restore;
+
     bool utf16;
     bool reverse_order;
 
@@ -33,6 +77,28 @@ struct buffer {
     uint32_t last_peek;
 
     bool buffer_ready[2];
+
+    // Hashes each block as it's loaded, when asked for
+    struct nix_hasher *hasher;
+
+    // Reads the input ahead, when asked for
+    struct prefetch *prefetch;
+    struct uring_reader *uring;
+
+    // The next buffer kept for reuse by the same thread
+    struct buffer *next_free;
+};
+
+// Input read without being reused is dropped from the cache in pieces of
+// at least this size
+#define BUFFER_DROP_SIZE (1 << 20)
+
+// Released buffers each thread keeps for reuse, beyond which they're freed
+#define BUFFER_FREE_LIST_MAX 16
+
+struct buffer_free_list {
+    struct buffer *head;
+    size_t count;
 };
 
 enum buffer_side {
@@ -40,11 +106,66 @@ enum buffer_side {
     BUFFER_RIGHT = 1
 };
 
-static inline enum nix_err
-__read_bom(FILE *, bool *, bool *);
+enum nix_err
+__buffer_setup(struct buffer *, size_t, unsigned int);
 
-static inline enum nix_err
-__read_bom_byte(FILE *, uint8_t *);
+enum nix_err
+__buffer_alloc(struct buffer *, size_t);
+
+enum nix_err
+__buffer_start(struct buffer *, FILE *);
+
+enum nix_err
+__buffer_start_fd(struct buffer *, int);
+
+enum nix_err
+__buffer_start_source(
+    struct buffer *,
+    const struct nix_source *,
+    const uint8_t *,
+    size_t);
+
+enum nix_err
+__buffer_start_mem(struct buffer *, const uint8_t *, size_t, bool);
+
+enum nix_err
+__buffer_start_feed(struct buffer *);
+
+void
+__buffer_stop(struct buffer *);
+
+enum nix_err
+__buffer_begin(struct buffer *);
+
+enum nix_err
+__buffer_sniff(struct buffer *);
+
+size_t
+__feed_take(struct buffer *, uint8_t *, size_t);
+
+enum nix_err
+__feed_top_up(struct buffer *);
+
+void
+__buffer_open_fd(struct buffer *);
+
+enum nix_err
+__read_fd(struct buffer *, uint8_t *, size_t, size_t *);
+
+enum nix_err
+__read_source(struct buffer *, uint8_t *, size_t, size_t *);
+
+void
+__buffer_cached_fd(struct buffer *);
+
+void
+__buffer_drop_fd(struct buffer *, bool);
+
+struct buffer_free_list *
+__buffer_free_list(void);
+
+void
+__buffer_free_list_free(void *);
 
 static inline enum nix_err
 __ensure_ptrs_initialized(struct buffer *);
@@ -97,4 +218,16 @@ __get_lexeme(struct buffer *, struct nix_lexeme **, uint8_t **, size_t);
 enum nix_err
 __read_lexeme(struct buffer *, struct nix_lexeme **, uint8_t **, size_t);
 
+enum nix_err
+__lexeme_length(struct buffer *, size_t *, size_t);
+
+enum nix_err
+__encode_lexeme(
+    struct buffer *,
+    uint8_t *,
+    size_t *,
+    uint8_t **,
+    struct nix_position *,
+    size_t);
+
 #endif
@@ -0,0 +1,34 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "char.h"
+#include "char_tables.h"
+
+// Every lookup is two dependent loads: the block for the high bits of the
+// code point, then the property byte within that block. The tables are
+// regenerated with `make tables`.
+uint8_t
+__char_props(uint32_t c) {
+    if (c > CHAR_MAX_CODE_POINT) {
+        return 0;
+    }
+
+    uint32_t block = char_table_blocks[c >> CHAR_TABLE_SHIFT];
+    return char_table_props[(block << CHAR_TABLE_SHIFT) |
+        (c & CHAR_TABLE_MASK)];
+}
+
+bool
+nix_char__is_ident_start(uint32_t c) {
+    return (__char_props(c) & CHAR_PROP_ID_START) != 0;
+}
+
+bool
+nix_char__is_ident_continue(uint32_t c) {
+    return (__char_props(c) & CHAR_PROP_ID_CONTINUE) != 0;
+}
+
+bool
+nix_char__is_whitespace(uint32_t c) {
+    return (__char_props(c) & CHAR_PROP_WHITESPACE) != 0;
+}
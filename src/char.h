@@ -0,0 +1,18 @@
+#ifndef INCLUDE_char_h__
+#define INCLUDE_char_h__
+
+#include <stdint.h>
+
+#include "libnix/char.h"
+
+// Property bits stored for each code point in the generated tables
+#define CHAR_PROP_ID_START (1 << 0)
+#define CHAR_PROP_ID_CONTINUE (1 << 1)
+#define CHAR_PROP_WHITESPACE (1 << 2)
+
+#define CHAR_MAX_CODE_POINT 0x10FFFF
+
+uint8_t
+__char_props(uint32_t);
+
+#endif
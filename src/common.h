@@ -10,6 +10,18 @@
    __nix_local_err = NIXERR_NOMEMORY; \
    goto except; }
 
+// Grow an array to hold at least needed items, doubling it or starting it at
+// initial
+#define GROW(array, capacity, needed, initial) if ((needed) > (capacity)) { \
+   size_t __nix_grown = (capacity) > 0 ? (capacity) * 2 : (initial); \
+   if (__nix_grown < (needed)) __nix_grown = (needed); \
+   void *__nix_resized = realloc(array, __nix_grown * sizeof(*(array))); \
+   if (__nix_resized == NULL) { \
+      __nix_local_err = NIXERR_NOMEMORY; \
+      goto except; } \
+   array = __nix_resized; \
+   capacity = __nix_grown; }
+
 #define FREE(ptr) if (ptr != NULL) free(ptr);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,635 @@
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cst.h"
+#include "common.h"
+#include "error.h"
+#include "hash.h"
+#include "lexer.h"
+#include "utf8.h"
+
+enum nix_err
+nix_green_cache__init(struct nix_green_cache *out) {
+    struct green_cache *cache = (struct green_cache *)out;
+    memset(cache, 0, sizeof(struct green_cache));
+
+    ALLOC(cache->slots, sizeof(struct cst_slot) * CST_INITIAL_CAPACITY);
+    memset(cache->slots, 0, sizeof(struct cst_slot) * CST_INITIAL_CAPACITY);
+    cache->capacity = CST_INITIAL_CAPACITY;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_green_cache__construct(struct nix_green_cache **out) {
+    struct green_cache *cache = NULL;
+    ALLOC(cache, sizeof(struct green_cache));
+    memset(cache, 0, sizeof(struct green_cache));
+
+    TRY(nix_green_cache__init((struct nix_green_cache *)cache));
+    *out = (struct nix_green_cache *)cache;
+
+    EXCEPT(err)
+    nix_green_cache__free((struct nix_green_cache **)&cache);
+    return err;
+}
+
+// Nodes live until the cache is freed, all at once
+void
+nix_green_cache__free(struct nix_green_cache **out) {
+    if (*out == NULL) return;
+
+    struct green_cache *cache = (struct green_cache *)*out;
+    FREE(cache->slots);
+
+    struct cst_chunk *chunk = cache->chunks;
+    while (chunk != NULL) {
+        struct cst_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    FREE(cache);
+
+    *out = NULL;
+}
+
+static enum nix_err
+__cst_rehash(struct green_cache *cache) {
+    size_t capacity = cache->capacity * 2;
+    size_t mask = capacity - 1;
+    struct cst_slot *slots = NULL;
+
+    ALLOC(slots, sizeof(struct cst_slot) * capacity);
+    memset(slots, 0, sizeof(struct cst_slot) * capacity);
+
+    for (size_t i = 0; i < cache->capacity; i++) {
+        struct cst_slot *slot = &cache->slots[i];
+        if (slot->green == NULL) {
+            continue;
+        }
+
+        size_t j = slot->hash & mask;
+        while (slots[j].green != NULL) {
+            j = (j + 1) & mask;
+        }
+
+        slots[j] = *slot;
+    }
+
+    free(cache->slots);
+    cache->slots = slots;
+    cache->capacity = capacity;
+
+    EXCEPT(err)
+    return err;
+}
+
+// Return the stored node equal to key followed by data, storing a copy if
+// there is none yet
+enum nix_err
+__cst_store(
+    struct green_cache *cache,
+    const struct nix_green *key,
+    const void *data,
+    size_t size,
+    const struct nix_green **out)
+{
+    // Probing stops at the first empty slot, and the cache is grown whenever
+    // it passes half full so there always is one
+    size_t mask = cache->capacity - 1;
+    size_t i = key->hash & mask;
+
+    while (cache->slots[i].green != NULL) {
+        struct cst_slot *slot = &cache->slots[i];
+
+        if (slot->hash == (uint32_t)key->hash &&
+                __cst_equal(slot->green, key, data, size)) {
+            cache->p.hits++;
+            *out = slot->green;
+            return NIXERR_NONE;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    // Keep every node aligned for the child pointers which may follow it
+    size_t total = sizeof(struct nix_green) + size;
+    total = (total + alignof(struct nix_green) - 1) &
+        ~(alignof(struct nix_green) - 1);
+
+    if (total > cache->arena_left) {
+        size_t chunk_size = CST_CHUNK_SIZE;
+        if (total > chunk_size) {
+            chunk_size = total;
+        }
+
+        struct cst_chunk *chunk = NULL;
+        ALLOC(chunk, sizeof(struct cst_chunk) + chunk_size);
+
+        chunk->next = cache->chunks;
+        cache->chunks = chunk;
+        cache->arena = chunk->data;
+        cache->arena_left = chunk_size;
+    }
+
+    struct nix_green *green = (struct nix_green *)cache->arena;
+    *green = *key;
+    if (size > 0) {
+        memcpy(green + 1, data, size);
+    }
+
+    cache->arena += total;
+    cache->arena_left -= total;
+
+    cache->slots[i].hash = (uint32_t)key->hash;
+    cache->slots[i].green = green;
+
+    cache->p.count++;
+    cache->p.size += total;
+
+    if (cache->p.count * 2 > cache->capacity) {
+        TRY(__cst_rehash(cache));
+    }
+
+    *out = green;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_green__token(
+    struct nix_green_cache *cache,
+    enum nix_token_kind kind,
+    const char *text,
+    size_t size,
+    const struct nix_green **out)
+{
+    if (size >= UINT32_MAX) {
+        return NIXERR_BUF_INVLEN;
+    }
+
+    struct nix_green key = {
+        .kind = (uint8_t)kind,
+        .width = 0,
+        .size = (uint32_t)size,
+        .count = 0,
+        .hash = __hash_word(__hash_bytes((const uint8_t *)text, size), kind)
+    };
+
+    // Every byte but a continuation byte starts a code point
+    for (size_t i = 0; i < size; i++) {
+        key.width += ((uint8_t)text[i] & 0xC0) != 0x80;
+    }
+
+    // Stored with the text NUL-terminated, which compares the same
+    char scratch[CST_INITIAL_TEXT];
+    char *data = scratch;
+
+    if (size + 1 > sizeof(scratch)) {
+        ALLOC(data, size + 1);
+    }
+
+    memcpy(data, text, size);
+    data[size] = '\0';
+
+    TRY(__cst_store((struct green_cache *)cache, &key, data, size + 1, out));
+
+    if (data != scratch) {
+        free(data);
+    }
+
+    EXCEPT(err)
+    if (data != scratch) {
+        FREE(data);
+    }
+
+    return err;
+}
+
+enum nix_err
+nix_green__node(
+    struct nix_green_cache *cache,
+    enum nix_cst_kind kind,
+    const struct nix_green *const *children,
+    size_t count,
+    const struct nix_green **out)
+{
+    struct nix_green key = {
+        .kind = (uint8_t)kind,
+        .width = 0,
+        .size = 0,
+        .count = (uint32_t)count,
+        .hash = HASH_SEED ^ kind
+    };
+
+    // Children are already unique, so their addresses identify them
+    uint64_t width = 0, size = 0;
+    for (size_t i = 0; i < count; i++) {
+        width += children[i]->width;
+        size += children[i]->size;
+        key.hash = __hash_word(key.hash, (uint64_t)(uintptr_t)children[i]);
+    }
+
+    if (size >= UINT32_MAX || count >= UINT32_MAX) {
+        return NIXERR_BUF_INVLEN;
+    }
+
+    key.width = (uint32_t)width;
+    key.size = (uint32_t)size;
+    key.hash = __hash_mix(key.hash);
+
+    return __cst_store((struct green_cache *)cache, &key, children,
+        sizeof(struct nix_green *) * count, out);
+}
+
+bool
+nix_green__is_token(const struct nix_green *green) {
+    return green->kind < NIX_TOKEN_KIND_COUNT;
+}
+
+const char *
+nix_green__text(const struct nix_green *green) {
+    return (const char *)__cst_data(green);
+}
+
+const struct nix_green *const *
+nix_green__children(const struct nix_green *green) {
+    return (const struct nix_green *const *)__cst_data(green);
+}
+
+static void
+__cst_write(const struct nix_green *green, char *out) {
+    if (nix_green__is_token(green)) {
+        memcpy(out, nix_green__text(green), green->size);
+        return;
+    }
+
+    const struct nix_green *const *children = nix_green__children(green);
+    for (uint32_t i = 0; i < green->count; i++) {
+        __cst_write(children[i], out);
+        out += children[i]->size;
+    }
+}
+
+enum nix_err
+nix_green__write(
+    const struct nix_green *green,
+    char *out,
+    size_t size,
+    size_t *length)
+{
+    if (size < (size_t)green->size + 1) {
+        return NIXERR_BUF_INVLEN;
+    }
+
+    __cst_write(green, out);
+    out[green->size] = '\0';
+
+    if (length != NULL) {
+        *length = green->size;
+    }
+
+    return NIXERR_NONE;
+}
+
+const char *
+nix_cst__kind_name(unsigned int kind) {
+    static const char *names[NIX_CST_KIND_COUNT - NIX_CST_ROOT] = {
+        [NIX_CST_ROOT - NIX_CST_ROOT] = "ROOT",
+        [NIX_CST_PAREN - NIX_CST_ROOT] = "PAREN",
+        [NIX_CST_BRACE - NIX_CST_ROOT] = "BRACE",
+        [NIX_CST_BRACKET - NIX_CST_ROOT] = "BRACKET",
+        [NIX_CST_STRING - NIX_CST_ROOT] = "STRING",
+        [NIX_CST_IND_STRING - NIX_CST_ROOT] = "IND_STRING",
+        [NIX_CST_INTERPOLATION - NIX_CST_ROOT] = "INTERPOLATION",
+        [NIX_CST_PATH - NIX_CST_ROOT] = "PATH",
+        [NIX_CST_LET - NIX_CST_ROOT] = "LET",
+        [NIX_CST_STATEMENT - NIX_CST_ROOT] = "STATEMENT"
+    };
+
+    if (kind < NIX_TOKEN_KIND_COUNT) {
+        return nix_token__name((enum nix_token_kind)kind);
+    }
+
+    if (kind >= NIX_CST_KIND_COUNT) {
+        return "UNKNOWN";
+    }
+
+    return names[kind - NIX_CST_ROOT];
+}
+
+enum nix_err
+__cst_push(struct cst_builder *b, const struct nix_green *green) {
+    GROW(b->stack, b->stack_capacity, b->stack_size + 1, CST_INITIAL_STACK);
+
+    b->stack[b->stack_size++] = green;
+
+    EXCEPT(err)
+    return err;
+}
+
+// Strings hold text rather than statements
+static inline bool
+__cst_has_statements(enum nix_cst_kind kind) {
+    return kind != NIX_CST_STRING && kind != NIX_CST_IND_STRING;
+}
+
+// Note that a statement starts at the next child of the innermost node,
+// unless one is already in progress
+static inline void
+__cst_begin_statement(struct cst_builder *b) {
+    struct cst_frame *frame = &b->frames[b->frame_count - 1];
+
+    if (frame->statement == SIZE_MAX && __cst_has_statements(frame->kind)) {
+        frame->statement = b->stack_size;
+    }
+}
+
+enum nix_err
+__cst_open(struct cst_builder *b, enum nix_cst_kind kind) {
+    GROW(b->frames, b->frame_capacity, b->frame_count + 1,
+        CST_INITIAL_STACK);
+
+    struct cst_frame *frame = &b->frames[b->frame_count++];
+    frame->kind = (uint8_t)kind;
+    frame->base = b->stack_size;
+    frame->statement = SIZE_MAX;
+
+    EXCEPT(err)
+    return err;
+}
+
+// Replace the children of the innermost node with the node itself
+enum nix_err
+__cst_close(struct cst_builder *b) {
+    struct cst_frame *frame = &b->frames[b->frame_count - 1];
+    const struct nix_green *green;
+
+    TRY(nix_green__node((struct nix_green_cache *)b->cache,
+        (enum nix_cst_kind)frame->kind, b->stack + frame->base,
+        b->stack_size - frame->base, &green));
+
+    b->stack_size = frame->base;
+    b->frame_count--;
+
+    TRY(__cst_push(b, green));
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__cst_close_statement(struct cst_builder *b) {
+    struct cst_frame *frame = &b->frames[b->frame_count - 1];
+    const struct nix_green *green;
+
+    TRY(nix_green__node((struct nix_green_cache *)b->cache,
+        NIX_CST_STATEMENT, b->stack + frame->statement,
+        b->stack_size - frame->statement, &green));
+
+    b->stack_size = frame->statement;
+    frame->statement = SIZE_MAX;
+
+    TRY(__cst_push(b, green));
+
+    EXCEPT(err)
+    return err;
+}
+
+// Add the pending token to the tree, opening or closing nodes around it
+enum nix_err
+__cst_flush(struct cst_builder *b) {
+    enum nix_token_kind kind = b->pending;
+    const struct nix_green *green;
+
+    if (kind == NIX_TOKEN_EOF) {
+        return NIXERR_NONE;
+    }
+
+    TRY(nix_green__token((struct nix_green_cache *)b->cache, kind,
+        b->text, b->text_size, &green));
+
+    b->pending = NIX_TOKEN_EOF;
+    b->text_size = 0;
+
+    if (nix_token__is_trivia(kind)) {
+        TRY(__cst_push(b, green));
+        return NIXERR_NONE;
+    }
+
+    // A closing delimiter ends the innermost node it matches, along with
+    // any unclosed ones inside that; with no match it's an ordinary token
+    for (size_t i = b->frame_count - 1; i > 0; i--) {
+        if (!__cst_closes(kind, (enum nix_cst_kind)b->frames[i].kind)) {
+            continue;
+        }
+
+        while (b->frame_count - 1 > i) {
+            TRY(__cst_close(b));
+        }
+
+        TRY(__cst_push(b, green));
+        TRY(__cst_close(b));
+        return NIXERR_NONE;
+    }
+
+    __cst_begin_statement(b);
+
+    enum nix_cst_kind opens = __cst_opens(kind);
+    if (opens != 0) {
+        TRY(__cst_open(b, opens));
+        TRY(__cst_push(b, green));
+        return NIXERR_NONE;
+    }
+
+    TRY(__cst_push(b, green));
+
+    struct cst_frame *frame = &b->frames[b->frame_count - 1];
+    if (kind == NIX_TOKEN_SEMICOLON && frame->statement != SIZE_MAX) {
+        TRY(__cst_close_statement(b));
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+// Take the current token's text, joining it to the pending token if the
+// lexer only split one token in two
+enum nix_err
+__cst_append(
+    struct cst_builder *b,
+    struct nix_buffer *buf,
+    enum nix_token_kind kind)
+{
+    struct nix_lexeme *lexeme = NULL;
+
+    if (kind != b->pending || !__lexer_is_splittable(kind)) {
+        TRY(__cst_flush(b));
+    }
+
+    b->pending = kind;
+
+    // The end of a path is empty, so has no lexeme to take
+    if (kind == NIX_TOKEN_PATH_END) {
+        return NIXERR_NONE;
+    }
+
+    TRY(nix_buffer__get_lexeme(buf, &lexeme, 0));
+
+    size_t n = lexeme->end->abs - lexeme->start->abs;
+    GROW(b->text, b->text_capacity, b->text_size + n * UTF8_MAX_BYTES,
+        CST_INITIAL_TEXT);
+
+    for (size_t i = 0; i < n; i++) {
+        b->text_size += __utf8_encode(lexeme->text[i],
+            (uint8_t *)b->text + b->text_size);
+    }
+
+    nix_lexeme__free(&lexeme);
+
+    EXCEPT(err)
+    nix_lexeme__free(&lexeme);
+    return err;
+}
+
+enum nix_err
+nix_cst__parse(
+    struct nix_green_cache *cache,
+    struct nix_buffer *buf,
+    const struct nix_green **out)
+{
+    struct cst_builder b;
+    struct lexer lex;
+    struct nix_token tok;
+
+    if (cache == NULL || buf == NULL || out == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    memset(&b, 0, sizeof(struct cst_builder));
+    b.cache = (struct green_cache *)cache;
+    b.pending = NIX_TOKEN_EOF;
+
+    TRY(nix_lexer__init((struct nix_lexer *)&lex, buf));
+    TRY(__cst_open(&b, NIX_CST_ROOT));
+
+    for (;;) {
+        TRY(nix_lexer__next((struct nix_lexer *)&lex, &tok));
+        if (tok.kind == NIX_TOKEN_EOF) {
+            break;
+        }
+
+        TRY(__cst_append(&b, buf, tok.kind));
+    }
+
+    TRY(__cst_flush(&b));
+    while (b.frame_count > 0) {
+        TRY(__cst_close(&b));
+    }
+
+    *out = b.stack[0];
+
+    FREE(b.stack);
+    FREE(b.frames);
+    FREE(b.text);
+
+    EXCEPT(err)
+    FREE(b.stack);
+    FREE(b.frames);
+    FREE(b.text);
+    return err;
+}
+
+enum nix_err
+nix_cst__path(
+    const struct nix_green *root,
+    uint32_t offset,
+    uint32_t *path,
+    size_t max_depth,
+    size_t *depth)
+{
+    const struct nix_green *green = root;
+    size_t n = 0;
+
+    if (offset > root->width) {
+        return NIXERR_BUF_INVLEN;
+    }
+
+    // An offset at the very end belongs to the last token
+    while (green->count > 0) {
+        const struct nix_green *const *children = nix_green__children(green);
+        uint32_t i = 0;
+
+        while (i + 1 < green->count && offset >= children[i]->width) {
+            offset -= children[i]->width;
+            i++;
+        }
+
+        if (n == max_depth) {
+            return NIXERR_BUF_INVLEN;
+        }
+
+        path[n++] = i;
+        green = children[i];
+    }
+
+    *depth = n;
+
+    return NIXERR_NONE;
+}
+
+enum nix_err
+nix_cst__replace(
+    struct nix_green_cache *cache,
+    const struct nix_green *root,
+    const uint32_t *path,
+    size_t depth,
+    const struct nix_green *replacement,
+    const struct nix_green **out)
+{
+    const struct nix_green **spine = NULL;
+    const struct nix_green **children = NULL;
+    size_t capacity = 0;
+
+    ALLOC(spine, sizeof(struct nix_green *) * (depth + 1));
+
+    spine[0] = root;
+    for (size_t i = 0; i < depth; i++) {
+        if (path[i] >= spine[i]->count) {
+            TRY(NIXERR_BUF_INVLEN);
+        }
+
+        spine[i + 1] = nix_green__children(spine[i])[path[i]];
+    }
+
+    // Each parent on the way up is a copy with one child swapped
+    const struct nix_green *green = replacement;
+    for (size_t i = depth; i > 0; i--) {
+        const struct nix_green *parent = spine[i - 1];
+
+        GROW(children, capacity, parent->count, CST_INITIAL_STACK);
+
+        memcpy(children, nix_green__children(parent),
+            sizeof(struct nix_green *) * parent->count);
+        children[path[i - 1]] = green;
+
+        TRY(nix_green__node(cache, (enum nix_cst_kind)parent->kind,
+            children, parent->count, &green));
+    }
+
+    *out = green;
+
+    FREE(spine);
+    FREE(children);
+
+    EXCEPT(err)
+    FREE(spine);
+    FREE(children);
+    return err;
+}
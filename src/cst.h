@@ -0,0 +1,161 @@
+#ifndef INCLUDE_cst_h__
+#define INCLUDE_cst_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnix/cst.h"
+
+#define CST_INITIAL_CAPACITY 256
+#define CST_CHUNK_SIZE 65536
+#define CST_INITIAL_STACK 64
+#define CST_INITIAL_TEXT 256
+
+// Where the hash set finds a node. Slots hold the low bits of the hash too,
+// so most mismatches are skipped without touching the node.
+struct cst_slot {
+    uint32_t hash;
+    struct nix_green *green;
+};
+
+struct cst_chunk {
+    struct cst_chunk *next;
+    _Alignas(struct nix_green) uint8_t data[];
+};
+
+struct green_cache {
+    struct nix_green_cache p;
+
+    struct cst_slot *slots;
+    size_t capacity;
+
+    struct cst_chunk *chunks;
+    uint8_t *arena;
+    size_t arena_left;
+};
+
+// A node whose children are still being collected, from base onwards on
+// the builder's stack
+struct cst_frame {
+    uint8_t kind;
+    size_t base;
+
+    // Where the statement in progress began, or SIZE_MAX between statements
+    size_t statement;
+};
+
+struct cst_builder {
+    struct green_cache *cache;
+
+    const struct nix_green **stack;
+    size_t stack_size;
+    size_t stack_capacity;
+
+    struct cst_frame *frames;
+    size_t frame_count;
+    size_t frame_capacity;
+
+    // The last token lexed, held back in case the lexer split it and the
+    // next token continues it
+    enum nix_token_kind pending;
+    uint32_t pending_width;
+    char *text;
+    size_t text_size;
+    size_t text_capacity;
+};
+
+enum nix_err
+__cst_store(
+    struct green_cache *,
+    const struct nix_green *,
+    const void *,
+    size_t,
+    const struct nix_green **);
+
+enum nix_err
+__cst_push(struct cst_builder *, const struct nix_green *);
+
+enum nix_err
+__cst_open(struct cst_builder *, enum nix_cst_kind);
+
+enum nix_err
+__cst_close(struct cst_builder *);
+
+enum nix_err
+__cst_close_statement(struct cst_builder *);
+
+enum nix_err
+__cst_flush(struct cst_builder *);
+
+enum nix_err
+__cst_append(struct cst_builder *, struct nix_buffer *, enum nix_token_kind);
+
+// The first byte after a node's header, where its children or text start
+static inline const void *
+__cst_data(const struct nix_green *green) {
+    return green + 1;
+}
+
+static inline bool
+__cst_equal(
+    const struct nix_green *green,
+    const struct nix_green *key,
+    const void *data,
+    size_t size)
+{
+    return green->hash == key->hash && green->kind == key->kind &&
+        green->count == key->count && green->size == key->size &&
+        (size == 0 || memcmp(__cst_data(green), data, size) == 0);
+}
+
+// Which kind of node a token opens, or 0 if it doesn't open one
+static inline enum nix_cst_kind
+__cst_opens(enum nix_token_kind kind) {
+    switch (kind) {
+    case NIX_TOKEN_LPAREN:
+        return NIX_CST_PAREN;
+    case NIX_TOKEN_LBRACE:
+        return NIX_CST_BRACE;
+    case NIX_TOKEN_LBRACKET:
+        return NIX_CST_BRACKET;
+    case NIX_TOKEN_STRING_OPEN:
+        return NIX_CST_STRING;
+    case NIX_TOKEN_IND_STRING_OPEN:
+        return NIX_CST_IND_STRING;
+    case NIX_TOKEN_DOLLAR_CURLY:
+        return NIX_CST_INTERPOLATION;
+    case NIX_TOKEN_PATH_START:
+        return NIX_CST_PATH;
+    case NIX_TOKEN_KW_LET:
+        return NIX_CST_LET;
+    default:
+        return 0;
+    }
+}
+
+// Whether a token closes a kind of node
+static inline bool
+__cst_closes(enum nix_token_kind kind, enum nix_cst_kind node) {
+    switch (kind) {
+    case NIX_TOKEN_RPAREN:
+        return node == NIX_CST_PAREN;
+    case NIX_TOKEN_RBRACE:
+        return node == NIX_CST_BRACE || node == NIX_CST_INTERPOLATION;
+    case NIX_TOKEN_RBRACKET:
+        return node == NIX_CST_BRACKET;
+    case NIX_TOKEN_STRING_CLOSE:
+        return node == NIX_CST_STRING;
+    case NIX_TOKEN_IND_STRING_CLOSE:
+        return node == NIX_CST_IND_STRING;
+    case NIX_TOKEN_PATH_END:
+        return node == NIX_CST_PATH;
+    case NIX_TOKEN_KW_IN:
+        return node == NIX_CST_LET;
+    default:
+        return false;
+    }
+}
+
+#endif
@@ -0,0 +1,284 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "digest.h"
+#include "common.h"
+#include "error.h"
+
+// A portable BLAKE3, hashing one chunk at a time. Inputs are split into
+// 1 KiB chunks which form the leaves of a binary tree, and each complete
+// subtree is merged into its parent as soon as its right sibling is done.
+
+static inline void
+__digest_g(
+    uint32_t *s,
+    size_t a,
+    size_t b,
+    size_t c,
+    size_t d,
+    uint32_t x,
+    uint32_t y)
+{
+    s[a] = s[a] + s[b] + x;
+    s[d] = __digest_rotate(s[d] ^ s[a], 16);
+    s[c] = s[c] + s[d];
+    s[b] = __digest_rotate(s[b] ^ s[c], 12);
+    s[a] = s[a] + s[b] + y;
+    s[d] = __digest_rotate(s[d] ^ s[a], 8);
+    s[c] = s[c] + s[d];
+    s[b] = __digest_rotate(s[b] ^ s[c], 7);
+}
+
+void
+__digest_compress(
+    const uint32_t cv[8],
+    const uint8_t block[DIGEST_BLOCK_SIZE],
+    uint64_t counter,
+    uint32_t size,
+    uint32_t flags,
+    uint32_t out[16])
+{
+    uint32_t m[16], permuted[16];
+    for (size_t i = 0; i < 16; i++) {
+        m[i] = __digest_load(block + i * 4);
+    }
+
+    uint32_t s[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        DIGEST_IV[0], DIGEST_IV[1], DIGEST_IV[2], DIGEST_IV[3],
+        (uint32_t)counter, (uint32_t)(counter >> 32), size, flags
+    };
+
+    for (size_t round = 0; round < 7; round++) {
+        __digest_g(s, 0, 4, 8, 12, m[0], m[1]);
+        __digest_g(s, 1, 5, 9, 13, m[2], m[3]);
+        __digest_g(s, 2, 6, 10, 14, m[4], m[5]);
+        __digest_g(s, 3, 7, 11, 15, m[6], m[7]);
+
+        __digest_g(s, 0, 5, 10, 15, m[8], m[9]);
+        __digest_g(s, 1, 6, 11, 12, m[10], m[11]);
+        __digest_g(s, 2, 7, 8, 13, m[12], m[13]);
+        __digest_g(s, 3, 4, 9, 14, m[14], m[15]);
+
+        for (size_t i = 0; i < 16; i++) {
+            permuted[i] = m[DIGEST_PERMUTATION[i]];
+        }
+
+        memcpy(m, permuted, sizeof(m));
+    }
+
+    for (size_t i = 0; i < 8; i++) {
+        out[i] = s[i] ^ s[i + 8];
+        out[i + 8] = s[i + 8] ^ cv[i];
+    }
+}
+
+static inline void
+__digest_store(uint8_t *p, uint32_t x) {
+    p[0] = (uint8_t)x;
+    p[1] = (uint8_t)(x >> 8);
+    p[2] = (uint8_t)(x >> 16);
+    p[3] = (uint8_t)(x >> 24);
+}
+
+// Compress the block of a parent node, whose children's chaining values
+// are its message
+static void
+__digest_parent(
+    const uint32_t left[8],
+    const uint32_t right[8],
+    uint32_t flags,
+    uint32_t out[16])
+{
+    uint8_t block[DIGEST_BLOCK_SIZE];
+    for (size_t i = 0; i < 8; i++) {
+        __digest_store(block + i * 4, left[i]);
+        __digest_store(block + 32 + i * 4, right[i]);
+    }
+
+    __digest_compress(DIGEST_IV, block, 0, DIGEST_BLOCK_SIZE,
+        DIGEST_PARENT | flags, out);
+}
+
+// Compress the last block of a chunk
+static void
+__digest_chunk_output(
+    const struct digest_chunk *chunk,
+    uint32_t flags,
+    uint32_t out[16])
+{
+    flags |= DIGEST_CHUNK_END;
+    if (chunk->blocks_compressed == 0) {
+        flags |= DIGEST_CHUNK_START;
+    }
+
+    __digest_compress(chunk->cv, chunk->block, chunk->counter,
+        chunk->block_size, flags, out);
+}
+
+void
+__digest_chunk_init(struct digest_chunk *chunk, uint64_t counter) {
+    memcpy(chunk->cv, DIGEST_IV, sizeof(chunk->cv));
+    memset(chunk->block, 0, sizeof(chunk->block));
+
+    chunk->counter = counter;
+    chunk->block_size = 0;
+    chunk->blocks_compressed = 0;
+}
+
+void
+__digest_chunk_update(
+    struct digest_chunk *chunk,
+    const uint8_t *data,
+    size_t size)
+{
+    uint32_t out[16];
+
+    while (size > 0) {
+        // The last block is kept back, since it's compressed differently
+        if (chunk->block_size == DIGEST_BLOCK_SIZE) {
+            uint32_t flags = chunk->blocks_compressed == 0 ?
+                DIGEST_CHUNK_START : 0;
+
+            __digest_compress(chunk->cv, chunk->block, chunk->counter,
+                DIGEST_BLOCK_SIZE, flags, out);
+            memcpy(chunk->cv, out, sizeof(chunk->cv));
+
+            chunk->blocks_compressed++;
+            chunk->block_size = 0;
+            memset(chunk->block, 0, sizeof(chunk->block));
+        }
+
+        size_t take = DIGEST_BLOCK_SIZE - chunk->block_size;
+        if (take > size) {
+            take = size;
+        }
+
+        memcpy(chunk->block + chunk->block_size, data, take);
+        chunk->block_size += take;
+
+        data += take;
+        size -= take;
+    }
+}
+
+enum nix_err
+nix_hasher__init(struct nix_hasher *out) {
+    struct hasher *h = (struct hasher *)out;
+
+    h->p.length = 0;
+    h->stack_size = 0;
+    __digest_chunk_init(&h->chunk, 0);
+
+    return NIXERR_NONE;
+}
+
+enum nix_err
+nix_hasher__construct(struct nix_hasher **out) {
+    struct hasher *h = NULL;
+    ALLOC(h, sizeof(struct hasher));
+
+    TRY(nix_hasher__init((struct nix_hasher *)h));
+    *out = (struct nix_hasher *)h;
+
+    EXCEPT(err)
+    nix_hasher__free((struct nix_hasher **)&h);
+    return err;
+}
+
+void
+nix_hasher__update(struct nix_hasher *hasher, const void *data, size_t size) {
+    struct hasher *h = (struct hasher *)hasher;
+    const uint8_t *bytes = data;
+    uint32_t out[16];
+
+    h->p.length += size;
+
+    while (size > 0) {
+        // A full chunk is only finished once more input shows it isn't the
+        // last, which is compressed as the root instead
+        if (__digest_chunk_size(&h->chunk) == DIGEST_CHUNK_SIZE) {
+            uint32_t cv[8];
+            __digest_chunk_output(&h->chunk, 0, out);
+            memcpy(cv, out, sizeof(cv));
+
+            // Each trailing zero bit of the chunk count completes a subtree
+            uint64_t chunks = h->chunk.counter + 1;
+            while ((chunks & 1) == 0) {
+                __digest_parent(h->stack[--h->stack_size], cv, 0, out);
+                memcpy(cv, out, sizeof(cv));
+                chunks >>= 1;
+            }
+
+            memcpy(h->stack[h->stack_size++], cv, sizeof(cv));
+            __digest_chunk_init(&h->chunk, h->chunk.counter + 1);
+        }
+
+        size_t take = DIGEST_CHUNK_SIZE - __digest_chunk_size(&h->chunk);
+        if (take > size) {
+            take = size;
+        }
+
+        __digest_chunk_update(&h->chunk, bytes, take);
+
+        bytes += take;
+        size -= take;
+    }
+}
+
+void
+nix_hasher__final(const struct nix_hasher *hasher, struct nix_digest *out) {
+    const struct hasher *h = (const struct hasher *)hasher;
+    uint32_t words[16];
+
+    // Fold the pending subtrees into the last chunk from the right, keeping
+    // the final compression back to mark it as the root
+    if (h->stack_size == 0) {
+        __digest_chunk_output(&h->chunk, DIGEST_ROOT, words);
+    } else {
+        uint32_t cv[8];
+        __digest_chunk_output(&h->chunk, 0, words);
+        memcpy(cv, words, sizeof(cv));
+
+        for (size_t i = h->stack_size; i > 0; i--) {
+            __digest_parent(h->stack[i - 1], cv, i == 1 ? DIGEST_ROOT : 0,
+                words);
+            memcpy(cv, words, sizeof(cv));
+        }
+    }
+
+    for (size_t i = 0; i < 8; i++) {
+        __digest_store(out->bytes + i * 4, words[i]);
+    }
+}
+
+void
+nix_hasher__free(struct nix_hasher **out) {
+    if (*out == NULL) return;
+
+    FREE(*out);
+
+    *out = NULL;
+}
+
+void
+nix_digest__bytes(const void *data, size_t size, struct nix_digest *out) {
+    struct hasher h;
+
+    nix_hasher__init((struct nix_hasher *)&h);
+    nix_hasher__update((struct nix_hasher *)&h, data, size);
+    nix_hasher__final((struct nix_hasher *)&h, out);
+}
+
+void
+nix_digest__hex(const struct nix_digest *digest, char *out) {
+    static const char digits[] = "0123456789abcdef";
+
+    for (size_t i = 0; i < NIX_DIGEST_SIZE; i++) {
+        out[i * 2] = digits[digest->bytes[i] >> 4];
+        out[i * 2 + 1] = digits[digest->bytes[i] & 0xF];
+    }
+
+    out[NIX_DIGEST_HEX_SIZE - 1] = '\0';
+}
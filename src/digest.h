@@ -0,0 +1,83 @@
+#ifndef INCLUDE_digest_h__
+#define INCLUDE_digest_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/digest.h"
+
+#define DIGEST_BLOCK_SIZE 64
+#define DIGEST_CHUNK_SIZE 1024
+
+// One chaining value per level of the tree, enough for 2^54 chunks
+#define DIGEST_MAX_DEPTH 54
+
+enum digest_flags {
+    DIGEST_CHUNK_START = 1 << 0,
+    DIGEST_CHUNK_END = 1 << 1,
+    DIGEST_PARENT = 1 << 2,
+    DIGEST_ROOT = 1 << 3
+};
+
+// The chunk currently being hashed
+struct digest_chunk {
+    uint32_t cv[8];
+    uint64_t counter;
+
+    uint8_t block[DIGEST_BLOCK_SIZE];
+    uint8_t block_size;
+    uint8_t blocks_compressed;
+};
+
+struct hasher {
+    struct nix_hasher p;
+
+    struct digest_chunk chunk;
+
+    // Chaining values of complete subtrees, awaiting their right siblings
+    uint32_t stack[DIGEST_MAX_DEPTH][8];
+    uint8_t stack_size;
+};
+
+static const uint32_t DIGEST_IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint8_t DIGEST_PERMUTATION[16] = {
+    2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8
+};
+
+void
+__digest_compress(
+    const uint32_t[8],
+    const uint8_t[DIGEST_BLOCK_SIZE],
+    uint64_t,
+    uint32_t,
+    uint32_t,
+    uint32_t[16]);
+
+void
+__digest_chunk_init(struct digest_chunk *, uint64_t);
+
+void
+__digest_chunk_update(struct digest_chunk *, const uint8_t *, size_t);
+
+static inline size_t
+__digest_chunk_size(const struct digest_chunk *chunk) {
+    return (size_t)chunk->blocks_compressed * DIGEST_BLOCK_SIZE +
+        chunk->block_size;
+}
+
+static inline uint32_t
+__digest_rotate(uint32_t x, unsigned n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t
+__digest_load(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+        ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#endif
@@ -3,7 +3,9 @@
 
 #include "libnix/error.h"
 
-static enum nix_err __nix_local_err;
+// Carries an error from TRY or ALLOC to EXCEPT. Nothing runs between the
+// two, so keeping one per thread is enough to make every function reentrant.
+static _Thread_local enum nix_err __nix_local_err;
 
 #define TRY(stmt) if ((__nix_local_err = stmt)) goto except;
 #define EXCEPT(err) return NIXERR_NONE; \
@@ -0,0 +1,54 @@
+#ifndef INCLUDE_hash_h__
+#define INCLUDE_hash_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Fast non-cryptographic hashing for in-memory tables. Not stable across
+// versions and never written to disk.
+
+#define HASH_SEED 0x9E3779B97F4A7C15ULL
+#define HASH_MULTIPLIER 0x9FB21C651E98DF25ULL
+
+static inline uint64_t
+__hash_mix(uint64_t h) {
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ULL;
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ULL;
+    h ^= h >> 32;
+
+    return h;
+}
+
+static inline uint64_t
+__hash_word(uint64_t h, uint64_t word) {
+    h = (h ^ word) * HASH_MULTIPLIER;
+    return h ^ (h >> 29);
+}
+
+static inline uint64_t
+__hash_bytes(const uint8_t *data, size_t length) {
+    uint64_t h = HASH_SEED ^ (length * HASH_MULTIPLIER);
+    uint64_t word;
+
+    // Consume the input a word at a time, then fold in the zero-padded tail
+    while (length >= sizeof(word)) {
+        memcpy(&word, data, sizeof(word));
+        h = __hash_word(h, word);
+
+        data += sizeof(word);
+        length -= sizeof(word);
+    }
+
+    if (length > 0) {
+        word = 0;
+        memcpy(&word, data, length);
+        h = __hash_word(h, word);
+    }
+
+    return __hash_mix(h);
+}
+
+#endif
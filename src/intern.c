@@ -0,0 +1,399 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "common.h"
+#include "error.h"
+#include "hash.h"
+#include "utf8.h"
+
+// Lengths up to this many code points are encoded on the stack when
+// interning UTF-32 text
+#define INTERN_SCRATCH_SIZE 256
+
+enum nix_err
+nix_intern__init(struct nix_intern *out, unsigned int flags) {
+    struct intern *in = (struct intern *)out;
+    bool concurrent = (flags & NIX_INTERN_CONCURRENT) != 0;
+
+    in->p.flags = flags;
+    in->shard_count = concurrent ? INTERN_SHARDS : 1;
+
+    atomic_init(&in->next_id, 0);
+    for (size_t i = 0; i < INTERN_PAGES; i++) {
+        atomic_init(&in->pages[i], NULL);
+    }
+
+    for (size_t i = 0; i < in->shard_count; i++) {
+        TRY(__intern_shard_init(&in->shards[i], concurrent));
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__intern_shard_init(struct intern_shard *shard, bool concurrent) {
+    shard->slots = NULL;
+    shard->capacity = INTERN_INITIAL_CAPACITY;
+    shard->count = 0;
+
+    shard->chunks = NULL;
+    shard->arena = NULL;
+    shard->arena_left = 0;
+
+    if (concurrent && pthread_mutex_init(&shard->lock, NULL) != 0) {
+        return NIXERR_THREAD;
+    }
+
+    ALLOC(shard->slots, sizeof(struct intern_slot) * shard->capacity);
+    memset(shard->slots, 0, sizeof(struct intern_slot) * shard->capacity);
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_intern__construct(struct nix_intern **out, unsigned int flags) {
+    struct intern *in = NULL;
+    ALLOC(in, sizeof(struct intern));
+    memset(in, 0, sizeof(struct intern));
+
+    TRY(nix_intern__init((struct nix_intern *)in, flags));
+    *out = (struct nix_intern *)in;
+
+    EXCEPT(err)
+    nix_intern__free((struct nix_intern **)&in);
+    return err;
+}
+
+enum nix_err
+nix_intern__intern(
+    struct nix_intern *intern,
+    const char *text,
+    size_t length,
+    uint32_t *out)
+{
+    struct intern *in = (struct intern *)intern;
+
+    uint64_t hash = __hash_bytes((const uint8_t *)text, length);
+    struct intern_shard *shard = &in->shards[0];
+    bool concurrent = in->shard_count > 1;
+
+    if (concurrent) {
+        shard = &in->shards[(hash >> 60) % in->shard_count];
+        if (pthread_mutex_lock(&shard->lock) != 0) {
+            return NIXERR_THREAD;
+        }
+    }
+
+    enum nix_err err = __intern_insert(
+        in, shard, text, length, (uint32_t)hash, out);
+
+    if (concurrent) {
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return err;
+}
+
+enum nix_err
+__intern_insert(
+    struct intern *in,
+    struct intern_shard *shard,
+    const char *text,
+    size_t length,
+    uint32_t hash,
+    uint32_t *out)
+{
+    struct intern_entry *entry = NULL;
+    uint32_t id;
+
+    // Linear probing - the table is kept at most half full, so an empty slot
+    // is always found
+    size_t mask = shard->capacity - 1;
+    size_t i = hash & mask;
+
+    while (shard->slots[i].id != 0) {
+        struct intern_slot *slot = &shard->slots[i];
+
+        if (slot->hash == hash) {
+            entry = __intern_entry(in, slot->id - 1);
+            if (entry->length == length &&
+                    memcmp(entry->text, text, length) == 0) {
+                *out = slot->id - 1;
+                return NIXERR_NONE;
+            }
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    // Grown before anything is stored, so failing to grow leaves the string
+    // out of the table rather than in an overfull one
+    if ((shard->count + 1) * 2 > shard->capacity) {
+        TRY(__intern_grow(in, shard));
+
+        mask = shard->capacity - 1;
+        i = hash & mask;
+        while (shard->slots[i].id != 0) {
+            i = (i + 1) & mask;
+        }
+    }
+
+    char *copy = NULL;
+    TRY(__intern_copy_text(shard, text, length, &copy));
+    TRY(__intern_new_entry(in, &id, &entry));
+
+    entry->length = length;
+    atomic_store_explicit(&entry->text, copy, memory_order_release);
+
+    shard->slots[i].hash = hash;
+    shard->slots[i].id = id + 1;
+    shard->count++;
+
+    *out = id;
+
+    EXCEPT(err)
+    return err;
+}
+
+static inline struct intern_entry *
+__intern_entry(struct intern *in, uint32_t id) {
+    // Page n holds ids [2^(n + base) - 2^base, 2^(n + base + 1) - 2^base)
+    uint64_t biased = (uint64_t)id + (1 << INTERN_PAGE_BASE_BITS);
+    size_t page = 63 - __builtin_clzll(biased) - INTERN_PAGE_BASE_BITS;
+    size_t offset = biased - ((uint64_t)1 << (page + INTERN_PAGE_BASE_BITS));
+
+    struct intern_entry *entries = atomic_load_explicit(
+        &in->pages[page], memory_order_acquire);
+
+    if (entries == NULL) {
+        return NULL;
+    }
+
+    return &entries[offset];
+}
+
+enum nix_err
+__intern_new_entry(
+    struct intern *in,
+    uint32_t *id,
+    struct intern_entry **out)
+{
+    uint32_t next = atomic_fetch_add(&in->next_id, 1);
+    if (next == NIX_INTERN_NONE) {
+        atomic_fetch_sub(&in->next_id, 1);
+        return NIXERR_INTERN_FULL;
+    }
+
+    uint64_t biased = (uint64_t)next + (1 << INTERN_PAGE_BASE_BITS);
+    size_t page = 63 - __builtin_clzll(biased) - INTERN_PAGE_BASE_BITS;
+
+    // Pages are allocated by whichever shard first needs them; losing the
+    // race just discards the spare page
+    struct intern_entry *entries = atomic_load_explicit(
+        &in->pages[page], memory_order_acquire);
+
+    if (entries == NULL) {
+        size_t size = sizeof(struct intern_entry) <<
+            (page + INTERN_PAGE_BASE_BITS);
+
+        struct intern_entry *fresh = NULL;
+        ALLOC(fresh, size);
+        memset(fresh, 0, size);
+
+        if (!atomic_compare_exchange_strong(&in->pages[page], &entries,
+                    fresh)) {
+            free(fresh);
+        }
+    }
+
+    *id = next;
+    *out = __intern_entry(in, next);
+
+    // An id which failed to allocate is never handed out again, since other
+    // threads may already have claimed the ones after it
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__intern_grow(struct intern *in, struct intern_shard *shard) {
+    size_t capacity = shard->capacity * 2;
+    size_t mask = capacity - 1;
+    struct intern_slot *slots = NULL;
+
+    ALLOC(slots, sizeof(struct intern_slot) * capacity);
+    memset(slots, 0, sizeof(struct intern_slot) * capacity);
+
+    for (size_t i = 0; i < shard->capacity; i++) {
+        struct intern_slot *slot = &shard->slots[i];
+        if (slot->id == 0) {
+            continue;
+        }
+
+        size_t j = slot->hash & mask;
+        while (slots[j].id != 0) {
+            j = (j + 1) & mask;
+        }
+
+        slots[j] = *slot;
+    }
+
+    free(shard->slots);
+    shard->slots = slots;
+    shard->capacity = capacity;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__intern_copy_text(
+    struct intern_shard *shard,
+    const char *text,
+    size_t length,
+    char **out)
+{
+    // Text is kept NUL-terminated so it can be handed to C string functions
+    size_t size = length + 1;
+
+    if (size > shard->arena_left) {
+        size_t chunk_size = INTERN_CHUNK_SIZE;
+        if (size > chunk_size) {
+            chunk_size = size;
+        }
+
+        struct intern_chunk *chunk = NULL;
+        ALLOC(chunk, sizeof(struct intern_chunk) + chunk_size);
+
+        chunk->next = shard->chunks;
+        shard->chunks = chunk;
+        shard->arena = chunk->data;
+        shard->arena_left = chunk_size;
+    }
+
+    char *copy = (char *)shard->arena;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+
+    shard->arena += size;
+    shard->arena_left -= size;
+
+    *out = copy;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_intern__intern_utf32(
+    struct nix_intern *in,
+    const uint32_t *text,
+    size_t length,
+    uint32_t *out)
+{
+    uint8_t scratch[INTERN_SCRATCH_SIZE * UTF8_MAX_BYTES];
+    uint8_t *encoded = scratch;
+
+    if (length > INTERN_SCRATCH_SIZE) {
+        ALLOC(encoded, length * UTF8_MAX_BYTES);
+    }
+
+    size_t size = 0;
+    for (size_t i = 0; i < length; i++) {
+        size += __utf8_encode(text[i], encoded + size);
+    }
+
+    TRY(nix_intern__intern(in, (const char *)encoded, size, out));
+
+    if (encoded != scratch) {
+        free(encoded);
+    }
+
+    EXCEPT(err)
+    if (encoded != scratch) {
+        FREE(encoded);
+    }
+
+    return err;
+}
+
+enum nix_err
+nix_intern__lookup(
+    struct nix_intern *intern,
+    uint32_t id,
+    const char **text,
+    size_t *length)
+{
+    struct intern *in = (struct intern *)intern;
+
+    if (id >= atomic_load(&in->next_id)) {
+        return NIXERR_INTERN_INVID;
+    }
+
+    struct intern_entry *entry = __intern_entry(in, id);
+    if (entry == NULL) {
+        return NIXERR_INTERN_INVID;
+    }
+
+    const char *entry_text = atomic_load_explicit(&entry->text,
+        memory_order_acquire);
+    if (entry_text == NULL) {
+        return NIXERR_INTERN_INVID;
+    }
+
+    *text = entry_text;
+    if (length != NULL) {
+        *length = entry->length;
+    }
+
+    return NIXERR_NONE;
+}
+
+uint32_t
+nix_intern__count(struct nix_intern *intern) {
+    struct intern *in = (struct intern *)intern;
+    return atomic_load(&in->next_id);
+}
+
+void
+__intern_shard_free(struct intern_shard *shard, bool concurrent) {
+    FREE(shard->slots);
+
+    struct intern_chunk *chunk = shard->chunks;
+    while (chunk != NULL) {
+        struct intern_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    if (concurrent) {
+        pthread_mutex_destroy(&shard->lock);
+    }
+}
+
+void
+nix_intern__free(struct nix_intern **out) {
+    if (*out == NULL) return;
+
+    struct intern *in = (struct intern *)*out;
+    bool concurrent = in->shard_count > 1;
+
+    for (size_t i = 0; i < in->shard_count; i++) {
+        __intern_shard_free(&in->shards[i], concurrent);
+    }
+
+    for (size_t i = 0; i < INTERN_PAGES; i++) {
+        FREE(in->pages[i]);
+    }
+
+    FREE(in);
+
+    *out = NULL;
+}
@@ -0,0 +1,91 @@
+#ifndef INCLUDE_intern_h__
+#define INCLUDE_intern_h__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/intern.h"
+
+// Concurrent tables split their slots and arenas into independently locked
+// shards, selected by the high bits of the hash
+#define INTERN_SHARDS 16
+#define INTERN_INITIAL_CAPACITY 64
+#define INTERN_CHUNK_SIZE 16384
+
+// The id-to-text directory is a list of pages which double in size, so
+// entries never move and may be read without a lock
+#define INTERN_PAGE_BASE_BITS 8
+#define INTERN_PAGES (33 - INTERN_PAGE_BASE_BITS)
+
+// An id can be handed out before its entry is filled in, so the text is
+// stored last and a reader seeing it set sees the length too
+struct intern_entry {
+    const char *_Atomic text;
+    size_t length;
+};
+
+struct intern_slot {
+    uint32_t hash;
+
+    // Stored as id + 1 so a zeroed slot is empty
+    uint32_t id;
+};
+
+struct intern_chunk {
+    struct intern_chunk *next;
+    uint8_t data[];
+};
+
+struct intern_shard {
+    pthread_mutex_t lock;
+
+    struct intern_slot *slots;
+    size_t capacity;
+    size_t count;
+
+    struct intern_chunk *chunks;
+    uint8_t *arena;
+    size_t arena_left;
+};
+
+struct intern {
+    struct nix_intern p;
+
+    size_t shard_count;
+    struct intern_shard shards[INTERN_SHARDS];
+
+    atomic_uint_fast32_t next_id;
+    struct intern_entry *_Atomic pages[INTERN_PAGES];
+};
+
+enum nix_err
+__intern_shard_init(struct intern_shard *, bool);
+
+void
+__intern_shard_free(struct intern_shard *, bool);
+
+enum nix_err
+__intern_insert(
+    struct intern *,
+    struct intern_shard *,
+    const char *,
+    size_t,
+    uint32_t,
+    uint32_t *);
+
+static inline struct intern_entry *
+__intern_entry(struct intern *, uint32_t);
+
+enum nix_err
+__intern_new_entry(struct intern *, uint32_t *, struct intern_entry **);
+
+enum nix_err
+__intern_grow(struct intern *, struct intern_shard *);
+
+enum nix_err
+__intern_copy_text(struct intern_shard *, const char *, size_t, char **);
+
+#endif
@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "keyword.h"
+#include "keyword_table.h"
+
+// The table is a perfect hash generated by scripts/gen_keywords.py; see
+// that script for the packing scheme.
+enum nix_keyword
+__keyword_lookup_word(uint64_t word) {
+    size_t slot = (word * KEYWORD_MULTIPLIER) >> (64 - KEYWORD_TABLE_BITS);
+
+    if (keyword_table[slot].word != word) {
+        return NIX_KEYWORD_NONE;
+    }
+
+    return keyword_table[slot].keyword;
+}
+
+enum nix_keyword
+nix_keyword__lookup(const char *text, size_t length) {
+    if (length == 0 || length > KEYWORD_MAX_LENGTH) {
+        return NIX_KEYWORD_NONE;
+    }
+
+    uint64_t word = (uint64_t)length << KEYWORD_LENGTH_SHIFT;
+    for (size_t i = 0; i < length; i++) {
+        word |= (uint64_t)(uint8_t)text[i] << (8 * i);
+    }
+
+    return __keyword_lookup_word(word);
+}
+
+enum nix_keyword
+nix_keyword__lookup_utf32(const uint32_t *text, size_t length) {
+    if (length == 0 || length > KEYWORD_MAX_LENGTH) {
+        return NIX_KEYWORD_NONE;
+    }
+
+    uint64_t word = (uint64_t)length << KEYWORD_LENGTH_SHIFT;
+    for (size_t i = 0; i < length; i++) {
+        // Keywords are plain ASCII
+        if (text[i] >= 0x80) {
+            return NIX_KEYWORD_NONE;
+        }
+
+        word |= (uint64_t)text[i] << (8 * i);
+    }
+
+    return __keyword_lookup_word(word);
+}
+
+enum nix_keyword
+nix_keyword__lookup_lexeme(struct nix_lexeme *lexeme) {
+    if (lexeme == NULL || lexeme->start == NULL || lexeme->end == NULL) {
+        return NIX_KEYWORD_NONE;
+    }
+
+    size_t length = lexeme->end->abs - lexeme->start->abs;
+    return nix_keyword__lookup_utf32(lexeme->text, length);
+}
+
+const char *
+nix_keyword__name(enum nix_keyword keyword) {
+    switch (keyword) {
+    case NIX_KEYWORD_LET: return "let";
+    case NIX_KEYWORD_IN: return "in";
+    case NIX_KEYWORD_REC: return "rec";
+    case NIX_KEYWORD_WITH: return "with";
+    case NIX_KEYWORD_INHERIT: return "inherit";
+    case NIX_KEYWORD_IF: return "if";
+    case NIX_KEYWORD_THEN: return "then";
+    case NIX_KEYWORD_ELSE: return "else";
+    case NIX_KEYWORD_ASSERT: return "assert";
+    case NIX_KEYWORD_OR: return "or";
+    default: return NULL;
+    }
+}
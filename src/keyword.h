@@ -0,0 +1,16 @@
+#ifndef INCLUDE_keyword_h__
+#define INCLUDE_keyword_h__
+
+#include <stdint.h>
+
+#include "libnix/keyword.h"
+
+// Keywords are packed one byte per character into a word, with the length
+// in the top byte, so they must be shorter than the word
+#define KEYWORD_MAX_LENGTH 7
+#define KEYWORD_LENGTH_SHIFT 56
+
+enum nix_keyword
+__keyword_lookup_word(uint64_t);
+
+#endif
@@ -0,0 +1,37 @@
+// Generated by scripts/gen_keywords.py. Do not edit by hand.
+
+#ifndef INCLUDE_keyword_table_h__
+#define INCLUDE_keyword_table_h__
+
+#include <stdint.h>
+
+#include "libnix/keyword.h"
+
+#define KEYWORD_TABLE_BITS 4
+#define KEYWORD_MULTIPLIER 0x5F1811E8BD3448BFULL
+
+struct keyword_slot {
+    uint64_t word;
+    enum nix_keyword keyword;
+};
+
+static const struct keyword_slot keyword_table[16] = {
+    { 0x0300000000636572ULL, NIX_KEYWORD_REC },
+    { 0x0200000000006669ULL, NIX_KEYWORD_IF },
+    { 0x0600747265737361ULL, NIX_KEYWORD_ASSERT },
+    { 0x0000000000000000ULL, NIX_KEYWORD_NONE },
+    { 0x0000000000000000ULL, NIX_KEYWORD_NONE },
+    { 0x0774697265686E69ULL, NIX_KEYWORD_INHERIT },
+    { 0x0000000000000000ULL, NIX_KEYWORD_NONE },
+    { 0x020000000000726FULL, NIX_KEYWORD_OR },
+    { 0x0400000065736C65ULL, NIX_KEYWORD_ELSE },
+    { 0x0000000000000000ULL, NIX_KEYWORD_NONE },
+    { 0x0000000000000000ULL, NIX_KEYWORD_NONE },
+    { 0x0400000068746977ULL, NIX_KEYWORD_WITH },
+    { 0x0000000000000000ULL, NIX_KEYWORD_NONE },
+    { 0x0200000000006E69ULL, NIX_KEYWORD_IN },
+    { 0x040000006E656874ULL, NIX_KEYWORD_THEN },
+    { 0x030000000074656CULL, NIX_KEYWORD_LET },
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "lex_files.h"
+#include "tokens.h"
+#include "libnix/buffer.h"
+#include "common.h"
+#include "error.h"
+
+enum nix_err
+nix_lex_files(
+    const char *const *paths,
+    size_t count,
+    const struct nix_lex_options *options,
+    nix_lex_callback callback)
+{
+    struct nix_lex_options defaults = { 0 };
+    struct lex_batch batch = { 0 };
+    struct lex_job *jobs = NULL;
+    struct nix_pool *pool = NULL;
+    struct nix_wait_group *group = NULL;
+    bool locked = false;
+
+    if (options == NULL) {
+        options = &defaults;
+    }
+
+    batch.paths = paths;
+    batch.count = count;
+    batch.intern = options->intern;
+    batch.flags = options->flags;
+    batch.callback = callback;
+    batch.context = options->context;
+
+    if (pthread_mutex_init(&batch.lock, NULL) != 0) {
+        return NIXERR_THREAD;
+    }
+
+    locked = true;
+
+    ALLOC(jobs, sizeof(struct lex_job) * (count > 0 ? count : 1));
+
+    if (batch.flags & NIX_LEX_ORDERED) {
+        ALLOC(batch.results,
+            sizeof(struct nix_lex_result) * (count > 0 ? count : 1));
+        ALLOC(batch.finished, sizeof(bool) * (count > 0 ? count : 1));
+        memset(batch.finished, 0, sizeof(bool) * count);
+    }
+
+    // Sizes are only for scheduling; a file that can't be looked at now
+    // reports why when it's opened
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct stat st;
+
+        jobs[i].batch = &batch;
+        jobs[i].index = i;
+        jobs[i].size = stat(paths[i], &st) == 0 ? (size_t)st.st_size : 0;
+        total += jobs[i].size;
+    }
+
+    qsort(jobs, count, sizeof(struct lex_job), &__lex_files_compare);
+
+    // Interning from several threads needs a table made for it
+    bool concurrent = batch.intern == NULL ||
+        (batch.intern->flags & NIX_INTERN_CONCURRENT) != 0;
+
+    pool = options->pool;
+    if (pool == NULL && concurrent) {
+        TRY(nix_pool__construct(&pool, options->threads, 0));
+    }
+
+    if (pool == NULL || !concurrent || pool->threads == 1) {
+        batch.split_size = SIZE_MAX;
+        batch.split_threads = 1;
+
+        for (size_t i = 0; i < count; i++) {
+            __lex_files_run(&jobs[i]);
+        }
+    } else {
+        batch.split_size = total / pool->threads + 1;
+        batch.split_threads = pool->threads;
+        batch.pool = pool;
+
+        TRY(nix_wait_group__construct(&group, pool));
+        for (size_t i = 0; i < count; i++) {
+            TRY(nix_pool__submit(pool, group, &__lex_files_run, &jobs[i]));
+        }
+
+        TRY(nix_wait_group__wait(group));
+    }
+
+    nix_wait_group__free(&group);
+    if (pool != options->pool) {
+        nix_pool__free(&pool);
+    }
+
+    pthread_mutex_destroy(&batch.lock);
+    FREE(batch.results);
+    FREE(batch.finished);
+    FREE(jobs);
+
+    EXCEPT(err)
+    // Jobs already submitted point into the batch, so they have to finish
+    if (group != NULL) {
+        nix_wait_group__wait(group);
+        nix_wait_group__free(&group);
+    }
+
+    if (pool != options->pool) {
+        nix_pool__free(&pool);
+    }
+
+    if (locked) {
+        pthread_mutex_destroy(&batch.lock);
+    }
+
+    FREE(batch.results);
+    FREE(batch.finished);
+    FREE(jobs);
+    return err;
+}
+
+void
+__lex_files_run(void *arg) {
+    struct lex_job *job = arg;
+    struct lex_batch *batch = job->batch;
+    struct nix_lex_result result = { 0 };
+
+    result.index = job->index;
+    result.path = batch->paths[job->index];
+
+    FILE *in = fopen(result.path, "rb");
+    if (in == NULL) {
+        result.err = NIXERR_BUF_FILE;
+    } else {
+        unsigned int threads = job->size >= batch->split_size ?
+            batch->split_threads : 1;
+
+        unsigned int buffer_flags = 0;
+        if (batch->flags & NIX_LEX_URING) {
+            buffer_flags = NIX_BUFFER_URING;
+        }
+
+        // Pieces of a split file are more jobs on the batch's pool
+        result.err = __tokens_file(&result.table, in, batch->intern,
+            threads, buffer_flags, batch->pool);
+        fclose(in);
+    }
+
+    if (result.err != NIXERR_NONE) {
+        result.table = NULL;
+    }
+
+    __lex_files_deliver(batch, &result);
+}
+
+void
+__lex_files_deliver(struct lex_batch *batch, struct nix_lex_result *result) {
+    pthread_mutex_lock(&batch->lock);
+
+    if ((batch->flags & NIX_LEX_ORDERED) == 0) {
+        batch->callback(batch->context, result);
+        pthread_mutex_unlock(&batch->lock);
+        return;
+    }
+
+    batch->results[result->index] = *result;
+    batch->finished[result->index] = true;
+
+    while (batch->next < batch->count && batch->finished[batch->next]) {
+        batch->callback(batch->context, &batch->results[batch->next]);
+        batch->next++;
+    }
+
+    pthread_mutex_unlock(&batch->lock);
+}
+
+// Largest first, then in the order given
+int
+__lex_files_compare(const void *a, const void *b) {
+    const struct lex_job *x = a, *y = b;
+
+    if (x->size != y->size) {
+        return x->size > y->size ? -1 : 1;
+    }
+
+    return x->index < y->index ? -1 : x->index > y->index;
+}
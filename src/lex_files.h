@@ -0,0 +1,48 @@
+#ifndef INCLUDE_lex_files_h__
+#define INCLUDE_lex_files_h__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/lex_files.h"
+
+struct lex_batch {
+    const char *const *paths;
+    size_t count;
+
+    struct nix_intern *intern;
+    unsigned int flags;
+    nix_lex_callback callback;
+    void *context;
+
+    // Files at least this big are split into this many jobs on the pool
+    size_t split_size;
+    unsigned int split_threads;
+    struct nix_pool *pool;
+
+    pthread_mutex_t lock;
+
+    // Results held back until every earlier file is done, when ordered
+    struct nix_lex_result *results;
+    bool *finished;
+    size_t next;
+};
+
+struct lex_job {
+    struct lex_batch *batch;
+    size_t index;
+    size_t size;
+};
+
+void
+__lex_files_run(void *);
+
+void
+__lex_files_deliver(struct lex_batch *, struct nix_lex_result *);
+
+int
+__lex_files_compare(const void *, const void *);
+
+#endif
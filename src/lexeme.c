@@ -27,7 +27,8 @@ nix_lexeme__construct(
     struct nix_lexeme *lexeme;
     ALLOC(lexeme, sizeof(struct nix_lexeme));
 
-    TRY(nix_lexeme__init(*out, text, start, end));
+    TRY(nix_lexeme__init(lexeme, text, start, end));
+    *out = lexeme;
 
     EXCEPT(err)
     return err;
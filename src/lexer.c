@@ -0,0 +1,834 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lexer.h"
+#include "common.h"
+#include "error.h"
+#include "keyword.h"
+
+// Tokens are recognized by a DFA over character classes. The lexer peeks
+// ahead through the DFA, committing the read pointer each time it passes an
+// accepting state, so when the DFA dies the read pointer sits at the end of
+// the longest match and the peek pointer is simply reset.
+
+enum lexer_class {
+    C_OTHER = 0,
+    C_SPACE,
+    C_TAB,
+    C_NL,
+    C_CR,
+    C_ALPHA,
+    C_E,
+    C_ZERO,
+    C_DIGIT,
+    C_UNDERSCORE,
+    C_APOS,
+    C_MINUS,
+    C_PLUS,
+    C_DOT,
+    C_SLASH,
+    C_BACKSLASH,
+    C_TILDE,
+    C_COLON,
+    C_LT,
+    C_GT,
+    C_EQ,
+    C_BANG,
+    C_AMP,
+    C_BAR,
+    C_STAR,
+    C_QUESTION,
+    C_AT,
+    C_PERCENT,
+    C_DOLLAR,
+    C_COMMA,
+    C_SEMI,
+    C_HASH,
+    C_QUOTE,
+    C_LBRACE,
+    C_RBRACE,
+    C_LPAREN,
+    C_RPAREN,
+    C_LBRACKET,
+    C_RBRACKET,
+
+    CLASS_COUNT
+};
+
+enum lexer_dfa_state {
+    S_DEAD = 0,
+
+    // Start states for each lexer mode
+    S_NORMAL,
+    S_STRING,
+    S_IND_STRING,
+
+    S_WS,
+    S_COMMENT,
+    S_BLOCK,
+    S_BLOCK_STAR,
+    S_BLOCK_END,
+
+    // Identifiers overlap with paths and URI schemes, so these states track
+    // which of the three the text so far could still become
+    S_ID_PATH_SCHEME,
+    S_ID_PATH,
+    S_ID,
+    S_PATH_SCHEME,
+    S_PATH_PREFIX,
+    S_URI_COLON,
+    S_URI,
+    S_PATH_SLASH,
+    S_PATH,
+    S_PATH_TRAIL,
+
+    // A path followed by ${, which is where it ends
+    S_PATH_DOLLAR,
+    S_PATH_INTERP,
+
+    S_ZERO,
+    S_INT,
+    S_INT_ZERO,
+    S_ZERO_DOT,
+    S_FLOAT_DOT,
+    S_FLOAT,
+    S_FLOAT_E,
+    S_FLOAT_SIGN,
+    S_FLOAT_EXP,
+
+    S_DOT,
+    S_DOT_DOT,
+    S_ELLIPSIS,
+    S_TILDE,
+    S_HPATH_SLASH,
+    S_HPATH,
+    S_HPATH_TRAIL,
+    S_LT,
+    S_LEQ,
+    S_SPATH_BODY,
+    S_SPATH_SLASH,
+    S_SPATH,
+    S_GT,
+    S_GEQ,
+    S_ASSIGN,
+    S_EQ,
+    S_NOT,
+    S_NEQ,
+    S_AMP,
+    S_AND,
+    S_BAR,
+    S_OR,
+    S_PLUS,
+    S_CONCAT,
+    S_MINUS,
+    S_IMPL,
+    S_MUL,
+    S_SLASH,
+    S_UPDATE,
+    S_LBRACE,
+    S_RBRACE,
+    S_LPAREN,
+    S_RPAREN,
+    S_LBRACKET,
+    S_RBRACKET,
+    S_SEMI,
+    S_COLON,
+    S_COMMA,
+    S_QUESTION,
+    S_AT,
+    S_DOLLAR,
+    S_DOLLAR_CURLY,
+    S_QUOTE,
+    S_APOS,
+    S_IND_OPEN,
+    S_IND_OPEN_SPACE,
+    S_IND_OPEN_NL,
+
+    S_STR,
+    S_STR_DOLLAR,
+    S_STR_START_DOLLAR,
+    S_STR_ESCAPE,
+    S_STR_CLOSE,
+
+    S_IND_STR,
+    S_IND_STR_APOS,
+    S_IND_STR_APOS2,
+    S_IND_STR_DOLLAR,
+    S_IND_START_APOS,
+    S_IND_START_DOLLAR,
+    S_IND_ESCAPE,
+    S_IND_CLOSE,
+
+    S_INPATH,
+    S_INPATH_DOLLAR,
+    S_PATH_STR,
+
+    // A slash in the rest of a path, which may only end it before a ${
+    S_PATH_STR_SLASH,
+    S_PATH_STR_DOLLAR,
+    S_PATH_STR_INTERP,
+
+    STATE_COUNT
+};
+
+static const uint8_t lexer_start[] = {
+    [LEXER_NORMAL] = S_NORMAL,
+    [LEXER_STRING] = S_STRING,
+    [LEXER_IND_STRING] = S_IND_STRING,
+    [LEXER_PATH] = S_INPATH,
+    [LEXER_LINE_COMMENT] = S_COMMENT,
+    [LEXER_BLOCK_COMMENT] = S_BLOCK,
+    [LEXER_BLOCK_COMMENT_STAR] = S_BLOCK_STAR
+};
+
+// Where lexing picks up again after a comment split in each state
+static const uint8_t lexer_resume[STATE_COUNT] = {
+    [S_COMMENT] = LEXER_LINE_COMMENT,
+    [S_BLOCK] = LEXER_BLOCK_COMMENT,
+    [S_BLOCK_STAR] = LEXER_BLOCK_COMMENT_STAR
+};
+
+static const uint8_t lexer_classes[128] = {
+    [' '] = C_SPACE, ['\t'] = C_TAB, ['\n'] = C_NL, ['\r'] = C_CR,
+
+    ['a'] = C_ALPHA, ['b'] = C_ALPHA, ['c'] = C_ALPHA, ['d'] = C_ALPHA,
+    ['e'] = C_E, ['f'] = C_ALPHA, ['g'] = C_ALPHA, ['h'] = C_ALPHA,
+    ['i'] = C_ALPHA, ['j'] = C_ALPHA, ['k'] = C_ALPHA, ['l'] = C_ALPHA,
+    ['m'] = C_ALPHA, ['n'] = C_ALPHA, ['o'] = C_ALPHA, ['p'] = C_ALPHA,
+    ['q'] = C_ALPHA, ['r'] = C_ALPHA, ['s'] = C_ALPHA, ['t'] = C_ALPHA,
+    ['u'] = C_ALPHA, ['v'] = C_ALPHA, ['w'] = C_ALPHA, ['x'] = C_ALPHA,
+    ['y'] = C_ALPHA, ['z'] = C_ALPHA,
+
+    ['A'] = C_ALPHA, ['B'] = C_ALPHA, ['C'] = C_ALPHA, ['D'] = C_ALPHA,
+    ['E'] = C_E, ['F'] = C_ALPHA, ['G'] = C_ALPHA, ['H'] = C_ALPHA,
+    ['I'] = C_ALPHA, ['J'] = C_ALPHA, ['K'] = C_ALPHA, ['L'] = C_ALPHA,
+    ['M'] = C_ALPHA, ['N'] = C_ALPHA, ['O'] = C_ALPHA, ['P'] = C_ALPHA,
+    ['Q'] = C_ALPHA, ['R'] = C_ALPHA, ['S'] = C_ALPHA, ['T'] = C_ALPHA,
+    ['U'] = C_ALPHA, ['V'] = C_ALPHA, ['W'] = C_ALPHA, ['X'] = C_ALPHA,
+    ['Y'] = C_ALPHA, ['Z'] = C_ALPHA,
+
+    ['0'] = C_ZERO, ['1'] = C_DIGIT, ['2'] = C_DIGIT, ['3'] = C_DIGIT,
+    ['4'] = C_DIGIT, ['5'] = C_DIGIT, ['6'] = C_DIGIT, ['7'] = C_DIGIT,
+    ['8'] = C_DIGIT, ['9'] = C_DIGIT,
+
+    ['_'] = C_UNDERSCORE, ['\''] = C_APOS, ['-'] = C_MINUS, ['+'] = C_PLUS,
+    ['.'] = C_DOT, ['/'] = C_SLASH, ['\\'] = C_BACKSLASH, ['~'] = C_TILDE,
+    [':'] = C_COLON, ['<'] = C_LT, ['>'] = C_GT, ['='] = C_EQ,
+    ['!'] = C_BANG, ['&'] = C_AMP, ['|'] = C_BAR, ['*'] = C_STAR,
+    ['?'] = C_QUESTION, ['@'] = C_AT, ['%'] = C_PERCENT, ['$'] = C_DOLLAR,
+    [','] = C_COMMA, [';'] = C_SEMI, ['#'] = C_HASH, ['"'] = C_QUOTE,
+    ['{'] = C_LBRACE, ['}'] = C_RBRACE, ['('] = C_LPAREN, [')'] = C_RPAREN,
+    ['['] = C_LBRACKET, [']'] = C_RBRACKET
+};
+
+// Groups of classes, for use inside a row of the transition table. Later
+// entries in a row override earlier ones.
+#define DIGITS(to) [C_ZERO] = to, [C_DIGIT] = to
+
+#define LETTERS(to) [C_ALPHA] = to, [C_E] = to
+
+// [a-zA-Z0-9._\-+]
+#define PATH_CHARS(to) LETTERS(to), DIGITS(to), [C_DOT] = to, \
+    [C_UNDERSCORE] = to, [C_MINUS] = to, [C_PLUS] = to
+
+// [a-zA-Z0-9%/?:@&=+$,\-_.!~*']
+#define URI_CHARS(to) PATH_CHARS(to), [C_PERCENT] = to, [C_SLASH] = to, \
+    [C_QUESTION] = to, [C_COLON] = to, [C_AT] = to, [C_AMP] = to, \
+    [C_EQ] = to, [C_DOLLAR] = to, [C_COMMA] = to, [C_BANG] = to, \
+    [C_TILDE] = to, [C_STAR] = to, [C_APOS] = to
+
+// Any run of path characters followed by a slash may still become a path
+#define PATH_CONTINUE PATH_CHARS(S_PATH_PREFIX), [C_SLASH] = S_PATH_SLASH
+
+#define ALL_CHARS(to) URI_CHARS(to), [C_OTHER] = to, [C_SPACE] = to, \
+    [C_TAB] = to, [C_NL] = to, [C_CR] = to, [C_BACKSLASH] = to, \
+    [C_LT] = to, [C_GT] = to, [C_BAR] = to, [C_SEMI] = to, [C_HASH] = to, \
+    [C_QUOTE] = to, [C_LBRACE] = to, [C_RBRACE] = to, [C_LPAREN] = to, \
+    [C_RPAREN] = to, [C_LBRACKET] = to, [C_RBRACKET] = to
+
+static const uint8_t lexer_transitions[STATE_COUNT][CLASS_COUNT] = {
+    [S_NORMAL] = {
+        [C_SPACE] = S_WS, [C_TAB] = S_WS, [C_NL] = S_WS, [C_CR] = S_WS,
+        LETTERS(S_ID_PATH_SCHEME), [C_UNDERSCORE] = S_ID_PATH,
+        [C_ZERO] = S_ZERO, [C_DIGIT] = S_INT,
+        [C_DOT] = S_DOT, [C_PLUS] = S_PLUS, [C_MINUS] = S_MINUS,
+        [C_SLASH] = S_SLASH, [C_TILDE] = S_TILDE, [C_LT] = S_LT,
+        [C_GT] = S_GT, [C_EQ] = S_ASSIGN, [C_BANG] = S_NOT,
+        [C_AMP] = S_AMP, [C_BAR] = S_BAR, [C_STAR] = S_MUL,
+        [C_QUESTION] = S_QUESTION, [C_AT] = S_AT, [C_COLON] = S_COLON,
+        [C_SEMI] = S_SEMI, [C_COMMA] = S_COMMA,
+        [C_LBRACE] = S_LBRACE, [C_RBRACE] = S_RBRACE,
+        [C_LPAREN] = S_LPAREN, [C_RPAREN] = S_RPAREN,
+        [C_LBRACKET] = S_LBRACKET, [C_RBRACKET] = S_RBRACKET,
+        [C_DOLLAR] = S_DOLLAR, [C_QUOTE] = S_QUOTE, [C_APOS] = S_APOS,
+        [C_HASH] = S_COMMENT
+    },
+
+    [S_WS] = {
+        [C_SPACE] = S_WS, [C_TAB] = S_WS, [C_NL] = S_WS, [C_CR] = S_WS
+    },
+    [S_COMMENT] = { ALL_CHARS(S_COMMENT), [C_NL] = S_DEAD, [C_CR] = S_DEAD },
+    [S_BLOCK] = { ALL_CHARS(S_BLOCK), [C_STAR] = S_BLOCK_STAR },
+    [S_BLOCK_STAR] = {
+        ALL_CHARS(S_BLOCK), [C_STAR] = S_BLOCK_STAR, [C_SLASH] = S_BLOCK_END
+    },
+
+    [S_ID_PATH_SCHEME] = {
+        LETTERS(S_ID_PATH_SCHEME), DIGITS(S_ID_PATH_SCHEME),
+        [C_MINUS] = S_ID_PATH_SCHEME, [C_UNDERSCORE] = S_ID_PATH,
+        [C_APOS] = S_ID, [C_DOT] = S_PATH_SCHEME, [C_PLUS] = S_PATH_SCHEME,
+        [C_SLASH] = S_PATH_SLASH, [C_COLON] = S_URI_COLON
+    },
+    [S_ID_PATH] = {
+        LETTERS(S_ID_PATH), DIGITS(S_ID_PATH), [C_MINUS] = S_ID_PATH,
+        [C_UNDERSCORE] = S_ID_PATH, [C_APOS] = S_ID,
+        [C_DOT] = S_PATH_PREFIX, [C_PLUS] = S_PATH_PREFIX,
+        [C_SLASH] = S_PATH_SLASH
+    },
+    [S_ID] = {
+        LETTERS(S_ID), DIGITS(S_ID), [C_MINUS] = S_ID,
+        [C_UNDERSCORE] = S_ID, [C_APOS] = S_ID
+    },
+    [S_PATH_SCHEME] = {
+        PATH_CONTINUE, LETTERS(S_PATH_SCHEME), DIGITS(S_PATH_SCHEME),
+        [C_MINUS] = S_PATH_SCHEME, [C_DOT] = S_PATH_SCHEME,
+        [C_PLUS] = S_PATH_SCHEME, [C_COLON] = S_URI_COLON
+    },
+    [S_PATH_PREFIX] = { PATH_CONTINUE },
+    [S_URI_COLON] = { URI_CHARS(S_URI) },
+    [S_URI] = { URI_CHARS(S_URI) },
+    [S_PATH_SLASH] = { PATH_CHARS(S_PATH), [C_DOLLAR] = S_PATH_DOLLAR },
+    [S_PATH] = {
+        PATH_CHARS(S_PATH), [C_SLASH] = S_PATH_TRAIL,
+        [C_DOLLAR] = S_PATH_DOLLAR
+    },
+    [S_PATH_TRAIL] = { PATH_CHARS(S_PATH), [C_DOLLAR] = S_PATH_DOLLAR },
+    [S_PATH_DOLLAR] = { [C_LBRACE] = S_PATH_INTERP },
+
+    [S_ZERO] = {
+        PATH_CONTINUE, DIGITS(S_INT_ZERO), [C_DOT] = S_ZERO_DOT
+    },
+    [S_INT] = { PATH_CONTINUE, DIGITS(S_INT), [C_DOT] = S_FLOAT_DOT },
+    [S_INT_ZERO] = { PATH_CONTINUE, DIGITS(S_INT_ZERO) },
+    [S_ZERO_DOT] = { PATH_CONTINUE, DIGITS(S_FLOAT) },
+    [S_FLOAT_DOT] = { PATH_CONTINUE, DIGITS(S_FLOAT), [C_E] = S_FLOAT_E },
+    [S_FLOAT] = { PATH_CONTINUE, DIGITS(S_FLOAT), [C_E] = S_FLOAT_E },
+    [S_FLOAT_E] = {
+        PATH_CONTINUE, DIGITS(S_FLOAT_EXP),
+        [C_PLUS] = S_FLOAT_SIGN, [C_MINUS] = S_FLOAT_SIGN
+    },
+    [S_FLOAT_SIGN] = { PATH_CONTINUE, DIGITS(S_FLOAT_EXP) },
+    [S_FLOAT_EXP] = { PATH_CONTINUE, DIGITS(S_FLOAT_EXP) },
+
+    [S_DOT] = { PATH_CONTINUE, DIGITS(S_FLOAT), [C_DOT] = S_DOT_DOT },
+    [S_DOT_DOT] = { PATH_CONTINUE, [C_DOT] = S_ELLIPSIS },
+    [S_ELLIPSIS] = { PATH_CONTINUE },
+    [S_PLUS] = { PATH_CONTINUE, [C_PLUS] = S_CONCAT },
+    [S_CONCAT] = { PATH_CONTINUE },
+    [S_MINUS] = { PATH_CONTINUE, [C_GT] = S_IMPL },
+
+    [S_TILDE] = { [C_SLASH] = S_HPATH_SLASH },
+    [S_HPATH_SLASH] = { PATH_CHARS(S_HPATH), [C_DOLLAR] = S_PATH_DOLLAR },
+    [S_HPATH] = {
+        PATH_CHARS(S_HPATH), [C_SLASH] = S_HPATH_TRAIL,
+        [C_DOLLAR] = S_PATH_DOLLAR
+    },
+    [S_HPATH_TRAIL] = { PATH_CHARS(S_HPATH), [C_DOLLAR] = S_PATH_DOLLAR },
+
+    [S_LT] = { PATH_CHARS(S_SPATH_BODY), [C_EQ] = S_LEQ },
+    [S_SPATH_BODY] = {
+        PATH_CHARS(S_SPATH_BODY), [C_SLASH] = S_SPATH_SLASH,
+        [C_GT] = S_SPATH
+    },
+    [S_SPATH_SLASH] = { PATH_CHARS(S_SPATH_BODY) },
+
+    [S_GT] = { [C_EQ] = S_GEQ },
+    [S_ASSIGN] = { [C_EQ] = S_EQ },
+    [S_NOT] = { [C_EQ] = S_NEQ },
+    [S_AMP] = { [C_AMP] = S_AND },
+    [S_BAR] = { [C_BAR] = S_OR },
+    [S_SLASH] = {
+        PATH_CHARS(S_PATH), [C_SLASH] = S_UPDATE, [C_STAR] = S_BLOCK,
+        [C_DOLLAR] = S_PATH_DOLLAR
+    },
+    [S_DOLLAR] = { [C_LBRACE] = S_DOLLAR_CURLY },
+    [S_APOS] = { [C_APOS] = S_IND_OPEN },
+
+    // The opening quotes of an indented string swallow the rest of the line
+    // when it is blank
+    [S_IND_OPEN] = { [C_SPACE] = S_IND_OPEN_SPACE, [C_NL] = S_IND_OPEN_NL },
+    [S_IND_OPEN_SPACE] = {
+        [C_SPACE] = S_IND_OPEN_SPACE, [C_NL] = S_IND_OPEN_NL
+    },
+
+    // Inside "strings", fragments run up to a quote or interpolation, and
+    // a backslash escapes whatever follows it
+    [S_STRING] = {
+        ALL_CHARS(S_STR), [C_QUOTE] = S_STR_CLOSE,
+        [C_DOLLAR] = S_STR_START_DOLLAR, [C_BACKSLASH] = S_STR_ESCAPE
+    },
+    [S_STR] = {
+        ALL_CHARS(S_STR), [C_QUOTE] = S_DEAD,
+        [C_DOLLAR] = S_STR_DOLLAR, [C_BACKSLASH] = S_STR_ESCAPE
+    },
+    [S_STR_DOLLAR] = {
+        ALL_CHARS(S_STR), [C_QUOTE] = S_DEAD, [C_LBRACE] = S_DEAD,
+        [C_BACKSLASH] = S_STR_ESCAPE
+    },
+    [S_STR_START_DOLLAR] = {
+        ALL_CHARS(S_STR), [C_QUOTE] = S_DEAD,
+        [C_LBRACE] = S_DOLLAR_CURLY, [C_BACKSLASH] = S_STR_ESCAPE
+    },
+    [S_STR_ESCAPE] = { ALL_CHARS(S_STR) },
+
+    // Inside ''indented strings'', two quotes close the string unless they
+    // start one of the ''$, ''' or ''\ escapes
+    [S_IND_STRING] = {
+        ALL_CHARS(S_IND_STR), [C_APOS] = S_IND_START_APOS,
+        [C_DOLLAR] = S_IND_START_DOLLAR
+    },
+    [S_IND_STR] = {
+        ALL_CHARS(S_IND_STR), [C_APOS] = S_IND_STR_APOS,
+        [C_DOLLAR] = S_IND_STR_DOLLAR
+    },
+    [S_IND_STR_APOS] = {
+        ALL_CHARS(S_IND_STR), [C_APOS] = S_IND_STR_APOS2,
+        [C_DOLLAR] = S_IND_STR_DOLLAR
+    },
+    [S_IND_STR_APOS2] = {
+        [C_DOLLAR] = S_IND_STR, [C_APOS] = S_IND_STR,
+        [C_BACKSLASH] = S_IND_ESCAPE
+    },
+    [S_IND_STR_DOLLAR] = {
+        ALL_CHARS(S_IND_STR), [C_LBRACE] = S_DEAD,
+        [C_APOS] = S_IND_STR_APOS
+    },
+    [S_IND_START_APOS] = {
+        ALL_CHARS(S_IND_STR), [C_APOS] = S_IND_CLOSE, [C_DOLLAR] = S_DEAD
+    },
+    [S_IND_START_DOLLAR] = {
+        ALL_CHARS(S_IND_STR), [C_LBRACE] = S_DOLLAR_CURLY,
+        [C_APOS] = S_IND_STR_APOS
+    },
+    [S_IND_CLOSE] = {
+        [C_DOLLAR] = S_IND_STR, [C_APOS] = S_IND_STR,
+        [C_BACKSLASH] = S_IND_ESCAPE
+    },
+    [S_IND_ESCAPE] = { ALL_CHARS(S_IND_STR) },
+
+    // After an interpolation in a path, more of the path may follow
+    [S_INPATH] = {
+        PATH_CHARS(S_PATH_STR), [C_SLASH] = S_PATH_STR_SLASH,
+        [C_DOLLAR] = S_INPATH_DOLLAR
+    },
+    [S_INPATH_DOLLAR] = { [C_LBRACE] = S_DOLLAR_CURLY },
+    [S_PATH_STR] = {
+        PATH_CHARS(S_PATH_STR), [C_SLASH] = S_PATH_STR_SLASH
+    },
+    [S_PATH_STR_SLASH] = {
+        PATH_CHARS(S_PATH_STR), [C_DOLLAR] = S_PATH_STR_DOLLAR
+    },
+    [S_PATH_STR_DOLLAR] = { [C_LBRACE] = S_PATH_STR_INTERP }
+};
+
+// The token recognized on reaching each state, or NIX_TOKEN_EOF for states
+// which do not accept
+static const uint8_t lexer_accept[STATE_COUNT] = {
+    [S_WS] = NIX_TOKEN_WHITESPACE,
+    [S_COMMENT] = NIX_TOKEN_COMMENT,
+    [S_BLOCK_END] = NIX_TOKEN_COMMENT,
+
+    // An unterminated block comment runs to the end of the file
+    [S_BLOCK] = NIX_TOKEN_ERROR,
+    [S_BLOCK_STAR] = NIX_TOKEN_ERROR,
+
+    [S_ID_PATH_SCHEME] = NIX_TOKEN_ID,
+    [S_ID_PATH] = NIX_TOKEN_ID,
+    [S_ID] = NIX_TOKEN_ID,
+    [S_URI] = NIX_TOKEN_URI,
+    [S_PATH] = NIX_TOKEN_PATH,
+    [S_HPATH] = NIX_TOKEN_HPATH,
+
+    // Nix rejects a path with a trailing slash, unless a ${ follows it
+    [S_PATH_TRAIL] = NIX_TOKEN_ERROR,
+    [S_HPATH_TRAIL] = NIX_TOKEN_ERROR,
+    [S_PATH_STR_SLASH] = NIX_TOKEN_ERROR,
+    [S_SPATH] = NIX_TOKEN_SPATH,
+
+    [S_ZERO] = NIX_TOKEN_INT,
+    [S_INT] = NIX_TOKEN_INT,
+    [S_INT_ZERO] = NIX_TOKEN_INT,
+    [S_FLOAT_DOT] = NIX_TOKEN_FLOAT,
+    [S_FLOAT] = NIX_TOKEN_FLOAT,
+    [S_FLOAT_EXP] = NIX_TOKEN_FLOAT,
+
+    [S_DOT] = NIX_TOKEN_DOT,
+    [S_ELLIPSIS] = NIX_TOKEN_ELLIPSIS,
+    [S_LT] = NIX_TOKEN_LT,
+    [S_LEQ] = NIX_TOKEN_LEQ,
+    [S_GT] = NIX_TOKEN_GT,
+    [S_GEQ] = NIX_TOKEN_GEQ,
+    [S_ASSIGN] = NIX_TOKEN_ASSIGN,
+    [S_EQ] = NIX_TOKEN_EQ,
+    [S_NOT] = NIX_TOKEN_NOT,
+    [S_NEQ] = NIX_TOKEN_NEQ,
+    [S_AND] = NIX_TOKEN_AND,
+    [S_OR] = NIX_TOKEN_OR,
+    [S_PLUS] = NIX_TOKEN_PLUS,
+    [S_CONCAT] = NIX_TOKEN_CONCAT,
+    [S_MINUS] = NIX_TOKEN_MINUS,
+    [S_IMPL] = NIX_TOKEN_IMPL,
+    [S_MUL] = NIX_TOKEN_MUL,
+    [S_SLASH] = NIX_TOKEN_DIV,
+    [S_UPDATE] = NIX_TOKEN_UPDATE,
+    [S_LBRACE] = NIX_TOKEN_LBRACE,
+    [S_RBRACE] = NIX_TOKEN_RBRACE,
+    [S_LPAREN] = NIX_TOKEN_LPAREN,
+    [S_RPAREN] = NIX_TOKEN_RPAREN,
+    [S_LBRACKET] = NIX_TOKEN_LBRACKET,
+    [S_RBRACKET] = NIX_TOKEN_RBRACKET,
+    [S_SEMI] = NIX_TOKEN_SEMICOLON,
+    [S_COLON] = NIX_TOKEN_COLON,
+    [S_COMMA] = NIX_TOKEN_COMMA,
+    [S_QUESTION] = NIX_TOKEN_QUESTION,
+    [S_AT] = NIX_TOKEN_AT,
+    [S_DOLLAR_CURLY] = NIX_TOKEN_DOLLAR_CURLY,
+    [S_QUOTE] = NIX_TOKEN_STRING_OPEN,
+    [S_IND_OPEN] = NIX_TOKEN_IND_STRING_OPEN,
+    [S_IND_OPEN_NL] = NIX_TOKEN_IND_STRING_OPEN,
+
+    [S_STR] = NIX_TOKEN_STR,
+    [S_STR_START_DOLLAR] = NIX_TOKEN_STR,
+    [S_STR_CLOSE] = NIX_TOKEN_STRING_CLOSE,
+
+    [S_IND_STR] = NIX_TOKEN_IND_STR,
+    [S_IND_START_APOS] = NIX_TOKEN_IND_STR,
+    [S_IND_START_DOLLAR] = NIX_TOKEN_IND_STR,
+    [S_IND_CLOSE] = NIX_TOKEN_IND_STRING_CLOSE,
+
+    [S_PATH_STR] = NIX_TOKEN_PATH_STR
+};
+
+enum nix_err
+nix_lexer__init(struct nix_lexer *out, struct nix_buffer *buf) {
+    struct lexer *l = (struct lexer *)out;
+
+    if (buf == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    l->p.buffer = buf;
+    l->state.mode = LEXER_NORMAL;
+    l->state.depth = 0;
+    l->state.interpolations = 0;
+
+    return NIXERR_NONE;
+}
+
+enum nix_err
+nix_lexer__construct(struct nix_lexer **out, struct nix_buffer *buf) {
+    struct lexer *l = NULL;
+    ALLOC(l, sizeof(struct lexer));
+
+    TRY(nix_lexer__init((struct nix_lexer *)l, buf));
+    *out = (struct nix_lexer *)l;
+
+    EXCEPT(err)
+    FREE(l);
+    return err;
+}
+
+enum nix_err
+nix_lexer__next(struct nix_lexer *lex, struct nix_token *out) {
+    struct lexer *l = (struct lexer *)lex;
+    struct nix_buffer *buf = l->p.buffer;
+
+    // The previous token stays in the buffer as the current lexeme until the
+    // next one is requested, so callers can fetch or intern its text
+    TRY(nix_buffer__discard_lexeme(buf, 0));
+    TRY(nix_position__copy(&out->start, buf->read));
+
+    enum nix_token_kind kind;
+    TRY(__lexer_scan(l, &kind));
+    TRY(__lexer_transition(&l->state, kind));
+
+    out->kind = kind;
+    TRY(nix_position__copy(&out->end, buf->read));
+
+    EXCEPT(err)
+
+    // Nothing of a token that failed partway is taken, so fed input which
+    // ran out can be scanned again from the token's start once there's more
+    if (err == NIXERR_BUF_WOULDBLOCK || err == NIXERR_BUF_EXHAUST) {
+        nix_buffer__rewind(buf);
+    }
+
+    return err;
+}
+
+enum nix_err
+__lexer_scan(struct lexer *l, enum nix_token_kind *out) {
+    struct nix_buffer *buf = l->p.buffer;
+
+    uint8_t state = lexer_start[l->state.mode];
+    enum nix_token_kind accepted = NIX_TOKEN_EOF;
+    size_t length = 0;
+    bool at_end = false;
+
+    // The first characters are packed into a word as they are scanned, so
+    // identifiers can be checked against the keyword table without reading
+    // their text back out of the buffer
+    uint64_t word = 0;
+    uint64_t accepted_word = 0;
+    size_t accepted_length = 0;
+
+    for (;;) {
+        uint32_t c;
+        enum nix_err peek_err = nix_buffer__peek(buf, &c);
+
+        if (peek_err == NIXERR_BUF_EOF || peek_err == NIXERR_BUF_PAST_EOF) {
+            at_end = true;
+            break;
+        }
+
+        // Long comments are split when the buffer can't hold them, and the
+        // next token carries on inside them
+        if (peek_err == NIXERR_BUF_EXHAUST &&
+                lexer_resume[state] != LEXER_NORMAL) {
+            *out = NIX_TOKEN_COMMENT;
+            l->state.mode = lexer_resume[state];
+            return nix_buffer__reset_peek(buf);
+        }
+
+        // So are long text and whitespace
+        if (peek_err == NIXERR_BUF_EXHAUST && __lexer_is_splittable(accepted)) {
+            break;
+        }
+
+        TRY(peek_err);
+
+        uint8_t class = c < 0x80 ? lexer_classes[c] : C_OTHER;
+        state = lexer_transitions[state][class];
+        if (state == S_DEAD) {
+            break;
+        }
+
+        // The path before a ${ is a token of its own, so go back to just
+        // before the $
+        if (state == S_PATH_INTERP || state == S_PATH_STR_INTERP) {
+            TRY(nix_buffer__reset_peek(buf));
+            for (size_t i = accepted_length; i < length - 1; i++) {
+                TRY(nix_buffer__peek(buf, &c));
+            }
+
+            TRY(nix_buffer__commit_peek(buf));
+            accepted = state == S_PATH_INTERP ?
+                NIX_TOKEN_PATH_START : NIX_TOKEN_PATH_STR;
+            break;
+        }
+
+        if (length < sizeof(word)) {
+            word |= (uint64_t)(c & 0xFF) << (8 * length);
+        }
+
+        length++;
+
+        if (lexer_accept[state] != NIX_TOKEN_EOF) {
+            accepted = lexer_accept[state];
+            accepted_word = word;
+            accepted_length = length;
+            TRY(nix_buffer__commit_peek(buf));
+        }
+    }
+
+    TRY(nix_buffer__reset_peek(buf));
+
+    // The last piece of a split comment ends it, and a line comment split
+    // just before its newline has nothing left
+    if (l->state.mode >= LEXER_LINE_COMMENT) {
+        l->state.mode = LEXER_NORMAL;
+        if (accepted == NIX_TOKEN_EOF) {
+            return __lexer_scan(l, out);
+        }
+    }
+
+    // A path ends at the first thing that can't carry it on, without taking
+    // any of the input
+    if (accepted == NIX_TOKEN_EOF && l->state.mode == LEXER_PATH) {
+        *out = NIX_TOKEN_PATH_END;
+        return NIXERR_NONE;
+    }
+
+    if (accepted == NIX_TOKEN_EOF) {
+        if (at_end && length == 0) {
+            *out = NIX_TOKEN_EOF;
+            return NIXERR_NONE;
+        }
+
+        // Nothing matched, so skip a single character
+        uint32_t c;
+        TRY(nix_buffer__read(buf, &c));
+
+        *out = NIX_TOKEN_ERROR;
+        return NIXERR_NONE;
+    }
+
+    if (accepted == NIX_TOKEN_ID && accepted_length <= KEYWORD_MAX_LENGTH) {
+        uint64_t packed = accepted_word |
+            (uint64_t)accepted_length << KEYWORD_LENGTH_SHIFT;
+
+        enum nix_keyword keyword = __keyword_lookup_word(packed);
+        if (keyword != NIX_KEYWORD_NONE) {
+            accepted = NIX_TOKEN_KW_LET + (keyword - NIX_KEYWORD_LET);
+        }
+    }
+
+    *out = accepted;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__lexer_transition(struct lexer_state *state, enum nix_token_kind kind) {
+    switch (kind) {
+    case NIX_TOKEN_STRING_OPEN:
+        state->mode = LEXER_STRING;
+        break;
+
+    case NIX_TOKEN_IND_STRING_OPEN:
+        state->mode = LEXER_IND_STRING;
+        break;
+
+    case NIX_TOKEN_PATH_START:
+        state->mode = LEXER_PATH;
+        break;
+
+    case NIX_TOKEN_STRING_CLOSE:
+    case NIX_TOKEN_IND_STRING_CLOSE:
+    case NIX_TOKEN_PATH_END:
+        state->mode = LEXER_NORMAL;
+        break;
+
+    case NIX_TOKEN_DOLLAR_CURLY:
+    case NIX_TOKEN_LBRACE:
+        if (state->depth == LEXER_MAX_DEPTH) {
+            return NIXERR_LEX_DEPTH;
+        }
+
+        state->stack[state->depth++] = state->mode;
+        if (state->mode != LEXER_NORMAL) {
+            state->interpolations++;
+        }
+
+        state->mode = LEXER_NORMAL;
+        break;
+
+    case NIX_TOKEN_RBRACE:
+        // An unbalanced brace is left for the parser to report
+        if (state->depth == 0) {
+            break;
+        }
+
+        state->mode = state->stack[--state->depth];
+        if (state->mode != LEXER_NORMAL) {
+            state->interpolations--;
+        }
+
+        break;
+
+    default:
+        break;
+    }
+
+    return NIXERR_NONE;
+}
+
+void
+nix_lexer__free(struct nix_lexer **out) {
+    if (*out == NULL) return;
+
+    FREE(*out);
+
+    *out = NULL;
+}
+
+const char *
+nix_token__name(enum nix_token_kind kind) {
+    static const char *names[NIX_TOKEN_KIND_COUNT] = {
+        [NIX_TOKEN_EOF] = "EOF",
+        [NIX_TOKEN_ERROR] = "ERROR",
+        [NIX_TOKEN_WHITESPACE] = "WHITESPACE",
+        [NIX_TOKEN_COMMENT] = "COMMENT",
+        [NIX_TOKEN_ID] = "ID",
+        [NIX_TOKEN_INT] = "INT",
+        [NIX_TOKEN_FLOAT] = "FLOAT",
+        [NIX_TOKEN_PATH] = "PATH",
+        [NIX_TOKEN_HPATH] = "HPATH",
+        [NIX_TOKEN_SPATH] = "SPATH",
+        [NIX_TOKEN_URI] = "URI",
+        [NIX_TOKEN_STRING_OPEN] = "STRING_OPEN",
+        [NIX_TOKEN_STRING_CLOSE] = "STRING_CLOSE",
+        [NIX_TOKEN_STR] = "STR",
+        [NIX_TOKEN_IND_STRING_OPEN] = "IND_STRING_OPEN",
+        [NIX_TOKEN_IND_STRING_CLOSE] = "IND_STRING_CLOSE",
+        [NIX_TOKEN_IND_STR] = "IND_STR",
+        [NIX_TOKEN_DOLLAR_CURLY] = "DOLLAR_CURLY",
+        [NIX_TOKEN_PATH_START] = "PATH_START",
+        [NIX_TOKEN_PATH_STR] = "PATH_STR",
+        [NIX_TOKEN_PATH_END] = "PATH_END",
+        [NIX_TOKEN_KW_LET] = "let",
+        [NIX_TOKEN_KW_IN] = "in",
+        [NIX_TOKEN_KW_REC] = "rec",
+        [NIX_TOKEN_KW_WITH] = "with",
+        [NIX_TOKEN_KW_INHERIT] = "inherit",
+        [NIX_TOKEN_KW_IF] = "if",
+        [NIX_TOKEN_KW_THEN] = "then",
+        [NIX_TOKEN_KW_ELSE] = "else",
+        [NIX_TOKEN_KW_ASSERT] = "assert",
+        [NIX_TOKEN_KW_OR] = "or",
+        [NIX_TOKEN_ELLIPSIS] = "...",
+        [NIX_TOKEN_EQ] = "==",
+        [NIX_TOKEN_NEQ] = "!=",
+        [NIX_TOKEN_LEQ] = "<=",
+        [NIX_TOKEN_GEQ] = ">=",
+        [NIX_TOKEN_AND] = "&&",
+        [NIX_TOKEN_OR] = "||",
+        [NIX_TOKEN_IMPL] = "->",
+        [NIX_TOKEN_UPDATE] = "//",
+        [NIX_TOKEN_CONCAT] = "++",
+        [NIX_TOKEN_LBRACE] = "{",
+        [NIX_TOKEN_RBRACE] = "}",
+        [NIX_TOKEN_LPAREN] = "(",
+        [NIX_TOKEN_RPAREN] = ")",
+        [NIX_TOKEN_LBRACKET] = "[",
+        [NIX_TOKEN_RBRACKET] = "]",
+        [NIX_TOKEN_SEMICOLON] = ";",
+        [NIX_TOKEN_COLON] = ":",
+        [NIX_TOKEN_COMMA] = ",",
+        [NIX_TOKEN_DOT] = ".",
+        [NIX_TOKEN_ASSIGN] = "=",
+        [NIX_TOKEN_QUESTION] = "?",
+        [NIX_TOKEN_NOT] = "!",
+        [NIX_TOKEN_PLUS] = "+",
+        [NIX_TOKEN_MINUS] = "-",
+        [NIX_TOKEN_MUL] = "*",
+        [NIX_TOKEN_DIV] = "/",
+        [NIX_TOKEN_LT] = "<",
+        [NIX_TOKEN_GT] = ">",
+        [NIX_TOKEN_AT] = "@"
+    };
+
+    if (kind >= NIX_TOKEN_KIND_COUNT) {
+        return NULL;
+    }
+
+    return names[kind];
+}
+
+bool
+nix_token__is_trivia(enum nix_token_kind kind) {
+    return kind == NIX_TOKEN_WHITESPACE || kind == NIX_TOKEN_COMMENT;
+}
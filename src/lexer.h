@@ -0,0 +1,64 @@
+#ifndef INCLUDE_lexer_h__
+#define INCLUDE_lexer_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "libnix/lexer.h"
+
+// Each `{` and `${` pushes the mode to return to on the matching `}`, so
+// this bounds how deeply braces and interpolations may nest
+#define LEXER_MAX_DEPTH 256
+
+enum lexer_mode {
+    LEXER_NORMAL = 0,
+    LEXER_STRING,
+    LEXER_IND_STRING,
+    LEXER_PATH,
+
+    // Partway through a comment too long for the buffer, which was split
+    // after a plain character, or after a * in a block comment
+    LEXER_LINE_COMMENT,
+    LEXER_BLOCK_COMMENT,
+    LEXER_BLOCK_COMMENT_STAR
+};
+
+struct lexer_state {
+    uint8_t mode;
+    uint16_t depth;
+
+    // How many entries on the stack return into a string
+    uint16_t interpolations;
+
+    uint8_t stack[LEXER_MAX_DEPTH];
+};
+
+struct lexer {
+    struct nix_lexer p;
+
+    struct lexer_state state;
+};
+
+enum nix_err
+__lexer_scan(struct lexer *, enum nix_token_kind *);
+
+enum nix_err
+__lexer_transition(struct lexer_state *, enum nix_token_kind);
+
+// A clean state is one a fresh lexer would also be in: lexing normal code,
+// with only plain braces (which behave the same when unbalanced) open
+static inline bool
+__lexer_is_clean(struct lexer_state *state) {
+    return state->mode == LEXER_NORMAL && state->interpolations == 0;
+}
+
+// Text and trivia mean the same when split in two, since lexing carries on
+// in the same mode, or inside the same comment
+static inline bool
+__lexer_is_splittable(enum nix_token_kind kind) {
+    return kind == NIX_TOKEN_STR || kind == NIX_TOKEN_IND_STR ||
+        kind == NIX_TOKEN_PATH_STR || kind == NIX_TOKEN_WHITESPACE ||
+        kind == NIX_TOKEN_COMMENT;
+}
+
+#endif
@@ -0,0 +1,677 @@
+#define _GNU_SOURCE
+
+#include <locale.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "number.h"
+#include "common.h"
+#include "error.h"
+#include "pow5_table.h"
+#include "pow10_table.h"
+
+static const double number_powers[DOUBLE_MAX_EXACT_POWER + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+    1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// The C library's conversions follow the locale, which a host program may
+// have set to one with a different decimal point, so they're made in the C
+// locale whatever it is
+static locale_t __number_locale = (locale_t)0;
+static pthread_once_t __number_locale_once = PTHREAD_ONCE_INIT;
+
+static void
+__number_locale_create(void) {
+    __number_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+}
+
+enum nix_err
+__number_c_locale(locale_t *out) {
+    pthread_once(&__number_locale_once, &__number_locale_create);
+    if (__number_locale == (locale_t)0) {
+        return NIXERR_NOMEMORY;
+    }
+
+    *out = __number_locale;
+    return NIXERR_NONE;
+}
+
+enum nix_err
+nix_number__parse_int(const char *text, size_t length, int64_t *out) {
+    if (text == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    size_t i = 0;
+    bool negative = false;
+
+    if (length > 0 && text[0] == '-') {
+        negative = true;
+        i++;
+    }
+
+    if (i == length) {
+        return NIXERR_NUM_SYNTAX;
+    }
+
+    // Leading zeros don't count towards the digits that fit in a word
+    while (i + 1 < length && text[i] == '0') {
+        i++;
+    }
+
+    // Input too long to fit is still checked to the end, so that malformed
+    // text reports a syntax error rather than a range one
+    if (length - i > NUMBER_MAX_DIGITS) {
+        for (; i < length; i++) {
+            if ((uint8_t)(text[i] - '0') > 9) {
+                return NIXERR_NUM_SYNTAX;
+            }
+        }
+
+        return NIXERR_NUM_RANGE;
+    }
+
+    uint64_t value = 0;
+
+    for (; length - i >= 8; i += 8) {
+        uint64_t word = __number_load(text + i);
+        if (!__number_is_eight_digits(word)) {
+            break;
+        }
+
+        value = value * 100000000 + __number_parse_eight(word);
+    }
+
+    for (; i < length; i++) {
+        uint8_t digit = (uint8_t)text[i] - '0';
+        if (digit > 9) {
+            return NIXERR_NUM_SYNTAX;
+        }
+
+        value = value * 10 + digit;
+    }
+
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : INT64_MAX;
+    if (value > limit) {
+        return NIXERR_NUM_RANGE;
+    }
+
+    *out = negative ? -(int64_t)(value - 1) - 1 : (int64_t)value;
+
+    return NIXERR_NONE;
+}
+
+enum nix_err
+nix_number__parse_float(const char *text, size_t length, double *out) {
+    char *copy = NULL;
+
+    if (text == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    struct number_decimal d;
+    TRY(__number_parse_decimal(text, length, &d));
+
+    double value;
+
+    // Clinger's fast path, when both operands are exact doubles
+    if (!d.truncated && d.mantissa <= DOUBLE_MAX_EXACT_INT &&
+            d.exponent >= -DOUBLE_MAX_EXACT_POWER &&
+            d.exponent <= DOUBLE_MAX_EXACT_POWER) {
+        value = (double)d.mantissa;
+        if (d.exponent < 0) {
+            value /= number_powers[-d.exponent];
+        } else {
+            value *= number_powers[d.exponent];
+        }
+    } else {
+        uint64_t bits = __number_eisel_lemire(d.exponent, d.mantissa);
+
+        // With digits dropped, the true value lies between the mantissa and
+        // the next one up; if those round differently, only an exact parse
+        // can decide
+        if (d.truncated &&
+                __number_eisel_lemire(d.exponent, d.mantissa + 1) != bits) {
+            locale_t c;
+            TRY(__number_c_locale(&c));
+
+            ALLOC(copy, length + 1);
+            memcpy(copy, text, length);
+            copy[length] = '\0';
+
+            value = fabs(strtod_l(copy, NULL, c));
+            free(copy);
+        } else {
+            memcpy(&value, &bits, sizeof(value));
+        }
+    }
+
+    if (isinf(value)) {
+        return NIXERR_NUM_RANGE;
+    }
+
+    *out = d.negative ? -value : value;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__number_parse_decimal(
+    const char *text,
+    size_t length,
+    struct number_decimal *out)
+{
+    size_t i = 0;
+    size_t digits = 0;
+    bool seen_digit = false;
+
+    out->negative = false;
+    out->mantissa = 0;
+    out->exponent = 0;
+    out->truncated = false;
+
+    if (length > 0 && text[0] == '-') {
+        out->negative = true;
+        i++;
+    }
+
+    // Two passes over the digits: the integer part, then the fraction, whose
+    // digits each scale the mantissa down by ten
+    for (int part = 0; part < 2; part++) {
+        int64_t scale = part == 0 ? 0 : -1;
+
+        for (;;) {
+            if (out->mantissa != 0 && digits + 8 <= NUMBER_MAX_DIGITS &&
+                    length - i >= 8) {
+                uint64_t word = __number_load(text + i);
+                if (__number_is_eight_digits(word)) {
+                    out->mantissa = out->mantissa * 100000000 +
+                        __number_parse_eight(word);
+                    out->exponent += scale * 8;
+                    digits += 8;
+                    i += 8;
+                    continue;
+                }
+            }
+
+            if (i == length || (uint8_t)(text[i] - '0') > 9) {
+                break;
+            }
+
+            uint8_t digit = text[i++] - '0';
+            seen_digit = true;
+
+            if (out->mantissa == 0 && digit == 0) {
+                out->exponent += scale;
+            } else if (digits < NUMBER_MAX_DIGITS) {
+                out->mantissa = out->mantissa * 10 + digit;
+                out->exponent += scale;
+                digits++;
+            } else {
+                // Dropped integer digits still scale the value up
+                out->exponent += part == 0 ? 1 : 0;
+                out->truncated |= digit != 0;
+            }
+        }
+
+        if (part == 0) {
+            if (i == length || text[i] != '.') {
+                break;
+            }
+
+            i++;
+        }
+    }
+
+    if (!seen_digit) {
+        return NIXERR_NUM_SYNTAX;
+    }
+
+    if (i < length && (text[i] == 'e' || text[i] == 'E')) {
+        i++;
+
+        bool negative = false;
+        if (i < length && (text[i] == '+' || text[i] == '-')) {
+            negative = text[i] == '-';
+            i++;
+        }
+
+        if (i == length) {
+            return NIXERR_NUM_SYNTAX;
+        }
+
+        // Exponents past this range round to zero or infinity anyway
+        int64_t exponent = 0;
+        for (; i < length && (uint8_t)(text[i] - '0') <= 9; i++) {
+            if (exponent < 100000) {
+                exponent = exponent * 10 + (text[i] - '0');
+            }
+        }
+
+        out->exponent += negative ? -exponent : exponent;
+    }
+
+    if (i != length) {
+        return NIXERR_NUM_SYNTAX;
+    }
+
+    return NIXERR_NONE;
+}
+
+// The bits of the double nearest to w * 10^q, by multiplying w with a
+// 128-bit approximation of 5^q. This is always enough to round correctly
+// when w holds every digit of the number.
+uint64_t
+__number_eisel_lemire(int64_t q, uint64_t w) {
+    if (w == 0 || q < POW5_SMALLEST_POWER) {
+        return 0;
+    }
+
+    if (q > POW5_LARGEST_POWER) {
+        return (uint64_t)DOUBLE_INFINITE_POWER << DOUBLE_MANTISSA_BITS;
+    }
+
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+
+    size_t index = 2 * (size_t)(q - POW5_SMALLEST_POWER);
+    unsigned __int128 product = (unsigned __int128)w * pow5_table[index];
+    uint64_t high = (uint64_t)(product >> 64);
+    uint64_t low = (uint64_t)product;
+
+    // Only when the bits below the mantissa are all ones could the rest of
+    // the power change the result
+    const uint64_t precision_mask = UINT64_MAX >> (DOUBLE_MANTISSA_BITS + 3);
+    if ((high & precision_mask) == precision_mask) {
+        unsigned __int128 second = (unsigned __int128)w *
+            pow5_table[index + 1];
+        uint64_t second_high = (uint64_t)(second >> 64);
+
+        low += second_high;
+        if (second_high > low) {
+            high++;
+        }
+    }
+
+    int upperbit = (int)(high >> 63);
+    int shift = upperbit + 64 - DOUBLE_MANTISSA_BITS - 3;
+    uint64_t mantissa = high >> shift;
+
+    // floor(log2(10^q)) + 63, and the exponent bias
+    int64_t power2 = (((152170 + 65536) * q) >> 16) + 63 + upperbit - lz -
+        DOUBLE_MIN_EXPONENT;
+
+    if (power2 <= 0) {
+        // Subnormal, or too small even for that
+        if (-power2 + 1 >= 64) {
+            return 0;
+        }
+
+        mantissa >>= -power2 + 1;
+        mantissa += mantissa & 1;
+        mantissa >>= 1;
+
+        power2 = mantissa < ((uint64_t)1 << DOUBLE_MANTISSA_BITS) ? 0 : 1;
+        return (mantissa & (((uint64_t)1 << DOUBLE_MANTISSA_BITS) - 1)) |
+            ((uint64_t)power2 << DOUBLE_MANTISSA_BITS);
+    }
+
+    // An exact halfway case rounds to even rather than up
+    if (low <= 1 && q >= DOUBLE_MIN_ROUND_TO_EVEN &&
+            q <= DOUBLE_MAX_ROUND_TO_EVEN && (mantissa & 3) == 1 &&
+            (mantissa << shift) == high) {
+        mantissa &= ~(uint64_t)1;
+    }
+
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+
+    if (mantissa >= ((uint64_t)2 << DOUBLE_MANTISSA_BITS)) {
+        mantissa = (uint64_t)1 << DOUBLE_MANTISSA_BITS;
+        power2++;
+    }
+
+    mantissa &= ~((uint64_t)1 << DOUBLE_MANTISSA_BITS);
+
+    if (power2 >= DOUBLE_INFINITE_POWER) {
+        return (uint64_t)DOUBLE_INFINITE_POWER << DOUBLE_MANTISSA_BITS;
+    }
+
+    return mantissa | ((uint64_t)power2 << DOUBLE_MANTISSA_BITS);
+}
+
+// The shortest decimal that reads back as value, which must be finite and
+// not zero, using Schubfach: scale the value and both ends of its rounding
+// interval by a power of ten, then pick the decimal with the fewest digits
+// inside the interval, or the closest of those when there are two
+void
+__number_shortest(double value, struct number_decimal *out) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    const uint64_t hidden = (uint64_t)1 << DOUBLE_MANTISSA_BITS;
+    uint64_t fraction = bits & (hidden - 1);
+    int32_t biased = (int32_t)(bits >> DOUBLE_MANTISSA_BITS) &
+        DOUBLE_INFINITE_POWER;
+
+    out->negative = bits >> 63;
+    out->truncated = false;
+
+    uint64_t c;
+    int32_t q;
+
+    if (biased != 0) {
+        c = hidden | fraction;
+        q = biased + DOUBLE_MIN_EXPONENT - DOUBLE_MANTISSA_BITS;
+
+        // Whole numbers below 2^53 are exactly their own digits
+        if (q <= 0 && q > -DOUBLE_MANTISSA_BITS - 1 &&
+                (c & (((uint64_t)1 << -q) - 1)) == 0) {
+            out->mantissa = c >> -q;
+            out->exponent = 0;
+            goto strip;
+        }
+    } else {
+        c = fraction;
+        q = 1 + DOUBLE_MIN_EXPONENT - DOUBLE_MANTISSA_BITS;
+    }
+
+    // The interval ends are only part of it when c is even, since ties in
+    // parsing round to even. Below a power of two the gap to the next double
+    // down is half as wide.
+    bool even = (c & 1) == 0;
+    bool closer = fraction == 0 && biased > 1;
+
+    uint64_t cbl = 4 * c - 2 + closer;
+    uint64_t cb = 4 * c;
+    uint64_t cbr = 4 * c + 2;
+
+    int32_t k = __number_floor_log10_pow2(q, closer);
+    int32_t h = q + __number_floor_log2_pow10(-k) + 1;
+
+    size_t index = 2 * (size_t)(-k - POW10_SMALLEST_POWER);
+    uint64_t g_high = pow10_table[index];
+    uint64_t g_low = pow10_table[index + 1];
+
+    // Four times the value and the interval ends, times 10^-k
+    uint64_t vbl = __number_round_to_odd(g_high, g_low, cbl << h);
+    uint64_t vb = __number_round_to_odd(g_high, g_low, cb << h);
+    uint64_t vbr = __number_round_to_odd(g_high, g_low, cbr << h);
+
+    uint64_t lower = vbl + !even;
+    uint64_t upper = vbr - !even;
+
+    uint64_t s = vb / 4;
+
+    // One digit fewer, if exactly one of the neighbours is inside
+    if (s >= 10) {
+        uint64_t sp = s / 10;
+        bool up_inside = lower <= 40 * sp;
+        bool wp_inside = 40 * sp + 40 <= upper;
+
+        if (up_inside != wp_inside) {
+            out->mantissa = sp + wp_inside;
+            out->exponent = k + 1;
+            goto strip;
+        }
+    }
+
+    bool u_inside = lower <= 4 * s;
+    bool w_inside = 4 * s + 4 <= upper;
+
+    if (u_inside != w_inside) {
+        out->mantissa = s + w_inside;
+        out->exponent = k;
+        goto strip;
+    }
+
+    // Both are inside, so take the closer, or the even one on a tie
+    uint64_t mid = 4 * s + 2;
+    bool round_up = vb > mid || (vb == mid && (s & 1) != 0);
+
+    out->mantissa = s + round_up;
+    out->exponent = k;
+
+strip:
+    while (out->mantissa % 10 == 0) {
+        out->mantissa /= 10;
+        out->exponent++;
+    }
+}
+
+static const char number_digit_pairs[200] =
+    "00010203040506070809101112131415161718192021222324252627282930313233"
+    "34353637383940414243444546474849505152535455565758596061626364656667"
+    "6869707172737475767778798081828384858687888990919293949596979899";
+
+// Write the decimal digits of value, returning how many there were
+size_t
+__number_write_digits(char *out, uint64_t value) {
+    char digits[NUMBER_MAX_DIGITS + 1];
+    size_t i = sizeof(digits);
+
+    while (value >= 100) {
+        size_t pair = 2 * (value % 100);
+        value /= 100;
+
+        digits[--i] = number_digit_pairs[pair + 1];
+        digits[--i] = number_digit_pairs[pair];
+    }
+
+    if (value >= 10) {
+        digits[--i] = number_digit_pairs[2 * value + 1];
+        digits[--i] = number_digit_pairs[2 * value];
+    } else {
+        digits[--i] = (char)('0' + value);
+    }
+
+    size_t n = sizeof(digits) - i;
+    memcpy(out, digits + i, n);
+
+    return n;
+}
+
+// Lay out the shortest digits the way builtins.toJSON does, returning the
+// length written. out must hold NIX_NUMBER_FLOAT_SIZE bytes.
+size_t
+__number_format_json(double value, char *out) {
+    char *p = out;
+
+    if (!isfinite(value)) {
+        memcpy(out, "null", 5);
+        return 4;
+    }
+
+    if (signbit(value)) {
+        *p++ = '-';
+    }
+
+    if (value == 0) {
+        memcpy(p, "0.0", 4);
+        return (size_t)(p - out) + 3;
+    }
+
+    struct number_decimal d;
+    __number_shortest(value, &d);
+
+    int k = (int)__number_write_digits(p, d.mantissa);
+
+    // Where the decimal point goes, counted from the start of the digits
+    int n = k + (int)d.exponent;
+
+    if (k <= n && n <= NUMBER_JSON_MAX_POINT) {
+        // 1234e7 -> 12340000000.0
+        memset(p + k, '0', n - k);
+        p += n;
+        memcpy(p, ".0", 2);
+        p += 2;
+    } else if (0 < n && n <= NUMBER_JSON_MAX_POINT) {
+        // 1234e-2 -> 12.34
+        memmove(p + n + 1, p + n, k - n);
+        p[n] = '.';
+        p += k + 1;
+    } else if (NUMBER_JSON_MIN_POINT < n && n <= 0) {
+        // 1234e-6 -> 0.001234
+        memmove(p + 2 - n, p, k);
+        p[0] = '0';
+        p[1] = '.';
+        memset(p + 2, '0', -n);
+        p += 2 - n + k;
+    } else {
+        // 1234e30 -> 1.234e+33, and 1e+33 for a single digit
+        if (k > 1) {
+            memmove(p + 2, p + 1, k - 1);
+            p[1] = '.';
+            p += k + 1;
+        } else {
+            p += 1;
+        }
+
+        int exponent = n - 1;
+        *p++ = 'e';
+        *p++ = exponent < 0 ? '-' : '+';
+        exponent = abs(exponent);
+
+        // At least two exponent digits
+        if (exponent >= 100) {
+            *p++ = (char)('0' + exponent / 100);
+            exponent %= 100;
+        }
+
+        *p++ = number_digit_pairs[2 * exponent];
+        *p++ = number_digit_pairs[2 * exponent + 1];
+    }
+
+    *p = '\0';
+    return (size_t)(p - out);
+}
+
+enum nix_err
+nix_number__format_float(
+    double value,
+    enum nix_float_format format,
+    char *out,
+    size_t size,
+    size_t *length)
+{
+    char text[NIX_NUMBER_FLOAT_SIZE];
+    size_t n;
+
+    if (out == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    if (format == NIX_FLOAT_FORMAT_TO_STRING) {
+        locale_t c;
+        enum nix_err err = __number_c_locale(&c);
+        if (err != NIXERR_NONE) {
+            return err;
+        }
+
+        // Six fixed decimals need exact arithmetic on the whole binary
+        // value rather than its shortest digits, which the C library has
+        locale_t previous = uselocale(c);
+        n = (size_t)snprintf(text, sizeof(text), "%f", value);
+        uselocale(previous);
+    } else {
+        n = __number_format_json(value, text);
+    }
+
+    if (n >= size) {
+        return NIXERR_BUF_INVLEN;
+    }
+
+    memcpy(out, text, n + 1);
+    if (length != NULL) {
+        *length = n;
+    }
+
+    return NIXERR_NONE;
+}
+
+// Copy the lexeme's text into bytes, using the scratch space when it fits
+enum nix_err
+__number_from_lexeme(
+    struct nix_lexeme *lexeme,
+    char *scratch,
+    char **out,
+    size_t *length)
+{
+    if (lexeme == NULL || lexeme->start == NULL || lexeme->end == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    size_t n = lexeme->end->abs - lexeme->start->abs;
+    char *text = scratch;
+
+    if (n > NUMBER_SCRATCH_SIZE) {
+        ALLOC(text, n);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (lexeme->text[i] > 0x7F) {
+            TRY(NIXERR_NUM_SYNTAX);
+        }
+
+        text[i] = (char)lexeme->text[i];
+    }
+
+    *out = text;
+    *length = n;
+
+    EXCEPT(err)
+    if (text != scratch) {
+        FREE(text);
+    }
+
+    return err;
+}
+
+enum nix_err
+nix_number__parse_int_lexeme(struct nix_lexeme *lexeme, int64_t *out) {
+    char scratch[NUMBER_SCRATCH_SIZE];
+    char *text = NULL;
+    size_t length;
+
+    TRY(__number_from_lexeme(lexeme, scratch, &text, &length));
+    TRY(nix_number__parse_int(text, length, out));
+
+    if (text != scratch) {
+        free(text);
+    }
+
+    EXCEPT(err)
+    if (text != NULL && text != scratch) {
+        FREE(text);
+    }
+
+    return err;
+}
+
+enum nix_err
+nix_number__parse_float_lexeme(struct nix_lexeme *lexeme, double *out) {
+    char scratch[NUMBER_SCRATCH_SIZE];
+    char *text = NULL;
+    size_t length;
+
+    TRY(__number_from_lexeme(lexeme, scratch, &text, &length));
+    TRY(nix_number__parse_float(text, length, out));
+
+    if (text != scratch) {
+        free(text);
+    }
+
+    EXCEPT(err)
+    if (text != NULL && text != scratch) {
+        FREE(text);
+    }
+
+    return err;
+}
@@ -0,0 +1,130 @@
+#ifndef INCLUDE_number_h__
+#define INCLUDE_number_h__
+
+#include <locale.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnix/number.h"
+
+// Lexemes up to this many code points are copied to the stack for parsing
+#define NUMBER_SCRATCH_SIZE 64
+
+// A uint64_t holds any 19 decimal digits
+#define NUMBER_MAX_DIGITS 19
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_MIN_EXPONENT (-1023)
+#define DOUBLE_INFINITE_POWER 0x7FF
+
+// Decimal exponents where products can land exactly halfway between two
+// doubles, and need rounding to even
+#define DOUBLE_MIN_ROUND_TO_EVEN (-4)
+#define DOUBLE_MAX_ROUND_TO_EVEN 23
+
+// Integers up to 2^53 and powers of ten up to 10^22 are exact doubles, so
+// their product or quotient is correctly rounded
+#define DOUBLE_MAX_EXACT_INT ((uint64_t)1 << 53)
+#define DOUBLE_MAX_EXACT_POWER 22
+
+// The decimal point positions, counted from the start of the digits, that
+// JSON output writes in fixed rather than scientific notation
+#define NUMBER_JSON_MIN_POINT (-4)
+#define NUMBER_JSON_MAX_POINT 15
+
+struct number_decimal {
+    bool negative;
+
+    // The first NUMBER_MAX_DIGITS significant digits, and the power of ten
+    // to scale them by
+    uint64_t mantissa;
+    int64_t exponent;
+
+    // Whether any non-zero digits were dropped from the mantissa
+    bool truncated;
+};
+
+enum nix_err
+__number_c_locale(locale_t *);
+
+enum nix_err
+__number_parse_decimal(const char *, size_t, struct number_decimal *);
+
+uint64_t
+__number_eisel_lemire(int64_t, uint64_t);
+
+void
+__number_shortest(double, struct number_decimal *);
+
+size_t
+__number_write_digits(char *, uint64_t);
+
+size_t
+__number_format_json(double, char *);
+
+enum nix_err
+__number_from_lexeme(struct nix_lexeme *, char *, char **, size_t *);
+
+// Load eight characters so the first is in the lowest byte
+static inline uint64_t
+__number_load(const char *text) {
+    uint64_t word;
+    memcpy(&word, text, sizeof(word));
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+
+    return word;
+}
+
+// Whether all eight bytes of the word are ASCII digits: adding 0x46 carries
+// into the top bit of bytes above '9', and subtracting 0x30 borrows into it
+// for bytes below '0'
+static inline bool
+__number_is_eight_digits(uint64_t word) {
+    return (((word + 0x4646464646464646ULL) |
+        (word - 0x3030303030303030ULL)) & 0x8080808080808080ULL) == 0;
+}
+
+// The value of eight ASCII digits loaded little-endian, so the first digit
+// is the lowest byte, using three multiplies instead of eight
+static inline uint32_t
+__number_parse_eight(uint64_t word) {
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 100 + (1000000ULL << 32);
+    const uint64_t mul2 = 1 + (10000ULL << 32);
+
+    word -= 0x3030303030303030ULL;
+    word = (word * 10) + (word >> 8);
+    word = (((word & mask) * mul1) + (((word >> 16) & mask) * mul2)) >> 32;
+
+    return (uint32_t)word;
+}
+
+// The top 64 bits of the 192-bit product of g and cp, with the lowest bit
+// set when anything was cut off, so the rounding direction survives
+static inline uint64_t
+__number_round_to_odd(uint64_t g_high, uint64_t g_low, uint64_t cp) {
+    unsigned __int128 low = (unsigned __int128)g_low * cp;
+    unsigned __int128 high = (unsigned __int128)g_high * cp + (low >> 64);
+
+    return (uint64_t)(high >> 64) | ((uint64_t)high > 1);
+}
+
+// floor(log10(2^q)), or floor(log10(3/4 * 2^q)) when three_quarters is set,
+// for the exponents of every double
+static inline int32_t
+__number_floor_log10_pow2(int32_t q, bool three_quarters) {
+    return (q * 1262611 - (three_quarters ? 524031 : 0)) >> 22;
+}
+
+// floor(log2(10^e)) for the exponents of every double
+static inline int32_t
+__number_floor_log2_pow10(int32_t e) {
+    return (e * 1741647) >> 19;
+}
+
+#endif
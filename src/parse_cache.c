@@ -0,0 +1,614 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parse_cache.h"
+#include "common.h"
+#include "error.h"
+#include "hash.h"
+
+enum nix_err
+nix_parse_cache__init(struct nix_parse_cache *out, const char *directory) {
+    struct parse_cache *cache = (struct parse_cache *)out;
+    size_t length = strlen(directory);
+
+    cache->directory = NULL;
+    cache->p.directory = NULL;
+
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        return NIXERR_BUF_FILE;
+    }
+
+    // The umask can only be read by setting it, so do it once here
+    mode_t mask = umask(0);
+    umask(mask);
+    cache->mode = 0644 & ~mask;
+
+    ALLOC(cache->directory, length + 1);
+    memcpy(cache->directory, directory, length + 1);
+    cache->p.directory = cache->directory;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_parse_cache__construct(
+    struct nix_parse_cache **out,
+    const char *directory)
+{
+    struct parse_cache *cache = NULL;
+    ALLOC(cache, sizeof(struct parse_cache));
+    memset(cache, 0, sizeof(struct parse_cache));
+
+    TRY(nix_parse_cache__init((struct nix_parse_cache *)cache, directory));
+    *out = (struct nix_parse_cache *)cache;
+
+    EXCEPT(err)
+    nix_parse_cache__free((struct nix_parse_cache **)&cache);
+    return err;
+}
+
+void
+nix_parse_cache__free(struct nix_parse_cache **out) {
+    if (*out == NULL) return;
+
+    struct parse_cache *cache = (struct parse_cache *)*out;
+
+    FREE(cache->directory);
+    FREE(cache);
+
+    *out = NULL;
+}
+
+enum nix_err
+__parse_cache_path(
+    struct parse_cache *cache,
+    const struct nix_digest *key,
+    char **out)
+{
+    char hex[NIX_DIGEST_HEX_SIZE];
+    nix_digest__hex(key, hex);
+
+    size_t size = strlen(cache->directory) + 1 + sizeof(hex) +
+        sizeof(PARSE_CACHE_SUFFIX);
+
+    ALLOC(*out, size);
+    snprintf(*out, size, "%s/%s%s", cache->directory, hex,
+        PARSE_CACHE_SUFFIX);
+
+    EXCEPT(err)
+    return err;
+}
+
+// Give the local number of an interner id, numbering it if it's new
+enum nix_err
+__parse_cache_symbol(struct cache_symbols *s, uint32_t id, uint32_t *out) {
+    uint32_t *keys = NULL, *values = NULL, *ids = NULL;
+
+    if ((s->count + 1) * 2 > s->capacity) {
+        size_t capacity = s->capacity > 0 ?
+            s->capacity * 2 : PARSE_CACHE_INITIAL_SYMBOLS;
+
+        ALLOC(keys, sizeof(uint32_t) * capacity);
+        ALLOC(values, sizeof(uint32_t) * capacity);
+        ALLOC(ids, sizeof(uint32_t) * capacity / 2);
+
+        memset(keys, 0xFF, sizeof(uint32_t) * capacity);
+        if (s->count > 0) {
+            memcpy(ids, s->ids, sizeof(uint32_t) * s->count);
+        }
+
+        for (size_t i = 0; i < s->capacity; i++) {
+            if (s->keys[i] == NIX_INTERN_NONE) {
+                continue;
+            }
+
+            size_t j = __hash_mix(s->keys[i]) & (capacity - 1);
+            while (keys[j] != NIX_INTERN_NONE) {
+                j = (j + 1) & (capacity - 1);
+            }
+
+            keys[j] = s->keys[i];
+            values[j] = s->values[i];
+        }
+
+        __parse_cache_symbols_free(s);
+        s->keys = keys;
+        s->values = values;
+        s->ids = ids;
+        s->capacity = capacity;
+    }
+
+    size_t mask = s->capacity - 1;
+    size_t i = __hash_mix(id) & mask;
+
+    while (s->keys[i] != NIX_INTERN_NONE) {
+        if (s->keys[i] == id) {
+            *out = s->values[i];
+            return NIXERR_NONE;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    s->keys[i] = id;
+    s->values[i] = s->count;
+    s->ids[s->count] = id;
+    *out = s->count++;
+
+    EXCEPT(err)
+    FREE(keys);
+    FREE(values);
+    FREE(ids);
+    return err;
+}
+
+void
+__parse_cache_symbols_free(struct cache_symbols *s) {
+    FREE(s->keys);
+    FREE(s->values);
+    FREE(s->ids);
+}
+
+// Pad the file out to where the next section starts
+static bool
+__parse_cache_pad(FILE *file, uint64_t *at, uint64_t to) {
+    static const uint8_t zeros[PARSE_CACHE_ALIGN] = { 0 };
+
+    size_t n = to - *at;
+    *at = to;
+
+    return fwrite(zeros, 1, n, file) == n;
+}
+
+enum nix_err
+nix_parse_cache__store(
+    struct nix_parse_cache *parse_cache,
+    const struct nix_digest *key,
+    const struct nix_ast *ast,
+    struct nix_intern *intern)
+{
+    struct parse_cache *cache = (struct parse_cache *)parse_cache;
+    struct cache_symbols symbols = { NULL, NULL, 0, NULL, 0 };
+    char *path = NULL;
+    char *temp = NULL;
+    FILE *file = NULL;
+    uint32_t local;
+
+    // Number the symbols the tree uses, and lay the symbols out
+    uint64_t symbol_text_size = 0;
+    for (uint32_t i = 0; i < ast->count; i++) {
+        if (!__parse_cache_has_symbol(&ast->nodes[i])) {
+            continue;
+        }
+
+        uint32_t count = symbols.count;
+        TRY(__parse_cache_symbol(&symbols, ast->nodes[i].data[0], &local));
+
+        if (symbols.count > count) {
+            const char *text;
+            size_t length;
+
+            TRY(nix_intern__lookup(intern, ast->nodes[i].data[0], &text,
+                &length));
+            symbol_text_size += length + 1;
+        }
+    }
+
+    if (symbol_text_size > UINT32_MAX) {
+        TRY(NIXERR_BUF_INVLEN);
+    }
+
+    struct cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PARSE_CACHE_MAGIC, sizeof(header.magic));
+
+    header.version = NIX_PARSE_CACHE_VERSION;
+    header.order = PARSE_CACHE_ORDER;
+    header.node_size = sizeof(struct nix_ast_node);
+    header.root = ast->root;
+    header.key = *key;
+
+    header.node_count = ast->count;
+    header.list_count = ast->list_count;
+    header.text_size = ast->text_size;
+    header.symbol_count = symbols.count;
+    header.symbol_text_size = (uint32_t)symbol_text_size;
+
+    header.nodes = __parse_cache_align(sizeof(header));
+    header.lists = __parse_cache_align(header.nodes +
+        sizeof(struct nix_ast_node) * (uint64_t)ast->count);
+    header.text = __parse_cache_align(header.lists +
+        sizeof(uint32_t) * (uint64_t)ast->list_count);
+    header.symbols = __parse_cache_align(header.text + ast->text_size);
+    header.symbol_text = header.symbols +
+        sizeof(uint32_t) * ((uint64_t)symbols.count + 1);
+    header.file_size = header.symbol_text + symbol_text_size;
+
+    TRY(__parse_cache_path(cache, key, &path));
+
+    // A uniquely named file in the same directory, so the rename is atomic
+    size_t size = strlen(path) + sizeof(".XXXXXX");
+    ALLOC(temp, size);
+    snprintf(temp, size, "%s.XXXXXX", path);
+
+    int fd = mkstemp(temp);
+    if (fd < 0) {
+        FREE(temp);
+        temp = NULL;
+        TRY(NIXERR_BUF_FILE);
+    }
+
+    // mkstemp only lets the owner read the file
+    if (fchmod(fd, cache->mode) != 0) {
+        close(fd);
+        TRY(NIXERR_BUF_FILE);
+    }
+
+    if ((file = fdopen(fd, "wb")) == NULL) {
+        close(fd);
+        TRY(NIXERR_BUF_FILE);
+    }
+
+    uint64_t at = sizeof(header);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // Nodes are written with their symbols renumbered
+    ok = ok && __parse_cache_pad(file, &at, header.nodes);
+    for (uint32_t i = 0; ok && i < ast->count; i++) {
+        struct nix_ast_node node = ast->nodes[i];
+
+        if (__parse_cache_has_symbol(&node)) {
+            TRY(__parse_cache_symbol(&symbols, node.data[0], &node.data[0]));
+        }
+
+        ok = fwrite(&node, sizeof(node), 1, file) == 1;
+    }
+
+    at = header.nodes + sizeof(struct nix_ast_node) * (uint64_t)ast->count;
+    ok = ok && __parse_cache_pad(file, &at, header.lists);
+    ok = ok && fwrite(ast->lists, sizeof(uint32_t), ast->list_count, file) ==
+        ast->list_count;
+
+    at = header.lists + sizeof(uint32_t) * (uint64_t)ast->list_count;
+    ok = ok && __parse_cache_pad(file, &at, header.text);
+    ok = ok && fwrite(ast->text, 1, ast->text_size, file) == ast->text_size;
+
+    at = header.text + ast->text_size;
+    ok = ok && __parse_cache_pad(file, &at, header.symbols);
+
+    uint32_t offset = 0;
+    for (uint32_t i = 0; ok && i < symbols.count; i++) {
+        const char *text;
+        size_t length;
+
+        TRY(nix_intern__lookup(intern, symbols.ids[i], &text, &length));
+        ok = fwrite(&offset, sizeof(offset), 1, file) == 1;
+        offset += length + 1;
+    }
+
+    ok = ok && fwrite(&offset, sizeof(offset), 1, file) == 1;
+
+    for (uint32_t i = 0; ok && i < symbols.count; i++) {
+        const char *text;
+        size_t length;
+
+        TRY(nix_intern__lookup(intern, symbols.ids[i], &text, &length));
+        ok = fwrite(text, 1, length + 1, file) == length + 1;
+    }
+
+    // The entry must be complete on disk before it's visible under its name
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    file = NULL;
+
+    if (!ok || rename(temp, path) != 0) {
+        TRY(NIXERR_BUF_FILE);
+    }
+
+    FREE(path);
+    FREE(temp);
+    __parse_cache_symbols_free(&symbols);
+
+    EXCEPT(err)
+    if (file != NULL) {
+        fclose(file);
+    }
+
+    if (temp != NULL) {
+        unlink(temp);
+    }
+
+    FREE(path);
+    FREE(temp);
+    __parse_cache_symbols_free(&symbols);
+    return err;
+}
+
+// Whether a section of count items of a size lies within the file and is
+// aligned for them
+static inline bool
+__parse_cache_section(uint64_t offset, uint64_t count, size_t size,
+    size_t file_size)
+{
+    return offset % PARSE_CACHE_ALIGN == 0 && offset <= file_size &&
+        count <= (file_size - offset) / size;
+}
+
+bool
+__parse_cache_check(
+    const struct cache_header *h,
+    const struct nix_digest *key,
+    size_t size)
+{
+    if (memcmp(h->magic, PARSE_CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+            h->version != NIX_PARSE_CACHE_VERSION ||
+            h->order != PARSE_CACHE_ORDER ||
+            h->node_size != sizeof(struct nix_ast_node) ||
+            memcmp(&h->key, key, sizeof(*key)) != 0 ||
+            h->file_size != size) {
+        return false;
+    }
+
+    return __parse_cache_section(h->nodes, h->node_count,
+            sizeof(struct nix_ast_node), size) &&
+        __parse_cache_section(h->lists, h->list_count, sizeof(uint32_t),
+            size) &&
+        __parse_cache_section(h->text, h->text_size, 1, size) &&
+        __parse_cache_section(h->symbols, (uint64_t)h->symbol_count + 1,
+            sizeof(uint32_t), size) &&
+        h->symbol_text <= size &&
+        h->symbol_text_size <= size - h->symbol_text &&
+        (h->root < h->node_count || h->root == NIX_AST_NONE);
+}
+
+// Whether the symbol offsets rise through the symbol text and each symbol
+// ends in a NUL, so lookups stay within the mapping
+// A child must come before its parent, as the parser pushes them, so walking
+// the tree can't loop
+static inline bool
+__parse_cache_child(uint32_t child, uint32_t parent, bool optional) {
+    return child < parent || (optional && child == NIX_AST_NONE);
+}
+
+// Check what each node's data points at, so walking the tree stays inside
+// the sections. Every list belongs to one node, so all of them together
+// hold no more than the lists section does.
+bool
+__parse_cache_check_nodes(const uint8_t *base, const struct cache_header *h)
+{
+    const struct nix_ast_node *nodes =
+        (const struct nix_ast_node *)(base + h->nodes);
+    const uint32_t *lists = (const uint32_t *)(base + h->lists);
+    uint64_t listed = 0;
+
+    for (uint32_t i = 0; i < h->node_count; i++) {
+        const uint32_t *data = nodes[i].data;
+        bool ok = true, has_list = false;
+        size_t list = 0;
+
+        switch (nodes[i].kind) {
+        case NIX_AST_INT:
+        case NIX_AST_FLOAT:
+        case NIX_AST_ID:
+            break;
+        case NIX_AST_TEXT:
+        case NIX_AST_PATH:
+        case NIX_AST_HPATH:
+        case NIX_AST_SPATH:
+        case NIX_AST_URI:
+            ok = (uint64_t)data[0] + data[1] <= h->text_size;
+            break;
+        case NIX_AST_STRING:
+        case NIX_AST_PATH_INTERP:
+        case NIX_AST_LIST:
+        case NIX_AST_ATTRSET:
+        case NIX_AST_ATTRPATH:
+        case NIX_AST_FORMALS:
+            has_list = true;
+            break;
+        case NIX_AST_LET:
+            ok = __parse_cache_child(data[2], i, false);
+            has_list = true;
+            break;
+        case NIX_AST_INHERIT:
+            ok = __parse_cache_child(data[0], i, true);
+            has_list = true;
+            list = 1;
+            break;
+        case NIX_AST_DYNAMIC:
+        case NIX_AST_UNARY:
+            ok = __parse_cache_child(data[0], i, false);
+            break;
+        case NIX_AST_BINDING:
+        case NIX_AST_HAS_ATTR:
+        case NIX_AST_APPLY:
+        case NIX_AST_BINARY:
+        case NIX_AST_WITH:
+        case NIX_AST_ASSERT:
+            ok = __parse_cache_child(data[0], i, false) &&
+                __parse_cache_child(data[1], i, false);
+            break;
+        case NIX_AST_SELECT:
+            ok = __parse_cache_child(data[0], i, false) &&
+                __parse_cache_child(data[1], i, false) &&
+                __parse_cache_child(data[2], i, true);
+            break;
+        case NIX_AST_IF:
+            ok = __parse_cache_child(data[0], i, false) &&
+                __parse_cache_child(data[1], i, false) &&
+                __parse_cache_child(data[2], i, false);
+            break;
+        case NIX_AST_LAMBDA:
+            ok = __parse_cache_child(data[1], i, true) &&
+                __parse_cache_child(data[2], i, false);
+            break;
+        case NIX_AST_FORMAL:
+            ok = __parse_cache_child(data[1], i, true);
+            break;
+        default:
+            return false;
+        }
+
+        if (!ok) {
+            return false;
+        }
+
+        if (!has_list) {
+            continue;
+        }
+
+        uint32_t first = data[list], count = data[list + 1];
+        listed += count;
+        if ((uint64_t)first + count > h->list_count ||
+                listed > h->list_count) {
+            return false;
+        }
+
+        for (uint32_t j = first; j < first + count; j++) {
+            if (!__parse_cache_child(lists[j], i, false)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool
+__parse_cache_check_symbols(const uint8_t *base, const struct cache_header *h)
+{
+    const uint32_t *symbols = (const uint32_t *)(base + h->symbols);
+    const char *text = (const char *)(base + h->symbol_text);
+
+    if (symbols[0] != 0 || symbols[h->symbol_count] != h->symbol_text_size) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < h->symbol_count; i++) {
+        if (symbols[i + 1] <= symbols[i] ||
+                symbols[i + 1] > h->symbol_text_size ||
+                text[symbols[i + 1] - 1] != '\0') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+enum nix_err
+nix_parse_cache__load(
+    struct nix_parse_cache *parse_cache,
+    const struct nix_digest *key,
+    struct nix_cached_ast **out)
+{
+    struct parse_cache *cache = (struct parse_cache *)parse_cache;
+    struct cached_ast *entry = NULL;
+    char *path = NULL;
+    void *map = MAP_FAILED;
+    struct stat st;
+    int fd = -1;
+
+    TRY(__parse_cache_path(cache, key, &path));
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        TRY(errno == ENOENT ? NIXERR_CACHE_MISS : NIXERR_BUF_FILE);
+    }
+
+    if (fstat(fd, &st) != 0) {
+        TRY(NIXERR_BUF_FILE);
+    }
+
+    if ((size_t)st.st_size < sizeof(struct cache_header)) {
+        TRY(NIXERR_CACHE_MISS);
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        TRY(NIXERR_BUF_FILE);
+    }
+
+    close(fd);
+    fd = -1;
+
+    // Everything is checked once here, and the sections are then used in
+    // place
+    const struct cache_header *h = map;
+    uint8_t *base = map;
+    if (!__parse_cache_check(h, key, st.st_size) ||
+            !__parse_cache_check_symbols(base, h) ||
+            !__parse_cache_check_nodes(base, h)) {
+        TRY(NIXERR_CACHE_MISS);
+    }
+
+    ALLOC(entry, sizeof(struct cached_ast));
+
+    entry->map = map;
+    entry->map_size = st.st_size;
+    entry->symbols = (const uint32_t *)(base + h->symbols);
+    entry->symbol_text = (const char *)(base + h->symbol_text);
+
+    entry->p.symbol_count = h->symbol_count;
+    entry->p.ast.nodes = (struct nix_ast_node *)(base + h->nodes);
+    entry->p.ast.count = h->node_count;
+    entry->p.ast.lists = (uint32_t *)(base + h->lists);
+    entry->p.ast.list_count = h->list_count;
+    entry->p.ast.text = (char *)(base + h->text);
+    entry->p.ast.text_size = h->text_size;
+    entry->p.ast.root = h->root;
+
+    *out = (struct nix_cached_ast *)entry;
+
+    FREE(path);
+
+    EXCEPT(err)
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (map != MAP_FAILED) {
+        munmap(map, st.st_size);
+    }
+
+    FREE(path);
+    return err;
+}
+
+enum nix_err
+nix_cached_ast__symbol(
+    const struct nix_cached_ast *cached,
+    uint32_t id,
+    const char **text,
+    size_t *length)
+{
+    const struct cached_ast *entry = (const struct cached_ast *)cached;
+
+    if (id >= cached->symbol_count) {
+        return NIXERR_INTERN_INVID;
+    }
+
+    *text = entry->symbol_text + entry->symbols[id];
+    *length = entry->symbols[id + 1] - entry->symbols[id] - 1;
+
+    return NIXERR_NONE;
+}
+
+void
+nix_cached_ast__free(struct nix_cached_ast **out) {
+    if (*out == NULL) return;
+
+    struct cached_ast *entry = (struct cached_ast *)*out;
+
+    munmap(entry->map, entry->map_size);
+    FREE(entry);
+
+    *out = NULL;
+}
@@ -0,0 +1,122 @@
+#ifndef INCLUDE_parse_cache_h__
+#define INCLUDE_parse_cache_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "libnix/parse_cache.h"
+
+#define PARSE_CACHE_MAGIC "LIBNIXAS"
+#define PARSE_CACHE_SUFFIX ".ast"
+
+// Written in the host's byte order, so entries from a machine of the other
+// order are rejected
+#define PARSE_CACHE_ORDER 0x01020304
+
+// Every section starts at a multiple of this
+#define PARSE_CACHE_ALIGN 8
+
+#define PARSE_CACHE_INITIAL_SYMBOLS 64
+
+// The start of every entry. Sections are given as offsets from the start of
+// the file, so the entry can be used wherever it is mapped.
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t order;
+    uint32_t node_size;
+    uint32_t root;
+
+    struct nix_digest key;
+
+    uint64_t file_size;
+
+    uint64_t nodes;
+    uint64_t lists;
+    uint64_t text;
+    uint64_t symbols;
+    uint64_t symbol_text;
+
+    uint32_t node_count;
+    uint32_t list_count;
+    uint64_t text_size;
+
+    uint32_t symbol_count;
+    uint32_t symbol_text_size;
+};
+
+struct parse_cache {
+    struct nix_parse_cache p;
+
+    char *directory;
+
+    // Entries are readable by everyone the umask allows, so the directory
+    // can be shared between users
+    mode_t mode;
+};
+
+struct cached_ast {
+    struct nix_cached_ast p;
+
+    void *map;
+    size_t map_size;
+
+    // Offsets into symbol_text, with one more after the last symbol
+    const uint32_t *symbols;
+    const char *symbol_text;
+};
+
+// Interner ids of a tree's symbols, numbered from 0 in the order first seen
+struct cache_symbols {
+    uint32_t *keys;
+    uint32_t *values;
+    size_t capacity;
+
+    uint32_t *ids;
+    uint32_t count;
+};
+
+enum nix_err
+__parse_cache_path(struct parse_cache *, const struct nix_digest *, char **);
+
+enum nix_err
+__parse_cache_symbol(struct cache_symbols *, uint32_t, uint32_t *);
+
+void
+__parse_cache_symbols_free(struct cache_symbols *);
+
+bool
+__parse_cache_check(
+    const struct cache_header *,
+    const struct nix_digest *,
+    size_t);
+
+bool
+__parse_cache_check_symbols(const uint8_t *, const struct cache_header *);
+
+bool
+__parse_cache_check_nodes(const uint8_t *, const struct cache_header *);
+
+// Whether a node holds a symbol id in data[0]
+static inline bool
+__parse_cache_has_symbol(const struct nix_ast_node *node) {
+    switch (node->kind) {
+    case NIX_AST_ID:
+    case NIX_AST_FORMAL:
+        return true;
+    case NIX_AST_LAMBDA:
+        return node->data[0] != NIX_INTERN_NONE;
+    default:
+        return false;
+    }
+}
+
+static inline uint64_t
+__parse_cache_align(uint64_t offset) {
+    return (offset + PARSE_CACHE_ALIGN - 1) &
+        ~(uint64_t)(PARSE_CACHE_ALIGN - 1);
+}
+
+#endif
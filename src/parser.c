@@ -0,0 +1,1125 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+#include "common.h"
+#include "error.h"
+#include "libnix/number.h"
+#include "utf8.h"
+
+enum nix_err
+nix_parser__init(
+    struct nix_parser *out,
+    struct nix_buffer *buf,
+    struct nix_intern *intern)
+{
+    struct parser *pr = (struct parser *)out;
+
+    if (buf == NULL || intern == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    memset(pr, 0, sizeof(struct parser));
+    pr->p.buffer = buf;
+    pr->p.intern = intern;
+    pr->p.error_kind = NIX_TOKEN_EOF;
+
+    TRY(nix_lexer__init((struct nix_lexer *)&pr->lexer, buf));
+
+    // or is a keyword, but also a valid attribute name
+    TRY(nix_intern__intern(intern, "or", 2, &pr->or_id));
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_parser__construct(
+    struct nix_parser **out,
+    struct nix_buffer *buf,
+    struct nix_intern *intern)
+{
+    struct parser *pr = NULL;
+    ALLOC(pr, sizeof(struct parser));
+    memset(pr, 0, sizeof(struct parser));
+
+    TRY(nix_parser__init((struct nix_parser *)pr, buf, intern));
+    *out = (struct nix_parser *)pr;
+
+    EXCEPT(err)
+    nix_parser__free((struct nix_parser **)&pr);
+    return err;
+}
+
+enum nix_err
+nix_parser__parse(struct nix_parser *parser, struct nix_ast **out) {
+    struct parser *pr = (struct parser *)parser;
+    struct ast *ast = NULL;
+
+    if (parser == NULL || out == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    TRY(__ast_construct(&ast));
+
+    pr->ast = ast;
+    pr->depth = 0;
+    pr->strings = 0;
+    pr->stack_size = 0;
+    pr->part_count = 0;
+
+    uint32_t root;
+    TRY(__parser_expr(pr, &root));
+    TRY(__parser_expect(pr, NIX_TOKEN_EOF, NULL));
+
+    ast->p.root = root;
+    pr->ast = NULL;
+    *out = (struct nix_ast *)ast;
+
+    EXCEPT(err)
+    pr->ast = NULL;
+    nix_ast__free((struct nix_ast **)&ast);
+    return err;
+}
+
+void
+nix_parser__free(struct nix_parser **out) {
+    if (*out == NULL) return;
+
+    struct parser *pr = (struct parser *)*out;
+
+    FREE(pr->stack);
+    FREE(pr->parts);
+    FREE(pr->decode);
+    FREE(pr->raw);
+    FREE(pr);
+
+    *out = NULL;
+}
+
+enum nix_err
+__parser_fill(struct parser *pr, size_t n) {
+    while (pr->count < n) {
+        // Text of tokens already taken is only needed by unfinished strings
+        if (pr->count == 0 && pr->strings == 0) {
+            pr->raw_size = 0;
+        }
+
+        struct parser_token *t = __parser_peek(pr, pr->count);
+
+        if (pr->count > 0 &&
+                __parser_peek(pr, pr->count - 1)->kind == NIX_TOKEN_EOF) {
+            *t = *__parser_peek(pr, pr->count - 1);
+        } else {
+            TRY(__parser_lex(pr, t));
+        }
+
+        pr->count++;
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+// Append a lexeme's text to the scratch space as UTF-8
+static inline enum nix_err
+__parser_raw(
+    struct parser *pr,
+    struct nix_lexeme *lexeme,
+    struct parser_token *out)
+{
+    size_t n = lexeme->end->abs - lexeme->start->abs;
+
+    GROW(pr->raw, pr->raw_capacity, pr->raw_size + n * UTF8_MAX_BYTES,
+        PARSER_INITIAL_RAW);
+
+    size_t offset = pr->raw_size;
+    for (size_t i = 0; i < n; i++) {
+        pr->raw_size += __utf8_encode(lexeme->text[i],
+            (uint8_t *)pr->raw + pr->raw_size);
+    }
+
+    out->value.raw.offset = (uint32_t)offset;
+    out->value.raw.length = (uint32_t)(pr->raw_size - offset);
+
+    EXCEPT(err)
+    return err;
+}
+
+// Lex the next token that isn't trivia, and take what's needed from its
+// text before the lexer moves on
+enum nix_err
+__parser_lex(struct parser *pr, struct parser_token *out) {
+    struct nix_buffer *buf = pr->p.buffer;
+    struct nix_lexeme *lexeme = NULL;
+    struct nix_token tok;
+
+    do {
+        TRY(nix_lexer__next((struct nix_lexer *)&pr->lexer, &tok));
+    } while (nix_token__is_trivia(tok.kind));
+
+    out->kind = (uint8_t)tok.kind;
+    out->start = (uint32_t)tok.start.abs;
+    out->end = (uint32_t)tok.end.abs;
+
+    enum nix_err number = NIXERR_NONE;
+
+    switch (tok.kind) {
+    case NIX_TOKEN_ID:
+        TRY(nix_buffer__intern_lexeme(buf, pr->p.intern, &out->value.id, 0));
+        break;
+    case NIX_TOKEN_INT:
+        TRY(nix_buffer__get_lexeme(buf, &lexeme, 0));
+        number = nix_number__parse_int_lexeme(lexeme, &out->value.i);
+        break;
+    case NIX_TOKEN_FLOAT:
+        TRY(nix_buffer__get_lexeme(buf, &lexeme, 0));
+        number = nix_number__parse_float_lexeme(lexeme, &out->value.f);
+        break;
+    case NIX_TOKEN_STR:
+    case NIX_TOKEN_IND_STR:
+    case NIX_TOKEN_PATH:
+    case NIX_TOKEN_HPATH:
+    case NIX_TOKEN_SPATH:
+    case NIX_TOKEN_URI:
+    case NIX_TOKEN_PATH_START:
+    case NIX_TOKEN_PATH_STR:
+        TRY(nix_buffer__get_lexeme(buf, &lexeme, 0));
+        TRY(__parser_raw(pr, lexeme, out));
+        break;
+    default:
+        break;
+    }
+
+    // A number too large for its type fails on its own token
+    if (number != NIXERR_NONE) {
+        __parser_error(pr, out);
+        TRY(number);
+    }
+
+    nix_lexeme__free(&lexeme);
+
+    EXCEPT(err)
+    nix_lexeme__free(&lexeme);
+    return err;
+}
+
+enum nix_err
+__parser_take(struct parser *pr, struct parser_token *out) {
+    TRY(__parser_fill(pr, 1));
+
+    struct parser_token *t = __parser_peek(pr, 0);
+    if (out != NULL) {
+        *out = *t;
+    }
+
+    pr->last_end = t->end;
+    pr->head = (pr->head + 1) % PARSER_LOOKAHEAD;
+    pr->count--;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__parser_expect(
+    struct parser *pr,
+    enum nix_token_kind kind,
+    struct parser_token *out)
+{
+    TRY(__parser_fill(pr, 1));
+
+    struct parser_token *t = __parser_peek(pr, 0);
+    if (t->kind != kind) {
+        TRY(__parser_error(pr, t));
+    }
+
+    TRY(__parser_take(pr, out));
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__parser_error(struct parser *pr, struct parser_token *tok) {
+    pr->p.error_kind = (enum nix_token_kind)tok->kind;
+    pr->p.error_start = tok->start;
+    pr->p.error_end = tok->end;
+
+    return NIXERR_PARSE_SYNTAX;
+}
+
+enum nix_err
+__parser_push(struct parser *pr, uint32_t node) {
+    GROW(pr->stack, pr->stack_capacity, pr->stack_size + 1,
+        PARSER_INITIAL_STACK);
+
+    pr->stack[pr->stack_size++] = node;
+
+    EXCEPT(err)
+    return err;
+}
+
+// Move the children pushed since base into a list of the tree
+enum nix_err
+__parser_pop_list(
+    struct parser *pr,
+    size_t base,
+    uint32_t *first,
+    uint32_t *count)
+{
+    *count = (uint32_t)(pr->stack_size - base);
+    TRY(__ast_push_list(pr->ast, pr->stack + base, *count, first));
+
+    pr->stack_size = base;
+
+    EXCEPT(err)
+    return err;
+}
+
+// Whether the { ahead opens a function's formals rather than a set
+static inline enum nix_err
+__parser_is_formals(struct parser *pr, bool *out) {
+    TRY(__parser_fill(pr, 3));
+
+    enum nix_token_kind second = __parser_peek(pr, 1)->kind;
+    enum nix_token_kind third = __parser_peek(pr, 2)->kind;
+
+    switch (second) {
+    case NIX_TOKEN_RBRACE:
+        *out = third == NIX_TOKEN_COLON || third == NIX_TOKEN_AT;
+        break;
+    case NIX_TOKEN_ELLIPSIS:
+        *out = true;
+        break;
+    case NIX_TOKEN_ID:
+        *out = third == NIX_TOKEN_COMMA || third == NIX_TOKEN_QUESTION ||
+            third == NIX_TOKEN_RBRACE;
+        break;
+    default:
+        *out = false;
+        break;
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+// Functions, and the keywords whose bodies extend as far right as possible
+enum nix_err
+__parser_expr(struct parser *pr, uint32_t *out) {
+    struct parser_token tok;
+    struct nix_ast_node node;
+    uint32_t a, b, c;
+
+    if (++pr->depth > PARSER_MAX_DEPTH) {
+        TRY(__parser_fill(pr, 1));
+        __parser_error(pr, __parser_peek(pr, 0));
+        TRY(NIXERR_PARSE_DEPTH);
+    }
+
+    TRY(__parser_fill(pr, 2));
+
+    struct parser_token first = *__parser_peek(pr, 0);
+    enum nix_token_kind second = __parser_peek(pr, 1)->kind;
+    bool formals = false;
+
+    if (first.kind == NIX_TOKEN_LBRACE) {
+        TRY(__parser_is_formals(pr, &formals));
+    }
+
+    if (first.kind == NIX_TOKEN_ID && second == NIX_TOKEN_COLON) {
+        // x: body
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_lambda(pr, first.start, first.value.id, NIX_AST_NONE,
+            out));
+    } else if (first.kind == NIX_TOKEN_ID && second == NIX_TOKEN_AT) {
+        // x @ { ... }: body
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_formals(pr, &a));
+        TRY(__parser_expect(pr, NIX_TOKEN_COLON, NULL));
+        TRY(__parser_lambda(pr, first.start, first.value.id, a, out));
+    } else if (formals) {
+        // { ... } @ x: body, with the name optional
+        uint32_t id = NIX_INTERN_NONE;
+
+        TRY(__parser_formals(pr, &a));
+        TRY(__parser_fill(pr, 1));
+        if (__parser_peek(pr, 0)->kind == NIX_TOKEN_AT) {
+            TRY(__parser_take(pr, NULL));
+            TRY(__parser_expect(pr, NIX_TOKEN_ID, &tok));
+            id = tok.value.id;
+        }
+
+        TRY(__parser_expect(pr, NIX_TOKEN_COLON, NULL));
+        TRY(__parser_lambda(pr, first.start, id, a, out));
+    } else if (first.kind == NIX_TOKEN_KW_ASSERT ||
+            first.kind == NIX_TOKEN_KW_WITH) {
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_expr(pr, &a));
+        TRY(__parser_expect(pr, NIX_TOKEN_SEMICOLON, NULL));
+        TRY(__parser_expr(pr, &b));
+
+        node = __ast_node(first.kind == NIX_TOKEN_KW_ASSERT ?
+            NIX_AST_ASSERT : NIX_AST_WITH, first.start, pr->last_end);
+        node.data[0] = a;
+        node.data[1] = b;
+        TRY(__ast_push(pr->ast, &node, out));
+    } else if (first.kind == NIX_TOKEN_KW_LET &&
+            second != NIX_TOKEN_LBRACE) {
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_binds(pr, NIX_TOKEN_KW_IN, &a, &b));
+        TRY(__parser_expect(pr, NIX_TOKEN_KW_IN, NULL));
+        TRY(__parser_expr(pr, &c));
+
+        node = __ast_node(NIX_AST_LET, first.start, pr->last_end);
+        node.data[0] = a;
+        node.data[1] = b;
+        node.data[2] = c;
+        TRY(__ast_push(pr->ast, &node, out));
+    } else if (first.kind == NIX_TOKEN_KW_IF) {
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_expr(pr, &a));
+        TRY(__parser_expect(pr, NIX_TOKEN_KW_THEN, NULL));
+        TRY(__parser_expr(pr, &b));
+        TRY(__parser_expect(pr, NIX_TOKEN_KW_ELSE, NULL));
+        TRY(__parser_expr(pr, &c));
+
+        node = __ast_node(NIX_AST_IF, first.start, pr->last_end);
+        node.data[0] = a;
+        node.data[1] = b;
+        node.data[2] = c;
+        TRY(__ast_push(pr->ast, &node, out));
+    } else {
+        TRY(__parser_op(pr, PREC_IMPL, out));
+    }
+
+    pr->depth--;
+
+    EXCEPT(err)
+    pr->depth--;
+    return err;
+}
+
+enum nix_err
+__parser_lambda(
+    struct parser *pr,
+    uint32_t start,
+    uint32_t arg,
+    uint32_t formals,
+    uint32_t *out)
+{
+    uint32_t body;
+    TRY(__parser_expr(pr, &body));
+
+    struct nix_ast_node node = __ast_node(NIX_AST_LAMBDA, start, pr->last_end);
+    node.data[0] = arg;
+    node.data[1] = formals;
+    node.data[2] = body;
+    TRY(__ast_push(pr->ast, &node, out));
+
+    EXCEPT(err)
+    return err;
+}
+
+// Operators, by precedence climbing: an operand, then each operator that
+// binds at least as tightly as min, taking its right operand from a
+// recursive call that only accepts tighter operators
+enum nix_err
+__parser_op(struct parser *pr, int min, uint32_t *out) {
+    struct parser_token tok;
+    struct nix_ast_node node;
+    uint32_t lhs, rhs;
+
+    if (++pr->depth > PARSER_MAX_DEPTH) {
+        TRY(__parser_fill(pr, 1));
+        __parser_error(pr, __parser_peek(pr, 0));
+        TRY(NIXERR_PARSE_DEPTH);
+    }
+
+    TRY(__parser_fill(pr, 1));
+
+    tok = *__parser_peek(pr, 0);
+    uint32_t start = tok.start;
+
+    if (tok.kind == NIX_TOKEN_NOT || tok.kind == NIX_TOKEN_MINUS) {
+        // ! takes in everything tighter than itself, as in !a + b; negation
+        // only what application does
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_op(pr, tok.kind == NIX_TOKEN_NOT ?
+            PREC_NOT + 1 : PREC_NEGATE + 1, &rhs));
+
+        node = __ast_node(NIX_AST_UNARY, start, pr->last_end);
+        node.op = tok.kind;
+        node.data[0] = rhs;
+        TRY(__ast_push(pr->ast, &node, &lhs));
+    } else {
+        TRY(__parser_app(pr, &lhs));
+    }
+
+    // Set after a non-associative operator, which can't be chained
+    int blocked = PREC_NONE;
+
+    for (;;) {
+        int prec;
+        enum parser_assoc assoc;
+
+        TRY(__parser_fill(pr, 1));
+        tok = *__parser_peek(pr, 0);
+        __parser_precedence(tok.kind, &prec, &assoc);
+
+        if (prec == PREC_NONE || prec < min) {
+            break;
+        }
+
+        if (prec == blocked) {
+            TRY(__parser_error(pr, &tok));
+        }
+
+        TRY(__parser_take(pr, NULL));
+
+        if (tok.kind == NIX_TOKEN_QUESTION) {
+            TRY(__parser_attrpath(pr, &rhs));
+            node = __ast_node(NIX_AST_HAS_ATTR, start, pr->last_end);
+        } else {
+            TRY(__parser_op(pr, assoc == ASSOC_RIGHT ? prec : prec + 1,
+                &rhs));
+            node = __ast_node(NIX_AST_BINARY, start, pr->last_end);
+            node.op = tok.kind;
+        }
+
+        node.data[0] = lhs;
+        node.data[1] = rhs;
+        TRY(__ast_push(pr->ast, &node, &lhs));
+
+        blocked = assoc == ASSOC_NONE ? prec : PREC_NONE;
+    }
+
+    *out = lhs;
+    pr->depth--;
+
+    EXCEPT(err)
+    pr->depth--;
+    return err;
+}
+
+enum nix_err
+__parser_app(struct parser *pr, uint32_t *out) {
+    uint32_t lhs, arg;
+
+    TRY(__parser_select(pr, &lhs));
+    uint32_t start = pr->ast->p.nodes[lhs].start;
+
+    for (;;) {
+        TRY(__parser_fill(pr, 1));
+        if (!__parser_starts_simple(__parser_peek(pr, 0)->kind)) {
+            break;
+        }
+
+        TRY(__parser_select(pr, &arg));
+
+        struct nix_ast_node node = __ast_node(NIX_AST_APPLY, start,
+            pr->last_end);
+        node.data[0] = lhs;
+        node.data[1] = arg;
+        TRY(__ast_push(pr->ast, &node, &lhs));
+    }
+
+    *out = lhs;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__parser_select(struct parser *pr, uint32_t *out) {
+    uint32_t expr, path;
+    uint32_t fallback = NIX_AST_NONE;
+
+    TRY(__parser_simple(pr, &expr));
+    TRY(__parser_fill(pr, 1));
+
+    if (__parser_peek(pr, 0)->kind != NIX_TOKEN_DOT) {
+        *out = expr;
+        return NIXERR_NONE;
+    }
+
+    TRY(__parser_take(pr, NULL));
+    TRY(__parser_attrpath(pr, &path));
+    TRY(__parser_fill(pr, 1));
+
+    if (__parser_peek(pr, 0)->kind == NIX_TOKEN_KW_OR) {
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_select(pr, &fallback));
+    }
+
+    struct nix_ast_node node = __ast_node(NIX_AST_SELECT,
+        pr->ast->p.nodes[expr].start, pr->last_end);
+    node.data[0] = expr;
+    node.data[1] = path;
+    node.data[2] = fallback;
+    TRY(__ast_push(pr->ast, &node, out));
+
+    EXCEPT(err)
+    return err;
+}
+
+// Copy a path or URI token's text into the tree as it is
+static inline enum nix_err
+__parser_text_node(
+    struct parser *pr,
+    enum nix_ast_kind kind,
+    struct parser_token *tok,
+    uint32_t *out)
+{
+    struct ast *ast = pr->ast;
+    TRY(__ast_reserve_text(ast, tok->value.raw.length));
+
+    struct nix_ast_node node = __ast_node(kind, tok->start, tok->end);
+    node.data[0] = (uint32_t)ast->p.text_size;
+    node.data[1] = tok->value.raw.length;
+
+    memcpy(ast->p.text + ast->p.text_size, pr->raw + tok->value.raw.offset,
+        tok->value.raw.length);
+    ast->p.text_size += tok->value.raw.length;
+
+    TRY(__ast_push(ast, &node, out));
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__parser_simple(struct parser *pr, uint32_t *out) {
+    struct parser_token tok;
+    struct nix_ast_node node;
+    uint32_t a, b;
+
+    if (++pr->depth > PARSER_MAX_DEPTH) {
+        TRY(__parser_fill(pr, 1));
+        __parser_error(pr, __parser_peek(pr, 0));
+        TRY(NIXERR_PARSE_DEPTH);
+    }
+
+    TRY(__parser_fill(pr, 1));
+    tok = *__parser_peek(pr, 0);
+
+    uint64_t bits;
+    uint16_t flags = 0;
+
+    switch (tok.kind) {
+    case NIX_TOKEN_ID:
+        TRY(__parser_take(pr, NULL));
+        node = __ast_node(NIX_AST_ID, tok.start, tok.end);
+        node.data[0] = tok.value.id;
+        TRY(__ast_push(pr->ast, &node, out));
+        break;
+
+    case NIX_TOKEN_INT:
+    case NIX_TOKEN_FLOAT:
+        TRY(__parser_take(pr, NULL));
+
+        if (tok.kind == NIX_TOKEN_INT) {
+            node = __ast_node(NIX_AST_INT, tok.start, tok.end);
+            bits = (uint64_t)tok.value.i;
+        } else {
+            node = __ast_node(NIX_AST_FLOAT, tok.start, tok.end);
+            memcpy(&bits, &tok.value.f, sizeof(bits));
+        }
+
+        node.data[0] = (uint32_t)bits;
+        node.data[1] = (uint32_t)(bits >> 32);
+        TRY(__ast_push(pr->ast, &node, out));
+        break;
+
+    case NIX_TOKEN_PATH:
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_text_node(pr, NIX_AST_PATH, &tok, out));
+        break;
+    case NIX_TOKEN_HPATH:
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_text_node(pr, NIX_AST_HPATH, &tok, out));
+        break;
+    case NIX_TOKEN_SPATH:
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_text_node(pr, NIX_AST_SPATH, &tok, out));
+        break;
+    case NIX_TOKEN_URI:
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_text_node(pr, NIX_AST_URI, &tok, out));
+        break;
+    case NIX_TOKEN_PATH_START:
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_path(pr, &tok, out));
+        break;
+
+    case NIX_TOKEN_STRING_OPEN:
+    case NIX_TOKEN_IND_STRING_OPEN:
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_string(pr, &tok, out));
+        break;
+
+    case NIX_TOKEN_LPAREN:
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_expr(pr, out));
+        TRY(__parser_expect(pr, NIX_TOKEN_RPAREN, NULL));
+        break;
+
+    case NIX_TOKEN_KW_REC:
+    case NIX_TOKEN_KW_LET:
+        // rec { ... } and the old let { ... }
+        flags = tok.kind == NIX_TOKEN_KW_REC ?
+            NIX_AST_FLAG_REC : NIX_AST_FLAG_LET;
+        TRY(__parser_take(pr, NULL));
+        /* fall through */
+
+    case NIX_TOKEN_LBRACE:
+        TRY(__parser_expect(pr, NIX_TOKEN_LBRACE, NULL));
+        TRY(__parser_binds(pr, NIX_TOKEN_RBRACE, &a, &b));
+        TRY(__parser_expect(pr, NIX_TOKEN_RBRACE, NULL));
+
+        node = __ast_node(NIX_AST_ATTRSET, tok.start, pr->last_end);
+        node.flags = flags;
+        node.data[0] = a;
+        node.data[1] = b;
+        TRY(__ast_push(pr->ast, &node, out));
+        break;
+
+    case NIX_TOKEN_LBRACKET: {
+        TRY(__parser_take(pr, NULL));
+
+        size_t base = pr->stack_size;
+        for (;;) {
+            TRY(__parser_fill(pr, 1));
+            if (__parser_peek(pr, 0)->kind == NIX_TOKEN_RBRACKET) {
+                break;
+            }
+
+            // Elements are selects, so [ f x ] is two elements
+            TRY(__parser_select(pr, &a));
+            TRY(__parser_push(pr, a));
+        }
+
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_pop_list(pr, base, &a, &b));
+
+        node = __ast_node(NIX_AST_LIST, tok.start, pr->last_end);
+        node.data[0] = a;
+        node.data[1] = b;
+        TRY(__ast_push(pr->ast, &node, out));
+        break;
+    }
+
+    default:
+        TRY(__parser_error(pr, &tok));
+    }
+
+    pr->depth--;
+
+    EXCEPT(err)
+    pr->depth--;
+    return err;
+}
+
+// The parts of a string up to its closing quotes, decoded together since
+// indentation is shared across all of them
+enum nix_err
+__parser_string(
+    struct parser *pr,
+    struct parser_token *open,
+    uint32_t *out)
+{
+    struct parser_token tok;
+    struct nix_ast_node node;
+    uint32_t expr;
+
+    bool indented = open->kind == NIX_TOKEN_IND_STRING_OPEN;
+    enum nix_token_kind text = indented ? NIX_TOKEN_IND_STR : NIX_TOKEN_STR;
+    enum nix_token_kind close = indented ?
+        NIX_TOKEN_IND_STRING_CLOSE : NIX_TOKEN_STRING_CLOSE;
+
+    size_t base = pr->part_count;
+    struct parser_part part = {
+        0, 0, open->end, open->end, NIX_AST_NONE
+    };
+
+    pr->strings++;
+
+    for (;;) {
+        TRY(__parser_take(pr, &tok));
+
+        if (tok.kind == text) {
+            // Text split across tokens is contiguous in the scratch space
+            if (part.length == 0) {
+                part.offset = tok.value.raw.offset;
+                part.start = tok.start;
+            }
+
+            part.length += tok.value.raw.length;
+            part.end = tok.end;
+            continue;
+        }
+
+        if (tok.kind != text && tok.kind != close &&
+                tok.kind != NIX_TOKEN_DOLLAR_CURLY) {
+            TRY(__parser_error(pr, &tok));
+        }
+
+        if (tok.kind == NIX_TOKEN_DOLLAR_CURLY) {
+            TRY(__parser_expr(pr, &expr));
+            TRY(__parser_expect(pr, NIX_TOKEN_RBRACE, NULL));
+            part.expr = expr;
+        }
+
+        GROW(pr->parts, pr->part_capacity, pr->part_count + 1,
+            PARSER_INITIAL_STACK);
+        pr->parts[pr->part_count++] = part;
+
+        if (tok.kind == close) {
+            break;
+        }
+
+        part.offset = 0;
+        part.length = 0;
+        part.start = pr->last_end;
+        part.end = pr->last_end;
+        part.expr = NIX_AST_NONE;
+    }
+
+    size_t count = pr->part_count - base;
+    size_t total = 0;
+
+    GROW(pr->decode, pr->decode_capacity, count, PARSER_INITIAL_STACK);
+
+    for (size_t i = 0; i < count; i++) {
+        struct parser_part *p = &pr->parts[base + i];
+
+        pr->decode[i].text = pr->raw + p->offset;
+        pr->decode[i].length = p->length;
+        total += p->length;
+    }
+
+    struct ast *ast = pr->ast;
+    TRY(__ast_reserve_text(ast, total));
+    TRY(nix_string__decode(
+        indented ? NIX_STRING_INDENTED : NIX_STRING_NORMAL,
+        pr->decode, count, ast->p.text + ast->p.text_size, total));
+
+    // Text and interpolations alternate, leaving out empty text
+    size_t stack_base = pr->stack_size;
+    for (size_t i = 0; i < count; i++) {
+        struct parser_part *p = &pr->parts[base + i];
+        struct nix_string_part *d = &pr->decode[i];
+
+        if (d->decoded_length > 0) {
+            node = __ast_node(NIX_AST_TEXT, p->start, p->end);
+            node.data[0] = (uint32_t)(d->decoded - ast->p.text);
+            node.data[1] = (uint32_t)d->decoded_length;
+            ast->p.text_size += d->decoded_length;
+
+            TRY(__ast_push(ast, &node, &expr));
+            TRY(__parser_push(pr, expr));
+        }
+
+        if (p->expr != NIX_AST_NONE) {
+            TRY(__parser_push(pr, p->expr));
+        }
+    }
+
+    pr->part_count = base;
+    pr->strings--;
+
+    uint32_t first, length;
+    TRY(__parser_pop_list(pr, stack_base, &first, &length));
+
+    node = __ast_node(NIX_AST_STRING, open->start, pr->last_end);
+    node.flags = indented ? NIX_AST_FLAG_INDENTED : 0;
+    node.data[0] = first;
+    node.data[1] = length;
+    TRY(__ast_push(ast, &node, out));
+
+    EXCEPT(err)
+    return err;
+}
+
+// The text and interpolations of a path up to where it ends. Its text is
+// kept as written, since paths have no escapes.
+enum nix_err
+__parser_path(
+    struct parser *pr,
+    struct parser_token *start,
+    uint32_t *out)
+{
+    struct parser_token tok;
+    struct parser_token text = *start;
+    struct nix_ast_node node;
+    uint32_t expr;
+
+    size_t stack_base = pr->stack_size;
+    bool home = pr->raw[start->value.raw.offset] == '~';
+
+    pr->strings++;
+
+    for (;;) {
+        TRY(__parser_take(pr, &tok));
+
+        if (tok.kind == NIX_TOKEN_PATH_STR) {
+            // Text split across tokens is contiguous in the scratch space
+            if (text.value.raw.length == 0) {
+                text = tok;
+            } else {
+                text.value.raw.length += tok.value.raw.length;
+                text.end = tok.end;
+            }
+
+            continue;
+        }
+
+        if (text.value.raw.length > 0) {
+            TRY(__parser_text_node(pr, NIX_AST_TEXT, &text, &expr));
+            TRY(__parser_push(pr, expr));
+            text.value.raw.length = 0;
+        }
+
+        if (tok.kind == NIX_TOKEN_PATH_END) {
+            break;
+        }
+
+        if (tok.kind != NIX_TOKEN_DOLLAR_CURLY) {
+            TRY(__parser_error(pr, &tok));
+        }
+
+        TRY(__parser_expr(pr, &expr));
+        TRY(__parser_expect(pr, NIX_TOKEN_RBRACE, NULL));
+        TRY(__parser_push(pr, expr));
+    }
+
+    pr->strings--;
+
+    uint32_t first, length;
+    TRY(__parser_pop_list(pr, stack_base, &first, &length));
+
+    node = __ast_node(NIX_AST_PATH_INTERP, start->start, pr->last_end);
+    node.flags = home ? NIX_AST_FLAG_HOME : 0;
+    node.data[0] = first;
+    node.data[1] = length;
+    TRY(__ast_push(pr->ast, &node, out));
+
+    EXCEPT(err)
+    return err;
+}
+
+// Bindings and inherits up to the terminator, which is left in place
+enum nix_err
+__parser_binds(
+    struct parser *pr,
+    enum nix_token_kind terminator,
+    uint32_t *first,
+    uint32_t *count)
+{
+    struct parser_token tok;
+    struct nix_ast_node node;
+    uint32_t a, b, c;
+
+    size_t base = pr->stack_size;
+
+    for (;;) {
+        TRY(__parser_fill(pr, 1));
+        tok = *__parser_peek(pr, 0);
+
+        if (tok.kind == terminator) {
+            break;
+        }
+
+        if (tok.kind == NIX_TOKEN_KW_INHERIT) {
+            uint32_t from = NIX_AST_NONE;
+
+            TRY(__parser_take(pr, NULL));
+            TRY(__parser_fill(pr, 1));
+
+            if (__parser_peek(pr, 0)->kind == NIX_TOKEN_LPAREN) {
+                TRY(__parser_take(pr, NULL));
+                TRY(__parser_expr(pr, &from));
+                TRY(__parser_expect(pr, NIX_TOKEN_RPAREN, NULL));
+            }
+
+            size_t names = pr->stack_size;
+            for (;;) {
+                TRY(__parser_fill(pr, 1));
+                if (__parser_peek(pr, 0)->kind == NIX_TOKEN_SEMICOLON) {
+                    break;
+                }
+
+                TRY(__parser_attr(pr, &a));
+                TRY(__parser_push(pr, a));
+            }
+
+            TRY(__parser_take(pr, NULL));
+            TRY(__parser_pop_list(pr, names, &b, &c));
+
+            node = __ast_node(NIX_AST_INHERIT, tok.start, pr->last_end);
+            node.data[0] = from;
+            node.data[1] = b;
+            node.data[2] = c;
+        } else {
+            TRY(__parser_attrpath(pr, &a));
+            TRY(__parser_expect(pr, NIX_TOKEN_ASSIGN, NULL));
+            TRY(__parser_expr(pr, &b));
+            TRY(__parser_expect(pr, NIX_TOKEN_SEMICOLON, NULL));
+
+            node = __ast_node(NIX_AST_BINDING, tok.start, pr->last_end);
+            node.data[0] = a;
+            node.data[1] = b;
+        }
+
+        TRY(__ast_push(pr->ast, &node, &a));
+        TRY(__parser_push(pr, a));
+    }
+
+    TRY(__parser_pop_list(pr, base, first, count));
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__parser_attrpath(struct parser *pr, uint32_t *out) {
+    uint32_t attr, first, count;
+
+    size_t base = pr->stack_size;
+    TRY(__parser_fill(pr, 1));
+    uint32_t start = __parser_peek(pr, 0)->start;
+
+    for (;;) {
+        TRY(__parser_attr(pr, &attr));
+        TRY(__parser_push(pr, attr));
+
+        TRY(__parser_fill(pr, 1));
+        if (__parser_peek(pr, 0)->kind != NIX_TOKEN_DOT) {
+            break;
+        }
+
+        TRY(__parser_take(pr, NULL));
+    }
+
+    TRY(__parser_pop_list(pr, base, &first, &count));
+
+    struct nix_ast_node node = __ast_node(NIX_AST_ATTRPATH, start,
+        pr->last_end);
+    node.data[0] = first;
+    node.data[1] = count;
+    TRY(__ast_push(pr->ast, &node, out));
+
+    EXCEPT(err)
+    return err;
+}
+
+// An attribute name: an identifier, a string or ${...}
+enum nix_err
+__parser_attr(struct parser *pr, uint32_t *out) {
+    struct parser_token tok;
+    struct nix_ast_node node;
+    uint32_t expr;
+
+    TRY(__parser_fill(pr, 1));
+    tok = *__parser_peek(pr, 0);
+
+    switch (tok.kind) {
+    case NIX_TOKEN_ID:
+    case NIX_TOKEN_KW_OR:
+        TRY(__parser_take(pr, NULL));
+        node = __ast_node(NIX_AST_ID, tok.start, tok.end);
+        node.data[0] = tok.kind == NIX_TOKEN_ID ? tok.value.id : pr->or_id;
+        TRY(__ast_push(pr->ast, &node, out));
+        break;
+
+    case NIX_TOKEN_STRING_OPEN:
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_string(pr, &tok, out));
+        break;
+
+    case NIX_TOKEN_DOLLAR_CURLY:
+        TRY(__parser_take(pr, NULL));
+        TRY(__parser_expr(pr, &expr));
+        TRY(__parser_expect(pr, NIX_TOKEN_RBRACE, NULL));
+
+        node = __ast_node(NIX_AST_DYNAMIC, tok.start, pr->last_end);
+        node.data[0] = expr;
+        TRY(__ast_push(pr->ast, &node, out));
+        break;
+
+    default:
+        TRY(__parser_error(pr, &tok));
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+// { a, b ? default, ... }
+enum nix_err
+__parser_formals(struct parser *pr, uint32_t *out) {
+    struct parser_token open, name;
+    struct nix_ast_node node;
+    uint32_t index, first, count;
+    uint16_t flags = 0;
+
+    TRY(__parser_expect(pr, NIX_TOKEN_LBRACE, &open));
+
+    size_t base = pr->stack_size;
+
+    for (;;) {
+        TRY(__parser_fill(pr, 1));
+        enum nix_token_kind kind = __parser_peek(pr, 0)->kind;
+
+        if (kind == NIX_TOKEN_RBRACE) {
+            TRY(__parser_take(pr, NULL));
+            break;
+        }
+
+        if (kind == NIX_TOKEN_ELLIPSIS) {
+            TRY(__parser_take(pr, NULL));
+            TRY(__parser_expect(pr, NIX_TOKEN_RBRACE, NULL));
+            flags |= NIX_AST_FLAG_ELLIPSIS;
+            break;
+        }
+
+        TRY(__parser_expect(pr, NIX_TOKEN_ID, &name));
+
+        uint32_t fallback = NIX_AST_NONE;
+        TRY(__parser_fill(pr, 1));
+        if (__parser_peek(pr, 0)->kind == NIX_TOKEN_QUESTION) {
+            TRY(__parser_take(pr, NULL));
+            TRY(__parser_expr(pr, &fallback));
+        }
+
+        node = __ast_node(NIX_AST_FORMAL, name.start, pr->last_end);
+        node.data[0] = name.value.id;
+        node.data[1] = fallback;
+        TRY(__ast_push(pr->ast, &node, &index));
+        TRY(__parser_push(pr, index));
+
+        TRY(__parser_fill(pr, 1));
+        if (__parser_peek(pr, 0)->kind != NIX_TOKEN_COMMA) {
+            TRY(__parser_expect(pr, NIX_TOKEN_RBRACE, NULL));
+            break;
+        }
+
+        TRY(__parser_take(pr, NULL));
+    }
+
+    TRY(__parser_pop_list(pr, base, &first, &count));
+
+    node = __ast_node(NIX_AST_FORMALS, open.start, pr->last_end);
+    node.flags = flags;
+    node.data[0] = first;
+    node.data[1] = count;
+    TRY(__ast_push(pr->ast, &node, out));
+
+    EXCEPT(err)
+    return err;
+}
@@ -0,0 +1,260 @@
+#ifndef INCLUDE_parser_h__
+#define INCLUDE_parser_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/parser.h"
+#include "libnix/string.h"
+#include "ast.h"
+#include "lexer.h"
+
+// Telling a function's formals from an attribute set takes up to three
+// tokens, as in { } : or { a ,
+#define PARSER_LOOKAHEAD 3
+
+// Bounds the recursion, so deeply nested input fails rather than
+// overflowing the stack
+#define PARSER_MAX_DEPTH 1024
+
+#define PARSER_INITIAL_STACK 64
+#define PARSER_INITIAL_RAW 1024
+
+// How tightly each binary operator binds, from Nix's grammar; application
+// and selection bind tighter than all of them
+enum parser_precedence {
+    PREC_NONE = 0,
+    PREC_IMPL,
+    PREC_OR,
+    PREC_AND,
+    PREC_EQUALITY,
+    PREC_COMPARE,
+    PREC_UPDATE,
+    PREC_NOT,
+    PREC_SUM,
+    PREC_PRODUCT,
+    PREC_CONCAT,
+    PREC_HAS_ATTR,
+    PREC_NEGATE
+};
+
+enum parser_assoc {
+    ASSOC_LEFT = 0,
+    ASSOC_RIGHT,
+    ASSOC_NONE
+};
+
+// A token with whatever its text turned into, taken from the buffer while
+// it was still the current lexeme
+struct parser_token {
+    uint8_t kind;
+    uint32_t start;
+    uint32_t end;
+
+    union {
+        uint32_t id;
+        int64_t i;
+        double f;
+
+        // Where the raw text went in the parser's scratch space
+        struct {
+            uint32_t offset;
+            uint32_t length;
+        } raw;
+    } value;
+};
+
+// Raw text of a string up to an interpolation, which is NIX_AST_NONE for
+// the last part
+struct parser_part {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t start;
+    uint32_t end;
+    uint32_t expr;
+};
+
+struct parser {
+    struct nix_parser p;
+
+    struct lexer lexer;
+    struct ast *ast;
+
+    struct parser_token lookahead[PARSER_LOOKAHEAD];
+    size_t head;
+    size_t count;
+
+    // Where the last token taken ended
+    uint32_t last_end;
+
+    unsigned depth;
+
+    // Strings currently being parsed, whose raw text must be kept
+    unsigned strings;
+
+    // Children of lists under construction
+    uint32_t *stack;
+    size_t stack_size;
+    size_t stack_capacity;
+
+    struct parser_part *parts;
+    size_t part_count;
+    size_t part_capacity;
+
+    struct nix_string_part *decode;
+    size_t decode_capacity;
+
+    // Raw text of strings and paths, in UTF-8
+    char *raw;
+    size_t raw_size;
+    size_t raw_capacity;
+
+    uint32_t or_id;
+};
+
+enum nix_err
+__parser_fill(struct parser *, size_t);
+
+enum nix_err
+__parser_lex(struct parser *, struct parser_token *);
+
+enum nix_err
+__parser_take(struct parser *, struct parser_token *);
+
+enum nix_err
+__parser_expect(struct parser *, enum nix_token_kind, struct parser_token *);
+
+enum nix_err
+__parser_error(struct parser *, struct parser_token *);
+
+enum nix_err
+__parser_push(struct parser *, uint32_t);
+
+enum nix_err
+__parser_pop_list(struct parser *, size_t, uint32_t *, uint32_t *);
+
+enum nix_err
+__parser_expr(struct parser *, uint32_t *);
+
+enum nix_err
+__parser_op(struct parser *, int, uint32_t *);
+
+enum nix_err
+__parser_app(struct parser *, uint32_t *);
+
+enum nix_err
+__parser_select(struct parser *, uint32_t *);
+
+enum nix_err
+__parser_simple(struct parser *, uint32_t *);
+
+enum nix_err
+__parser_string(struct parser *, struct parser_token *, uint32_t *);
+
+enum nix_err
+__parser_path(struct parser *, struct parser_token *, uint32_t *);
+
+enum nix_err
+__parser_binds(struct parser *, enum nix_token_kind, uint32_t *, uint32_t *);
+
+enum nix_err
+__parser_attrpath(struct parser *, uint32_t *);
+
+enum nix_err
+__parser_attr(struct parser *, uint32_t *);
+
+enum nix_err
+__parser_formals(struct parser *, uint32_t *);
+
+enum nix_err
+__parser_lambda(struct parser *, uint32_t, uint32_t, uint32_t, uint32_t *);
+
+// The next unconsumed token but i, once filled
+static inline struct parser_token *
+__parser_peek(struct parser *pr, size_t i) {
+    return &pr->lookahead[(pr->head + i) % PARSER_LOOKAHEAD];
+}
+
+static inline void
+__parser_precedence(
+    enum nix_token_kind kind,
+    int *prec,
+    enum parser_assoc *assoc)
+{
+    *assoc = ASSOC_LEFT;
+
+    switch (kind) {
+    case NIX_TOKEN_IMPL:
+        *prec = PREC_IMPL;
+        *assoc = ASSOC_RIGHT;
+        break;
+    case NIX_TOKEN_OR:
+        *prec = PREC_OR;
+        break;
+    case NIX_TOKEN_AND:
+        *prec = PREC_AND;
+        break;
+    case NIX_TOKEN_EQ:
+    case NIX_TOKEN_NEQ:
+        *prec = PREC_EQUALITY;
+        *assoc = ASSOC_NONE;
+        break;
+    case NIX_TOKEN_LT:
+    case NIX_TOKEN_GT:
+    case NIX_TOKEN_LEQ:
+    case NIX_TOKEN_GEQ:
+        *prec = PREC_COMPARE;
+        *assoc = ASSOC_NONE;
+        break;
+    case NIX_TOKEN_UPDATE:
+        *prec = PREC_UPDATE;
+        *assoc = ASSOC_RIGHT;
+        break;
+    case NIX_TOKEN_PLUS:
+    case NIX_TOKEN_MINUS:
+        *prec = PREC_SUM;
+        break;
+    case NIX_TOKEN_MUL:
+    case NIX_TOKEN_DIV:
+        *prec = PREC_PRODUCT;
+        break;
+    case NIX_TOKEN_CONCAT:
+        *prec = PREC_CONCAT;
+        *assoc = ASSOC_RIGHT;
+        break;
+    case NIX_TOKEN_QUESTION:
+        *prec = PREC_HAS_ATTR;
+        *assoc = ASSOC_NONE;
+        break;
+    default:
+        *prec = PREC_NONE;
+        break;
+    }
+}
+
+// Whether a token can begin an argument in an application
+static inline bool
+__parser_starts_simple(enum nix_token_kind kind) {
+    switch (kind) {
+    case NIX_TOKEN_ID:
+    case NIX_TOKEN_INT:
+    case NIX_TOKEN_FLOAT:
+    case NIX_TOKEN_PATH:
+    case NIX_TOKEN_HPATH:
+    case NIX_TOKEN_SPATH:
+    case NIX_TOKEN_URI:
+    case NIX_TOKEN_PATH_START:
+    case NIX_TOKEN_STRING_OPEN:
+    case NIX_TOKEN_IND_STRING_OPEN:
+    case NIX_TOKEN_LPAREN:
+    case NIX_TOKEN_LBRACE:
+    case NIX_TOKEN_LBRACKET:
+    case NIX_TOKEN_KW_REC:
+        return true;
+    default:
+        return false;
+    }
+}
+
+#endif
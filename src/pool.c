@@ -0,0 +1,615 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "common.h"
+#include "error.h"
+#include "hash.h"
+
+// The worker running on this thread, if any, so jobs submitted from inside
+// a job can go on its own deque
+static _Thread_local struct pool_worker *__pool_current;
+
+enum nix_err
+nix_pool__init(struct nix_pool *out, unsigned int threads, unsigned int flags) {
+    struct pool *pool = (struct pool *)out;
+
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (unsigned int)online : 1;
+    }
+
+    pool->p.threads = threads;
+    pool->p.flags = flags;
+
+    pool->workers = NULL;
+    pool->queue = NULL;
+    pool->queue_start = 0;
+    pool->queue_count = 0;
+    pool->queue_capacity = POOL_INITIAL_QUEUE;
+    pool->stopping = false;
+    pool->ready = 0;
+
+    atomic_init(&pool->sleeping, 0);
+    atomic_init(&pool->queued, 0);
+
+    if (pthread_mutex_init(&pool->queue_lock, NULL) != 0) {
+        TRY(NIXERR_THREAD);
+    }
+
+    pool->ready |= POOL_READY_QUEUE_LOCK;
+
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        TRY(NIXERR_THREAD);
+    }
+
+    pool->ready |= POOL_READY_LOCK;
+
+    if (pthread_cond_init(&pool->wake, NULL) != 0) {
+        TRY(NIXERR_THREAD);
+    }
+
+    pool->ready |= POOL_READY_WAKE;
+
+    ALLOC(pool->queue, sizeof(struct pool_task *) * pool->queue_capacity);
+    ALLOC(pool->workers, sizeof(struct pool_worker) * threads);
+    memset(pool->workers, 0, sizeof(struct pool_worker) * threads);
+
+    // Every deque exists before any worker starts looking for one to steal
+    // from
+    for (size_t i = 0; i < threads; i++) {
+        struct pool_worker *w = &pool->workers[i];
+        w->pool = pool;
+        w->index = i;
+        w->seed = __hash_mix(i + 1);
+
+        TRY(__pool_deque_init(&w->deque));
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        struct pool_worker *w = &pool->workers[i];
+        if (pthread_create(&w->thread, NULL, &__pool_worker_run, w) != 0) {
+            TRY(NIXERR_THREAD);
+        }
+
+        w->started = true;
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_pool__construct(
+    struct nix_pool **out,
+    unsigned int threads,
+    unsigned int flags)
+{
+    struct pool *pool = NULL;
+    ALLOC(pool, sizeof(struct pool));
+    memset(pool, 0, sizeof(struct pool));
+
+    TRY(nix_pool__init((struct nix_pool *)pool, threads, flags));
+    *out = (struct nix_pool *)pool;
+
+    EXCEPT(err)
+    nix_pool__free((struct nix_pool **)&pool);
+    return err;
+}
+
+enum nix_err
+nix_pool__submit(
+    struct nix_pool *nix_pool,
+    struct nix_wait_group *group,
+    nix_pool_job job,
+    void *arg)
+{
+    struct pool *pool = (struct pool *)nix_pool;
+    struct pool_task *task = NULL;
+    bool queued = false;
+
+    ALLOC(task, sizeof(struct pool_task));
+    task->job = job;
+    task->arg = arg;
+    task->group = (struct wait_group *)group;
+
+    if (task->group != NULL) {
+        atomic_fetch_add(&task->group->pending, 1);
+    }
+
+    // Counted before it's published, since a thief could take it and count
+    // it off straight away. This pairs with the worker counting itself as
+    // sleeping before it checks for tasks, so either it sees this task or
+    // it's woken for it.
+    atomic_fetch_add(&pool->queued, 1);
+    queued = true;
+
+    if (__pool_current != NULL && __pool_current->pool == pool) {
+        TRY(__pool_deque_push(&__pool_current->deque, task));
+    } else {
+        TRY(__pool_enqueue(pool, task));
+    }
+
+    if (atomic_load(&pool->sleeping) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    EXCEPT(err)
+    if (queued) {
+        atomic_fetch_sub(&pool->queued, 1);
+    }
+
+    if (task != NULL && task->group != NULL) {
+        __pool_group_done(task->group);
+    }
+
+    FREE(task);
+    return err;
+}
+
+enum nix_err
+__pool_enqueue(struct pool *pool, struct pool_task *task) {
+    if (pthread_mutex_lock(&pool->queue_lock) != 0) {
+        return NIXERR_THREAD;
+    }
+
+    if (pool->queue_count == pool->queue_capacity) {
+        size_t capacity = pool->queue_capacity * 2;
+        struct pool_task **queue = NULL;
+        ALLOC(queue, sizeof(struct pool_task *) * capacity);
+
+        for (size_t i = 0; i < pool->queue_count; i++) {
+            queue[i] = pool->queue[
+                (pool->queue_start + i) % pool->queue_capacity];
+        }
+
+        FREE(pool->queue);
+        pool->queue = queue;
+        pool->queue_start = 0;
+        pool->queue_capacity = capacity;
+    }
+
+    pool->queue[(pool->queue_start + pool->queue_count) %
+        pool->queue_capacity] = task;
+    pool->queue_count++;
+
+    pthread_mutex_unlock(&pool->queue_lock);
+
+    EXCEPT(err)
+    pthread_mutex_unlock(&pool->queue_lock);
+    return err;
+}
+
+struct pool_task *
+__pool_dequeue(struct pool *pool) {
+    struct pool_task *task = NULL;
+
+    if (pthread_mutex_lock(&pool->queue_lock) != 0) {
+        return NULL;
+    }
+
+    if (pool->queue_count > 0) {
+        task = pool->queue[pool->queue_start];
+        pool->queue_start = (pool->queue_start + 1) % pool->queue_capacity;
+        pool->queue_count--;
+    }
+
+    pthread_mutex_unlock(&pool->queue_lock);
+
+    return task;
+}
+
+// Look for a task: the worker's own newest first, then the shared queue,
+// then the oldest of another worker's, starting from a random one
+struct pool_task *
+__pool_find(struct pool *pool, struct pool_worker *worker) {
+    struct pool_task *task = NULL;
+    size_t start = 0;
+
+    if (atomic_load(&pool->queued) == 0) {
+        return NULL;
+    }
+
+    if (worker != NULL) {
+        task = __pool_deque_take(&worker->deque);
+        worker->seed = __hash_mix(worker->seed);
+        start = worker->seed % pool->p.threads;
+    }
+
+    if (task == NULL) {
+        task = __pool_dequeue(pool);
+    }
+
+    for (size_t i = 0; task == NULL && i < pool->p.threads; i++) {
+        struct pool_worker *victim =
+            &pool->workers[(start + i) % pool->p.threads];
+
+        if (victim != worker) {
+            task = __pool_deque_steal(&victim->deque);
+        }
+    }
+
+    if (task != NULL) {
+        atomic_fetch_sub(&pool->queued, 1);
+    }
+
+    return task;
+}
+
+void
+__pool_run(struct pool *pool, struct pool_task *task) {
+    struct wait_group *group = task->group;
+
+    task->job(task->arg);
+    FREE(task);
+
+    if (group != NULL) {
+        __pool_group_done(group);
+    }
+}
+
+// Count a job of the group as finished. The last one is counted under the
+// lock, so a waiter can neither miss the wakeup nor free the group before
+// it has been given.
+void
+__pool_group_done(struct wait_group *group) {
+    size_t pending = atomic_load(&group->pending);
+
+    while (pending > 1) {
+        if (atomic_compare_exchange_weak(&group->pending, &pending,
+                    pending - 1)) {
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&group->lock);
+    if (atomic_fetch_sub(&group->pending, 1) == 1) {
+        pthread_cond_broadcast(&group->done);
+    }
+
+    pthread_mutex_unlock(&group->lock);
+}
+
+void *
+__pool_worker_run(void *arg) {
+    struct pool_worker *worker = arg;
+    struct pool *pool = worker->pool;
+
+    __pool_current = worker;
+
+    if (pool->p.flags & NIX_POOL_PIN) {
+        __pool_pin(worker);
+    }
+
+    for (;;) {
+        struct pool_task *task = __pool_find(pool, worker);
+        if (task != NULL) {
+            __pool_run(pool, task);
+            continue;
+        }
+
+        atomic_fetch_add(&pool->sleeping, 1);
+        pthread_mutex_lock(&pool->lock);
+
+        while (atomic_load(&pool->queued) == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+
+        bool stop = pool->stopping && atomic_load(&pool->queued) == 0;
+
+        pthread_mutex_unlock(&pool->lock);
+        atomic_fetch_sub(&pool->sleeping, 1);
+
+        if (stop) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+void
+__pool_pin(struct pool_worker *worker) {
+#ifdef __linux__
+    // Workers go round the CPUs the process may run on, which under a
+    // cpuset needn't be the first ones
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+
+    int count = CPU_COUNT(&allowed);
+    if (count == 0) {
+        return;
+    }
+
+    size_t skip = worker->index % count;
+    int cpu = 0;
+    for (; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && skip-- == 0) {
+            break;
+        }
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    // Only a hint; a worker left unpinned still works
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)worker;
+#endif
+}
+
+void
+nix_pool__free(struct nix_pool **out) {
+    if (*out == NULL) return;
+
+    struct pool *pool = (struct pool *)*out;
+
+    if (pool->ready & POOL_READY_WAKE) {
+        pthread_mutex_lock(&pool->lock);
+        pool->stopping = true;
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    for (size_t i = 0; pool->workers != NULL && i < pool->p.threads; i++) {
+        if (pool->workers[i].started) {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+    }
+
+    for (size_t i = 0; pool->workers != NULL && i < pool->p.threads; i++) {
+        __pool_deque_free(&pool->workers[i].deque);
+    }
+
+    if (pool->ready & POOL_READY_WAKE) {
+        pthread_cond_destroy(&pool->wake);
+    }
+
+    if (pool->ready & POOL_READY_LOCK) {
+        pthread_mutex_destroy(&pool->lock);
+    }
+
+    if (pool->ready & POOL_READY_QUEUE_LOCK) {
+        pthread_mutex_destroy(&pool->queue_lock);
+    }
+
+    FREE(pool->queue);
+    FREE(pool->workers);
+    FREE(pool);
+
+    *out = NULL;
+}
+
+enum nix_err
+__pool_deque_init(struct pool_deque *deque) {
+    struct pool_array *array = NULL;
+
+    ALLOC(array, sizeof(struct pool_array) +
+        sizeof(struct pool_task *) * POOL_INITIAL_DEQUE);
+    array->size = POOL_INITIAL_DEQUE;
+    array->retired = NULL;
+
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->array, array);
+
+    EXCEPT(err)
+    return err;
+}
+
+void
+__pool_deque_free(struct pool_deque *deque) {
+    struct pool_array *array = atomic_load(&deque->array);
+
+    while (array != NULL) {
+        struct pool_array *retired = array->retired;
+        FREE(array);
+        array = retired;
+    }
+
+    atomic_store(&deque->array, NULL);
+}
+
+enum nix_err
+__pool_deque_push(struct pool_deque *deque, struct pool_task *task) {
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    struct pool_array *array =
+        atomic_load_explicit(&deque->array, memory_order_relaxed);
+
+    // Grow into a new array, keeping the old one alive for thieves which
+    // may still be reading it
+    if (b - t > array->size - 1) {
+        struct pool_array *grown = NULL;
+        ALLOC(grown, sizeof(struct pool_array) +
+            sizeof(struct pool_task *) * array->size * 2);
+        grown->size = array->size * 2;
+        grown->retired = array;
+
+        for (int64_t i = t; i < b; i++) {
+            atomic_store_explicit(&grown->tasks[i % grown->size],
+                atomic_load_explicit(&array->tasks[i % array->size],
+                    memory_order_relaxed), memory_order_relaxed);
+        }
+
+        atomic_store_explicit(&deque->array, grown, memory_order_release);
+        array = grown;
+    }
+
+    atomic_store_explicit(&array->tasks[b % array->size], task,
+        memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+
+    EXCEPT(err)
+    return err;
+}
+
+struct pool_task *
+__pool_deque_take(struct pool_deque *deque) {
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    struct pool_array *array =
+        atomic_load_explicit(&deque->array, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (t > b) {
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    struct pool_task *task = atomic_load_explicit(
+        &array->tasks[b % array->size], memory_order_relaxed);
+
+    // The last task may be wanted by a thief too; whoever moves the top
+    // first gets it
+    if (t == b) {
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                    memory_order_seq_cst, memory_order_relaxed)) {
+            task = NULL;
+        }
+
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    }
+
+    return task;
+}
+
+struct pool_task *
+__pool_deque_steal(struct pool_deque *deque) {
+    int64_t t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (t >= b) {
+        return NULL;
+    }
+
+    struct pool_array *array =
+        atomic_load_explicit(&deque->array, memory_order_acquire);
+    struct pool_task *task = atomic_load_explicit(
+        &array->tasks[t % array->size], memory_order_relaxed);
+
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+
+    return task;
+}
+
+enum nix_err
+nix_wait_group__init(struct nix_wait_group *out, struct nix_pool *pool) {
+    struct wait_group *group = (struct wait_group *)out;
+
+    group->p.pool = pool;
+    group->ready = 0;
+    atomic_init(&group->pending, 0);
+
+    if (pthread_mutex_init(&group->lock, NULL) != 0) {
+        TRY(NIXERR_THREAD);
+    }
+
+    group->ready |= POOL_READY_LOCK;
+
+    if (pthread_cond_init(&group->done, NULL) != 0) {
+        TRY(NIXERR_THREAD);
+    }
+
+    group->ready |= POOL_READY_WAKE;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_wait_group__construct(
+    struct nix_wait_group **out,
+    struct nix_pool *pool)
+{
+    struct wait_group *group = NULL;
+    ALLOC(group, sizeof(struct wait_group));
+    memset(group, 0, sizeof(struct wait_group));
+
+    TRY(nix_wait_group__init((struct nix_wait_group *)group, pool));
+    *out = (struct nix_wait_group *)group;
+
+    EXCEPT(err)
+    nix_wait_group__free((struct nix_wait_group **)&group);
+    return err;
+}
+
+enum nix_err
+nix_wait_group__wait(struct nix_wait_group *wait_group) {
+    struct wait_group *group = (struct wait_group *)wait_group;
+    struct pool *pool = (struct pool *)group->p.pool;
+    struct pool_worker *worker = __pool_current;
+
+    if (worker != NULL && worker->pool != pool) {
+        worker = NULL;
+    }
+
+    // Help with whatever is queued, then sleep through the group's last
+    // jobs once there's nothing left to take
+    while (atomic_load(&group->pending) > 0) {
+        struct pool_task *task = __pool_find(pool, worker);
+        if (task != NULL) {
+            __pool_run(pool, task);
+            continue;
+        }
+
+        if (pthread_mutex_lock(&group->lock) != 0) {
+            return NIXERR_THREAD;
+        }
+
+        while (atomic_load(&group->pending) > 0) {
+            pthread_cond_wait(&group->done, &group->lock);
+        }
+
+        pthread_mutex_unlock(&group->lock);
+    }
+
+    // Wait for whoever finished the last job to let go of the lock, so the
+    // group can be freed as soon as this returns
+    if (pthread_mutex_lock(&group->lock) != 0) {
+        return NIXERR_THREAD;
+    }
+
+    pthread_mutex_unlock(&group->lock);
+
+    return NIXERR_NONE;
+}
+
+void
+nix_wait_group__free(struct nix_wait_group **out) {
+    if (*out == NULL) return;
+
+    struct wait_group *group = (struct wait_group *)*out;
+
+    if (group->ready & POOL_READY_WAKE) {
+        pthread_cond_destroy(&group->done);
+    }
+
+    if (group->ready & POOL_READY_LOCK) {
+        pthread_mutex_destroy(&group->lock);
+    }
+
+    FREE(group);
+
+    *out = NULL;
+}
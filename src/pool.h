@@ -0,0 +1,127 @@
+#ifndef INCLUDE_pool_h__
+#define INCLUDE_pool_h__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/pool.h"
+
+#define POOL_INITIAL_DEQUE 256
+#define POOL_INITIAL_QUEUE 256
+
+// Keeps each worker's deque indices on their own cache line
+#define POOL_CACHE_LINE 64
+
+struct pool_task {
+    nix_pool_job job;
+    void *arg;
+    struct wait_group *group;
+};
+
+struct pool_array {
+    int64_t size;
+
+    // Arrays outgrown while thieves may still be reading them
+    struct pool_array *retired;
+
+    _Atomic(struct pool_task *) tasks[];
+};
+
+// A Chase-Lev deque, as given for C11 atomics by Lê et al. The owner pushes
+// and takes at the bottom; thieves take from the top.
+struct pool_deque {
+    _Alignas(POOL_CACHE_LINE) atomic_int_fast64_t top;
+    _Alignas(POOL_CACHE_LINE) atomic_int_fast64_t bottom;
+    _Atomic(struct pool_array *) array;
+};
+
+struct pool_worker {
+    struct pool_deque deque;
+
+    struct pool *pool;
+    size_t index;
+    uint64_t seed;
+
+    pthread_t thread;
+    bool started;
+};
+
+struct pool {
+    struct nix_pool p;
+
+    struct pool_worker *workers;
+
+    // Tasks submitted from outside the pool, in a ring
+    pthread_mutex_t queue_lock;
+    struct pool_task **queue;
+    size_t queue_start;
+    size_t queue_count;
+    size_t queue_capacity;
+
+    // Idle workers sleep until a task is submitted or the pool is freed
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    atomic_size_t sleeping;
+    atomic_size_t queued;
+    bool stopping;
+
+    unsigned int ready;
+};
+
+struct wait_group {
+    struct nix_wait_group p;
+
+    atomic_size_t pending;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    unsigned int ready;
+};
+
+// Which parts of a pool or group have been set up, to be undone when freed
+enum pool_ready {
+    POOL_READY_QUEUE_LOCK = 1 << 0,
+    POOL_READY_LOCK = 1 << 1,
+    POOL_READY_WAKE = 1 << 2
+};
+
+enum nix_err
+__pool_deque_init(struct pool_deque *);
+
+void
+__pool_deque_free(struct pool_deque *);
+
+enum nix_err
+__pool_deque_push(struct pool_deque *, struct pool_task *);
+
+struct pool_task *
+__pool_deque_take(struct pool_deque *);
+
+struct pool_task *
+__pool_deque_steal(struct pool_deque *);
+
+enum nix_err
+__pool_enqueue(struct pool *, struct pool_task *);
+
+struct pool_task *
+__pool_dequeue(struct pool *);
+
+struct pool_task *
+__pool_find(struct pool *, struct pool_worker *);
+
+void
+__pool_run(struct pool *, struct pool_task *);
+
+void
+__pool_group_done(struct wait_group *);
+
+void *
+__pool_worker_run(void *);
+
+void
+__pool_pin(struct pool_worker *);
+
+#endif
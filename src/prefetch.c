@@ -0,0 +1,140 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prefetch.h"
+#include "common.h"
+#include "error.h"
+
+enum nix_err
+__prefetch_start(
+    struct prefetch **out,
+    FILE *in,
+    uint8_t *data,
+    size_t segment_size)
+{
+    struct prefetch *p = NULL;
+    bool free_ready = false, filled_ready = false;
+
+    ALLOC(p, sizeof(struct prefetch));
+
+    p->input = in;
+    p->data = data;
+    p->segment_size = segment_size;
+    p->taken = 0;
+    p->released = 0;
+    p->done = false;
+
+    atomic_init(&p->stopping, false);
+
+    if (sem_init(&p->free, 0, PREFETCH_SEGMENTS) != 0) {
+        TRY(NIXERR_THREAD);
+    }
+
+    free_ready = true;
+
+    if (sem_init(&p->filled, 0, 0) != 0) {
+        TRY(NIXERR_THREAD);
+    }
+
+    filled_ready = true;
+
+    if (pthread_create(&p->thread, NULL, &__prefetch_run, p) != 0) {
+        TRY(NIXERR_THREAD);
+    }
+
+    *out = p;
+
+    EXCEPT(err)
+    if (filled_ready) {
+        sem_destroy(&p->filled);
+    }
+
+    if (free_ready) {
+        sem_destroy(&p->free);
+    }
+
+    FREE(p);
+    return err;
+}
+
+void *
+__prefetch_run(void *arg) {
+    struct prefetch *p = arg;
+
+    for (size_t n = 0;; n++) {
+        while (sem_wait(&p->free) != 0) {}
+
+        if (atomic_load(&p->stopping)) {
+            break;
+        }
+
+        size_t i = n % PREFETCH_SEGMENTS;
+        size_t length = fread(p->data + i * p->segment_size, 1,
+            p->segment_size, p->input);
+
+        p->lengths[i] = length;
+        p->errors[i] = NIXERR_NONE;
+        if (length < p->segment_size && ferror(p->input)) {
+            p->errors[i] = NIXERR_BUF_FILE;
+        }
+
+        sem_post(&p->filled);
+
+        if (length < p->segment_size) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+enum nix_err
+__prefetch_take(struct prefetch *p, size_t *length) {
+    if (p->done) {
+        *length = 0;
+        return NIXERR_NONE;
+    }
+
+    while (sem_wait(&p->filled) != 0) {}
+
+    size_t i = p->taken % PREFETCH_SEGMENTS;
+    *length = p->lengths[i];
+    p->taken++;
+
+    if (*length < p->segment_size) {
+        p->done = true;
+    }
+
+    return p->errors[i];
+}
+
+void
+__prefetch_release(struct prefetch *p) {
+    p->released++;
+    sem_post(&p->free);
+}
+
+void
+__prefetch_stop(struct prefetch **out) {
+    if (*out == NULL) return;
+
+    struct prefetch *p = *out;
+
+    // The extra post wakes the thread if it's waiting for room; if it's
+    // reading, it sees the flag as soon as it's done
+    atomic_store(&p->stopping, true);
+    sem_post(&p->free);
+    pthread_join(p->thread, NULL);
+
+    sem_destroy(&p->filled);
+    sem_destroy(&p->free);
+    FREE(p);
+
+    *out = NULL;
+}
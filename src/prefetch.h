@@ -0,0 +1,77 @@
+#ifndef INCLUDE_prefetch_h__
+#define INCLUDE_prefetch_h__
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libnix/error.h"
+
+// The halves of the buffer, which are the segments read ahead
+#define PREFETCH_SEGMENTS 2
+
+// A thread reading a file straight into the buffer's halves ahead of its
+// reader. The halves are handed back and forth through two semaphores: one
+// counts the halves the thread may fill and the other those filled for the
+// reader, and each post orders the half's contents for whoever waits next.
+struct prefetch {
+    FILE *input;
+    size_t segment_size;
+
+    // The halves, owned by the buffer
+    uint8_t *data;
+    size_t lengths[PREFETCH_SEGMENTS];
+    enum nix_err errors[PREFETCH_SEGMENTS];
+
+    sem_t free;
+    sem_t filled;
+
+    // Halves the reader has taken and given back so far, only touched by
+    // the reader
+    size_t taken;
+    size_t released;
+
+    // Set once the reader has taken the last segment, after which the
+    // thread is gone and there's nothing left to wait for
+    bool done;
+
+    atomic_bool stopping;
+    pthread_t thread;
+};
+
+enum nix_err
+__prefetch_start(struct prefetch **, FILE *, uint8_t *, size_t);
+
+// Take the next half once the thread has filled it, waiting if need be. A
+// short segment means the end of the file.
+enum nix_err
+__prefetch_take(struct prefetch *, size_t *);
+
+// Give the oldest half the reader holds back to the thread to fill again
+void
+__prefetch_release(struct prefetch *);
+
+void
+__prefetch_stop(struct prefetch **);
+
+void *
+__prefetch_run(void *);
+
+// Whether the reader holds both halves, so the oldest can be given back once
+// nothing points into it
+static inline bool
+__prefetch_holding(const struct prefetch *p) {
+    return !p->done && p->taken - p->released == PREFETCH_SEGMENTS;
+}
+
+// The side of the buffer the oldest half held is on
+static inline size_t
+__prefetch_oldest(const struct prefetch *p) {
+    return p->released % PREFETCH_SEGMENTS;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "source.h"
+
+void
+nix_source__file(struct nix_source *out, FILE *in) {
+    out->context = in;
+    out->read = &__source_file_read;
+    out->size_hint = NULL;
+    out->borrow = NULL;
+}
+
+enum nix_err
+__source_file_read(void *context, uint8_t *out, size_t size, size_t *length) {
+    FILE *in = context;
+
+    *length = fread(out, sizeof(uint8_t), size, in);
+    if (*length < size && ferror(in)) {
+        return NIXERR_BUF_FILE;
+    }
+
+    return NIXERR_NONE;
+}
@@ -0,0 +1,13 @@
+#ifndef INCLUDE_source_h__
+#define INCLUDE_source_h__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libnix/source.h"
+
+enum nix_err
+__source_file_read(void *, uint8_t *, size_t, size_t *);
+
+#endif
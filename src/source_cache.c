@@ -0,0 +1,385 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "source_cache.h"
+#include "common.h"
+#include "error.h"
+#include "hash.h"
+
+// Given to views of empty files, which can't be mapped
+static const uint8_t __source_empty[1] = { 0 };
+
+enum nix_err
+nix_source_cache__init(struct nix_source_cache *out, size_t budget) {
+    struct source_cache *cache = (struct source_cache *)out;
+
+    cache->p.budget = budget;
+    cache->p.size = 0;
+    cache->p.count = 0;
+    cache->p.hits = 0;
+
+    cache->buckets = NULL;
+    cache->bucket_count = SOURCE_CACHE_INITIAL_BUCKETS;
+    cache->newest = NULL;
+    cache->oldest = NULL;
+    cache->lock_ready = false;
+
+    if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+        return NIXERR_THREAD;
+    }
+
+    cache->lock_ready = true;
+
+    ALLOC(cache->buckets, sizeof(struct source_entry *) * cache->bucket_count);
+    memset(cache->buckets, 0,
+        sizeof(struct source_entry *) * cache->bucket_count);
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_source_cache__construct(struct nix_source_cache **out, size_t budget) {
+    struct source_cache *cache = NULL;
+    ALLOC(cache, sizeof(struct source_cache));
+    memset(cache, 0, sizeof(struct source_cache));
+
+    TRY(nix_source_cache__init((struct nix_source_cache *)cache, budget));
+    *out = (struct nix_source_cache *)cache;
+
+    EXCEPT(err)
+    nix_source_cache__free((struct nix_source_cache **)&cache);
+    return err;
+}
+
+enum nix_err
+nix_source_cache__open(
+    struct nix_source_cache *source_cache,
+    const char *path,
+    const struct nix_source_view **out)
+{
+    struct source_cache *cache = (struct source_cache *)source_cache;
+    struct source_entry *entry = NULL, *loaded = NULL;
+    bool locked = false;
+    struct stat st;
+
+    uint64_t hash = __hash_bytes((const uint8_t *)path, strlen(path));
+
+    // The file is looked at and mapped outside the lock, which only covers
+    // the table, so opens don't wait on each other's system calls
+    if (stat(path, &st) != 0) {
+        return NIXERR_BUF_FILE;
+    }
+
+    if (pthread_mutex_lock(&cache->lock) != 0) {
+        return NIXERR_THREAD;
+    }
+
+    locked = true;
+
+    entry = __source_cache_find(cache, path, hash);
+    if (entry != NULL && __source_entry_current(entry, &st)) {
+        cache->p.hits++;
+    } else {
+        pthread_mutex_unlock(&cache->lock);
+        locked = false;
+
+        TRY(__source_entry_load(cache, path, hash, &loaded));
+
+        if (pthread_mutex_lock(&cache->lock) != 0) {
+            TRY(NIXERR_THREAD);
+        }
+
+        locked = true;
+
+        // Another thread may have mapped the same file in the meantime
+        entry = __source_cache_find(cache, path, hash);
+        if (entry == NULL || !__source_entry_same(entry, loaded)) {
+            if (entry != NULL) {
+                __source_cache_detach(cache, entry);
+                if (entry->refs == 0) {
+                    __source_entry_free(entry);
+                }
+            }
+
+            TRY(__source_cache_insert(cache, loaded));
+
+            entry = loaded;
+            loaded = NULL;
+        }
+    }
+
+    // Move it to the front of the list
+    if (cache->newest != entry) {
+        if (entry->older != NULL) {
+            entry->older->newer = entry->newer;
+        } else {
+            cache->oldest = entry->newer;
+        }
+
+        entry->newer->older = entry->older;
+
+        entry->newer = NULL;
+        entry->older = cache->newest;
+        cache->newest->newer = entry;
+        cache->newest = entry;
+    }
+
+    entry->refs++;
+    __source_cache_evict(cache);
+
+    *out = &entry->p;
+
+    pthread_mutex_unlock(&cache->lock);
+
+    // A copy that lost the race is dropped
+    __source_entry_free(loaded);
+
+    EXCEPT(err)
+    if (locked) {
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    __source_entry_free(loaded);
+    return err;
+}
+
+struct source_entry *
+__source_cache_find(struct source_cache *cache, const char *path,
+    uint64_t hash)
+{
+    struct source_entry *entry =
+        cache->buckets[hash & (cache->bucket_count - 1)];
+
+    while (entry != NULL) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+
+        entry = entry->next;
+    }
+
+    return NULL;
+}
+
+enum nix_err
+__source_cache_insert(struct source_cache *cache, struct source_entry *entry) {
+    struct source_entry **buckets = NULL;
+
+    // Chains are kept short by keeping the table at most half full
+    if ((cache->p.count + 1) * 2 > cache->bucket_count) {
+        size_t bucket_count = cache->bucket_count * 2;
+
+        ALLOC(buckets, sizeof(struct source_entry *) * bucket_count);
+        memset(buckets, 0, sizeof(struct source_entry *) * bucket_count);
+
+        for (size_t i = 0; i < cache->bucket_count; i++) {
+            struct source_entry *e = cache->buckets[i];
+            while (e != NULL) {
+                struct source_entry *next = e->next;
+                size_t j = e->hash & (bucket_count - 1);
+
+                e->next = buckets[j];
+                buckets[j] = e;
+                e = next;
+            }
+        }
+
+        FREE(cache->buckets);
+        cache->buckets = buckets;
+        cache->bucket_count = bucket_count;
+    }
+
+    size_t i = entry->hash & (cache->bucket_count - 1);
+    entry->next = cache->buckets[i];
+    cache->buckets[i] = entry;
+
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest != NULL) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+
+    cache->newest = entry;
+
+    cache->p.count++;
+    cache->p.size += entry->p.size;
+
+    EXCEPT(err)
+    return err;
+}
+
+void
+__source_cache_detach(struct source_cache *cache, struct source_entry *entry) {
+    struct source_entry **link =
+        &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+
+    *link = entry->next;
+
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+
+    entry->next = NULL;
+    entry->newer = NULL;
+    entry->older = NULL;
+    entry->detached = true;
+
+    cache->p.count--;
+    cache->p.size -= entry->p.size;
+}
+
+// Drop the least recently used files nobody is reading until the cache fits
+// in its budget
+void
+__source_cache_evict(struct source_cache *cache) {
+    struct source_entry *entry = cache->oldest;
+
+    while (entry != NULL && cache->p.size > cache->p.budget) {
+        struct source_entry *newer = entry->newer;
+
+        if (entry->refs == 0) {
+            __source_cache_detach(cache, entry);
+            __source_entry_free(entry);
+        }
+
+        entry = newer;
+    }
+}
+
+enum nix_err
+__source_entry_load(
+    struct source_cache *cache,
+    const char *path,
+    uint64_t hash,
+    struct source_entry **out)
+{
+    struct source_entry *entry = NULL;
+    size_t length = strlen(path);
+    struct stat st;
+    int fd = -1;
+
+    ALLOC(entry, sizeof(struct source_entry));
+    memset(entry, 0, sizeof(struct source_entry));
+    entry->p.data = __source_empty;
+
+    ALLOC(entry->path, length + 1);
+    memcpy(entry->path, path, length + 1);
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        TRY(NIXERR_BUF_FILE);
+    }
+
+    // The file is described by what was opened, not what was looked up, in
+    // case it was replaced in between
+    if (fstat(fd, &st) != 0) {
+        TRY(NIXERR_BUF_FILE);
+    }
+
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            TRY(NIXERR_BUF_FILE);
+        }
+
+        entry->p.data = map;
+    }
+
+    close(fd);
+
+    entry->p.path = entry->path;
+    entry->p.size = st.st_size;
+    entry->cache = cache;
+    entry->hash = hash;
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->mtime = st.st_mtim;
+
+    *out = entry;
+
+    EXCEPT(err)
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    __source_entry_free(entry);
+    return err;
+}
+
+void
+__source_entry_free(struct source_entry *entry) {
+    if (entry == NULL) return;
+
+    if (entry->p.data != __source_empty) {
+        munmap((void *)entry->p.data, entry->p.size);
+    }
+
+    FREE(entry->path);
+    FREE(entry);
+}
+
+void
+nix_source_cache__free(struct nix_source_cache **out) {
+    if (*out == NULL) return;
+
+    struct source_cache *cache = (struct source_cache *)*out;
+
+    struct source_entry *entry = cache->newest;
+    while (entry != NULL) {
+        struct source_entry *older = entry->older;
+        __source_entry_free(entry);
+        entry = older;
+    }
+
+    if (cache->lock_ready) {
+        pthread_mutex_destroy(&cache->lock);
+    }
+
+    FREE(cache->buckets);
+    FREE(cache);
+
+    *out = NULL;
+}
+
+void
+nix_source_view__release(const struct nix_source_view **out) {
+    if (*out == NULL) return;
+
+    struct source_entry *entry = (struct source_entry *)*out;
+    struct source_cache *cache = entry->cache;
+
+    pthread_mutex_lock(&cache->lock);
+
+    if (--entry->refs == 0) {
+        if (entry->detached) {
+            __source_entry_free(entry);
+        } else {
+            __source_cache_evict(cache);
+        }
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+    *out = NULL;
+}
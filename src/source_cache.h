@@ -0,0 +1,92 @@
+#ifndef INCLUDE_source_cache_h__
+#define INCLUDE_source_cache_h__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "libnix/source_cache.h"
+
+#define SOURCE_CACHE_INITIAL_BUCKETS 64
+
+struct source_entry {
+    struct nix_source_view p;
+
+    struct source_cache *cache;
+    char *path;
+    uint64_t hash;
+
+    // What the file looked like when it was mapped
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+
+    size_t refs;
+
+    // Detached entries are out of the table, and go when their last view is
+    // released
+    bool detached;
+
+    struct source_entry *next;
+
+    // Most recently used first
+    struct source_entry *newer;
+    struct source_entry *older;
+};
+
+struct source_cache {
+    struct nix_source_cache p;
+
+    pthread_mutex_t lock;
+    bool lock_ready;
+
+    struct source_entry **buckets;
+    size_t bucket_count;
+
+    struct source_entry *newest;
+    struct source_entry *oldest;
+};
+
+struct source_entry *
+__source_cache_find(struct source_cache *, const char *, uint64_t);
+
+enum nix_err
+__source_cache_insert(struct source_cache *, struct source_entry *);
+
+void
+__source_cache_detach(struct source_cache *, struct source_entry *);
+
+void
+__source_cache_evict(struct source_cache *);
+
+enum nix_err
+__source_entry_load(
+    struct source_cache *,
+    const char *,
+    uint64_t,
+    struct source_entry **);
+
+void
+__source_entry_free(struct source_entry *);
+
+static inline bool
+__source_entry_current(const struct source_entry *e, const struct stat *st) {
+    return e->dev == st->st_dev && e->ino == st->st_ino &&
+        e->mtime.tv_sec == st->st_mtim.tv_sec &&
+        e->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+        e->p.size == (size_t)st->st_size;
+}
+
+// Whether two entries were mapped from the same version of a file
+static inline bool
+__source_entry_same(const struct source_entry *a, const struct source_entry *b)
+{
+    return a->dev == b->dev && a->ino == b->ino &&
+        a->mtime.tv_sec == b->mtime.tv_sec &&
+        a->mtime.tv_nsec == b->mtime.tv_nsec &&
+        a->p.size == b->p.size;
+}
+
+#endif
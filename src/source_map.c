@@ -0,0 +1,226 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "source_map.h"
+#include "common.h"
+#include "error.h"
+
+enum nix_err
+nix_source_map__init(struct nix_source_map *out) {
+    struct source_map *map = (struct source_map *)out;
+
+    map->p.file_count = 0;
+    map->p.size = 0;
+    map->capacity = SOURCE_MAP_INITIAL_FILES;
+
+    ALLOC(map->files, sizeof(struct source_file) * map->capacity);
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_source_map__construct(struct nix_source_map **out) {
+    struct source_map *map = NULL;
+    ALLOC(map, sizeof(struct source_map));
+    memset(map, 0, sizeof(struct source_map));
+
+    TRY(nix_source_map__init((struct nix_source_map *)map));
+    *out = (struct nix_source_map *)map;
+
+    EXCEPT(err)
+    nix_source_map__free((struct nix_source_map **)&map);
+    return err;
+}
+
+void
+nix_source_map__free(struct nix_source_map **out) {
+    if (*out == NULL) return;
+
+    struct source_map *map = (struct source_map *)*out;
+
+    for (size_t i = 0; i < map->p.file_count; i++) {
+        FREE(map->files[i].name);
+        FREE(map->files[i].lines);
+    }
+
+    FREE(map->files);
+    FREE(map);
+
+    *out = NULL;
+}
+
+enum nix_err
+nix_source_map__add(
+    struct nix_source_map *source_map,
+    const char *name,
+    const char *text,
+    size_t size,
+    uint32_t *base)
+{
+    struct source_map *map = (struct source_map *)source_map;
+    struct source_file file = { 0 };
+    size_t name_length = strlen(name);
+
+    if (size >= 3 && memcmp(text, "\xEF\xBB\xBF", 3) == 0) {
+        text += 3;
+        size -= 3;
+    }
+
+    if (map->p.file_count == map->capacity) {
+        struct source_file *files = realloc(map->files,
+            sizeof(struct source_file) * map->capacity * 2);
+        if (files == NULL) {
+            TRY(NIXERR_NOMEMORY);
+        }
+
+        map->files = files;
+        map->capacity *= 2;
+    }
+
+    ALLOC(file.name, name_length + 1);
+    memcpy(file.name, name, name_length + 1);
+
+    TRY(__source_map_lines(&file, text, size));
+
+    // Files are kept one address apart, so the end of one is never the start
+    // of the next
+    if ((uint64_t)map->p.size + file.length + 1 > UINT32_MAX) {
+        TRY(NIXERR_MAP_FULL);
+    }
+
+    file.base = map->p.size;
+    map->p.size += file.length + 1;
+    map->files[map->p.file_count++] = file;
+
+    *base = file.base;
+
+    EXCEPT(err)
+    FREE(file.name);
+    FREE(file.lines);
+    return err;
+}
+
+// Count the code points of a file and note where each line starts
+enum nix_err
+__source_map_lines(struct source_file *file, const char *text, size_t size) {
+    size_t capacity = SOURCE_MAP_INITIAL_LINES;
+    uint64_t length = 0;
+
+    ALLOC(file->lines, sizeof(uint32_t) * capacity);
+    file->line_count = 0;
+
+    for (size_t i = 0; i < size; i++) {
+        uint8_t c = text[i];
+
+        // Continuation bytes don't start a code point
+        if ((c & 0xC0) == 0x80) {
+            continue;
+        }
+
+        length++;
+
+        bool end = c == '\n' || (c == '\r' && (i + 1 == size ||
+            text[i + 1] != '\n'));
+        if (!end) {
+            continue;
+        }
+
+        if (length > UINT32_MAX) {
+            TRY(NIXERR_MAP_FULL);
+        }
+
+        if (file->line_count == capacity) {
+            uint32_t *lines = realloc(file->lines,
+                sizeof(uint32_t) * capacity * 2);
+            if (lines == NULL) {
+                TRY(NIXERR_NOMEMORY);
+            }
+
+            file->lines = lines;
+            capacity *= 2;
+        }
+
+        file->lines[file->line_count++] = length;
+    }
+
+    if (length >= UINT32_MAX) {
+        TRY(NIXERR_MAP_FULL);
+    }
+
+    file->length = length;
+
+    EXCEPT(err)
+    return err;
+}
+
+// The number of values no greater than the key
+size_t
+__source_map_find(const uint32_t *values, size_t count, uint32_t key) {
+    size_t low = 0, high = count;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (values[mid] <= key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+enum nix_err
+nix_source_map__resolve(
+    struct nix_source_map *source_map,
+    uint32_t address,
+    struct nix_source_location *out)
+{
+    struct source_map *map = (struct source_map *)source_map;
+    size_t low = 0, high = map->p.file_count;
+
+    // Find the last file starting at or before the address
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (map->files[mid].base <= address) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == 0) {
+        return NIXERR_MAP_INVADDR;
+    }
+
+    struct source_file *file = &map->files[low - 1];
+    uint32_t offset = address - file->base;
+
+    // The end of a file is a valid address, for spans that reach it
+    if (offset > file->length) {
+        return NIXERR_MAP_INVADDR;
+    }
+
+    size_t line = __source_map_find(file->lines, file->line_count, offset);
+    uint32_t line_start = line > 0 ? file->lines[line - 1] : 0;
+
+    out->file = low - 1;
+    out->name = file->name;
+    out->row = line + 1;
+    out->col = offset - line_start + 1;
+
+    return NIXERR_NONE;
+}
+
+void
+nix_span__from_lexeme(
+    uint32_t base,
+    const struct nix_lexeme *lexeme,
+    struct nix_span *out)
+{
+    out->start = base + (uint32_t)lexeme->start->abs;
+    out->length = (uint32_t)(lexeme->end->abs - lexeme->start->abs);
+}
@@ -0,0 +1,36 @@
+#ifndef INCLUDE_source_map_h__
+#define INCLUDE_source_map_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "libnix/source_map.h"
+
+#define SOURCE_MAP_INITIAL_FILES 16
+#define SOURCE_MAP_INITIAL_LINES 256
+
+struct source_file {
+    char *name;
+
+    uint32_t base;
+    uint32_t length;
+
+    // Offsets of the first code point of each line after the first
+    uint32_t *lines;
+    size_t line_count;
+};
+
+struct source_map {
+    struct nix_source_map p;
+
+    struct source_file *files;
+    size_t capacity;
+};
+
+enum nix_err
+__source_map_lines(struct source_file *, const char *, size_t);
+
+size_t
+__source_map_find(const uint32_t *, size_t, uint32_t);
+
+#endif
@@ -0,0 +1,316 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "string.h"
+#include "common.h"
+#include "error.h"
+#include "utf8.h"
+
+enum nix_err
+nix_string__decode(
+    enum nix_string_kind kind,
+    struct nix_string_part *parts,
+    size_t count,
+    char *out,
+    size_t size)
+{
+    if ((parts == NULL && count > 0) || out == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (parts[i].text == NULL && parts[i].length > 0) {
+            return NIXERR_BUF_INVPTR;
+        }
+    }
+
+    struct string_writer w = { out, out, out + size };
+    struct string_dedent d = { 0, 0, true };
+    const char *cut = NULL;
+
+    if (kind == NIX_STRING_INDENTED) {
+        d.indent = __string_find_indent(parts, count, &cut);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        char *start = w.at;
+
+        // Each part after the first follows an interpolation, which is
+        // content on its line
+        if (i > 0) {
+            d.at_line_start = false;
+            d.dropped = 0;
+        }
+
+        if (kind == NIX_STRING_INDENTED) {
+            TRY(__string_decode_indented(&w, &d, &parts[i],
+                i == count - 1 ? cut : NULL));
+        } else {
+            TRY(__string_decode_normal(&w, &parts[i]));
+        }
+
+        parts[i].decoded = start;
+        parts[i].decoded_length = (size_t)(w.at - start);
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_string__decode_lexemes(
+    enum nix_string_kind kind,
+    struct nix_lexeme **lexemes,
+    struct nix_string_part *parts,
+    size_t count,
+    char *out,
+    size_t size)
+{
+    if ((count > 0 && (lexemes == NULL || parts == NULL)) || out == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    size_t used = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        struct nix_lexeme *lexeme = lexemes[i];
+
+        parts[i].text = out + used;
+
+        if (lexeme != NULL) {
+            if (lexeme->start == NULL || lexeme->end == NULL) {
+                return NIXERR_BUF_INVPTR;
+            }
+
+            size_t n = lexeme->end->abs - lexeme->start->abs;
+            for (size_t j = 0; j < n; j++) {
+                uint8_t encoded[UTF8_MAX_BYTES];
+                size_t length = __utf8_encode(lexeme->text[j], encoded);
+
+                if (size - used < length) {
+                    return NIXERR_BUF_INVLEN;
+                }
+
+                memcpy(out + used, encoded, length);
+                used += length;
+            }
+        }
+
+        parts[i].length = (size_t)(out + used - parts[i].text);
+    }
+
+    return nix_string__decode(kind, parts, count, out, size);
+}
+
+enum nix_err
+__string_decode_normal(struct string_writer *w, struct nix_string_part *part) {
+    const char *p = part->text;
+    const char *end = p + part->length;
+
+    while (p < end) {
+        const char *q = __string_find(p, end, '\\', '\r');
+        TRY(__string_write(w, p, (size_t)(q - p)));
+
+        p = q;
+        if (p == end) {
+            break;
+        }
+
+        if (*p == '\\' && end - p >= 2) {
+            char c = __string_unescape(p[1]);
+            p += 2;
+            TRY(__string_put(w, c));
+        } else if (*p == '\\') {
+            p++;
+            TRY(__string_put(w, '\\'));
+        } else {
+            // \r and \r\n both become \n
+            p++;
+            if (p < end && *p == '\n') {
+                p++;
+            }
+
+            TRY(__string_put(w, '\n'));
+        }
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+// How long the escape at text is, or 0 if the apostrophe there is just an
+// apostrophe
+static inline size_t
+__string_escape_length(const char *text, const char *end) {
+    if (end - text < 3 || text[1] != '\'') {
+        return 0;
+    }
+
+    return text[2] == '\\' && end - text >= 4 ? 4 : 3;
+}
+
+// The indentation to remove from each line: the fewest spaces any line
+// starts with before its content, where escapes and interpolations count as
+// content but lines of nothing but spaces don't. When the string ends in a
+// line of only spaces, cut is set to where it starts, since it's dropped.
+size_t
+__string_find_indent(
+    struct nix_string_part *parts,
+    size_t count,
+    const char **cut)
+{
+    size_t indent = STRING_NO_INDENT;
+    size_t current = 0;
+    bool at_line_start = true;
+
+    *cut = NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        const char *p = parts[i].text;
+        const char *end = p + parts[i].length;
+
+        // Only text after the last escape can be the final line
+        const char *segment = p;
+
+        if (i > 0 && at_line_start) {
+            at_line_start = false;
+            indent = current < indent ? current : indent;
+        }
+
+        while (p < end) {
+            if (at_line_start) {
+                if (*p == ' ') {
+                    current++;
+                    p++;
+                    continue;
+                }
+
+                if (*p == '\n') {
+                    current = 0;
+                    p++;
+                    continue;
+                }
+
+                at_line_start = false;
+                indent = current < indent ? current : indent;
+            }
+
+            // Nothing else matters until the next line
+            p = __string_find(p, end, '\n', '\'');
+            if (p == end) {
+                break;
+            }
+
+            if (*p == '\n') {
+                at_line_start = true;
+                current = 0;
+                p++;
+                continue;
+            }
+
+            size_t escape = __string_escape_length(p, end);
+            if (escape > 0) {
+                p += escape;
+                segment = p;
+            } else {
+                p++;
+            }
+        }
+
+        if (i == count - 1 && parts[i].length > 0) {
+            const char *q = end;
+            while (q > segment && q[-1] == ' ') {
+                q--;
+            }
+
+            if (q > segment && q[-1] == '\n') {
+                *cut = q;
+            }
+        }
+    }
+
+    return indent;
+}
+
+// Write one decoded character of an indented string, dropping it if it's
+// part of the common indentation
+static inline enum nix_err
+__string_dedent_put(struct string_writer *w, struct string_dedent *d, char c) {
+    if (!d->at_line_start) {
+        d->at_line_start = c == '\n';
+        return __string_put(w, c);
+    }
+
+    if (c == ' ') {
+        if (d->dropped++ < d->indent) {
+            return NIXERR_NONE;
+        }
+    } else if (c == '\n') {
+        d->dropped = 0;
+    } else {
+        d->at_line_start = false;
+        d->dropped = 0;
+    }
+
+    return __string_put(w, c);
+}
+
+enum nix_err
+__string_decode_indented(
+    struct string_writer *w,
+    struct string_dedent *d,
+    struct nix_string_part *part,
+    const char *cut)
+{
+    const char *p = part->text;
+    const char *end = cut != NULL ? cut : p + part->length;
+
+    while (p < end) {
+        if (d->at_line_start && *p != '\'') {
+            TRY(__string_dedent_put(w, d, *p++));
+            continue;
+        }
+
+        if (!d->at_line_start) {
+            // Past the indentation, runs of text are copied as they are
+            const char *q = __string_find(p, end, '\n', '\'');
+            TRY(__string_write(w, p, (size_t)(q - p)));
+
+            p = q;
+            if (p == end) {
+                break;
+            }
+
+            if (*p == '\n') {
+                TRY(__string_dedent_put(w, d, *p++));
+                continue;
+            }
+        }
+
+        size_t escape = __string_escape_length(p, end);
+
+        if (escape == 4) {
+            // ''\ escapes like a backslash in a normal string
+            char c = __string_unescape(p[3]);
+            p += 4;
+            TRY(__string_dedent_put(w, d, c));
+        } else if (escape == 3 && p[2] == '\'') {
+            // ''' is two apostrophes
+            p += 3;
+            TRY(__string_dedent_put(w, d, '\''));
+            TRY(__string_dedent_put(w, d, '\''));
+        } else if (escape == 3) {
+            // ''$ is a dollar sign
+            char c = p[2];
+            p += 3;
+            TRY(__string_dedent_put(w, d, c));
+        } else {
+            TRY(__string_dedent_put(w, d, *p++));
+        }
+    }
+
+    EXCEPT(err)
+    return err;
+}
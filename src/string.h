@@ -0,0 +1,140 @@
+#ifndef INCLUDE_string_h__
+#define INCLUDE_string_h__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "libnix/string.h"
+
+// Indentation that no line can reach, so a string with no content has all
+// of its leading spaces removed
+#define STRING_NO_INDENT SIZE_MAX
+
+// Where the output of a decode goes, and how far it has got
+struct string_writer {
+    char *start;
+    char *at;
+    char *end;
+};
+
+// How far through removing indentation the current line is
+struct string_dedent {
+    size_t indent;
+    size_t dropped;
+    bool at_line_start;
+};
+
+enum nix_err
+__string_decode_normal(struct string_writer *, struct nix_string_part *);
+
+size_t
+__string_find_indent(struct nix_string_part *, size_t, const char **);
+
+enum nix_err
+__string_decode_indented(
+    struct string_writer *,
+    struct string_dedent *,
+    struct nix_string_part *,
+    const char *);
+
+// Bytes of a word equal to zero get their top bit set, and the lowest set
+// top bit is always a true match
+static inline uint64_t
+__string_zero_bytes(uint64_t word) {
+    return (word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL;
+}
+
+// The first of a or b in [text, end), or end if neither is there. These are
+// rare in string bodies, so whole blocks are skipped at once.
+static inline const char *
+__string_find(const char *text, const char *end, char a, char b) {
+#ifdef __SSE2__
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+
+    for (; end - text >= 16; text += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)text);
+        int mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(block, va), _mm_cmpeq_epi8(block, vb)));
+
+        if (mask != 0) {
+            return text + __builtin_ctz(mask);
+        }
+    }
+#else
+    const uint64_t wa = 0x0101010101010101ULL * (uint8_t)a;
+    const uint64_t wb = 0x0101010101010101ULL * (uint8_t)b;
+
+    for (; end - text >= 8; text += 8) {
+        uint64_t word;
+        memcpy(&word, text, sizeof(word));
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+
+        uint64_t found = __string_zero_bytes(word ^ wa) |
+            __string_zero_bytes(word ^ wb);
+
+        if (found != 0) {
+            return text + __builtin_ctzll(found) / 8;
+        }
+    }
+#endif
+
+    for (; text < end; text++) {
+        if (*text == a || *text == b) {
+            return text;
+        }
+    }
+
+    return end;
+}
+
+// Copy a run of text that may overlap the output, when decoding in place
+static inline enum nix_err
+__string_write(struct string_writer *w, const char *text, size_t length) {
+    if ((size_t)(w->end - w->at) < length) {
+        return NIXERR_BUF_INVLEN;
+    }
+
+    if (w->at != text) {
+        memmove(w->at, text, length);
+    }
+
+    w->at += length;
+    return NIXERR_NONE;
+}
+
+static inline enum nix_err
+__string_put(struct string_writer *w, char c) {
+    if (w->at == w->end) {
+        return NIXERR_BUF_INVLEN;
+    }
+
+    *w->at++ = c;
+    return NIXERR_NONE;
+}
+
+// The character a backslash escape stands for
+static inline char
+__string_unescape(char c) {
+    switch (c) {
+    case 'n':
+        return '\n';
+    case 'r':
+        return '\r';
+    case 't':
+        return '\t';
+    default:
+        return c;
+    }
+}
+
+#endif
@@ -0,0 +1,790 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tokens.h"
+#include "common.h"
+#include "error.h"
+#include "lexer.h"
+
+#define UTF8_BOM "\xEF\xBB\xBF"
+
+enum nix_err
+nix_token_table__init(struct nix_token_table *out, bool with_ids) {
+    struct token_table *t = (struct token_table *)out;
+
+    t->p.count = 0;
+    t->p.kinds = NULL;
+    t->p.flags = NULL;
+    t->p.starts = NULL;
+    t->p.lengths = NULL;
+    t->p.ids = NULL;
+    t->capacity = 0;
+
+    TRY(__token_table_reserve(t, TOKENS_INITIAL_CAPACITY));
+
+    if (with_ids) {
+        ALLOC(t->p.ids, sizeof(uint32_t) * t->capacity);
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_token_table__construct(struct nix_token_table **out, bool with_ids) {
+    struct token_table *t = NULL;
+    ALLOC(t, sizeof(struct token_table));
+    memset(t, 0, sizeof(struct token_table));
+
+    TRY(nix_token_table__init((struct nix_token_table *)t, with_ids));
+    *out = (struct nix_token_table *)t;
+
+    EXCEPT(err)
+    nix_token_table__free((struct nix_token_table **)&t);
+    return err;
+}
+
+enum nix_err
+__token_table_reserve(struct token_table *t, size_t capacity) {
+    if (capacity <= t->capacity) {
+        return NIXERR_NONE;
+    }
+
+    size_t grown = t->capacity * 2;
+    if (grown > capacity) {
+        capacity = grown;
+    }
+
+    void *kinds = realloc(t->p.kinds, sizeof(uint8_t) * capacity);
+    if (kinds == NULL) return NIXERR_NOMEMORY;
+    t->p.kinds = kinds;
+
+    void *flags = realloc(t->p.flags, sizeof(uint8_t) * capacity);
+    if (flags == NULL) return NIXERR_NOMEMORY;
+    t->p.flags = flags;
+
+    void *starts = realloc(t->p.starts, sizeof(uint32_t) * capacity);
+    if (starts == NULL) return NIXERR_NOMEMORY;
+    t->p.starts = starts;
+
+    void *lengths = realloc(t->p.lengths, sizeof(uint32_t) * capacity);
+    if (lengths == NULL) return NIXERR_NOMEMORY;
+    t->p.lengths = lengths;
+
+    if (t->p.ids != NULL) {
+        void *ids = realloc(t->p.ids, sizeof(uint32_t) * capacity);
+        if (ids == NULL) return NIXERR_NOMEMORY;
+        t->p.ids = ids;
+    }
+
+    t->capacity = capacity;
+
+    return NIXERR_NONE;
+}
+
+enum nix_err
+__token_table_push(
+    struct token_table *t,
+    uint8_t kind,
+    uint8_t flags,
+    uint32_t start,
+    uint32_t length,
+    uint32_t id)
+{
+    if (__token_table_merge(t, kind, start, length)) {
+        return NIXERR_NONE;
+    }
+
+    if (t->p.count == t->capacity) {
+        TRY(__token_table_reserve(t, t->p.count + 1));
+    }
+
+    size_t i = t->p.count++;
+    t->p.kinds[i] = kind;
+    t->p.flags[i] = flags;
+    t->p.starts[i] = start;
+    t->p.lengths[i] = length;
+
+    if (t->p.ids != NULL) {
+        t->p.ids[i] = id;
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+// Append the tokens of src from index `from`, shifting their starts
+enum nix_err
+__token_table_append(
+    struct token_table *dst,
+    struct token_table *src,
+    size_t from,
+    uint32_t shift)
+{
+    if (from < src->p.count && __token_table_merge(dst, src->p.kinds[from],
+                src->p.starts[from] + shift, src->p.lengths[from])) {
+        from++;
+    }
+
+    size_t n = src->p.count - from;
+    size_t at = dst->p.count;
+
+    TRY(__token_table_reserve(dst, at + n));
+
+    memcpy(dst->p.kinds + at, src->p.kinds + from, sizeof(uint8_t) * n);
+    memcpy(dst->p.flags + at, src->p.flags + from, sizeof(uint8_t) * n);
+    memcpy(dst->p.lengths + at, src->p.lengths + from, sizeof(uint32_t) * n);
+
+    for (size_t i = 0; i < n; i++) {
+        dst->p.starts[at + i] = src->p.starts[from + i] + shift;
+    }
+
+    if (dst->p.ids != NULL) {
+        memcpy(dst->p.ids + at, src->p.ids + from, sizeof(uint32_t) * n);
+    }
+
+    dst->p.count += n;
+
+    EXCEPT(err)
+    return err;
+}
+
+// Lex a single token into the table, offsetting its start by base
+enum nix_err
+__tokens_lex(
+    struct lexer *l,
+    struct nix_intern *intern,
+    uint32_t base,
+    struct token_table *t,
+    bool *done)
+{
+    uint8_t flags = __lexer_is_clean(&l->state) ? NIX_TOKEN_FLAG_CLEAN : 0;
+
+    struct nix_token tok;
+    TRY(nix_lexer__next((struct nix_lexer *)l, &tok));
+
+    if (tok.kind == NIX_TOKEN_EOF) {
+        *done = true;
+        return NIXERR_NONE;
+    }
+
+    if (base + tok.end.abs > UINT32_MAX) {
+        return NIXERR_BUF_INVLEN;
+    }
+
+    uint32_t id = NIX_INTERN_NONE;
+    if (intern != NULL && tok.kind == NIX_TOKEN_ID) {
+        TRY(nix_buffer__intern_lexeme(l->p.buffer, intern, &id, 0));
+    }
+
+    TRY(__token_table_push(t, tok.kind, flags, base + tok.start.abs,
+                tok.end.abs - tok.start.abs, id));
+
+    *done = false;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+nix_tokenize_file(
+    struct nix_token_table **out,
+    FILE *in,
+    struct nix_intern *intern,
+    unsigned int threads)
+{
+    return nix_tokenize_file_flags(out, in, intern, threads, 0);
+}
+
+enum nix_err
+nix_tokenize_file_flags(
+    struct nix_token_table **out,
+    FILE *in,
+    struct nix_intern *intern,
+    unsigned int threads,
+    unsigned int buffer_flags)
+{
+    return __tokens_file(out, in, intern, threads, buffer_flags, NULL);
+}
+
+// Pieces of a split file are lexed as jobs on the pool when one is given,
+// and on threads of their own otherwise
+enum nix_err
+__tokens_file(
+    struct nix_token_table **out,
+    FILE *in,
+    struct nix_intern *intern,
+    unsigned int threads,
+    unsigned int buffer_flags,
+    struct nix_pool *pool)
+{
+    struct nix_token_table *table = NULL;
+    struct nix_buffer *mem = NULL;
+    uint8_t *data = NULL;
+
+    TRY(nix_token_table__construct(&table, intern != NULL));
+
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (unsigned int)online : 1;
+    }
+
+    // The interned ids would be assigned racily by a table which isn't
+    // protected for concurrent use
+    if (intern != NULL && (intern->flags & NIX_INTERN_CONCURRENT) == 0) {
+        threads = 1;
+    }
+
+    if (threads == 1) {
+        TRY(__tokens_sequential(in, intern, buffer_flags,
+                    (struct token_table *)table));
+        *out = table;
+        return NIXERR_NONE;
+    }
+
+    size_t size;
+    TRY(__tokens_read_file(in, &data, &size));
+
+    // Only UTF-8 can be split at arbitrary lines, so anything starting with
+    // another byte-order mark is lexed in one piece
+    size_t skip = 0;
+    if (size >= 3 && memcmp(data, UTF8_BOM, 3) == 0) {
+        skip = 3;
+    }
+
+    bool utf16 = size >= 2 &&
+        ((data[0] == 0xFE && data[1] == 0xFF) ||
+         (data[0] == 0xFF && data[1] == 0xFE));
+
+    if (utf16 || size - skip < TOKENS_MIN_CHUNK_SIZE * 2) {
+        TRY(nix_buffer__construct_mem(&mem, data, size, false));
+        TRY(__tokens_lex_buffer(mem, intern, (struct token_table *)table));
+    } else {
+        TRY(__tokens_parallel(data + skip, size - skip, intern, threads,
+                    pool, (struct token_table *)table));
+    }
+
+    nix_buffer__free(&mem);
+    free(data);
+    *out = table;
+
+    EXCEPT(err)
+    nix_buffer__free(&mem);
+    FREE(data);
+    nix_token_table__free(&table);
+    return err;
+}
+
+enum nix_err
+__tokens_sequential(
+    FILE *in,
+    struct nix_intern *intern,
+    unsigned int buffer_flags,
+    struct token_table *table)
+{
+    struct nix_buffer *buf = NULL;
+
+    // Batches lex many files on each thread, so buffers are reused rather
+    // than allocated afresh for every one
+    TRY(nix_buffer__acquire(&buf, in, TOKENS_BUFFER_SIZE, buffer_flags));
+    TRY(__tokens_lex_buffer(buf, intern, table));
+
+    nix_buffer__release(&buf);
+
+    EXCEPT(err)
+    nix_buffer__release(&buf);
+    return err;
+}
+
+enum nix_err
+__tokens_lex_buffer(
+    struct nix_buffer *buf,
+    struct nix_intern *intern,
+    struct token_table *table)
+{
+    struct nix_lexer *lex = NULL;
+
+    TRY(nix_lexer__construct(&lex, buf));
+
+    bool done = false;
+    while (!done) {
+        TRY(__tokens_lex((struct lexer *)lex, intern, 0, table, &done));
+    }
+
+    nix_lexer__free(&lex);
+
+    EXCEPT(err)
+    nix_lexer__free(&lex);
+    return err;
+}
+
+enum nix_err
+__tokens_read_file(FILE *in, uint8_t **out, size_t *size) {
+    size_t capacity = TOKENS_BUFFER_SIZE;
+    size_t length = 0;
+    uint8_t *data = NULL;
+
+    ALLOC(data, capacity);
+
+    for (;;) {
+        length += fread(data + length, 1, capacity - length, in);
+        if (length < capacity) {
+            break;
+        }
+
+        capacity *= 2;
+
+        uint8_t *grown = realloc(data, capacity);
+        if (grown == NULL) {
+            TRY(NIXERR_NOMEMORY);
+        }
+
+        data = grown;
+    }
+
+    if (ferror(in)) {
+        TRY(NIXERR_BUF_FILE);
+    }
+
+    if (length > UINT32_MAX) {
+        TRY(NIXERR_BUF_INVLEN);
+    }
+
+    *out = data;
+    *size = length;
+
+    EXCEPT(err)
+    FREE(data);
+    return err;
+}
+
+enum nix_err
+__tokens_parallel(
+    const uint8_t *data,
+    size_t size,
+    struct nix_intern *intern,
+    unsigned int threads,
+    struct nix_pool *pool,
+    struct token_table *table)
+{
+    struct tokens_chunk chunks[TOKENS_MAX_THREADS];
+    struct nix_wait_group *group = NULL;
+    size_t count = 0;
+    size_t started = 1;
+
+    size_t pieces = size / TOKENS_MIN_CHUNK_SIZE;
+    if (pieces > threads) pieces = threads;
+    if (pieces > TOKENS_MAX_THREADS) pieces = TOKENS_MAX_THREADS;
+
+    // Pieces start after a newline near each even split. A line can't start
+    // with a byte-order mark, since the piece's buffer would skip it.
+    size_t start = 0;
+    for (size_t i = 0; i < pieces && start < size; i++) {
+        size_t end = size;
+
+        if (i + 1 < pieces) {
+            end = size / pieces * (i + 1);
+            if (end < start) {
+                end = start;
+            }
+
+            for (;;) {
+                const uint8_t *nl = memchr(data + end, '\n', size - end);
+                end = nl == NULL ? size : (size_t)(nl - data) + 1;
+
+                if (end + 3 > size || memcmp(data + end, UTF8_BOM, 3) != 0) {
+                    break;
+                }
+            }
+        }
+
+        struct tokens_chunk *c = &chunks[count++];
+        c->data = data + start;
+        c->size = end - start;
+        c->remaining = size - start;
+        c->intern = intern;
+        c->err = NIXERR_NONE;
+
+        TRY(nix_token_table__init((struct nix_token_table *)&c->table,
+                    intern != NULL));
+
+        start = end;
+    }
+
+    uint32_t base = 0;
+    for (size_t i = 0; i < count; i++) {
+        chunks[i].base = base;
+        chunks[i].length = __tokens_count_code_points(chunks[i].data,
+                chunks[i].size);
+        base += chunks[i].length;
+    }
+
+    if (pool != NULL) {
+        TRY(nix_wait_group__construct(&group, pool));
+    }
+
+    for (; started < count; started++) {
+        if (group != NULL) {
+            if (nix_pool__submit(pool, group, &__tokens_chunk_job,
+                        &chunks[started]) != NIXERR_NONE) {
+                break;
+            }
+        } else if (pthread_create(&chunks[started].thread, NULL,
+                    &__tokens_chunk_run, &chunks[started]) != 0) {
+            break;
+        }
+    }
+
+    // Pieces which couldn't get a thread are left empty and lexed while
+    // stitching instead
+    for (size_t i = started; i < count; i++) {
+        chunks[i].err = NIXERR_THREAD;
+    }
+
+    __tokens_chunk_run(&chunks[0]);
+
+    if (group != NULL) {
+        TRY(nix_wait_group__wait(group));
+        nix_wait_group__free(&group);
+    } else {
+        for (size_t i = 1; i < started; i++) {
+            pthread_join(chunks[i].thread, NULL);
+        }
+    }
+
+    TRY(__tokens_stitch(chunks, count, intern, table));
+
+    for (size_t i = 0; i < count; i++) {
+        __token_table_release(&chunks[i].table);
+    }
+
+    EXCEPT(err)
+    nix_wait_group__free(&group);
+
+    for (size_t i = 0; i < count; i++) {
+        __token_table_release(&chunks[i].table);
+    }
+
+    return err;
+}
+
+void *
+__tokens_chunk_run(void *arg) {
+    struct tokens_chunk *c = arg;
+
+    // Nothing from a failed piece is used, so the stitcher lexes it again
+    // and reports the error from there if it is real
+    c->err = __tokens_chunk_lex(c);
+    if (c->err != NIXERR_NONE) {
+        c->table.p.count = 0;
+    }
+
+    return NULL;
+}
+
+void
+__tokens_chunk_job(void *arg) {
+    __tokens_chunk_run(arg);
+}
+
+enum nix_err
+__tokens_chunk_lex(struct tokens_chunk *c) {
+    struct nix_buffer *buf = NULL;
+    struct nix_lexer *lex = NULL;
+
+    // The piece is lexed to the end of the file if need be, to finish its
+    // last token
+    TRY(nix_buffer__construct_mem(&buf, c->data, c->remaining, false));
+    TRY(nix_lexer__construct(&lex, buf));
+
+    struct lexer *l = (struct lexer *)lex;
+    bool done = false;
+
+    while (!done && buf->read->abs < c->length) {
+        TRY(__tokens_lex(l, c->intern, 0, &c->table, &done));
+    }
+
+    c->end = buf->read->abs;
+    c->state = l->state;
+
+    nix_lexer__free(&lex);
+    nix_buffer__free(&buf);
+
+    EXCEPT(err)
+    nix_lexer__free(&lex);
+    nix_buffer__free(&buf);
+    return err;
+}
+
+// Join the pieces in order. A piece's tokens are correct from the first one
+// starting exactly where the true token stream is, provided the lexer is in a
+// clean state on both sides; until then the text is lexed again from the
+// true state.
+enum nix_err
+__tokens_stitch(
+    struct tokens_chunk *chunks,
+    size_t count,
+    struct nix_intern *intern,
+    struct token_table *table)
+{
+    uint32_t pos = 0;
+    struct lexer_state state = { .mode = LEXER_NORMAL };
+
+    struct nix_buffer *buf = NULL;
+    struct nix_lexer *lex = NULL;
+    uint32_t lex_base = 0;
+
+    bool done = false;
+
+    for (size_t i = 0; i < count && !done; i++) {
+        struct tokens_chunk *c = &chunks[i];
+        struct nix_token_table *t = &c->table.p;
+        uint32_t end = c->base + c->length;
+        size_t j = 0;
+
+        while (pos < end) {
+            while (j < t->count && c->base + t->starts[j] < pos) {
+                j++;
+            }
+
+            if (j < t->count && c->base + t->starts[j] == pos &&
+                    (t->flags[j] & NIX_TOKEN_FLAG_CLEAN) != 0 &&
+                    __lexer_is_clean(&state)) {
+                TRY(__token_table_append(table, &c->table, j, c->base));
+
+                pos = c->base + c->end;
+                state = c->state;
+
+                nix_lexer__free(&lex);
+                nix_buffer__free(&buf);
+
+                break;
+            }
+
+            if (lex == NULL) {
+                size_t offset = __tokens_byte_offset(c->data, c->remaining,
+                        pos - c->base);
+
+                TRY(nix_buffer__construct_mem(&buf, c->data + offset,
+                            c->remaining - offset, false));
+                TRY(nix_lexer__construct(&lex, buf));
+
+                ((struct lexer *)lex)->state = state;
+                lex_base = pos;
+            }
+
+            TRY(__tokens_lex((struct lexer *)lex, intern, lex_base, table,
+                        &done));
+
+            pos = lex_base + buf->read->abs;
+            state = ((struct lexer *)lex)->state;
+
+            if (done) {
+                break;
+            }
+        }
+    }
+
+    nix_lexer__free(&lex);
+    nix_buffer__free(&buf);
+
+    EXCEPT(err)
+    nix_lexer__free(&lex);
+    nix_buffer__free(&buf);
+    return err;
+}
+
+enum nix_err
+nix_token_table__relex(
+    struct nix_token_table *table,
+    struct nix_intern *intern,
+    const char *text,
+    size_t size,
+    const struct nix_token_edit *edit,
+    struct nix_token_diff *out)
+{
+    struct token_table *t = (struct token_table *)table;
+    struct token_table fresh = { 0 };
+
+    struct nix_buffer *buf = NULL;
+    struct nix_lexer *lex = NULL;
+
+    if (edit->start > edit->end || edit->offset > size) {
+        return NIXERR_BUF_INVLEN;
+    }
+
+    if (t->p.ids != NULL && intern == NULL) {
+        return NIXERR_BUF_INVPTR;
+    }
+
+    uint32_t inserted = __tokens_count_code_points(
+        (const uint8_t *)edit->text, edit->length);
+    uint32_t new_end = edit->start + inserted;
+    int64_t delta = (int64_t)inserted - (edit->end - edit->start);
+
+    size_t from = __tokens_relex_start(t, edit);
+    size_t to = t->p.count;
+    uint32_t base = from < t->p.count ? t->p.starts[from] : 0;
+
+    // Find the restart point in the new text by walking back from the edit,
+    // rather than counting from the start of the file
+    size_t offset = edit->offset;
+    for (uint32_t n = edit->start - base; n > 0 && offset > 0; n--) {
+        do {
+            offset--;
+        } while (offset > 0 && ((uint8_t)text[offset] & 0xC0) == 0x80);
+    }
+
+    TRY(nix_token_table__init((struct nix_token_table *)&fresh,
+                t->p.ids != NULL));
+
+    if (offset < size) {
+        TRY(nix_buffer__construct_mem(&buf, (const uint8_t *)text + offset,
+                    size - offset, false));
+        TRY(nix_lexer__construct(&lex, buf));
+
+        struct lexer *l = (struct lexer *)lex;
+        size_t j = from;
+
+        for (;;) {
+            // Past the edit, the old tokens are correct again from the first
+            // one starting here if the lexer state is clean on both sides
+            uint32_t pos = base + buf->read->abs;
+            if (pos >= new_end) {
+                int64_t old_pos = pos - delta;
+                while (j < t->p.count && t->p.starts[j] < old_pos) {
+                    j++;
+                }
+
+                if (j < t->p.count && t->p.starts[j] == old_pos &&
+                        (t->p.flags[j] & NIX_TOKEN_FLAG_CLEAN) != 0 &&
+                        __lexer_is_clean(&l->state)) {
+                    to = j;
+                    break;
+                }
+            }
+
+            bool done;
+            TRY(__tokens_lex(l, intern, base, &fresh, &done));
+
+            if (done) {
+                break;
+            }
+        }
+    }
+
+    TRY(__tokens_splice(t, from, to, &fresh, delta));
+
+    out->start = from;
+    out->removed = to - from;
+    out->inserted = fresh.p.count;
+
+    nix_lexer__free(&lex);
+    nix_buffer__free(&buf);
+
+    __token_table_release(&fresh);
+
+    EXCEPT(err)
+    nix_lexer__free(&lex);
+    nix_buffer__free(&buf);
+
+    __token_table_release(&fresh);
+    return err;
+}
+
+// The index of the token to restart lexing from for an edit. Apart from
+// comments and strings, which are single tokens, the lexer never looks ahead
+// past whitespace; so a clean token after whitespace, starting before the
+// edit, was lexed without seeing any of the edited text.
+size_t
+__tokens_relex_start(struct token_table *t, const struct nix_token_edit *edit) {
+    size_t lo = 0;
+    size_t hi = t->p.count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (t->p.starts[mid] < edit->start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // A restart point can't begin with an error token, since that might be
+    // a byte-order mark which the buffer would skip
+    for (size_t i = lo; i-- > 1;) {
+        if (t->p.kinds[i - 1] == NIX_TOKEN_WHITESPACE &&
+                t->p.kinds[i] != NIX_TOKEN_ERROR &&
+                (t->p.flags[i] & NIX_TOKEN_FLAG_CLEAN) != 0) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
+// Replace the tokens [from, to) with the fresh ones, moving the tokens after
+// them by delta
+enum nix_err
+__tokens_splice(
+    struct token_table *t,
+    size_t from,
+    size_t to,
+    struct token_table *fresh,
+    int64_t delta)
+{
+    size_t inserted = fresh->p.count;
+    size_t tail = t->p.count - to;
+    size_t at = from + inserted;
+
+    TRY(__token_table_reserve(t, at + tail));
+
+    memmove(t->p.kinds + at, t->p.kinds + to, sizeof(uint8_t) * tail);
+    memmove(t->p.flags + at, t->p.flags + to, sizeof(uint8_t) * tail);
+    memmove(t->p.starts + at, t->p.starts + to, sizeof(uint32_t) * tail);
+    memmove(t->p.lengths + at, t->p.lengths + to, sizeof(uint32_t) * tail);
+
+    if (t->p.ids != NULL) {
+        memmove(t->p.ids + at, t->p.ids + to, sizeof(uint32_t) * tail);
+        memcpy(t->p.ids + from, fresh->p.ids, sizeof(uint32_t) * inserted);
+    }
+
+    for (size_t i = at; i < at + tail; i++) {
+        t->p.starts[i] += delta;
+    }
+
+    memcpy(t->p.kinds + from, fresh->p.kinds, sizeof(uint8_t) * inserted);
+    memcpy(t->p.flags + from, fresh->p.flags, sizeof(uint8_t) * inserted);
+    memcpy(t->p.starts + from, fresh->p.starts, sizeof(uint32_t) * inserted);
+    memcpy(t->p.lengths + from, fresh->p.lengths,
+            sizeof(uint32_t) * inserted);
+
+    t->p.count = at + tail;
+
+    EXCEPT(err)
+    return err;
+}
+
+void
+__token_table_release(struct token_table *t) {
+    FREE(t->p.kinds);
+    FREE(t->p.flags);
+    FREE(t->p.starts);
+    FREE(t->p.lengths);
+    FREE(t->p.ids);
+}
+
+void
+nix_token_table__free(struct nix_token_table **out) {
+    if (*out == NULL) return;
+
+    __token_table_release((struct token_table *)*out);
+    FREE(*out);
+
+    *out = NULL;
+}
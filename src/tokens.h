@@ -0,0 +1,193 @@
+#ifndef INCLUDE_tokens_h__
+#define INCLUDE_tokens_h__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "libnix/lexer.h"
+#include "libnix/pool.h"
+#include "libnix/tokens.h"
+#include "lexer.h"
+
+#define TOKENS_INITIAL_CAPACITY 256
+
+// Half-window size of the buffers used for lexing. Longer text and trivia
+// are split and merged back together, but any other token longer than this
+// fails with NIXERR_BUF_EXHAUST when lexed through a buffer of this size.
+#define TOKENS_BUFFER_SIZE 65536
+
+// Files are only split when every piece would be at least this many bytes
+#define TOKENS_MIN_CHUNK_SIZE 65536
+#define TOKENS_MAX_THREADS 64
+
+struct token_table {
+    struct nix_token_table p;
+
+    size_t capacity;
+};
+
+// A piece of the file lexed speculatively from a clean state, with token
+// starts relative to the start of the piece
+struct tokens_chunk {
+    const uint8_t *data;
+    size_t size;
+    size_t remaining;
+
+    // Code point offset and length of the piece within the file
+    uint32_t base;
+    uint32_t length;
+
+    struct nix_intern *intern;
+    struct token_table table;
+
+    // Where the last token ended, and the lexer state there
+    uint32_t end;
+    struct lexer_state state;
+
+    enum nix_err err;
+    pthread_t thread;
+};
+
+enum nix_err
+__token_table_reserve(struct token_table *, size_t);
+
+enum nix_err
+__token_table_push(
+    struct token_table *,
+    uint8_t,
+    uint8_t,
+    uint32_t,
+    uint32_t,
+    uint32_t);
+
+void
+__token_table_release(struct token_table *);
+
+enum nix_err
+__token_table_append(
+    struct token_table *,
+    struct token_table *,
+    size_t,
+    uint32_t);
+
+enum nix_err
+__tokens_lex(
+    struct lexer *,
+    struct nix_intern *,
+    uint32_t,
+    struct token_table *,
+    bool *);
+
+enum nix_err
+__tokens_file(
+    struct nix_token_table **,
+    FILE *,
+    struct nix_intern *,
+    unsigned int,
+    unsigned int,
+    struct nix_pool *);
+
+enum nix_err
+__tokens_sequential(
+    FILE *,
+    struct nix_intern *,
+    unsigned int,
+    struct token_table *);
+
+enum nix_err
+__tokens_lex_buffer(
+    struct nix_buffer *,
+    struct nix_intern *,
+    struct token_table *);
+
+enum nix_err
+__tokens_read_file(FILE *, uint8_t **, size_t *);
+
+enum nix_err
+__tokens_parallel(
+    const uint8_t *,
+    size_t,
+    struct nix_intern *,
+    unsigned int,
+    struct nix_pool *,
+    struct token_table *);
+
+void *
+__tokens_chunk_run(void *);
+
+void
+__tokens_chunk_job(void *);
+
+enum nix_err
+__tokens_chunk_lex(struct tokens_chunk *);
+
+enum nix_err
+__tokens_stitch(
+    struct tokens_chunk *,
+    size_t,
+    struct nix_intern *,
+    struct token_table *);
+
+size_t
+__tokens_relex_start(struct token_table *, const struct nix_token_edit *);
+
+enum nix_err
+__tokens_splice(
+    struct token_table *,
+    size_t,
+    size_t,
+    struct token_table *,
+    int64_t);
+
+static inline uint32_t
+__tokens_count_code_points(const uint8_t *data, size_t size) {
+    uint32_t count = 0;
+    for (size_t i = 0; i < size; i++) {
+        count += (data[i] & 0xC0) != 0x80;
+    }
+
+    return count;
+}
+
+// Text and trivia which the lexer split to fit its buffer are joined back
+// together, so the table doesn't depend on where lexing started
+static inline bool
+__token_table_merge(
+    struct token_table *t,
+    uint8_t kind,
+    uint32_t start,
+    uint32_t length)
+{
+    if (t->p.count == 0) {
+        return false;
+    }
+
+    size_t last = t->p.count - 1;
+    if (t->p.kinds[last] != kind ||
+            !__lexer_is_splittable(kind) ||
+            t->p.starts[last] + t->p.lengths[last] != start) {
+        return false;
+    }
+
+    t->p.lengths[last] += length;
+    return true;
+}
+
+// The byte offset of the code point `index` code points into the text
+static inline size_t
+__tokens_byte_offset(const uint8_t *data, size_t size, uint32_t index) {
+    size_t offset = 0;
+    while (index > 0 && offset < size) {
+        offset++;
+        if (offset == size || (data[offset] & 0xC0) != 0x80) {
+            index--;
+        }
+    }
+
+    return offset;
+}
+
+#endif
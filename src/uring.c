@@ -0,0 +1,407 @@
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "uring.h"
+#include "common.h"
+#include "error.h"
+
+// Frees each thread's ring when the thread exits
+static pthread_key_t __uring_key;
+static pthread_once_t __uring_once = PTHREAD_ONCE_INIT;
+static bool __uring_key_ready = false;
+
+// Set once a thread fails to make a ring, so it doesn't try for every file
+static _Thread_local bool __uring_unavailable = false;
+
+static void
+__uring_key_create(void) {
+    __uring_key_ready = pthread_key_create(&__uring_key, &__uring_free) == 0;
+}
+
+// The kernel reads and writes the ring indices from the other side
+static inline unsigned
+__uring_load(unsigned *index) {
+    return atomic_load_explicit((_Atomic unsigned *)index,
+        memory_order_acquire);
+}
+
+static inline void
+__uring_store(unsigned *index, unsigned value) {
+    atomic_store_explicit((_Atomic unsigned *)index, value,
+        memory_order_release);
+}
+
+enum nix_err
+__uring_reader_start(
+    struct uring_reader **out,
+    FILE *in,
+    uint8_t *data,
+    size_t segment_size)
+{
+    struct uring_reader *r = NULL;
+    *out = NULL;
+
+    int fd = fileno(in);
+    if (fd < 0) {
+        return NIXERR_NONE;
+    }
+
+    // Reads are given offsets, so they start from wherever stdio has got to
+    // rather than where it has buffered up to
+    off_t offset = ftello(in);
+    if (offset < 0 || lseek(fd, 0, SEEK_CUR) < 0) {
+        return NIXERR_NONE;
+    }
+
+    struct uring *ring = __uring_thread();
+    if (ring == NULL) {
+        return NIXERR_NONE;
+    }
+
+    unsigned index = 0;
+    while (index < URING_READERS && ring->claimed[index]) {
+        index++;
+    }
+
+    if (index == URING_READERS) {
+        return NIXERR_NONE;
+    }
+
+    ALLOC(r, sizeof(struct uring_reader));
+
+    ring->claimed[index] = true;
+
+    r->ring = ring;
+    r->fd = fd;
+    r->index = index;
+    r->data = data;
+    r->segment_size = segment_size;
+    r->offset = offset;
+    r->taken = 0;
+    r->released = 0;
+    r->done = false;
+
+    // The entry is replaced for each reader, since a buffer freed since
+    // could have given its memory to this one
+    r->fixed = false;
+    if (ring->registered) {
+        struct iovec iov = {
+            .iov_base = data,
+            .iov_len = URING_READER_SLOTS * segment_size
+        };
+
+        struct io_uring_rsrc_update2 update = {
+            .offset = index,
+            .data = (uintptr_t)&iov,
+            .nr = 1
+        };
+
+        r->fixed = syscall(__NR_io_uring_register, ring->fd,
+            IORING_REGISTER_BUFFERS_UPDATE, &update, sizeof(update)) == 1;
+    }
+
+    for (size_t i = 0; i < URING_READER_SLOTS; i++) {
+        r->offsets[i] = r->offset;
+        r->filled[i] = 0;
+        __uring_queue(r, i);
+
+        r->offset += segment_size;
+    }
+
+    *out = r;
+
+    EXCEPT(err)
+    return err;
+}
+
+enum nix_err
+__uring_reader_take(struct uring_reader *r, size_t *length) {
+    if (r->done) {
+        *length = 0;
+        return NIXERR_NONE;
+    }
+
+    struct uring *ring = r->ring;
+    size_t i = r->taken % URING_READER_SLOTS;
+    struct uring_slot *slot = &ring->slots[r->index * URING_READER_SLOTS + i];
+
+    for (;;) {
+        while (slot->pending) {
+            TRY(__uring_wait(ring));
+        }
+
+        if (slot->result < 0 && slot->result != -EINTR &&
+                slot->result != -EAGAIN) {
+            r->done = true;
+            return NIXERR_BUF_FILE;
+        }
+
+        if (slot->result > 0) {
+            r->filled[i] += slot->result;
+        }
+
+        if (slot->result == 0 || r->filled[i] == r->segment_size) {
+            break;
+        }
+
+        // A read can come up short before the end, so ask for the rest
+        __uring_queue(r, i);
+    }
+
+    *length = r->filled[i];
+    r->taken++;
+
+    if (*length < r->segment_size) {
+        r->done = true;
+    }
+
+    EXCEPT(err)
+    return err;
+}
+
+void
+__uring_reader_release(struct uring_reader *r) {
+    size_t i = r->released % URING_READER_SLOTS;
+
+    r->offsets[i] = r->offset;
+    r->filled[i] = 0;
+    __uring_queue(r, i);
+
+    r->offset += r->segment_size;
+    r->released++;
+}
+
+void
+__uring_reader_stop(struct uring_reader **out) {
+    if (*out == NULL) return;
+
+    struct uring_reader *r = *out;
+    struct uring *ring = r->ring;
+    bool pending = false;
+
+    for (size_t i = 0; i < URING_READER_SLOTS; i++) {
+        struct uring_slot *slot =
+            &ring->slots[r->index * URING_READER_SLOTS + i];
+
+        while (slot->pending) {
+            if (__uring_wait(ring) != NIXERR_NONE) {
+                // The ring is unusable, so no other reader is given it
+                __uring_unavailable = true;
+                break;
+            }
+        }
+
+        pending = pending || slot->pending;
+    }
+
+    ring->claimed[r->index] = pending;
+
+    FREE(r);
+    *out = NULL;
+}
+
+struct uring *
+__uring_thread(void) {
+    if (__uring_unavailable) {
+        return NULL;
+    }
+
+    pthread_once(&__uring_once, &__uring_key_create);
+    if (!__uring_key_ready) {
+        return NULL;
+    }
+
+    struct uring *ring = pthread_getspecific(__uring_key);
+    if (ring != NULL) {
+        return ring;
+    }
+
+    if (__uring_setup(&ring) != NIXERR_NONE) {
+        __uring_unavailable = true;
+        return NULL;
+    }
+
+    if (pthread_setspecific(__uring_key, ring) != 0) {
+        __uring_free(ring);
+        __uring_unavailable = true;
+        return NULL;
+    }
+
+    return ring;
+}
+
+enum nix_err
+__uring_setup(struct uring **out) {
+    struct uring *ring = NULL;
+    struct io_uring_params params;
+
+    ALLOC(ring, sizeof(struct uring));
+    memset(ring, 0, sizeof(struct uring));
+    ring->fd = -1;
+    ring->sq_map = MAP_FAILED;
+    ring->cq_map = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, URING_SLOTS, &params);
+    if (ring->fd < 0) {
+        TRY(NIXERR_BUF_FILE);
+    }
+
+    ring->sq_map_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // Newer kernels put both rings in one mapping
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_map_size > ring->sq_map_size) {
+        ring->sq_map_size = ring->cq_map_size;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        TRY(NIXERR_NOMEMORY);
+    }
+
+    if (single) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            TRY(NIXERR_NOMEMORY);
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        TRY(NIXERR_NOMEMORY);
+    }
+
+    uint8_t *sq = ring->sq_map, *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Each reader fills in its own entry of the table as it starts
+    struct io_uring_rsrc_register table = {
+        .nr = URING_READERS,
+        .flags = IORING_RSRC_REGISTER_SPARSE
+    };
+
+    ring->registered = syscall(__NR_io_uring_register, ring->fd,
+        IORING_REGISTER_BUFFERS2, &table, sizeof(table)) == 0;
+
+    *out = ring;
+
+    EXCEPT(err)
+    __uring_free(ring);
+    return err;
+}
+
+void
+__uring_free(void *arg) {
+    struct uring *ring = arg;
+    if (ring == NULL) return;
+
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+
+    if (ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+
+    if (ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+
+    if (ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+
+    FREE(ring);
+}
+
+// Queue a read of the rest of a half's segment. Only ever as many reads are
+// in flight as there are slots, so the queue, which has an entry for each,
+// can't overflow.
+void
+__uring_queue(struct uring_reader *r, size_t half) {
+    struct uring *ring = r->ring;
+    unsigned slot = r->index * URING_READER_SLOTS + half;
+
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = r->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = r->fd;
+    sqe->off = r->offsets[half] + r->filled[half];
+    sqe->addr = (uintptr_t)(r->data + half * r->segment_size +
+        r->filled[half]);
+    sqe->len = r->segment_size - r->filled[half];
+    sqe->buf_index = r->index;
+    sqe->user_data = slot;
+
+    ring->sq_array[index] = index;
+    __uring_store(ring->sq_tail, tail + 1);
+
+    ring->slots[slot].pending = true;
+    ring->unsubmitted++;
+}
+
+// Submit everything queued and wait for at least one read to finish. Every
+// buffer on the thread shares the one call.
+enum nix_err
+__uring_wait(struct uring *ring) {
+    for (;;) {
+        int submitted = syscall(__NR_io_uring_enter, ring->fd,
+            ring->unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        if (submitted >= 0) {
+            ring->unsubmitted -= submitted;
+            break;
+        }
+
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return NIXERR_BUF_FILE;
+        }
+    }
+
+    unsigned head = *ring->cq_head;
+    while (head != __uring_load(ring->cq_tail)) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        struct uring_slot *slot = &ring->slots[cqe->user_data];
+
+        slot->pending = false;
+        slot->result = cqe->res;
+
+        head++;
+    }
+
+    __uring_store(ring->cq_head, head);
+
+    return NIXERR_NONE;
+}
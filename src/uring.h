@@ -0,0 +1,138 @@
+#ifndef INCLUDE_uring_h__
+#define INCLUDE_uring_h__
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "libnix/error.h"
+
+// Reads each thread's ring can have in flight at once
+#define URING_SLOTS 32
+
+// Each buffer reads into its two halves, so it has a read in flight for
+// each and the ring can read for this many buffers
+#define URING_READER_SLOTS 2
+#define URING_READERS (URING_SLOTS / URING_READER_SLOTS)
+
+struct uring_slot {
+    bool pending;
+    int32_t result;
+};
+
+// An io_uring shared by every buffer on a thread, with a table of buffers
+// registered up front that each reader puts its halves in, so reads into
+// them don't map pages each time
+struct uring {
+    int fd;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Queued but not yet given to the kernel, which happens only when
+    // something has to wait
+    unsigned unsubmitted;
+
+    // Registration can be refused, in which case reads are unregistered
+    bool registered;
+
+    bool claimed[URING_READERS];
+    struct uring_slot slots[URING_SLOTS];
+};
+
+// One file being read through the calling thread's ring straight into the
+// halves of a buffer, which are handed back and forth as with prefetching
+struct uring_reader {
+    struct uring *ring;
+    int fd;
+
+    // The reader's entry in the ring's buffer table, and its slots follow
+    // from it
+    unsigned index;
+    bool fixed;
+
+    // The halves, owned by the buffer
+    uint8_t *data;
+    size_t segment_size;
+
+    // Where the next read queued will start
+    off_t offset;
+
+    // Each half's segment starts at its offset and has the filled bytes in
+    // it so far
+    off_t offsets[URING_READER_SLOTS];
+    size_t filled[URING_READER_SLOTS];
+
+    // Halves taken and given back so far
+    size_t taken;
+    size_t released;
+
+    bool done;
+};
+
+// Leaves the reader NULL without failing when the file can't be read this
+// way: it has no descriptor or can't seek, or the thread has no ring or no
+// room left in it
+enum nix_err
+__uring_reader_start(struct uring_reader **, FILE *, uint8_t *, size_t);
+
+// Take the next half once it's been read into, waiting if need be. A short
+// segment means the end of the file.
+enum nix_err
+__uring_reader_take(struct uring_reader *, size_t *);
+
+// Give the oldest half held back to be read into again
+void
+__uring_reader_release(struct uring_reader *);
+
+// Waits for the reader's reads still in flight, since they write into the
+// buffer's memory
+void
+__uring_reader_stop(struct uring_reader **);
+
+// Whether the reader holds both halves, so the oldest can be given back once
+// nothing points into it
+static inline bool
+__uring_reader_holding(const struct uring_reader *r) {
+    return !r->done && r->taken - r->released == URING_READER_SLOTS;
+}
+
+// The side of the buffer the oldest half held is on
+static inline size_t
+__uring_reader_oldest(const struct uring_reader *r) {
+    return r->released % URING_READER_SLOTS;
+}
+
+struct uring *
+__uring_thread(void);
+
+enum nix_err
+__uring_setup(struct uring **);
+
+void
+__uring_free(void *);
+
+void
+__uring_queue(struct uring_reader *, size_t);
+
+enum nix_err
+__uring_wait(struct uring *);
+
+#endif
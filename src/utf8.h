@@ -0,0 +1,39 @@
+#ifndef INCLUDE_utf8_h__
+#define INCLUDE_utf8_h__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// The longest UTF-8 encoding of a single code point
+#define UTF8_MAX_BYTES 4
+
+// Encode a code point as UTF-8, returning the number of bytes written. The
+// output must have room for at least UTF8_MAX_BYTES.
+static inline size_t
+__utf8_encode(uint32_t c, uint8_t *out) {
+    if (c < 0x80) {
+        out[0] = c;
+        return 1;
+    }
+
+    if (c < 0x800) {
+        out[0] = 0xC0 | (c >> 6);
+        out[1] = 0x80 | (c & 0x3F);
+        return 2;
+    }
+
+    if (c < 0x10000) {
+        out[0] = 0xE0 | (c >> 12);
+        out[1] = 0x80 | ((c >> 6) & 0x3F);
+        out[2] = 0x80 | (c & 0x3F);
+        return 3;
+    }
+
+    out[0] = 0xF0 | (c >> 18);
+    out[1] = 0x80 | ((c >> 12) & 0x3F);
+    out[2] = 0x80 | ((c >> 6) & 0x3F);
+    out[3] = 0x80 | (c & 0x3F);
+    return 4;
+}
+
+#endif
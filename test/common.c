@@ -44,7 +44,7 @@ char* combine_path(char *part_1, char *part_2) {
     size_t len_1 = strlen(part_1);
     size_t len_2 = strlen(part_2);
     size_t len_slug = 9;
-    size_t len = len_1 + len_2 + len_slug + 1;
+    size_t len = len_1 + 1 + len_2 + 1 + len_slug + 1;
     char *filename = malloc(sizeof(uint8_t) * len);
     if (filename == NULL) {
         return NULL;
@@ -1,8 +1,12 @@
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "libnix/buffer.h"
+#include "libnix/digest.h"
 #include "libnix/error.h"
 #include "unity/src/unity.h"
 #include "src/buffer.h"
@@ -206,6 +210,593 @@ void test_read_over_buffer() {
     fclose(file);
 }
 
+// Read everything, discarding as it goes so the buffer keeps loading
+static void __read_to_eof(struct nix_buffer *buf) {
+    uint32_t c;
+    enum nix_err r;
+
+    while ((r = nix_buffer__read(buf, &c)) == NIXERR_NONE) {
+        nix_buffer__discard_lexeme(buf, 0);
+    }
+
+    TEST_ASSERT_MESSAGE(r == NIXERR_BUF_EOF, "Failed to read to the end");
+}
+
+void test_content_hash() {
+    const char *pattern = "let x = \"caf\xc3\xa9\"; in x\n";
+    size_t sizes[] = { 0, 1, 7, 8, 16, 31, 64, 1000, 4096, 5000 };
+    char data[5003];
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = pattern[i % strlen(pattern)];
+    }
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        FILE *file = fmemopen(data, sizes[i], "r");
+
+        struct nix_buffer *buf;
+        struct nix_digest digest, expected;
+        nix_buffer__construct_flags(&buf, file, 8, NIX_BUFFER_HASH);
+
+        if (sizes[i] >= 16) {
+            TEST_ASSERT_MESSAGE(nix_buffer__content_hash(buf, &digest) ==
+                    NIXERR_BUF_INCOMPLETE, "Hash given before the end");
+        }
+
+        __read_to_eof(buf);
+
+        TEST_ASSERT_MESSAGE(nix_buffer__content_hash(buf, &digest) ==
+                NIXERR_NONE, "No hash at the end of input");
+
+        nix_digest__bytes(data, sizes[i], &expected);
+        TEST_ASSERT_MESSAGE(memcmp(&digest, &expected, sizeof(digest)) == 0,
+                "Hash differs from one of the whole input");
+
+        nix_buffer__free(&buf);
+        fclose(file);
+    }
+
+    // A byte-order mark is part of the content
+    memcpy(data, "\xEF\xBB\xBFx = 1", 8);
+    FILE *file = fmemopen(data, 8, "r");
+
+    struct nix_buffer *buf;
+    struct nix_digest digest, expected;
+    nix_buffer__construct_flags(&buf, file, 8, NIX_BUFFER_HASH);
+    __read_to_eof(buf);
+
+    nix_buffer__content_hash(buf, &digest);
+    nix_digest__bytes(data, 8, &expected);
+    TEST_ASSERT_MESSAGE(memcmp(&digest, &expected, sizeof(digest)) == 0,
+            "Byte-order mark was left out of the hash");
+
+    nix_buffer__free(&buf);
+    fclose(file);
+
+    // Without the flag there's no hash to give
+    file = fmemopen(data, 8, "r");
+    nix_buffer__construct(&buf, file, 8);
+    __read_to_eof(buf);
+
+    TEST_ASSERT_MESSAGE(nix_buffer__content_hash(buf, &digest) ==
+            NIXERR_BUF_INCOMPLETE, "Hash given without being asked for");
+
+    nix_buffer__free(&buf);
+    fclose(file);
+}
+
+static void __assert_reads(struct nix_buffer *buf, const char *expected) {
+    uint32_t c;
+
+    for (size_t i = 0; expected[i] != '\0'; i++) {
+        TEST_ASSERT_MESSAGE(nix_buffer__read(buf, &c) == NIXERR_NONE,
+                "Failed to read");
+        TEST_ASSERT_EQUAL_HEX32((uint8_t)expected[i], c);
+        nix_buffer__discard_lexeme(buf, 0);
+    }
+
+    TEST_ASSERT_MESSAGE(nix_buffer__read(buf, &c) == NIXERR_BUF_EOF,
+            "Expected the end of input");
+}
+
+// Expect the buffer to have hashed exactly the given input
+static void __assert_hashed(
+        struct nix_buffer *buf,
+        const void *data,
+        size_t size,
+        const char *message)
+{
+    struct nix_digest digest, expected;
+    nix_buffer__content_hash(buf, &digest);
+    nix_digest__bytes(data, size, &expected);
+    TEST_ASSERT_MESSAGE(memcmp(&digest, &expected, sizeof(digest)) == 0,
+            message);
+}
+
+void test_reset_buffer() {
+    char first[] = "let a = 1; in a";
+    char second[] = "\xFE\xFF\x00x\x00\n\x00y";
+
+    FILE *a = fmemopen(first, strlen(first), "r");
+    FILE *b = fmemopen(second, 8, "r");
+
+    struct nix_buffer *buf;
+    nix_buffer__construct(&buf, a, 4);
+    __assert_reads(buf, first);
+
+    // Starts over on the new input, whatever its encoding
+    TEST_ASSERT_MESSAGE(nix_buffer__reset(buf, b) == NIXERR_NONE,
+            "Failed to reset");
+    TEST_ASSERT_MESSAGE(buf->read->row == 1 && buf->read->col == 1 &&
+            buf->read->abs == 0, "Position wasn't reset");
+    __assert_reads(buf, "x\ny");
+    TEST_ASSERT_MESSAGE(buf->read->row == 2, "Wrong row after reset");
+
+    rewind(a);
+    nix_buffer__reset(buf, a);
+    __assert_reads(buf, first);
+
+    nix_buffer__free(&buf);
+    fclose(a);
+    fclose(b);
+}
+
+void test_acquire_buffer() {
+    char data[] = "{ x = 1; }";
+    FILE *file = fmemopen(data, strlen(data), "r");
+
+    struct nix_buffer *buf, *other;
+    nix_buffer__acquire(&buf, file, 8, 0);
+    __assert_reads(buf, data);
+
+    struct nix_buffer *released = buf;
+    nix_buffer__release(&buf);
+    TEST_ASSERT_MESSAGE(buf == NULL, "Released buffer not cleared");
+
+    // A buffer of the same size comes back; another size is made anew
+    rewind(file);
+    nix_buffer__acquire(&other, file, 16, 0);
+    TEST_ASSERT_MESSAGE(other != released, "Reused a buffer of another size");
+    nix_buffer__free(&other);
+
+    rewind(file);
+    nix_buffer__acquire(&buf, file, 8, NIX_BUFFER_HASH);
+    TEST_ASSERT_MESSAGE(buf == released, "Released buffer wasn't reused");
+    TEST_ASSERT_MESSAGE(buf->flags == NIX_BUFFER_HASH, "Flags weren't set");
+    __assert_reads(buf, data);
+
+    __assert_hashed(buf, data, strlen(data),
+            "Reused buffer hashed the wrong input");
+
+    nix_buffer__release(&buf);
+    nix_buffer__trim();
+
+    rewind(file);
+    nix_buffer__acquire(&buf, file, 8, 0);
+    nix_buffer__free(&buf);
+
+    fclose(file);
+}
+
+// Read one character from each, expecting the same from both
+static enum nix_err __assert_same_read(
+        struct nix_buffer *buf,
+        struct nix_buffer *plain)
+{
+    uint32_t c, expected_c;
+
+    enum nix_err r = nix_buffer__read(buf, &c);
+    enum nix_err expected_r = nix_buffer__read(plain, &expected_c);
+
+    TEST_ASSERT_EQUAL_HEX32(expected_r, r);
+    if (r == NIXERR_NONE) {
+        TEST_ASSERT_EQUAL_HEX32(expected_c, c);
+    }
+
+    nix_buffer__discard_lexeme(buf, 0);
+    nix_buffer__discard_lexeme(plain, 0);
+
+    return r;
+}
+
+// Read both to the end, expecting the same from each
+static void __assert_same_reads(
+        struct nix_buffer *buf,
+        struct nix_buffer *plain)
+{
+    enum nix_err r;
+    do {
+        r = __assert_same_read(buf, plain);
+    } while (r == NIXERR_NONE);
+
+    TEST_ASSERT_MESSAGE(r == NIXERR_BUF_EOF, "Failed to read to the end");
+}
+
+void test_prefetch_buffer() {
+    const char *pattern = "let x = \"caf\xc3\xa9\"; in x\n";
+    size_t sizes[] = { 0, 1, 8, 16, 31, 1000, 5000 };
+    char data[5003];
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = pattern[i % strlen(pattern)];
+    }
+
+    // Reads the same as a buffer reading for itself
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        FILE *file = fmemopen(data, sizes[i], "r");
+        FILE *plain_file = fmemopen(data, sizes[i], "r");
+
+        struct nix_buffer *buf, *plain;
+        nix_buffer__construct_flags(&buf, file, 8,
+                NIX_BUFFER_PREFETCH | NIX_BUFFER_HASH);
+        nix_buffer__construct(&plain, plain_file, 8);
+
+        __assert_same_reads(buf, plain);
+        __assert_hashed(buf, data, sizes[i],
+                "Prefetched input hashed differently");
+
+        nix_buffer__free(&buf);
+        nix_buffer__free(&plain);
+        fclose(file);
+        fclose(plain_file);
+    }
+
+    // Stopping part way through leaves the file to the caller
+    FILE *file = fmemopen(data, sizeof(data), "r");
+    struct nix_buffer *buf;
+    uint32_t c;
+
+    nix_buffer__construct_flags(&buf, file, 8, NIX_BUFFER_PREFETCH);
+    nix_buffer__read(buf, &c);
+    nix_buffer__discard_lexeme(buf, 0);
+
+    rewind(file);
+    TEST_ASSERT_MESSAGE(nix_buffer__reset(buf, file) == NIXERR_NONE,
+            "Failed to reset");
+    TEST_ASSERT_MESSAGE(nix_buffer__read(buf, &c) == NIXERR_NONE &&
+            c == 'l', "Reset didn't start from the beginning");
+    nix_buffer__discard_lexeme(buf, 0);
+
+    nix_buffer__free(&buf);
+    fclose(file);
+}
+
+void test_uring_buffer() {
+    const char *pattern = "let x = \"caf\xc3\xa9\"; in x\n";
+    uint8_t data[20000];
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = pattern[i % strlen(pattern)];
+    }
+
+    FILE *file;
+    FILE_FROM_STRING(file, "test_uring_buffer", data, sizeof(data));
+    FILE *other = fmemopen(data, sizeof(data), "r");
+    FILE *second_other = fmemopen(data, sizeof(data), "r");
+
+    // Two buffers share the thread's ring, with their reads interleaved
+    struct nix_buffer *buf, *second, *plain, *second_plain;
+    nix_buffer__construct_flags(&buf, file, 8,
+            NIX_BUFFER_URING | NIX_BUFFER_HASH);
+    nix_buffer__construct(&plain, other, 8);
+    nix_buffer__construct(&second_plain, second_other, 8);
+
+    rewind(file);
+    FILE *copy = fdopen(dup(fileno(file)), "rb");
+    nix_buffer__construct_flags(&second, copy, 64, NIX_BUFFER_URING);
+
+    if (__uring_thread() != NULL) {
+        TEST_ASSERT_MESSAGE(((struct buffer *)buf)->uring != NULL &&
+                ((struct buffer *)second)->uring != NULL,
+                "Ring wasn't used");
+
+        // Read straight into the halves, which are registered with it
+        struct uring_reader *reader = ((struct buffer *)buf)->uring;
+        TEST_ASSERT_MESSAGE(!reader->ring->registered || reader->fixed,
+                "Halves weren't registered");
+    }
+
+    enum nix_err r;
+    do {
+        r = __assert_same_read(buf, plain);
+        TEST_ASSERT_EQUAL_HEX32(r, __assert_same_read(second, second_plain));
+    } while (r == NIXERR_NONE);
+
+    TEST_ASSERT_MESSAGE(r == NIXERR_BUF_EOF, "Failed to read to the end");
+    __assert_hashed(buf, data, sizeof(data),
+            "Input read through the ring hashed differently");
+
+    uint32_t c;
+
+    // Starts the ring's reads over, and a file with no descriptor is read as
+    // usual
+    rewind(file);
+    nix_buffer__reset(buf, file);
+    TEST_ASSERT_MESSAGE(nix_buffer__read(buf, &c) == NIXERR_NONE && c == 'l',
+            "Reset didn't start from the beginning");
+    nix_buffer__discard_lexeme(buf, 0);
+
+    rewind(other);
+    nix_buffer__reset(buf, other);
+    __read_to_eof(buf);
+
+    nix_buffer__free(&buf);
+    nix_buffer__free(&second);
+    nix_buffer__free(&plain);
+    nix_buffer__free(&second_plain);
+    fclose(file);
+    fclose(copy);
+    fclose(other);
+    fclose(second_other);
+}
+
+void test_fd_buffer() {
+    const char *pattern = "let x = \"caf\xc3\xa9\"; in x\n";
+    uint8_t data[20000];
+
+    memcpy(data, "\xEF\xBB\xBF", 3);
+    for (size_t i = 3; i < sizeof(data); i++) {
+        data[i] = pattern[i % strlen(pattern)];
+    }
+
+    FILE *file;
+    FILE_FROM_STRING(file, "test_fd_buffer", data, sizeof(data));
+    FILE *other = fmemopen(data, sizeof(data), "r");
+    int fd = fileno(file);
+
+    // The byte-order mark is found in the first half, and hashed with it
+    struct nix_buffer *buf, *plain;
+    nix_buffer__construct_fd(&buf, fd, 8,
+            NIX_BUFFER_HASH | NIX_BUFFER_NOREUSE);
+    nix_buffer__construct(&plain, other, 8);
+    __assert_same_reads(buf, plain);
+    __assert_hashed(buf, data, sizeof(data),
+            "Input read from the descriptor hashed differently");
+    TEST_ASSERT_MESSAGE(lseek(fd, 0, SEEK_CUR) == 0,
+            "Descriptor's offset was moved");
+    nix_buffer__free(&buf);
+
+    // Direct reads give the same, and leave the descriptor as it was
+    int status = fcntl(fd, F_GETFL);
+    rewind(other);
+    nix_buffer__reset(plain, other);
+    nix_buffer__construct_fd(&buf, fd, NIX_BUFFER_DIRECT_ALIGN,
+            NIX_BUFFER_DIRECT);
+    __assert_same_reads(buf, plain);
+    nix_buffer__free(&buf);
+    TEST_ASSERT_EQUAL_HEX32(status, fcntl(fd, F_GETFL));
+
+    // A descriptor that can't be read fails, with nothing left behind
+    int closed = dup(fd);
+    close(closed);
+
+    buf = NULL;
+    TEST_ASSERT_EQUAL_HEX32(NIXERR_BUF_FILE,
+            nix_buffer__construct_fd(&buf, -1, 8, 0));
+    TEST_ASSERT_EQUAL_HEX32(NIXERR_BUF_FILE,
+            nix_buffer__construct_fd(&buf, closed, 8, NIX_BUFFER_HASH));
+    TEST_ASSERT_MESSAGE(buf == NULL, "Failed buffer was given out");
+
+    // A pipe is read as it comes
+    int pipe_fds[2];
+    TEST_ASSERT_MESSAGE(pipe(pipe_fds) == 0, "Failed to make a pipe");
+    TEST_ASSERT_EQUAL_INT(8,
+            write(pipe_fds[1], "\xFF\xFEx\x00\n\x00y\x00", 8));
+    close(pipe_fds[1]);
+
+    nix_buffer__construct_fd(&buf, pipe_fds[0], 4, 0);
+    __assert_reads(buf, "x\ny");
+
+    nix_buffer__free(&buf);
+    nix_buffer__free(&plain);
+    close(pipe_fds[0]);
+    fclose(file);
+    fclose(other);
+}
+
+void test_mem_buffer() {
+    uint8_t data[] = "\xEF\xBB\xBFlet a = \"caf\xc3\xa9\"; in a";
+    size_t length = sizeof(data) - 1;
+
+    // Reads the same as the file would, straight from the caller's memory
+    FILE *other = fmemopen(data, length, "r");
+    struct nix_buffer *buf, *plain;
+    nix_buffer__construct_mem(&buf, data, length, false);
+    nix_buffer__construct(&plain, other, 8);
+    __assert_same_reads(buf, plain);
+
+    TEST_ASSERT_MESSAGE(nix_buffer__reset(buf, other) == NIXERR_BUF_INVPTR,
+            "Reset a buffer over memory");
+    nix_buffer__free(&buf);
+
+    // A copy doesn't see later changes to the memory
+    nix_buffer__construct_mem(&buf, data + 3, length - 3, true);
+    memset(data, 'x', length);
+    __assert_reads(buf, "let a = \"caf\xe9\"; in a");
+    nix_buffer__free(&buf);
+
+    uint32_t c;
+    buf = malloc(sizeof(struct buffer));
+    TEST_ASSERT_MESSAGE(nix_buffer__init_mem(buf, data, 0, false) ==
+            NIXERR_NONE, "Failed to init over nothing");
+    TEST_ASSERT_MESSAGE(nix_buffer__read(buf, &c) == NIXERR_BUF_EOF,
+            "Read something from nothing");
+    nix_buffer__free(&buf);
+
+    nix_buffer__free(&plain);
+    fclose(other);
+}
+
+struct chunks {
+    const uint8_t *data;
+    size_t length;
+    size_t at;
+    size_t piece;
+};
+
+// Hands the input out a few bytes at a time, as a pipe might
+static enum nix_err chunks_read(void *context, uint8_t *out, size_t size,
+        size_t *length) {
+    struct chunks *c = context;
+
+    *length = c->length - c->at;
+    if (*length > c->piece) {
+        *length = c->piece;
+    }
+
+    if (*length > size) {
+        *length = size;
+    }
+
+    memcpy(out, c->data + c->at, *length);
+    c->at += *length;
+
+    return NIXERR_NONE;
+}
+
+static enum nix_err chunks_borrow(void *context, const uint8_t **out,
+        size_t *length) {
+    struct chunks *c = context;
+
+    *length = c->length - c->at;
+    if (*length > c->piece) {
+        *length = c->piece;
+    }
+
+    *out = c->data + c->at;
+    c->at += *length;
+
+    return NIXERR_NONE;
+}
+
+static enum nix_err chunks_size(void *context, size_t *out) {
+    struct chunks *c = context;
+    *out = c->length - c->at;
+
+    return NIXERR_NONE;
+}
+
+void test_source_buffer() {
+    uint8_t data[] = "\xFF\xFEx\x00 \x00=\x00 \x00\xe9\x00\n\x00";
+    size_t length = sizeof(data) - 1;
+
+    // Short reads and lent blocks both read the same as a file
+    struct chunks c = { data, length, 0, 3 };
+    struct nix_source source = { &c, chunks_read, NULL, NULL };
+
+    struct nix_buffer *buf;
+    nix_buffer__construct_source(&buf, &source, 4, 0);
+    __assert_reads(buf, "x = \xe9\n");
+
+    c.at = 0;
+    source.read = NULL;
+    source.borrow = chunks_borrow;
+    nix_buffer__reset_source(buf, &source);
+    __assert_reads(buf, "x = \xe9\n");
+    nix_buffer__free(&buf);
+
+    // All of it lent at once is read where it is
+    c.at = 0;
+    c.piece = length;
+    source.size_hint = chunks_size;
+    nix_buffer__construct_source(&buf, &source, 4, NIX_BUFFER_HASH);
+    TEST_ASSERT_MESSAGE(((struct buffer *)buf)->mem,
+            "Whole input wasn't read in place");
+    __assert_reads(buf, "x = \xe9\n");
+
+    __assert_hashed(buf, data, length,
+            "Input read in place hashed differently");
+    nix_buffer__free(&buf);
+
+    // A pipe can't seek, and needn't
+    int pipe_fds[2];
+    TEST_ASSERT_MESSAGE(pipe(pipe_fds) == 0, "Failed to make a pipe");
+    TEST_ASSERT_EQUAL_INT(5, write(pipe_fds[1], "x = 1", 5));
+    close(pipe_fds[1]);
+
+    FILE *file = fdopen(pipe_fds[0], "rb");
+    nix_buffer__construct(&buf, file, 4);
+    __assert_reads(buf, "x = 1");
+
+    nix_buffer__free(&buf);
+    fclose(file);
+}
+
+// Read through the fed buffer, feeding it a byte each time it runs out
+static uint32_t __read_fed(struct nix_buffer *buf, const uint8_t *data,
+        size_t length, size_t *fed) {
+    uint32_t c;
+    enum nix_err err;
+
+    while ((err = nix_buffer__read(buf, &c)) == NIXERR_BUF_WOULDBLOCK) {
+        if (*fed < length) {
+            nix_buffer__feed(buf, data + (*fed)++, 1);
+        } else {
+            nix_buffer__finish(buf);
+        }
+    }
+
+    if (err == NIXERR_BUF_EOF) {
+        return 0;
+    }
+
+    TEST_ASSERT_MESSAGE(err == NIXERR_NONE, "Failed to read fed input");
+    return c;
+}
+
+void test_feed_buffer() {
+    uint8_t data[] = "\xEF\xBB\xBFlet a = \"caf\xc3\xa9\";\r\nin a";
+    size_t length = sizeof(data) - 1;
+
+    FILE *file = fmemopen(data, length, "r");
+    struct nix_buffer *buf, *plain;
+    nix_buffer__construct(&plain, file, 8);
+    nix_buffer__construct_feed(&buf, 8, NIX_BUFFER_HASH);
+
+    // Nothing to read yet, and the cursor stays put
+    uint32_t c;
+    TEST_ASSERT_MESSAGE(nix_buffer__read(buf, &c) == NIXERR_BUF_WOULDBLOCK,
+            "Read from an empty feed");
+    TEST_ASSERT_MESSAGE(buf->read->abs == 0, "Moved without reading");
+
+    // Split inside the mark and the characters, it reads as the file does
+    size_t fed = 0;
+    for (;;) {
+        uint32_t expected = 0;
+        enum nix_err err = nix_buffer__read(plain, &expected);
+        uint32_t actual = __read_fed(buf, data, length, &fed);
+
+        TEST_ASSERT_EQUAL_HEX32(expected, actual);
+        TEST_ASSERT_MESSAGE(buf->read->row == plain->read->row &&
+                buf->read->col == plain->read->col &&
+                buf->read->abs == plain->read->abs, "Wrong position");
+
+        if (err == NIXERR_BUF_EOF) {
+            break;
+        }
+
+        nix_buffer__discard_lexeme(buf, 0);
+        nix_buffer__discard_lexeme(plain, 0);
+    }
+
+    TEST_ASSERT_MESSAGE(fed == length, "Didn't feed everything");
+    TEST_ASSERT_MESSAGE(nix_buffer__feed(buf, data, 1) == NIXERR_BUF_PAST_EOF,
+            "Fed a finished buffer");
+
+    __assert_hashed(buf, data, length,
+            "Fed input hashed wrong");
+
+    // Fed all at once, well past the size of the buffer
+    nix_buffer__reset_feed(buf);
+    nix_buffer__feed(buf, data + 3, length - 3);
+    nix_buffer__finish(buf);
+    __assert_reads(buf, "let a = \"caf\xe9\";\r\nin a");
+
+    nix_buffer__free(&buf);
+    nix_buffer__free(&plain);
+    fclose(file);
+}
+
 int main(int argc, char **argv) {
     TEST_PATH();
 
@@ -220,6 +811,15 @@ int main(int argc, char **argv) {
     RUN_TEST(test_read_reverse_utf16);
     RUN_TEST(test_discard_lexeme);
     RUN_TEST(test_read_over_buffer);
+    RUN_TEST(test_content_hash);
+    RUN_TEST(test_reset_buffer);
+    RUN_TEST(test_acquire_buffer);
+    RUN_TEST(test_prefetch_buffer);
+    RUN_TEST(test_uring_buffer);
+    RUN_TEST(test_fd_buffer);
+    RUN_TEST(test_mem_buffer);
+    RUN_TEST(test_source_buffer);
+    RUN_TEST(test_feed_buffer);
     return UNITY_END();
 }
 
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/char.h"
+#include "unity/src/unity.h"
+#include "test_char.h"
+
+void test_char_ascii() {
+    TEST_ASSERT_MESSAGE(nix_char__is_ident_start('a'), "a is an ident start");
+    TEST_ASSERT_MESSAGE(nix_char__is_ident_start('Z'), "Z is an ident start");
+    TEST_ASSERT_MESSAGE(!nix_char__is_ident_start('1'),
+            "1 is not an ident start");
+    TEST_ASSERT_MESSAGE(nix_char__is_ident_continue('1'),
+            "1 is an ident continue");
+    TEST_ASSERT_MESSAGE(nix_char__is_ident_continue('_'),
+            "_ is an ident continue");
+    TEST_ASSERT_MESSAGE(!nix_char__is_ident_continue('-'),
+            "- is not an ident continue");
+    TEST_ASSERT_MESSAGE(nix_char__is_whitespace(' '), "Space is whitespace");
+    TEST_ASSERT_MESSAGE(nix_char__is_whitespace('\n'),
+            "Newline is whitespace");
+    TEST_ASSERT_MESSAGE(!nix_char__is_whitespace('x'),
+            "x is not whitespace");
+}
+
+void test_char_unicode() {
+    TEST_ASSERT_MESSAGE(nix_char__is_ident_start(0xE9),
+            "Latin é is an ident start");
+    TEST_ASSERT_MESSAGE(nix_char__is_ident_start(0x4E2D),
+            "CJK ideograph is an ident start");
+    TEST_ASSERT_MESSAGE(!nix_char__is_ident_start(0x301),
+            "Combining acute is not an ident start");
+    TEST_ASSERT_MESSAGE(nix_char__is_ident_continue(0x301),
+            "Combining acute is an ident continue");
+    TEST_ASSERT_MESSAGE(nix_char__is_ident_continue(0x0663),
+            "Arabic-indic digit is an ident continue");
+    TEST_ASSERT_MESSAGE(!nix_char__is_ident_continue(0x1F616),
+            "Emoji is not an ident continue");
+    TEST_ASSERT_MESSAGE(nix_char__is_whitespace(0xA0),
+            "No-break space is whitespace");
+    TEST_ASSERT_MESSAGE(nix_char__is_whitespace(0x3000),
+            "Ideographic space is whitespace");
+}
+
+void test_char_out_of_range() {
+    TEST_ASSERT_MESSAGE(!nix_char__is_ident_start(0x110000),
+            "Code points past U+10FFFF have no properties");
+    TEST_ASSERT_MESSAGE(!nix_char__is_whitespace(UINT32_MAX),
+            "Code points past U+10FFFF have no properties");
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_char_ascii);
+    RUN_TEST(test_char_unicode);
+    RUN_TEST(test_char_out_of_range);
+    return UNITY_END();
+}
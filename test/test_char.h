@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_char_h__
+#define INCLUDE_test_char_h__
+
+void test_char_ascii();
+
+#endif
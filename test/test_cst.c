@@ -0,0 +1,299 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/buffer.h"
+#include "libnix/cst.h"
+#include "unity/src/unity.h"
+#include "test_cst.h"
+
+static const struct nix_green *parse(
+    struct nix_green_cache *cache,
+    const char *source)
+{
+    const struct nix_green *root = NULL;
+
+    FILE *file = fmemopen((void *)source, strlen(source), "r");
+    TEST_ASSERT_MESSAGE(file != NULL, "Failed to open source");
+
+    struct nix_buffer *buf;
+    nix_buffer__construct(&buf, file, 64);
+
+    TEST_ASSERT_MESSAGE(nix_cst__parse(cache, buf, &root) == NIXERR_NONE,
+            source);
+
+    nix_buffer__free(&buf);
+    fclose(file);
+
+    return root;
+}
+
+static void assert_lossless(
+    struct nix_green_cache *cache,
+    const char *source)
+{
+    const struct nix_green *root = parse(cache, source);
+
+    size_t size = strlen(source) + 1;
+    char *text = malloc(size);
+    size_t length;
+
+    TEST_ASSERT_MESSAGE(nix_green__write(root, text, size, &length) ==
+            NIXERR_NONE, source);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(source, text, source);
+    TEST_ASSERT_MESSAGE(length == strlen(source), source);
+
+    free(text);
+}
+
+// Write the shape of a tree, leaving out the text of its tokens
+static void dump(const struct nix_green *green, char *out, size_t size) {
+    size_t length = strlen(out);
+
+    if (nix_green__is_token(green)) {
+        snprintf(out + length, size - length, " %s",
+                nix_cst__kind_name(green->kind));
+        return;
+    }
+
+    snprintf(out + length, size - length, " (%s",
+            nix_cst__kind_name(green->kind));
+
+    const struct nix_green *const *children = nix_green__children(green);
+    for (uint32_t i = 0; i < green->count; i++) {
+        dump(children[i], out, size);
+    }
+
+    length = strlen(out);
+    snprintf(out + length, size - length, ")");
+}
+
+static void assert_shape(
+    struct nix_green_cache *cache,
+    const char *source,
+    const char *expected)
+{
+    char shape[1024] = "";
+    dump(parse(cache, source), shape, sizeof(shape));
+
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(expected, shape + 1, source);
+}
+
+void test_cst_lossless() {
+    struct nix_green_cache *cache;
+    nix_green_cache__construct(&cache);
+
+    assert_lossless(cache, "");
+    assert_lossless(cache, "  # only a comment\n");
+    assert_lossless(cache,
+            "{ pkgs ? import <nixpkgs> {} }:\n"
+            "\n"
+            "/* block\n   comment */\n"
+            "let\n"
+            "  name = \"caf\xc3\xa9-${pkgs.lib.version}\\n\";\n"
+            "  src = ./src/main.c;\n"
+            "  config = ./hosts/${name}/default.nix;\n"
+            "  script = ''\n"
+            "    echo ${name} ''${literal}\n"
+            "    exit 0\n"
+            "  '';\n"
+            "in pkgs.stdenv.mkDerivation { inherit name src; x = -1.5e3; }\n");
+
+    // Unbalanced input is still kept exactly
+    assert_lossless(cache, "( ] } ) in ;; ${ \"unclosed ${ x");
+
+    // Long runs the lexer splits come back as one token
+    char source[8192];
+    memset(source, ' ', sizeof(source) - 3);
+    source[0] = '"';
+    source[sizeof(source) - 3] = '"';
+    source[sizeof(source) - 2] = '\n';
+    source[sizeof(source) - 1] = '\0';
+    for (size_t i = 1; i < sizeof(source) - 3; i += 7) {
+        source[i] = 'a' + i % 26;
+    }
+
+    assert_lossless(cache, source);
+
+    const struct nix_green *root = parse(cache, source);
+    const struct nix_green *string = nix_green__children(root)[0];
+
+    TEST_ASSERT_MESSAGE(string->kind == NIX_CST_STRING &&
+            string->count == 3, "Split text was not joined");
+
+    // So do comments, in both forms
+    source[0] = '#';
+    source[sizeof(source) - 3] = ' ';
+    assert_lossless(cache, source);
+    root = parse(cache, source);
+    TEST_ASSERT_MESSAGE(root->count == 2 &&
+            nix_green__children(root)[0]->kind == NIX_TOKEN_COMMENT,
+            "Split line comment was not joined");
+
+    source[0] = '/';
+    source[1] = '*';
+    source[sizeof(source) - 4] = '*';
+    source[sizeof(source) - 3] = '/';
+    assert_lossless(cache, source);
+    root = parse(cache, source);
+    TEST_ASSERT_MESSAGE(root->count == 2 &&
+            nix_green__children(root)[0]->kind == NIX_TOKEN_COMMENT,
+            "Split block comment was not joined");
+
+    nix_green_cache__free(&cache);
+}
+
+void test_cst_structure() {
+    struct nix_green_cache *cache;
+    nix_green_cache__construct(&cache);
+
+    assert_shape(cache, "{ a = 1; }",
+            "(ROOT (BRACE { WHITESPACE "
+            "(STATEMENT ID WHITESPACE = WHITESPACE INT ;) WHITESPACE }))");
+    assert_shape(cache, "let a = [ 1 ]; in a",
+            "(ROOT (LET let WHITESPACE "
+            "(STATEMENT ID WHITESPACE = WHITESPACE "
+            "(BRACKET [ WHITESPACE INT WHITESPACE ]) ;) WHITESPACE in) "
+            "WHITESPACE ID)");
+    assert_shape(cache, "with a; \"x${y}\"",
+            "(ROOT (STATEMENT with WHITESPACE ID ;) WHITESPACE "
+            "(STRING STRING_OPEN STR "
+            "(INTERPOLATION DOLLAR_CURLY ID }) STRING_CLOSE))");
+    assert_shape(cache, "./a/${b}.nix",
+            "(ROOT (PATH PATH_START (INTERPOLATION DOLLAR_CURLY ID }) "
+            "PATH_STR PATH_END))");
+    assert_shape(cache, "{ x = let b = 1; in b; }",
+            "(ROOT (BRACE { WHITESPACE (STATEMENT ID WHITESPACE = WHITESPACE "
+            "(LET let WHITESPACE (STATEMENT ID WHITESPACE = WHITESPACE INT ;) "
+            "WHITESPACE in) WHITESPACE ID ;) WHITESPACE }))");
+    assert_shape(cache, "( [ a ) ]",
+            "(ROOT (PAREN ( WHITESPACE (BRACKET [ WHITESPACE ID WHITESPACE) )) "
+            "WHITESPACE ])");
+
+    nix_green_cache__free(&cache);
+}
+
+void test_cst_sharing() {
+    struct nix_green_cache *cache;
+    nix_green_cache__construct(&cache);
+
+    const char *source =
+        "{\n"
+        "  a = fetchurl { url = \"https://example.org\"; hash = \"x\"; };\n"
+        "  b = fetchurl { url = \"https://example.org\"; hash = \"x\"; };\n"
+        "  c = {\n"
+        "    d = fetchurl {\n"
+        "      url = \"https://example.org\";\n"
+        "    };\n"
+        "  };\n"
+        "}\n";
+
+    const struct nix_green *root = parse(cache, source);
+    const struct nix_green *brace = nix_green__children(root)[0];
+    const struct nix_green *const *items = nix_green__children(brace);
+
+    // Statements a and b differ only in their name, so they share the
+    // fetchurl argument
+    const struct nix_green *a = items[2];
+    const struct nix_green *b = items[4];
+    TEST_ASSERT_MESSAGE(a->kind == NIX_CST_STATEMENT &&
+            b->kind == NIX_CST_STATEMENT && a != b, "Wrong statements");
+    TEST_ASSERT_MESSAGE(nix_green__children(a)[6] ==
+            nix_green__children(b)[6], "Identical subtrees not shared");
+
+    // Statements leave out the indentation around them, so the url binding
+    // is shared however deeply it's nested
+    const struct nix_green *args = nix_green__children(a)[6];
+    const struct nix_green *url = nix_green__children(args)[2];
+    TEST_ASSERT_MESSAGE(url->kind == NIX_CST_STATEMENT, "Wrong url binding");
+
+    const struct nix_green *c = items[6];
+    const struct nix_green *inner = nix_green__children(c)[4];
+    const struct nix_green *d = nix_green__children(inner)[2];
+    const struct nix_green *nested = nix_green__children(d)[6];
+    TEST_ASSERT_MESSAGE(nix_green__children(nested)[2] == url,
+            "Nested binding not shared");
+
+    // Building the same file again stores nothing new
+    size_t count = cache->count;
+    TEST_ASSERT_MESSAGE(parse(cache, source) == root,
+            "Equal files gave different trees");
+    TEST_ASSERT_MESSAGE(cache->count == count, "Nodes were duplicated");
+
+    nix_green_cache__free(&cache);
+}
+
+void test_cst_replace() {
+    struct nix_green_cache *cache;
+    nix_green_cache__construct(&cache);
+
+    const char *source = "{ a = [ 1 2 ]; b = { c = 3; }; }";
+    const char *expected = "{ a = [ 1 2 ]; b = { c = 42; }; }";
+    const struct nix_green *root = parse(cache, source);
+
+    uint32_t path[16];
+    size_t depth;
+
+    TEST_ASSERT_MESSAGE(nix_cst__path(root, 25, path, 16, &depth) ==
+            NIXERR_NONE, "Failed to find token");
+
+    const struct nix_green *green = root;
+    for (size_t i = 0; i < depth; i++) {
+        green = nix_green__children(green)[path[i]];
+    }
+
+    TEST_ASSERT_MESSAGE(green->kind == NIX_TOKEN_INT &&
+            strcmp(nix_green__text(green), "3") == 0, "Wrong token found");
+
+    const struct nix_green *token;
+    nix_green__token(cache, NIX_TOKEN_INT, "42", 2, &token);
+
+    size_t count = cache->count;
+    const struct nix_green *edited;
+    TEST_ASSERT_MESSAGE(nix_cst__replace(cache, root, path, depth, token,
+                &edited) == NIXERR_NONE, "Failed to replace token");
+
+    char text[64];
+    nix_green__write(edited, text, sizeof(text), NULL);
+    TEST_ASSERT_EQUAL_STRING(expected, text);
+
+    // Only the spine is new, and the rest is shared with the old tree
+    TEST_ASSERT_MESSAGE(cache->count - count == depth,
+            "More than the spine was rebuilt");
+    TEST_ASSERT_MESSAGE(nix_green__children(nix_green__children(edited)[0])[2]
+            == nix_green__children(nix_green__children(root)[0])[2],
+            "Unchanged sibling not shared");
+
+    // The edited tree is the one a fresh parse of the new text gives
+    TEST_ASSERT_MESSAGE(parse(cache, expected) == edited,
+            "Edited tree differs from a fresh parse");
+
+    // Putting the old token back gives back the old tree
+    const struct nix_green *undone;
+    nix_cst__replace(cache, edited, path, depth, green, &undone);
+    TEST_ASSERT_MESSAGE(undone == root, "Undoing the edit changed the tree");
+
+    path[0] = 5;
+    TEST_ASSERT_MESSAGE(nix_cst__replace(cache, root, path, 1, token,
+                &edited) == NIXERR_BUF_INVLEN, "Accepted a bad path");
+    TEST_ASSERT_MESSAGE(nix_green__write(root, text, 5, NULL) ==
+            NIXERR_BUF_INVLEN, "Wrote past the end of the output");
+
+    nix_green_cache__free(&cache);
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_cst_lossless);
+    RUN_TEST(test_cst_structure);
+    RUN_TEST(test_cst_sharing);
+    RUN_TEST(test_cst_replace);
+    return UNITY_END();
+}
@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_cst_h__
+#define INCLUDE_test_cst_h__
+
+void test_cst_lossless();
+
+#endif
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/digest.h"
+#include "unity/src/unity.h"
+#include "test_digest.h"
+
+// Inputs of the official test vectors are the bytes 0, 1, ..., 250, 0, ...
+static uint8_t *vector_input(size_t size) {
+    uint8_t *input = malloc(size > 0 ? size : 1);
+    for (size_t i = 0; i < size; i++) {
+        input[i] = i % 251;
+    }
+
+    return input;
+}
+
+void test_digest_vectors() {
+    struct {
+        size_t size;
+        const char *hex;
+    } vectors[] = {
+        { 0,
+            "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+        { 1,
+            "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+        { 1023,
+            "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+        { 1024,
+            "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+        { 1025,
+            "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+        { 2048,
+            "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a" },
+        { 2049,
+            "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030" },
+        { 102400,
+            "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" }
+    };
+
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        uint8_t *input = vector_input(vectors[i].size);
+        struct nix_digest digest;
+        char hex[NIX_DIGEST_HEX_SIZE];
+
+        nix_digest__bytes(input, vectors[i].size, &digest);
+        nix_digest__hex(&digest, hex);
+        TEST_ASSERT_EQUAL_STRING(vectors[i].hex, hex);
+
+        free(input);
+    }
+
+    struct nix_digest digest;
+    char hex[NIX_DIGEST_HEX_SIZE];
+
+    nix_digest__bytes("abc", 3, &digest);
+    nix_digest__hex(&digest, hex);
+    TEST_ASSERT_EQUAL_STRING(
+            "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85",
+            hex);
+}
+
+void test_digest_incremental() {
+    size_t size = 70000;
+    uint8_t *input = vector_input(size);
+
+    struct nix_digest expected;
+    nix_digest__bytes(input, size, &expected);
+
+    // However the input is split, the digest is the same
+    for (int round = 0; round < 50; round++) {
+        struct nix_hasher *hasher;
+        nix_hasher__construct(&hasher);
+
+        size_t at = 0;
+        while (at < size) {
+            size_t piece = rand() % 3000;
+            if (piece > size - at) {
+                piece = size - at;
+            }
+
+            nix_hasher__update(hasher, input + at, piece);
+            at += piece;
+        }
+
+        struct nix_digest digest;
+        nix_hasher__final(hasher, &digest);
+
+        TEST_ASSERT_MESSAGE(memcmp(&digest, &expected, sizeof(digest)) == 0,
+                "Split input gave a different digest");
+        TEST_ASSERT_MESSAGE(hasher->length == size, "Wrong length");
+
+        nix_hasher__free(&hasher);
+    }
+
+    // Finishing doesn't stop hashing from carrying on
+    struct nix_hasher *hasher;
+    struct nix_digest first, digest;
+    nix_hasher__construct(&hasher);
+
+    nix_hasher__update(hasher, input, 3000);
+    nix_hasher__final(hasher, &first);
+    nix_hasher__update(hasher, input + 3000, size - 3000);
+    nix_hasher__final(hasher, &digest);
+
+    TEST_ASSERT_MESSAGE(memcmp(&digest, &expected, sizeof(digest)) == 0,
+            "Finishing early changed the digest");
+    TEST_ASSERT_MESSAGE(memcmp(&first, &expected, sizeof(digest)) != 0,
+            "Digest of a prefix matched the whole");
+
+    nix_hasher__free(&hasher);
+    free(input);
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_digest_vectors);
+    RUN_TEST(test_digest_incremental);
+    return UNITY_END();
+}
@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_digest_h__
+#define INCLUDE_test_digest_h__
+
+void test_digest_vectors();
+
+#endif
@@ -0,0 +1,194 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/buffer.h"
+#include "libnix/error.h"
+#include "libnix/intern.h"
+#include "unity/src/unity.h"
+#include "test_intern.h"
+
+#define THREAD_COUNT 4
+#define THREAD_SYMBOLS 2000
+
+void test_intern_same_text() {
+    struct nix_intern *in;
+    enum nix_err r = nix_intern__construct(&in, 0);
+    TEST_ASSERT_MESSAGE(r == NIXERR_NONE, "Could not construct intern table");
+
+    uint32_t a, b, c;
+    nix_intern__intern(in, "pkgs", 4, &a);
+    nix_intern__intern(in, "lib", 3, &b);
+    nix_intern__intern(in, "pkgs", 4, &c);
+
+    TEST_ASSERT_MESSAGE(a == 0, "First symbol should have id 0");
+    TEST_ASSERT_MESSAGE(b == 1, "Second symbol should have id 1");
+    TEST_ASSERT_MESSAGE(a == c, "Same text interned to different ids");
+    TEST_ASSERT_MESSAGE(nix_intern__count(in) == 2, "Invalid symbol count");
+
+    nix_intern__free(&in);
+}
+
+void test_intern_lookup() {
+    struct nix_intern *in;
+    nix_intern__construct(&in, 0);
+
+    uint32_t id;
+    nix_intern__intern(in, "fetchurl", 8, &id);
+
+    const char *text;
+    size_t length;
+    enum nix_err r = nix_intern__lookup(in, id, &text, &length);
+    TEST_ASSERT_MESSAGE(r == NIXERR_NONE, "Could not look up symbol");
+    TEST_ASSERT_MESSAGE(length == 8, "Invalid symbol length");
+    TEST_ASSERT_MESSAGE(strcmp(text, "fetchurl") == 0, "Invalid symbol text");
+
+    r = nix_intern__lookup(in, id + 1, &text, &length);
+    TEST_ASSERT_MESSAGE(r == NIXERR_INTERN_INVID, "Invalid id was accepted");
+
+    nix_intern__free(&in);
+}
+
+void test_intern_utf32() {
+    struct nix_intern *in;
+    nix_intern__construct(&in, 0);
+
+    // "é" as UTF-32 and as UTF-8
+    uint32_t wide[] = { 'c', 'a', 'f', 0xE9 };
+    char narrow[] = { 'c', 'a', 'f', (char)0xC3, (char)0xA9 };
+
+    uint32_t a, b;
+    nix_intern__intern_utf32(in, wide, 4, &a);
+    nix_intern__intern(in, narrow, sizeof(narrow), &b);
+
+    TEST_ASSERT_MESSAGE(a == b, "UTF-32 and UTF-8 text interned differently");
+
+    nix_intern__free(&in);
+}
+
+void test_intern_grow() {
+    struct nix_intern *in;
+    nix_intern__construct(&in, 0);
+
+    char name[16];
+    for (uint32_t i = 0; i < 10000; i++) {
+        uint32_t id;
+        int length = snprintf(name, sizeof(name), "attr%u", i);
+        nix_intern__intern(in, name, length, &id);
+        TEST_ASSERT_MESSAGE(id == i, "Symbol ids are not dense");
+    }
+
+    for (uint32_t i = 0; i < 10000; i += 97) {
+        uint32_t id;
+        const char *text;
+        int length = snprintf(name, sizeof(name), "attr%u", i);
+        nix_intern__intern(in, name, length, &id);
+        TEST_ASSERT_MESSAGE(id == i, "Symbol id changed after growing");
+
+        nix_intern__lookup(in, id, &text, NULL);
+        TEST_ASSERT_MESSAGE(strcmp(text, name) == 0, "Invalid symbol text");
+    }
+
+    nix_intern__free(&in);
+}
+
+void *__intern_worker(void *arg) {
+    struct nix_intern *in = arg;
+    uint32_t *ids = malloc(sizeof(uint32_t) * THREAD_SYMBOLS);
+
+    char name[16];
+    for (uint32_t i = 0; i < THREAD_SYMBOLS; i++) {
+        int length = snprintf(name, sizeof(name), "sym%u", i);
+        if (nix_intern__intern(in, name, length, &ids[i]) != NIXERR_NONE) {
+            free(ids);
+            return NULL;
+        }
+    }
+
+    return ids;
+}
+
+void test_intern_concurrent() {
+    struct nix_intern *in;
+    enum nix_err r = nix_intern__construct(&in, NIX_INTERN_CONCURRENT);
+    TEST_ASSERT_MESSAGE(r == NIXERR_NONE, "Could not construct intern table");
+
+    pthread_t threads[THREAD_COUNT];
+    uint32_t *ids[THREAD_COUNT];
+
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        pthread_create(&threads[i], NULL, __intern_worker, in);
+    }
+
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], (void **)&ids[i]);
+        TEST_ASSERT_MESSAGE(ids[i] != NULL, "Worker failed to intern");
+    }
+
+    TEST_ASSERT_MESSAGE(nix_intern__count(in) == THREAD_SYMBOLS,
+            "Threads created duplicate symbols");
+
+    char name[16];
+    for (uint32_t i = 0; i < THREAD_SYMBOLS; i++) {
+        const char *text;
+        snprintf(name, sizeof(name), "sym%u", i);
+        nix_intern__lookup(in, ids[0][i], &text, NULL);
+        TEST_ASSERT_MESSAGE(strcmp(text, name) == 0, "Invalid symbol text");
+
+        for (size_t j = 1; j < THREAD_COUNT; j++) {
+            TEST_ASSERT_MESSAGE(ids[j][i] == ids[0][i],
+                    "Threads disagree on a symbol id");
+        }
+    }
+
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        free(ids[i]);
+    }
+
+    nix_intern__free(&in);
+}
+
+void test_intern_lexeme() {
+    FILE *file;
+    FILE_FROM_STRING(file, "test_intern_lexeme", (uint8_t*)"abc", 3);
+
+    struct nix_buffer *buf;
+    nix_buffer__construct(&buf, file, 8);
+
+    struct nix_intern *in;
+    nix_intern__construct(&in, 0);
+
+    uint32_t c;
+    nix_buffer__read(buf, &c);
+    nix_buffer__read(buf, &c);
+
+    uint32_t id, expected;
+    enum nix_err r = nix_buffer__intern_lexeme(buf, in, &id, 0);
+    TEST_ASSERT_MESSAGE(r == NIXERR_NONE, "Could not intern lexeme");
+
+    nix_intern__intern(in, "ab", 2, &expected);
+    TEST_ASSERT_MESSAGE(id == expected, "Lexeme interned to the wrong symbol");
+    TEST_ASSERT_MESSAGE(buf->lexeme->abs == 2, "Lexeme was not consumed");
+
+    nix_buffer__free(&buf);
+    nix_intern__free(&in);
+    fclose(file);
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_intern_same_text);
+    RUN_TEST(test_intern_lookup);
+    RUN_TEST(test_intern_utf32);
+    RUN_TEST(test_intern_grow);
+    RUN_TEST(test_intern_concurrent);
+    RUN_TEST(test_intern_lexeme);
+    return UNITY_END();
+}
@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_intern_h__
+#define INCLUDE_test_intern_h__
+
+void test_intern_same_text();
+
+#endif
@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/keyword.h"
+#include "unity/src/unity.h"
+#include "test_keyword.h"
+
+void test_keyword_lookup() {
+    for (enum nix_keyword k = NIX_KEYWORD_LET; k <= NIX_KEYWORD_OR; k++) {
+        const char *name = nix_keyword__name(k);
+        TEST_ASSERT_MESSAGE(name != NULL, "Keyword has no name");
+        TEST_ASSERT_MESSAGE(nix_keyword__lookup(name, strlen(name)) == k,
+                "Keyword was not recognized");
+    }
+}
+
+void test_keyword_not_keyword() {
+    TEST_ASSERT_MESSAGE(nix_keyword__lookup("letter", 6) == NIX_KEYWORD_NONE,
+            "Identifier recognized as a keyword");
+    TEST_ASSERT_MESSAGE(nix_keyword__lookup("i", 1) == NIX_KEYWORD_NONE,
+            "Prefix recognized as a keyword");
+    TEST_ASSERT_MESSAGE(nix_keyword__lookup("Let", 3) == NIX_KEYWORD_NONE,
+            "Keywords are case sensitive");
+    TEST_ASSERT_MESSAGE(nix_keyword__lookup("in\0", 3) == NIX_KEYWORD_NONE,
+            "Trailing NUL recognized as a keyword");
+    TEST_ASSERT_MESSAGE(nix_keyword__lookup("inheritance", 11) ==
+            NIX_KEYWORD_NONE, "Long identifier recognized as a keyword");
+    TEST_ASSERT_MESSAGE(nix_keyword__lookup("", 0) == NIX_KEYWORD_NONE,
+            "Empty text recognized as a keyword");
+}
+
+void test_keyword_utf32() {
+    uint32_t with[] = { 'w', 'i', 't', 'h' };
+    uint32_t wide[] = { 'w', 'i', 't', 'h' + 0x100 };
+
+    TEST_ASSERT_MESSAGE(nix_keyword__lookup_utf32(with, 4) ==
+            NIX_KEYWORD_WITH, "UTF-32 keyword was not recognized");
+    TEST_ASSERT_MESSAGE(nix_keyword__lookup_utf32(wide, 4) ==
+            NIX_KEYWORD_NONE, "Non-ASCII text recognized as a keyword");
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_keyword_lookup);
+    RUN_TEST(test_keyword_not_keyword);
+    RUN_TEST(test_keyword_utf32);
+    return UNITY_END();
+}
@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_keyword_h__
+#define INCLUDE_test_keyword_h__
+
+void test_keyword_lookup();
+
+#endif
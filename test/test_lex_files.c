@@ -0,0 +1,175 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "libnix/intern.h"
+#include "libnix/lex_files.h"
+#include "libnix/tokens.h"
+#include "unity/src/unity.h"
+#include "test_lex_files.h"
+
+#define FILES 24
+
+static const char *PIECE =
+    "{ pkgs ? import <nixpkgs> {} }: pkgs.mkDerivation {\n"
+    "  name = \"hello-${version}\"; src = ./src; doCheck = true;\n"
+    "  meta.description = ''\n    A ${\"friendly\"} greeting\n  '';\n}\n";
+
+struct collected {
+    size_t calls;
+    size_t order[FILES + 1];
+    size_t counts[FILES + 1];
+    enum nix_err errs[FILES + 1];
+};
+
+static void collect(void *context, const struct nix_lex_result *result) {
+    struct collected *c = context;
+
+    c->order[c->calls++] = result->index;
+    c->errs[result->index] = result->err;
+    c->counts[result->index] = result->table != NULL ?
+        result->table->count : 0;
+
+    struct nix_token_table *table = result->table;
+    nix_token_table__free(&table);
+}
+
+// Files of very different sizes, the biggest of them big enough to split,
+// and one which doesn't exist
+static char **write_files() {
+    char **paths = malloc(sizeof(char *) * (FILES + 1));
+
+    for (size_t i = 0; i < FILES; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "lex_files_%zu", i);
+        paths[i] = combine_path(test_path, name);
+
+        FILE *file = fopen(paths[i], "wb");
+        TEST_ASSERT_MESSAGE(file != NULL, "Failed to write file");
+
+        size_t repeat = i == FILES - 1 ? 2000 : i * 3 + 1;
+        for (size_t j = 0; j < repeat; j++) {
+            fputs(PIECE, file);
+        }
+
+        fclose(file);
+    }
+
+    paths[FILES] = combine_path(test_path, "lex_files_missing");
+    return paths;
+}
+
+static size_t expected_count(const char *path, struct nix_intern *intern) {
+    FILE *file = fopen(path, "rb");
+    struct nix_token_table *table;
+
+    TEST_ASSERT_MESSAGE(nix_tokenize_file(&table, file, intern, 1) ==
+            NIXERR_NONE, "Failed to tokenize");
+
+    size_t count = table->count;
+    nix_token_table__free(&table);
+    fclose(file);
+
+    return count;
+}
+
+static void check(struct collected *c, char **paths) {
+    TEST_ASSERT_EQUAL_UINT(FILES + 1, c->calls);
+
+    for (size_t i = 0; i < FILES; i++) {
+        TEST_ASSERT_EQUAL_INT(NIXERR_NONE, c->errs[i]);
+        TEST_ASSERT_EQUAL_UINT(expected_count(paths[i], NULL), c->counts[i]);
+    }
+
+    TEST_ASSERT_EQUAL_INT(NIXERR_BUF_FILE, c->errs[FILES]);
+}
+
+void test_lex_files_batch() {
+    char **paths = write_files();
+    struct collected c = { 0 };
+
+    struct nix_lex_options options = { 0 };
+    options.threads = 4;
+    options.context = &c;
+
+    TEST_ASSERT_MESSAGE(nix_lex_files((const char *const *)paths, FILES + 1,
+                &options, collect) == NIXERR_NONE, "Batch failed");
+    check(&c, paths);
+
+    // Results come in the order given when asked for
+    memset(&c, 0, sizeof(c));
+    options.flags = NIX_LEX_ORDERED;
+    nix_lex_files((const char *const *)paths, FILES + 1, &options, collect);
+    check(&c, paths);
+
+    for (size_t i = 0; i <= FILES; i++) {
+        TEST_ASSERT_EQUAL_UINT(i, c.order[i]);
+    }
+
+    // Reading through each thread's ring gives the same tokens
+    memset(&c, 0, sizeof(c));
+    options.flags = NIX_LEX_URING;
+    nix_lex_files((const char *const *)paths, FILES + 1, &options, collect);
+    check(&c, paths);
+
+    for (size_t i = 0; i <= FILES; i++) {
+        free(paths[i]);
+    }
+
+    free(paths);
+}
+
+void test_lex_files_intern() {
+    char **paths = write_files();
+    struct nix_pool *pool;
+    nix_pool__construct(&pool, 3, 0);
+
+    // Shared between threads, and used on one thread only otherwise
+    unsigned int flags[] = { NIX_INTERN_CONCURRENT, 0 };
+
+    for (size_t f = 0; f < 2; f++) {
+        struct nix_intern *intern;
+        nix_intern__construct(&intern, flags[f]);
+
+        struct collected c = { 0 };
+        struct nix_lex_options options = { 0 };
+        options.intern = intern;
+        options.pool = pool;
+        options.context = &c;
+
+        nix_lex_files((const char *const *)paths, FILES + 1, &options,
+                collect);
+        check(&c, paths);
+
+        uint32_t id;
+        TEST_ASSERT_MESSAGE(nix_intern__count(intern) > 0, "Nothing interned");
+        nix_intern__intern(intern, "mkDerivation", 12, &id);
+        TEST_ASSERT_MESSAGE(id < nix_intern__count(intern),
+                "Identifier wasn't interned");
+
+        nix_intern__free(&intern);
+    }
+
+    // The pool given is left for the caller
+    nix_pool__free(&pool);
+
+    for (size_t i = 0; i <= FILES; i++) {
+        free(paths[i]);
+    }
+
+    free(paths);
+
+    TEST_ASSERT_MESSAGE(nix_lex_files(NULL, 0, NULL, collect) == NIXERR_NONE,
+            "Empty batch failed");
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_lex_files_batch);
+    RUN_TEST(test_lex_files_intern);
+    return UNITY_END();
+}
@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_lex_files_h__
+#define INCLUDE_test_lex_files_h__
+
+void test_lex_files_batch();
+
+#endif
@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/buffer.h"
+#include "libnix/lexer.h"
+#include "unity/src/unity.h"
+#include "test_lexer.h"
+
+#define MAX_TOKENS 64
+
+// Lex the text and compare the kinds of its non-trivia tokens, ending with EOF
+static void assert_tokens(
+    char *name,
+    const char *text,
+    const enum nix_token_kind *expected,
+    size_t count)
+{
+    FILE *file;
+    FILE_FROM_STRING(file, name, (uint8_t *)text, strlen(text));
+
+    struct nix_buffer *buf;
+    nix_buffer__construct(&buf, file, 64);
+
+    struct nix_lexer *lex;
+    nix_lexer__construct(&lex, buf);
+
+    size_t i = 0;
+    struct nix_token tok;
+
+    do {
+        enum nix_err r = nix_lexer__next(lex, &tok);
+        TEST_ASSERT_MESSAGE(r == NIXERR_NONE, "Lexer returned an error");
+
+        if (nix_token__is_trivia(tok.kind)) {
+            continue;
+        }
+
+        TEST_ASSERT_MESSAGE(i < count, "Too many tokens");
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(nix_token__name(expected[i]),
+                nix_token__name(tok.kind), "Unexpected token");
+        i++;
+    } while (tok.kind != NIX_TOKEN_EOF);
+
+    TEST_ASSERT_MESSAGE(i == count, "Too few tokens");
+
+    nix_lexer__free(&lex);
+    nix_buffer__free(&buf);
+    fclose(file);
+}
+
+void test_lexer_identifiers() {
+    enum nix_token_kind expected[] = {
+        NIX_TOKEN_KW_LET, NIX_TOKEN_ID, NIX_TOKEN_ASSIGN, NIX_TOKEN_ID,
+        NIX_TOKEN_SEMICOLON, NIX_TOKEN_KW_INHERIT, NIX_TOKEN_ID,
+        NIX_TOKEN_SEMICOLON, NIX_TOKEN_KW_IN, NIX_TOKEN_ID, NIX_TOKEN_EOF
+    };
+
+    assert_tokens("test_lexer_identifiers",
+            "let foo-bar' = letter;\n  inherit _x; in foo",
+            expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+void test_lexer_numbers() {
+    enum nix_token_kind expected[] = {
+        NIX_TOKEN_INT, NIX_TOKEN_INT, NIX_TOKEN_FLOAT, NIX_TOKEN_FLOAT,
+        NIX_TOKEN_FLOAT, NIX_TOKEN_MINUS, NIX_TOKEN_INT, NIX_TOKEN_EOF
+    };
+
+    assert_tokens("test_lexer_numbers", "0 123 1.5 .25e-3 2.e10 -7",
+            expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+void test_lexer_paths() {
+    enum nix_token_kind expected[] = {
+        NIX_TOKEN_PATH, NIX_TOKEN_PATH, NIX_TOKEN_PATH, NIX_TOKEN_HPATH,
+        NIX_TOKEN_SPATH, NIX_TOKEN_URI, NIX_TOKEN_ID, NIX_TOKEN_DIV,
+        NIX_TOKEN_ID, NIX_TOKEN_EOF
+    };
+
+    assert_tokens("test_lexer_paths",
+            "./foo.nix /etc/nixos ../a/b ~/x <nixpkgs/lib> "
+            "https://example.org/a?b=c a / b",
+            expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+void test_lexer_interpolated_paths() {
+    enum nix_token_kind expected[] = {
+        NIX_TOKEN_PATH_START, NIX_TOKEN_DOLLAR_CURLY, NIX_TOKEN_ID,
+        NIX_TOKEN_RBRACE, NIX_TOKEN_PATH_STR, NIX_TOKEN_DOLLAR_CURLY,
+        NIX_TOKEN_LBRACE, NIX_TOKEN_RBRACE, NIX_TOKEN_RBRACE,
+        NIX_TOKEN_PATH_END, NIX_TOKEN_SEMICOLON,
+        NIX_TOKEN_PATH_START, NIX_TOKEN_DOLLAR_CURLY, NIX_TOKEN_ID,
+        NIX_TOKEN_RBRACE, NIX_TOKEN_PATH_END, NIX_TOKEN_ERROR,
+        NIX_TOKEN_ERROR, NIX_TOKEN_ID, NIX_TOKEN_DIV,
+        NIX_TOKEN_DOLLAR_CURLY, NIX_TOKEN_RBRACE, NIX_TOKEN_EOF
+    };
+
+    assert_tokens("test_lexer_interpolated_paths",
+            "./a/${b}/c.nix${{}};~/${x} ./d/$ a / ${}",
+            expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+void test_lexer_trailing_slashes() {
+    // Nix rejects these, but a slash before an interpolation is fine
+    enum nix_token_kind expected[] = {
+        NIX_TOKEN_ERROR, NIX_TOKEN_ERROR, NIX_TOKEN_ERROR,
+        NIX_TOKEN_PATH_START, NIX_TOKEN_DOLLAR_CURLY, NIX_TOKEN_ID,
+        NIX_TOKEN_RBRACE, NIX_TOKEN_ERROR, NIX_TOKEN_PATH_END,
+        NIX_TOKEN_PATH_START, NIX_TOKEN_DOLLAR_CURLY, NIX_TOKEN_ID,
+        NIX_TOKEN_RBRACE, NIX_TOKEN_PATH_STR, NIX_TOKEN_DOLLAR_CURLY,
+        NIX_TOKEN_ID, NIX_TOKEN_RBRACE, NIX_TOKEN_PATH_END, NIX_TOKEN_EOF
+    };
+
+    assert_tokens("test_lexer_trailing_slashes",
+            "./foo/ ~/x/ a/b/ ./a/${b}/ ./a/${b}/${c}",
+            expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+void test_lexer_exhaust() {
+    FILE *file;
+    FILE_FROM_STRING(file, "test_lexer_exhaust",
+            (uint8_t *)"a abcdefghijklmnopqrstuvwxyz", 28);
+
+    struct nix_buffer *buf;
+    nix_buffer__construct(&buf, file, 8);
+
+    struct nix_lexer *lex;
+    nix_lexer__construct(&lex, buf);
+
+    struct nix_token tok;
+    nix_lexer__next(lex, &tok);
+    nix_lexer__next(lex, &tok);
+
+    // A token too long for the buffer is left unread rather than half taken
+    TEST_ASSERT_MESSAGE(nix_lexer__next(lex, &tok) == NIXERR_BUF_EXHAUST,
+            "Long identifier fit in the buffer");
+    TEST_ASSERT_MESSAGE(buf->read->abs == 2 && buf->peek->abs == 2,
+            "Part of the token was taken");
+
+    nix_lexer__free(&lex);
+    nix_buffer__free(&buf);
+    fclose(file);
+}
+
+void test_lexer_strings() {
+    enum nix_token_kind expected[] = {
+        NIX_TOKEN_STRING_OPEN, NIX_TOKEN_STR, NIX_TOKEN_DOLLAR_CURLY,
+        NIX_TOKEN_LBRACE, NIX_TOKEN_ID, NIX_TOKEN_ASSIGN,
+        NIX_TOKEN_STRING_OPEN, NIX_TOKEN_STRING_CLOSE, NIX_TOKEN_SEMICOLON,
+        NIX_TOKEN_RBRACE, NIX_TOKEN_DOT, NIX_TOKEN_ID, NIX_TOKEN_RBRACE,
+        NIX_TOKEN_STR, NIX_TOKEN_STRING_CLOSE, NIX_TOKEN_EOF
+    };
+
+    assert_tokens("test_lexer_strings",
+            "\"a \\\"$b ${ { x = \"\"; }.x } $x\"",
+            expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+void test_lexer_ind_strings() {
+    enum nix_token_kind expected[] = {
+        NIX_TOKEN_IND_STRING_OPEN, NIX_TOKEN_IND_STR,
+        NIX_TOKEN_DOLLAR_CURLY, NIX_TOKEN_ID, NIX_TOKEN_RBRACE,
+        NIX_TOKEN_IND_STR, NIX_TOKEN_IND_STRING_CLOSE, NIX_TOKEN_EOF
+    };
+
+    assert_tokens("test_lexer_ind_strings",
+            "''\n  a '''b ''${c} ''\\n ' $d\n  ${e} x\n''",
+            expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+void test_lexer_operators() {
+    enum nix_token_kind expected[] = {
+        NIX_TOKEN_LPAREN, NIX_TOKEN_ID, NIX_TOKEN_UPDATE, NIX_TOKEN_ID,
+        NIX_TOKEN_RPAREN, NIX_TOKEN_CONCAT, NIX_TOKEN_LBRACKET,
+        NIX_TOKEN_RBRACKET, NIX_TOKEN_EQ, NIX_TOKEN_NOT, NIX_TOKEN_ID,
+        NIX_TOKEN_AND, NIX_TOKEN_ID, NIX_TOKEN_IMPL, NIX_TOKEN_ID,
+        NIX_TOKEN_OR, NIX_TOKEN_ID, NIX_TOKEN_LEQ, NIX_TOKEN_ID,
+        NIX_TOKEN_NEQ, NIX_TOKEN_ID, NIX_TOKEN_QUESTION, NIX_TOKEN_ID,
+        NIX_TOKEN_ELLIPSIS, NIX_TOKEN_AT, NIX_TOKEN_COLON, NIX_TOKEN_MUL,
+        NIX_TOKEN_ERROR, NIX_TOKEN_EOF
+    };
+
+    assert_tokens("test_lexer_operators",
+            "(a // b) ++ [] == !c && d -> e || f <= g != h ? i ... @ : * ^"
+            " # comment\n/* block ** */",
+            expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+void test_lexer_positions() {
+    FILE *file;
+    FILE_FROM_STRING(file, "test_lexer_positions", (uint8_t *)"ab\n  cd", 7);
+
+    struct nix_buffer *buf;
+    nix_buffer__construct(&buf, file, 64);
+
+    struct nix_lexer *lex;
+    nix_lexer__construct(&lex, buf);
+
+    struct nix_token tok;
+    nix_lexer__next(lex, &tok);
+    nix_lexer__next(lex, &tok);
+    nix_lexer__next(lex, &tok);
+
+    TEST_ASSERT_MESSAGE(tok.kind == NIX_TOKEN_ID, "Expected an identifier");
+    TEST_ASSERT_MESSAGE(tok.start.abs == 5 && tok.end.abs == 7,
+            "Wrong token offsets");
+    TEST_ASSERT_MESSAGE(tok.start.row == 2, "Wrong token row");
+
+    struct nix_lexeme *lexeme;
+    nix_buffer__get_lexeme(buf, &lexeme, 0);
+    TEST_ASSERT_MESSAGE(lexeme->end->abs - lexeme->start->abs == 2 &&
+            lexeme->text[0] == 'c', "Token text is not the current lexeme");
+
+    nix_lexeme__free(&lexeme);
+    nix_lexer__free(&lex);
+    nix_buffer__free(&buf);
+    fclose(file);
+}
+
+void test_lexer_feed() {
+    const char *text = "let s = \"a ${b} c\"; p = ./x/y; in s.p or 1.5e3\n";
+    size_t length = strlen(text);
+
+    FILE *file;
+    FILE_FROM_STRING(file, "test_lexer_feed", (uint8_t *)text, length);
+
+    struct nix_buffer *buf, *plain;
+    nix_buffer__construct(&plain, file, 64);
+    nix_buffer__construct_feed(&buf, 64, 0);
+
+    struct nix_lexer *lex, *plain_lex;
+    nix_lexer__construct(&lex, buf);
+    nix_lexer__construct(&plain_lex, plain);
+
+    // Fed a few bytes at a time, tokens that run out are scanned again
+    size_t fed = 0;
+    struct nix_token tok, expected;
+
+    do {
+        enum nix_err err;
+        while ((err = nix_lexer__next(lex, &tok)) == NIXERR_BUF_WOULDBLOCK) {
+            size_t piece = 1 + rand() % 4;
+            if (piece > length - fed) {
+                piece = length - fed;
+            }
+
+            if (piece == 0) {
+                nix_buffer__finish(buf);
+            } else {
+                nix_buffer__feed(buf, (uint8_t *)text + fed, piece);
+                fed += piece;
+            }
+        }
+
+        TEST_ASSERT_MESSAGE(err == NIXERR_NONE, "Lexer returned an error");
+        nix_lexer__next(plain_lex, &expected);
+
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(nix_token__name(expected.kind),
+                nix_token__name(tok.kind), "Unexpected token");
+        TEST_ASSERT_MESSAGE(tok.start.abs == expected.start.abs &&
+                tok.end.abs == expected.end.abs, "Wrong token offsets");
+    } while (tok.kind != NIX_TOKEN_EOF);
+
+    nix_lexer__free(&lex);
+    nix_lexer__free(&plain_lex);
+    nix_buffer__free(&buf);
+    nix_buffer__free(&plain);
+    fclose(file);
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_lexer_identifiers);
+    RUN_TEST(test_lexer_numbers);
+    RUN_TEST(test_lexer_paths);
+    RUN_TEST(test_lexer_interpolated_paths);
+    RUN_TEST(test_lexer_trailing_slashes);
+    RUN_TEST(test_lexer_exhaust);
+    RUN_TEST(test_lexer_strings);
+    RUN_TEST(test_lexer_ind_strings);
+    RUN_TEST(test_lexer_operators);
+    RUN_TEST(test_lexer_positions);
+    RUN_TEST(test_lexer_feed);
+    return UNITY_END();
+}
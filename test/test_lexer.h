@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_lexer_h__
+#define INCLUDE_test_lexer_h__
+
+void test_lexer_identifiers();
+
+#endif
@@ -0,0 +1,334 @@
+#include <locale.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/number.h"
+#include "unity/src/unity.h"
+#include "test_number.h"
+
+static enum nix_err parse_int(const char *text, int64_t *out) {
+    return nix_number__parse_int(text, strlen(text), out);
+}
+
+static enum nix_err parse_float(const char *text, double *out) {
+    return nix_number__parse_float(text, strlen(text), out);
+}
+
+// The parsed float must have exactly the bits strtod gives
+static void assert_float(const char *text) {
+    double value = 0;
+    enum nix_err r = parse_float(text, &value);
+    double expected = strtod(text, NULL);
+
+    char message[128];
+    snprintf(message, sizeof(message), "Wrong value for %s", text);
+
+    TEST_ASSERT_MESSAGE(r == NIXERR_NONE, message);
+    TEST_ASSERT_MESSAGE(memcmp(&value, &expected, sizeof(double)) == 0,
+            message);
+}
+
+void test_number_int() {
+    int64_t value;
+
+    TEST_ASSERT_MESSAGE(parse_int("0", &value) == NIXERR_NONE && value == 0,
+            "Zero was not parsed");
+    TEST_ASSERT_MESSAGE(parse_int("1234567890123", &value) == NIXERR_NONE &&
+            value == 1234567890123LL, "Long integer was not parsed");
+    TEST_ASSERT_MESSAGE(parse_int("00000000000000000000042", &value) ==
+            NIXERR_NONE && value == 42, "Leading zeros were not skipped");
+    TEST_ASSERT_MESSAGE(parse_int("9223372036854775807", &value) ==
+            NIXERR_NONE && value == INT64_MAX, "Maximum was not parsed");
+    TEST_ASSERT_MESSAGE(parse_int("-9223372036854775808", &value) ==
+            NIXERR_NONE && value == INT64_MIN, "Minimum was not parsed");
+
+    TEST_ASSERT_MESSAGE(parse_int("9223372036854775808", &value) ==
+            NIXERR_NUM_RANGE, "Overflow was not detected");
+    TEST_ASSERT_MESSAGE(parse_int("18446744073709551617", &value) ==
+            NIXERR_NUM_RANGE, "Wrapping overflow was not detected");
+    TEST_ASSERT_MESSAGE(parse_int("12345678a", &value) == NIXERR_NUM_SYNTAX,
+            "Invalid digit was accepted");
+    TEST_ASSERT_MESSAGE(parse_int("1234567:", &value) == NIXERR_NUM_SYNTAX,
+            "Character after 9 was accepted");
+    TEST_ASSERT_MESSAGE(parse_int("123456789012345678901234x", &value) ==
+            NIXERR_NUM_SYNTAX && parse_int("-1234567890123456789012-",
+            &value) == NIXERR_NUM_SYNTAX,
+            "Long malformed number was reported as out of range");
+    TEST_ASSERT_MESSAGE(parse_int("", &value) == NIXERR_NUM_SYNTAX &&
+            parse_int("-", &value) == NIXERR_NUM_SYNTAX,
+            "Empty number was accepted");
+
+    // Every length, to cover each mix of whole words and leftover digits
+    char text[20];
+    for (int length = 1; length <= 18; length++) {
+        int64_t expected = 0;
+        for (int i = 0; i < length; i++) {
+            text[i] = '0' + rand() % 10;
+            expected = expected * 10 + (text[i] - '0');
+        }
+
+        text[length] = '\0';
+        TEST_ASSERT_MESSAGE(parse_int(text, &value) == NIXERR_NONE &&
+                value == expected, "Random integer was not parsed");
+    }
+}
+
+void test_number_float() {
+    double value;
+
+    TEST_ASSERT_MESSAGE(parse_float(".5", &value) == NIXERR_NONE &&
+            value == 0.5, "Leading dot was not parsed");
+    TEST_ASSERT_MESSAGE(parse_float("1e3", &value) == NIXERR_NONE &&
+            value == 1000, "Exponent without a dot was not parsed");
+    TEST_ASSERT_MESSAGE(parse_float("1.", &value) == NIXERR_NONE &&
+            value == 1, "Trailing dot was not parsed");
+    TEST_ASSERT_MESSAGE(parse_float("1.7976931348623159e308", &value) ==
+            NIXERR_NUM_RANGE, "Overflow was not detected");
+
+    TEST_ASSERT_MESSAGE(parse_float(".", &value) == NIXERR_NUM_SYNTAX,
+            "Lone dot was accepted");
+    TEST_ASSERT_MESSAGE(parse_float("1e", &value) == NIXERR_NUM_SYNTAX,
+            "Missing exponent was accepted");
+    TEST_ASSERT_MESSAGE(parse_float("1.5x", &value) == NIXERR_NUM_SYNTAX,
+            "Trailing garbage was accepted");
+
+    const char *cases[] = {
+        "0.1", "0.3", "1.5", "2.2250738585072011e-308",
+        "2.2250738585072014e-308", "4.9e-324", "2.4703282292062328e-324",
+        "1.7976931348623157e308", "9007199254740993", "9007199254740993.0",
+        "123456789012345678901234567890", "0.000000000000000000000000001",
+        "7.2057594037927933e16", "3.0000000000000000000000000000001",
+        "1e-400", "0e999", "1.00000000000000011102230246251565404236316680908203125",
+        "1.00000000000000011102230246251565404236316680908203124",
+        "1.00000000000000011102230246251565404236316680908203126"
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        assert_float(cases[i]);
+    }
+}
+
+void test_number_float_random() {
+    char text[64];
+
+    for (int n = 0; n < 100000; n++) {
+        int length = 0;
+
+        int digits = 1 + rand() % 22;
+        int dot = rand() % (digits + 1);
+        for (int i = 0; i < digits; i++) {
+            if (i == dot) {
+                text[length++] = '.';
+            }
+
+            text[length++] = '0' + rand() % 10;
+        }
+
+        if (rand() % 2) {
+            length += sprintf(text + length, "e%d", rand() % 660 - 340);
+        }
+
+        text[length] = '\0';
+
+        double expected = strtod(text, NULL);
+        if (expected > 1.7976931348623157e308) {
+            continue;
+        }
+
+        assert_float(text);
+    }
+}
+
+static void assert_json(double value, const char *expected) {
+    char text[NIX_NUMBER_FLOAT_SIZE];
+    size_t length = 0;
+
+    char message[128];
+    snprintf(message, sizeof(message), "Wrong JSON for %.17g", value);
+
+    TEST_ASSERT_MESSAGE(nix_number__format_float(value, NIX_FLOAT_FORMAT_JSON,
+            text, sizeof(text), &length) == NIXERR_NONE, message);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(expected, text, message);
+    TEST_ASSERT_MESSAGE(length == strlen(expected), message);
+}
+
+void test_number_format() {
+    assert_json(0.0, "0.0");
+    assert_json(-0.0, "-0.0");
+    assert_json(1.0, "1.0");
+    assert_json(-1.5, "-1.5");
+    assert_json(0.1, "0.1");
+    assert_json(0.3, "0.3");
+    assert_json(0.1 + 0.2, "0.30000000000000004");
+    assert_json(100.0, "100.0");
+    assert_json(123456.789, "123456.789");
+    assert_json(1e14, "100000000000000.0");
+    assert_json(123456789012345.0, "123456789012345.0");
+    assert_json(1e15, "1e+15");
+    assert_json(4e15, "4e+15");
+    assert_json(1e16, "1e+16");
+    assert_json(1.5e16, "1.5e+16");
+    assert_json(9007199254740993.0, "9.007199254740992e+15");
+    assert_json(0.0001, "0.0001");
+    assert_json(0.00001, "1e-05");
+    assert_json(1.25e-7, "1.25e-07");
+    assert_json(1e100, "1e+100");
+    assert_json(5e-324, "5e-324");
+    assert_json(2.2250738585072014e-308, "2.2250738585072014e-308");
+    assert_json(1.7976931348623157e308, "1.7976931348623157e+308");
+    assert_json(NAN, "null");
+    assert_json(-INFINITY, "null");
+
+    char text[NIX_NUMBER_FLOAT_SIZE];
+    size_t length = 0;
+
+    TEST_ASSERT_MESSAGE(nix_number__format_float(2.5,
+            NIX_FLOAT_FORMAT_TO_STRING, text, sizeof(text), &length) ==
+            NIXERR_NONE && strcmp(text, "2.500000") == 0 && length == 8,
+            "Wrong toString output");
+    TEST_ASSERT_MESSAGE(nix_number__format_float(-1.7976931348623157e308,
+            NIX_FLOAT_FORMAT_TO_STRING, text, sizeof(text), &length) ==
+            NIXERR_NONE && length == 317,
+            "Largest toString output did not fit");
+
+    TEST_ASSERT_MESSAGE(nix_number__format_float(0.5, NIX_FLOAT_FORMAT_JSON,
+            text, 3, NULL) == NIXERR_BUF_INVLEN,
+            "Short buffer was not detected");
+    TEST_ASSERT_MESSAGE(nix_number__format_float(0.5, NIX_FLOAT_FORMAT_JSON,
+            text, 4, NULL) == NIXERR_NONE && strcmp(text, "0.5") == 0,
+            "Exact buffer was not used");
+}
+
+// The shortest digits found the slow way: the fewest significant digits
+// printf can round to that still read back as the same double
+static int shortest_digits(double value, char *digits) {
+    char text[64];
+
+    for (int precision = 1; precision <= 17; precision++) {
+        snprintf(text, sizeof(text), "%.*e", precision - 1, value);
+        if (strtod(text, NULL) == value) {
+            int n = 0;
+            for (char *c = text; *c != 'e'; c++) {
+                if (*c >= '0' && *c <= '9') {
+                    digits[n++] = *c;
+                }
+            }
+
+            while (n > 1 && digits[n - 1] == '0') {
+                n--;
+            }
+
+            digits[n] = '\0';
+            return n;
+        }
+    }
+
+    return 0;
+}
+
+void test_number_format_random() {
+    char text[NIX_NUMBER_FLOAT_SIZE];
+    char expected[32];
+    char actual[32];
+
+    for (int n = 0; n < 200000; n++) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 4; i++) {
+            bits = (bits << 16) ^ (uint64_t)(rand() & 0xFFFF);
+        }
+
+        // Some whole numbers and subnormals, which take their own paths
+        if (n % 8 == 0) {
+            double whole = (double)(bits >> (11 + rand() % 53));
+            memcpy(&bits, &whole, sizeof(bits));
+        } else if (n % 8 == 1) {
+            bits &= ((uint64_t)1 << 52) - 1;
+        }
+
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (!isfinite(value) || value == 0) {
+            continue;
+        }
+
+        TEST_ASSERT_MESSAGE(nix_number__format_float(value,
+                NIX_FLOAT_FORMAT_JSON, text, sizeof(text), NULL) ==
+                NIXERR_NONE, "Random float was not formatted");
+
+        double parsed = strtod(text, NULL);
+        TEST_ASSERT_MESSAGE(memcmp(&parsed, &value, sizeof(double)) == 0,
+                "Formatted float did not round-trip");
+
+        // Compare the significant digits alone, whatever the notation
+        int count = 0;
+        bool leading = true;
+        for (char *c = text; *c != '\0' && *c != 'e'; c++) {
+            if (*c >= '1' && *c <= '9') {
+                leading = false;
+            }
+
+            if (*c >= '0' && *c <= '9' && !leading) {
+                actual[count++] = *c;
+            }
+        }
+
+        while (count > 1 && actual[count - 1] == '0') {
+            count--;
+        }
+
+        actual[count] = '\0';
+
+        shortest_digits(value, expected);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(expected, actual,
+                "Formatted float was not the shortest");
+    }
+}
+
+// A host program's locale mustn't change how numbers are read or written,
+// which only shows where one with a decimal comma is installed
+void test_number_locale() {
+    const char *names[] = {
+        "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8"
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (setlocale(LC_ALL, names[i]) == NULL) {
+            continue;
+        }
+
+        // Enough digits to fall back on the C library
+        double value;
+        TEST_ASSERT_MESSAGE(parse_float(
+                    "1.00000000000000011102230246251565404236316680908203125",
+                    &value) == NIXERR_NONE && value > 1,
+                "Fallback parse followed the locale");
+
+        char text[NIX_NUMBER_FLOAT_SIZE];
+        nix_number__format_float(1.5, NIX_FLOAT_FORMAT_TO_STRING, text,
+                sizeof(text), NULL);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE("1.500000", text,
+                "Formatting followed the locale");
+    }
+
+    setlocale(LC_ALL, "C");
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_number_int);
+    RUN_TEST(test_number_float);
+    RUN_TEST(test_number_float_random);
+    RUN_TEST(test_number_format);
+    RUN_TEST(test_number_format_random);
+    RUN_TEST(test_number_locale);
+    return UNITY_END();
+}
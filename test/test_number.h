@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_number_h__
+#define INCLUDE_test_number_h__
+
+void test_number_int();
+
+#endif
@@ -0,0 +1,337 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "libnix/ast.h"
+#include "libnix/buffer.h"
+#include "libnix/digest.h"
+#include "libnix/intern.h"
+#include "libnix/parse_cache.h"
+#include "libnix/parser.h"
+#include "src/parse_cache.h"
+#include "unity/src/unity.h"
+#include "test_parse_cache.h"
+
+static const char *SOURCE =
+    "{ pkgs, lib ? pkgs.lib, ... }@args:\n"
+    "let\n"
+    "  name = \"hello-${lib.version}\";\n"
+    "  xs = [ 1 2.5 ./a/b ];\n"
+    "in { inherit name; value = x: x.y or args; }\n";
+
+static struct nix_ast *parse(struct nix_intern *intern, const char *source) {
+    struct nix_ast *ast = NULL;
+
+    FILE *file = fmemopen((void *)source, strlen(source), "r");
+    TEST_ASSERT_MESSAGE(file != NULL, "Failed to open source");
+
+    struct nix_buffer *buf;
+    struct nix_parser *parser;
+    nix_buffer__construct(&buf, file, 64);
+    nix_parser__construct(&parser, buf, intern);
+
+    TEST_ASSERT_MESSAGE(nix_parser__parse(parser, &ast) == NIXERR_NONE,
+            "Failed to parse");
+
+    nix_parser__free(&parser);
+    nix_buffer__free(&buf);
+    fclose(file);
+
+    return ast;
+}
+
+static char *cache_directory(const char *name) {
+    char *directory = combine_path(test_path, (char *)name);
+    TEST_ASSERT_MESSAGE(directory != NULL, "Out of memory");
+
+    return directory;
+}
+
+void test_parse_cache_roundtrip() {
+    struct nix_intern *intern;
+    nix_intern__construct(&intern, 0);
+
+    // Make the tree's ids differ from the numbering the entry uses
+    uint32_t unused;
+    nix_intern__intern(intern, "unused", 6, &unused);
+
+    struct nix_ast *ast = parse(intern, SOURCE);
+
+    struct nix_digest key;
+    nix_digest__bytes(SOURCE, strlen(SOURCE), &key);
+
+    char *directory = cache_directory("parse_cache_roundtrip");
+    struct nix_parse_cache *cache;
+    TEST_ASSERT_MESSAGE(nix_parse_cache__construct(&cache, directory) ==
+            NIXERR_NONE, "Failed to create cache");
+
+    struct nix_cached_ast *entry = NULL;
+    struct nix_digest other;
+    nix_digest__bytes("other", 5, &other);
+    TEST_ASSERT_MESSAGE(nix_parse_cache__load(cache, &other, &entry) ==
+            NIXERR_CACHE_MISS, "Loaded a missing entry");
+
+    TEST_ASSERT_MESSAGE(nix_parse_cache__store(cache, &key, ast, intern) ==
+            NIXERR_NONE, "Failed to store");
+    TEST_ASSERT_MESSAGE(nix_parse_cache__load(cache, &key, &entry) ==
+            NIXERR_NONE, "Failed to load");
+
+    struct nix_ast *cached = &entry->ast;
+    TEST_ASSERT_MESSAGE(cached->count == ast->count &&
+            cached->list_count == ast->list_count &&
+            cached->text_size == ast->text_size &&
+            cached->root == ast->root, "Wrong tree size");
+    TEST_ASSERT_MESSAGE(memcmp(cached->lists, ast->lists,
+                sizeof(uint32_t) * ast->list_count) == 0, "Wrong lists");
+    TEST_ASSERT_MESSAGE(memcmp(cached->text, ast->text, ast->text_size) == 0,
+            "Wrong text");
+
+    // Nodes are the same but for symbols, which name the same text
+    for (uint32_t i = 0; i < ast->count; i++) {
+        struct nix_ast_node a = ast->nodes[i];
+        struct nix_ast_node b = cached->nodes[i];
+
+        bool symbol = a.kind == NIX_AST_ID || a.kind == NIX_AST_FORMAL ||
+            (a.kind == NIX_AST_LAMBDA && a.data[0] != NIX_INTERN_NONE);
+
+        if (symbol) {
+            const char *text_a, *text_b;
+            size_t length_a, length_b;
+
+            nix_intern__lookup(intern, a.data[0], &text_a, &length_a);
+            TEST_ASSERT_MESSAGE(nix_cached_ast__symbol(entry, b.data[0],
+                        &text_b, &length_b) == NIXERR_NONE, "Bad symbol");
+            TEST_ASSERT_MESSAGE(length_a == length_b &&
+                    memcmp(text_a, text_b, length_a) == 0,
+                    "Symbol names different text");
+
+            a.data[0] = b.data[0];
+        }
+
+        TEST_ASSERT_MESSAGE(memcmp(&a, &b, sizeof(a)) == 0,
+                "Node changed in the cache");
+    }
+
+    const char *text;
+    size_t length;
+    TEST_ASSERT_MESSAGE(nix_cached_ast__symbol(entry, entry->symbol_count,
+                &text, &length) == NIXERR_INTERN_INVID, "Accepted a bad id");
+
+    nix_cached_ast__free(&entry);
+
+    nix_parse_cache__free(&cache);
+    nix_ast__free(&ast);
+    nix_intern__free(&intern);
+    free(directory);
+}
+
+// Overwrite one word of the data of the first node of a kind in an entry
+static void corrupt_node(
+    const char *path,
+    enum nix_ast_kind kind,
+    size_t field,
+    uint32_t value)
+{
+    struct cache_header header;
+    FILE *file = fopen(path, "r+b");
+    TEST_ASSERT_MESSAGE(file != NULL, "Entry was not written");
+    fread(&header, sizeof(header), 1, file);
+
+    struct nix_ast_node node;
+    for (uint32_t i = 0; i < header.node_count; i++) {
+        long at = header.nodes + sizeof(node) * i;
+        fseek(file, at, SEEK_SET);
+        fread(&node, sizeof(node), 1, file);
+
+        if (node.kind == kind) {
+            node.data[field] = value;
+            fseek(file, at, SEEK_SET);
+            fwrite(&node, sizeof(node), 1, file);
+            fclose(file);
+            return;
+        }
+    }
+
+    fclose(file);
+    TEST_FAIL_MESSAGE("No node of the kind to corrupt");
+}
+
+void test_parse_cache_invalid() {
+    struct nix_intern *intern;
+    nix_intern__construct(&intern, 0);
+
+    struct nix_ast *ast = parse(intern, SOURCE);
+
+    struct nix_digest key;
+    nix_digest__bytes(SOURCE, strlen(SOURCE), &key);
+
+    char *directory = cache_directory("parse_cache_invalid");
+    struct nix_parse_cache *cache;
+    nix_parse_cache__construct(&cache, directory);
+    nix_parse_cache__store(cache, &key, ast, intern);
+
+    char hex[NIX_DIGEST_HEX_SIZE];
+    nix_digest__hex(&key, hex);
+
+    size_t size = strlen(directory) + NIX_DIGEST_HEX_SIZE + 8;
+    char *path = malloc(size);
+    snprintf(path, size, "%s/%s.ast", directory, hex);
+
+    // Entries can be read by other users the umask allows
+    mode_t mask = umask(0);
+    umask(mask);
+
+    struct stat st;
+    TEST_ASSERT_MESSAGE(stat(path, &st) == 0, "Entry was not written");
+    TEST_ASSERT_MESSAGE((st.st_mode & 0777) == (0644 & ~mask),
+            "Entry has the wrong mode");
+
+    // An entry from another version reads as a miss
+    FILE *file = fopen(path, "r+b");
+    TEST_ASSERT_MESSAGE(file != NULL, "Entry was not written");
+
+    uint32_t version = NIX_PARSE_CACHE_VERSION + 1;
+    fseek(file, 8, SEEK_SET);
+    fwrite(&version, sizeof(version), 1, file);
+    fclose(file);
+
+    struct nix_cached_ast *entry = NULL;
+    TEST_ASSERT_MESSAGE(nix_parse_cache__load(cache, &key, &entry) ==
+            NIXERR_CACHE_MISS, "Loaded an entry of another version");
+
+    // So does a truncated one, and storing again replaces it
+    nix_parse_cache__store(cache, &key, ast, intern);
+    TEST_ASSERT_MESSAGE(truncate(path, 100) == 0, "Failed to truncate");
+    TEST_ASSERT_MESSAGE(nix_parse_cache__load(cache, &key, &entry) ==
+            NIXERR_CACHE_MISS, "Loaded a truncated entry");
+
+    nix_parse_cache__store(cache, &key, ast, intern);
+    TEST_ASSERT_MESSAGE(nix_parse_cache__load(cache, &key, &entry) ==
+            NIXERR_NONE, "Failed to load a replaced entry");
+    nix_cached_ast__free(&entry);
+
+    // So does one whose symbols point past their text
+    struct cache_header header;
+    file = fopen(path, "r+b");
+    fread(&header, sizeof(header), 1, file);
+
+    uint32_t offset = UINT32_MAX;
+    fseek(file, header.symbols + sizeof(offset), SEEK_SET);
+    fwrite(&offset, sizeof(offset), 1, file);
+    fclose(file);
+
+    TEST_ASSERT_MESSAGE(nix_parse_cache__load(cache, &key, &entry) ==
+            NIXERR_CACHE_MISS, "Loaded an entry with bad symbols");
+
+    // And so does one whose nodes point outside the tree, or back up it
+    nix_parse_cache__store(cache, &key, ast, intern);
+    corrupt_node(path, NIX_AST_TEXT, 1, UINT32_MAX);
+    TEST_ASSERT_MESSAGE(nix_parse_cache__load(cache, &key, &entry) ==
+            NIXERR_CACHE_MISS, "Loaded an entry with bad text");
+
+    nix_parse_cache__store(cache, &key, ast, intern);
+    corrupt_node(path, NIX_AST_LIST, 0, ast->list_count);
+    TEST_ASSERT_MESSAGE(nix_parse_cache__load(cache, &key, &entry) ==
+            NIXERR_CACHE_MISS, "Loaded an entry with a bad list");
+
+    nix_parse_cache__store(cache, &key, ast, intern);
+    corrupt_node(path, NIX_AST_LAMBDA, 2, ast->root);
+    TEST_ASSERT_MESSAGE(nix_parse_cache__load(cache, &key, &entry) ==
+            NIXERR_CACHE_MISS, "Loaded an entry with a cycle");
+
+    nix_parse_cache__store(cache, &key, ast, intern);
+    corrupt_node(path, NIX_AST_SELECT, 0, ast->count);
+    TEST_ASSERT_MESSAGE(nix_parse_cache__load(cache, &key, &entry) ==
+            NIXERR_CACHE_MISS, "Loaded an entry with a bad child");
+
+    nix_cached_ast__free(&entry);
+    nix_parse_cache__free(&cache);
+    nix_ast__free(&ast);
+    nix_intern__free(&intern);
+    free(path);
+    free(directory);
+}
+
+struct writer {
+    struct nix_parse_cache *cache;
+    struct nix_digest key;
+    struct nix_ast *ast;
+    struct nix_intern *intern;
+    int failures;
+};
+
+static void *write_entries(void *arg) {
+    struct writer *w = arg;
+
+    for (int i = 0; i < 50; i++) {
+        if (nix_parse_cache__store(w->cache, &w->key, w->ast, w->intern) !=
+                NIXERR_NONE) {
+            w->failures++;
+        }
+
+        // Whatever a reader sees is a whole entry
+        struct nix_cached_ast *entry = NULL;
+        if (nix_parse_cache__load(w->cache, &w->key, &entry) != NIXERR_NONE ||
+                entry->ast.count != w->ast->count) {
+            w->failures++;
+        }
+
+        nix_cached_ast__free(&entry);
+    }
+
+    return NULL;
+}
+
+void test_parse_cache_concurrent() {
+    struct writer writers[4];
+    pthread_t threads[4];
+
+    char *directory = cache_directory("parse_cache_concurrent");
+    struct nix_parse_cache *cache;
+    nix_parse_cache__construct(&cache, directory);
+
+    struct nix_digest key;
+    nix_digest__bytes(SOURCE, strlen(SOURCE), &key);
+
+    for (size_t i = 0; i < 4; i++) {
+        writers[i].cache = cache;
+        writers[i].key = key;
+        writers[i].failures = 0;
+        nix_intern__construct(&writers[i].intern, 0);
+        writers[i].ast = parse(writers[i].intern, SOURCE);
+    }
+
+    for (size_t i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, write_entries, &writers[i]);
+    }
+
+    for (size_t i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT_MESSAGE(writers[i].failures == 0,
+                "A concurrent store or load failed");
+
+        nix_ast__free(&writers[i].ast);
+        nix_intern__free(&writers[i].intern);
+    }
+
+    nix_parse_cache__free(&cache);
+    free(directory);
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_cache_roundtrip);
+    RUN_TEST(test_parse_cache_invalid);
+    RUN_TEST(test_parse_cache_concurrent);
+    return UNITY_END();
+}
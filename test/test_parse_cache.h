@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_parse_cache_h__
+#define INCLUDE_test_parse_cache_h__
+
+void test_parse_cache_roundtrip();
+
+#endif
@@ -0,0 +1,448 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/ast.h"
+#include "libnix/buffer.h"
+#include "libnix/intern.h"
+#include "libnix/parser.h"
+#include "unity/src/unity.h"
+#include "test_parser.h"
+
+struct dump {
+    char text[1024];
+    size_t length;
+};
+
+static void append(struct dump *d, const char *text, size_t length) {
+    if (d->length + length < sizeof(d->text)) {
+        memcpy(d->text + d->length, text, length);
+        d->length += length;
+        d->text[d->length] = '\0';
+    }
+}
+
+static void append_str(struct dump *d, const char *text) {
+    append(d, text, strlen(text));
+}
+
+static void dump_node(
+    struct dump *d,
+    struct nix_ast *ast,
+    struct nix_intern *intern,
+    uint32_t index);
+
+static void dump_list(
+    struct dump *d,
+    struct nix_ast *ast,
+    struct nix_intern *intern,
+    uint32_t index,
+    const char *separator)
+{
+    uint32_t count;
+    const uint32_t *children = nix_ast__list(ast, index, &count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (i > 0) {
+            append_str(d, separator);
+        }
+
+        dump_node(d, ast, intern, children[i]);
+    }
+}
+
+static void dump_symbol(
+    struct dump *d,
+    struct nix_intern *intern,
+    uint32_t id)
+{
+    const char *text;
+    size_t length;
+
+    nix_intern__lookup(intern, id, &text, &length);
+    append(d, text, length);
+}
+
+// Write a node as an S-expression, to compare trees as strings
+static void dump_node(
+    struct dump *d,
+    struct nix_ast *ast,
+    struct nix_intern *intern,
+    uint32_t index)
+{
+    struct nix_ast_node *n = &ast->nodes[index];
+    char number[64];
+
+    switch (n->kind) {
+    case NIX_AST_INT:
+        snprintf(number, sizeof(number), "%lld",
+                (long long)nix_ast__int(ast, index));
+        append_str(d, number);
+        break;
+    case NIX_AST_FLOAT:
+        snprintf(number, sizeof(number), "%g", nix_ast__float(ast, index));
+        append_str(d, number);
+        break;
+    case NIX_AST_TEXT:
+        append_str(d, "'");
+        append(d, ast->text + n->data[0], n->data[1]);
+        append_str(d, "'");
+        break;
+    case NIX_AST_PATH:
+    case NIX_AST_HPATH:
+    case NIX_AST_SPATH:
+    case NIX_AST_URI:
+        append(d, ast->text + n->data[0], n->data[1]);
+        break;
+    case NIX_AST_ID:
+        dump_symbol(d, intern, n->data[0]);
+        break;
+    case NIX_AST_STRING:
+        append_str(d, n->flags & NIX_AST_FLAG_INDENTED ? "(istr " : "(str ");
+        dump_list(d, ast, intern, index, " ");
+        append_str(d, ")");
+        break;
+    case NIX_AST_PATH_INTERP:
+        append_str(d, n->flags & NIX_AST_FLAG_HOME ? "(hpath " : "(path ");
+        dump_list(d, ast, intern, index, " ");
+        append_str(d, ")");
+        break;
+    case NIX_AST_LIST:
+        append_str(d, "[");
+        dump_list(d, ast, intern, index, " ");
+        append_str(d, "]");
+        break;
+    case NIX_AST_ATTRSET:
+        append_str(d, n->flags & NIX_AST_FLAG_REC ? "(rec " :
+                n->flags & NIX_AST_FLAG_LET ? "(letset " : "(set ");
+        dump_list(d, ast, intern, index, " ");
+        append_str(d, ")");
+        break;
+    case NIX_AST_ATTRPATH:
+        dump_list(d, ast, intern, index, ".");
+        break;
+    case NIX_AST_DYNAMIC:
+        append_str(d, "${");
+        dump_node(d, ast, intern, n->data[0]);
+        append_str(d, "}");
+        break;
+    case NIX_AST_BINDING:
+        append_str(d, "(= ");
+        dump_node(d, ast, intern, n->data[0]);
+        append_str(d, " ");
+        dump_node(d, ast, intern, n->data[1]);
+        append_str(d, ")");
+        break;
+    case NIX_AST_INHERIT:
+        append_str(d, "(inherit ");
+        if (n->data[0] != NIX_AST_NONE) {
+            dump_node(d, ast, intern, n->data[0]);
+            append_str(d, " ");
+        }
+
+        dump_list(d, ast, intern, index, " ");
+        append_str(d, ")");
+        break;
+    case NIX_AST_SELECT:
+    case NIX_AST_HAS_ATTR:
+        append_str(d, n->kind == NIX_AST_SELECT ? "(. " : "(? ");
+        dump_node(d, ast, intern, n->data[0]);
+        append_str(d, " ");
+        dump_node(d, ast, intern, n->data[1]);
+        if (n->kind == NIX_AST_SELECT && n->data[2] != NIX_AST_NONE) {
+            append_str(d, " or ");
+            dump_node(d, ast, intern, n->data[2]);
+        }
+
+        append_str(d, ")");
+        break;
+    case NIX_AST_APPLY:
+        append_str(d, "(");
+        dump_node(d, ast, intern, n->data[0]);
+        append_str(d, " ");
+        dump_node(d, ast, intern, n->data[1]);
+        append_str(d, ")");
+        break;
+    case NIX_AST_UNARY:
+        append_str(d, n->op == NIX_TOKEN_NOT ? "(! " : "(neg ");
+        dump_node(d, ast, intern, n->data[0]);
+        append_str(d, ")");
+        break;
+    case NIX_AST_BINARY:
+        append_str(d, "(");
+        append_str(d, nix_token__name((enum nix_token_kind)n->op));
+        append_str(d, " ");
+        dump_node(d, ast, intern, n->data[0]);
+        append_str(d, " ");
+        dump_node(d, ast, intern, n->data[1]);
+        append_str(d, ")");
+        break;
+    case NIX_AST_IF:
+    case NIX_AST_LET:
+        append_str(d, n->kind == NIX_AST_IF ? "(if " : "(let ");
+        if (n->kind == NIX_AST_IF) {
+            dump_node(d, ast, intern, n->data[0]);
+            append_str(d, " ");
+            dump_node(d, ast, intern, n->data[1]);
+        } else {
+            dump_list(d, ast, intern, index, " ");
+        }
+
+        append_str(d, " ");
+        dump_node(d, ast, intern, n->data[2]);
+        append_str(d, ")");
+        break;
+    case NIX_AST_WITH:
+    case NIX_AST_ASSERT:
+        append_str(d, n->kind == NIX_AST_WITH ? "(with " : "(assert ");
+        dump_node(d, ast, intern, n->data[0]);
+        append_str(d, " ");
+        dump_node(d, ast, intern, n->data[1]);
+        append_str(d, ")");
+        break;
+    case NIX_AST_LAMBDA:
+        append_str(d, "(fn ");
+        if (n->data[0] != NIX_INTERN_NONE) {
+            dump_symbol(d, intern, n->data[0]);
+            append_str(d, " ");
+        }
+
+        if (n->data[1] != NIX_AST_NONE) {
+            dump_node(d, ast, intern, n->data[1]);
+            append_str(d, " ");
+        }
+
+        dump_node(d, ast, intern, n->data[2]);
+        append_str(d, ")");
+        break;
+    case NIX_AST_FORMALS:
+        append_str(d, "{");
+        dump_list(d, ast, intern, index, " ");
+        if (n->flags & NIX_AST_FLAG_ELLIPSIS) {
+            append_str(d, n->data[1] > 0 ? " ..." : "...");
+        }
+
+        append_str(d, "}");
+        break;
+    case NIX_AST_FORMAL:
+        dump_symbol(d, intern, n->data[0]);
+        if (n->data[1] != NIX_AST_NONE) {
+            append_str(d, "?");
+            dump_node(d, ast, intern, n->data[1]);
+        }
+
+        break;
+    }
+}
+
+struct parsed {
+    enum nix_err err;
+    struct nix_ast *ast;
+    struct nix_intern *intern;
+    struct nix_parser *parser;
+};
+
+static struct parsed parse(const char *source) {
+    struct parsed result = { NIXERR_NONE, NULL, NULL, NULL };
+
+    FILE *file = fmemopen((void *)source, strlen(source), "r");
+    TEST_ASSERT_MESSAGE(file != NULL, "Failed to open source");
+
+    struct nix_buffer *buf;
+    nix_buffer__construct(&buf, file, 64);
+    nix_intern__construct(&result.intern, 0);
+    nix_parser__construct(&result.parser, buf, result.intern);
+
+    result.err = nix_parser__parse(result.parser, &result.ast);
+
+    nix_buffer__free(&buf);
+    fclose(file);
+
+    return result;
+}
+
+static void release(struct parsed *result) {
+    nix_ast__free(&result->ast);
+    nix_parser__free(&result->parser);
+    nix_intern__free(&result->intern);
+}
+
+static void assert_parse(const char *source, const char *expected) {
+    struct parsed result = parse(source);
+
+    char message[256];
+    snprintf(message, sizeof(message), "Failed to parse %s", source);
+    TEST_ASSERT_MESSAGE(result.err == NIXERR_NONE, message);
+
+    struct dump d = { "", 0 };
+    dump_node(&d, result.ast, result.intern, result.ast->root);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(expected, d.text, source);
+
+    release(&result);
+}
+
+static void assert_error(
+    const char *source,
+    enum nix_err err,
+    enum nix_token_kind kind,
+    uint32_t start)
+{
+    struct parsed result = parse(source);
+
+    TEST_ASSERT_MESSAGE(result.err == err, source);
+    TEST_ASSERT_MESSAGE(result.ast == NULL, source);
+    TEST_ASSERT_MESSAGE(result.parser->error_kind == kind &&
+            result.parser->error_start == start, source);
+
+    release(&result);
+}
+
+void test_parser_operators() {
+    assert_parse("1 + 2 * 3", "(+ 1 (* 2 3))");
+    assert_parse("a - b - c", "(- (- a b) c)");
+    assert_parse("a ++ b ++ c", "(++ a (++ b c))");
+    assert_parse("a -> b -> c", "(-> a (-> b c))");
+    assert_parse("a // b // c", "(// a (// b c))");
+    assert_parse("a || b && c == d", "(|| a (&& b (== c d)))");
+    assert_parse("a < b == c", "(== (< a b) c)");
+    assert_parse("!a && b", "(&& (! a) b)");
+    assert_parse("!a + b", "(! (+ a b))");
+    assert_parse("-a ? b", "(? (neg a) b)");
+    assert_parse("- f x", "(neg (f x))");
+    assert_parse("f -1", "(- f 1)");
+    assert_parse("a ? b.c || d", "(|| (? a b.c) d)");
+    assert_parse("f x y", "((f x) y)");
+    assert_parse("f x.y or z", "(f (. x y or z))");
+    assert_parse("a.b.\"c\".${d}", "(. a b.(str 'c').${d})");
+    assert_parse("(a + b) * c", "(* (+ a b) c)");
+}
+
+void test_parser_expressions() {
+    assert_parse("x: y: x", "(fn x (fn y x))");
+    assert_parse("{ a, b ? 1, ... }@args: a",
+            "(fn args {a b?1 ...} a)");
+    assert_parse("args@{ a }: a", "(fn args {a} a)");
+    assert_parse("{ }: 1", "(fn {} 1)");
+    assert_parse("{ ... }: 1", "(fn {...} 1)");
+    assert_parse("{ }", "(set )");
+    assert_parse("{ } // { }", "(// (set ) (set ))");
+    assert_parse("let a = 1; inherit (x) b \"c\"; inherit d; in a",
+            "(let (= a 1) (inherit x b (str 'c')) (inherit d) a)");
+    assert_parse("rec { a.b = 1; ${x} = 2; \"s\" = 3; or = 4; }",
+            "(rec (= a.b 1) (= ${x} 2) (= (str 's') 3) (= or 4))");
+    assert_parse("let { body = 1; }", "(letset (= body 1))");
+    assert_parse("[ 1 (f x) \"s\" 2.5 ]", "[1 (f x) (str 's') 2.5]");
+    assert_parse("if a then b else c + 1", "(if a b (+ c 1))");
+    assert_parse("with a; assert b; c", "(with a (assert b c))");
+    assert_parse("./foo/bar <nixpkgs> ~/x",
+            "((./foo/bar <nixpkgs>) ~/x)");
+    assert_parse("9223372036854775807", "9223372036854775807");
+}
+
+void test_parser_strings() {
+    assert_parse("\"a${b}c\\n\"", "(str 'a' b 'c\n')");
+    assert_parse("\"\"", "(str )");
+    assert_parse("\"${a}${b}\"", "(str a b)");
+    assert_parse("''\n  x\n    ${y}\n  ''", "(istr 'x\n  ' y '\n')");
+    assert_parse("\"a${\"b${c}\"}\"", "(str 'a' (str 'b' c))");
+    assert_parse("''a''$b''", "(istr 'a$b')");
+}
+
+void test_parser_paths() {
+    assert_parse("./foo/${x}", "(path './foo/' x)");
+    assert_parse("a/${b}/c${d}.nix + e",
+            "(+ (path 'a/' b '/c' d '.nix') e)");
+    assert_parse("~/${x}", "(hpath '~/' x)");
+    assert_parse("[ /a${\"b\"}/c ./d ]", "[(path '/a' (str 'b') '/c') ./d]");
+    assert_parse("f ./${x} y", "((f (path './' x)) y)");
+    assert_error("./a/${x}$", NIXERR_PARSE_SYNTAX, NIX_TOKEN_ERROR, 8);
+
+    // Nix rejects a path with a trailing slash
+    assert_error("./foo/", NIXERR_PARSE_SYNTAX, NIX_TOKEN_ERROR, 0);
+    assert_error("~/x/", NIXERR_PARSE_SYNTAX, NIX_TOKEN_ERROR, 0);
+    assert_error("./a/${b}/", NIXERR_PARSE_SYNTAX, NIX_TOKEN_ERROR, 8);
+}
+
+void test_parser_errors() {
+    assert_error("1 + ;", NIXERR_PARSE_SYNTAX, NIX_TOKEN_SEMICOLON, 4);
+    assert_error("a == b == c", NIXERR_PARSE_SYNTAX, NIX_TOKEN_EQ, 7);
+    assert_error("1 + if a then b else c", NIXERR_PARSE_SYNTAX,
+            NIX_TOKEN_KW_IF, 4);
+    assert_error("{ a = 1; ", NIXERR_PARSE_SYNTAX, NIX_TOKEN_EOF, 9);
+    assert_error("", NIXERR_PARSE_SYNTAX, NIX_TOKEN_EOF, 0);
+    assert_error("a b )", NIXERR_PARSE_SYNTAX, NIX_TOKEN_RPAREN, 4);
+    assert_error("x + 99999999999999999999", NIXERR_NUM_RANGE,
+            NIX_TOKEN_INT, 4);
+
+    // Nesting past the limit fails cleanly instead of overflowing the stack
+    size_t depth = 5000;
+    char *source = malloc(2 * depth + 2);
+    memset(source, '(', depth);
+    source[depth] = '1';
+    memset(source + depth + 1, ')', depth);
+    source[2 * depth + 1] = '\0';
+
+    struct parsed result = parse(source);
+    TEST_ASSERT_MESSAGE(result.err == NIXERR_PARSE_DEPTH,
+            "Deep nesting was not limited");
+
+    release(&result);
+    free(source);
+}
+
+void test_parser_layout() {
+    struct parsed result = parse("let\n  x = [ 1 2 3 ];\nin x");
+    TEST_ASSERT_MESSAGE(result.err == NIXERR_NONE, "Failed to parse");
+
+    struct nix_ast *ast = result.ast;
+    struct nix_ast_node *root = &ast->nodes[ast->root];
+
+    TEST_ASSERT_MESSAGE(root->kind == NIX_AST_LET && root->start == 0 &&
+            root->end == 25, "Wrong root node");
+
+    // Every child comes before its parent, so the tree is built bottom-up
+    for (uint32_t i = 0; i < ast->count; i++) {
+        uint32_t count;
+        struct nix_ast_node *n = &ast->nodes[i];
+
+        if (n->kind == NIX_AST_LIST || n->kind == NIX_AST_LET) {
+            const uint32_t *children = nix_ast__list(ast, i, &count);
+            for (uint32_t j = 0; j < count; j++) {
+                TEST_ASSERT_MESSAGE(children[j] < i,
+                        "Child was stored after its parent");
+            }
+        }
+    }
+
+    struct nix_ast_node *list = NULL;
+    for (uint32_t i = 0; i < ast->count; i++) {
+        if (ast->nodes[i].kind == NIX_AST_LIST) {
+            list = &ast->nodes[i];
+        }
+    }
+
+    TEST_ASSERT_MESSAGE(list != NULL && list->data[1] == 3 &&
+            list->start == 10 && list->end == 19, "Wrong list node");
+    TEST_ASSERT_MESSAGE(sizeof(struct nix_ast_node) == 24,
+            "Nodes are not compact");
+
+    release(&result);
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_parser_operators);
+    RUN_TEST(test_parser_expressions);
+    RUN_TEST(test_parser_strings);
+    RUN_TEST(test_parser_paths);
+    RUN_TEST(test_parser_errors);
+    RUN_TEST(test_parser_layout);
+    return UNITY_END();
+}
@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_parser_h__
+#define INCLUDE_test_parser_h__
+
+void test_parser_operators();
+
+#endif
@@ -0,0 +1,202 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "libnix/pool.h"
+#include "src/pool.h"
+#include "unity/src/unity.h"
+#include "test_pool.h"
+
+static void count(void *arg) {
+    atomic_fetch_add((atomic_size_t *)arg, 1);
+}
+
+void test_pool_submit() {
+    struct nix_pool *pool;
+    TEST_ASSERT_MESSAGE(nix_pool__construct(&pool, 4, 0) == NIXERR_NONE,
+            "Failed to create pool");
+    TEST_ASSERT_EQUAL_UINT(4, pool->threads);
+
+    struct nix_wait_group *group;
+    nix_wait_group__construct(&group, pool);
+
+    atomic_size_t counter;
+    atomic_init(&counter, 0);
+
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 10000; i++) {
+            TEST_ASSERT_MESSAGE(nix_pool__submit(pool, group, count,
+                        &counter) == NIXERR_NONE, "Failed to submit");
+        }
+
+        nix_wait_group__wait(group);
+        TEST_ASSERT_EQUAL_UINT((round + 1) * 10000, atomic_load(&counter));
+    }
+
+    // Waiting on a group with nothing in it returns at once
+    nix_wait_group__wait(group);
+
+    nix_wait_group__free(&group);
+    nix_pool__free(&pool);
+}
+
+struct tree {
+    struct nix_pool *pool;
+    struct nix_wait_group *group;
+    atomic_size_t leaves;
+    atomic_size_t nodes;
+};
+
+struct branch {
+    struct tree *tree;
+    int depth;
+};
+
+// Each job submits its children from inside the pool, so they go onto its
+// worker's own deque and are stolen from there
+static void grow(void *arg) {
+    struct branch *branch = arg;
+    struct tree *tree = branch->tree;
+
+    atomic_fetch_add(&tree->nodes, 1);
+
+    if (branch->depth == 0) {
+        atomic_fetch_add(&tree->leaves, 1);
+        free(branch);
+        return;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        struct branch *child = malloc(sizeof(struct branch));
+        child->tree = tree;
+        child->depth = branch->depth - 1;
+        nix_pool__submit(tree->pool, tree->group, grow, child);
+    }
+
+    free(branch);
+}
+
+void test_pool_nested() {
+    struct tree tree;
+    nix_pool__construct(&tree.pool, 0, 0);
+    nix_wait_group__construct(&tree.group, tree.pool);
+    atomic_init(&tree.leaves, 0);
+    atomic_init(&tree.nodes, 0);
+
+    struct branch *root = malloc(sizeof(struct branch));
+    root->tree = &tree;
+    root->depth = 7;
+    nix_pool__submit(tree.pool, tree.group, grow, root);
+
+    nix_wait_group__wait(tree.group);
+
+    // 4^7 leaves, with their jobs spread over every worker's deque
+    TEST_ASSERT_EQUAL_UINT(16384, atomic_load(&tree.leaves));
+    TEST_ASSERT_EQUAL_UINT(21845, atomic_load(&tree.nodes));
+
+    nix_wait_group__free(&tree.group);
+    nix_pool__free(&tree.pool);
+}
+
+struct burst {
+    struct nix_pool *pool;
+    struct nix_wait_group *group;
+    atomic_size_t counter;
+    atomic_bool submitted;
+};
+
+static void submit_burst(void *arg) {
+    struct burst *burst = arg;
+
+    for (int i = 0; i < 1000; i++) {
+        nix_pool__submit(burst->pool, burst->group, count, &burst->counter);
+    }
+
+    atomic_store(&burst->submitted, true);
+}
+
+void test_pool_deque_grow() {
+    struct burst burst;
+    nix_pool__construct(&burst.pool, 1, 0);
+    nix_wait_group__construct(&burst.group, burst.pool);
+    atomic_init(&burst.counter, 0);
+    atomic_init(&burst.submitted, false);
+
+    nix_pool__submit(burst.pool, burst.group, submit_burst, &burst);
+
+    // Nothing steals from the only worker's deque while its job is still
+    // submitting, so every child is on it at once
+    while (!atomic_load(&burst.submitted)) {}
+
+    struct pool *pool = (struct pool *)burst.pool;
+    TEST_ASSERT_MESSAGE(atomic_load(&pool->workers[0].deque.array)->size >
+            POOL_INITIAL_DEQUE, "Deque didn't grow");
+
+    nix_wait_group__wait(burst.group);
+    TEST_ASSERT_EQUAL_UINT(1000, atomic_load(&burst.counter));
+
+    nix_wait_group__free(&burst.group);
+    nix_pool__free(&burst.pool);
+}
+
+struct file_job {
+    struct nix_pool *pool;
+    atomic_size_t *counter;
+};
+
+// A job waiting on jobs of its own helps run them rather than blocking
+static void fan_out(void *arg) {
+    struct file_job *job = arg;
+
+    struct nix_wait_group *group;
+    nix_wait_group__construct(&group, job->pool);
+
+    for (int i = 0; i < 100; i++) {
+        nix_pool__submit(job->pool, group, count, job->counter);
+    }
+
+    nix_wait_group__wait(group);
+    nix_wait_group__free(&group);
+}
+
+void test_pool_wait_inside() {
+    struct nix_pool *pool;
+    nix_pool__construct(&pool, 2, NIX_POOL_PIN);
+
+    struct nix_wait_group *group;
+    nix_wait_group__construct(&group, pool);
+
+    atomic_size_t counter;
+    atomic_init(&counter, 0);
+
+    struct file_job jobs[50];
+    for (int i = 0; i < 50; i++) {
+        jobs[i].pool = pool;
+        jobs[i].counter = &counter;
+        nix_pool__submit(pool, group, fan_out, &jobs[i]);
+    }
+
+    nix_wait_group__wait(group);
+    TEST_ASSERT_EQUAL_UINT(5000, atomic_load(&counter));
+
+    // Jobs still queued when the pool is freed are run first
+    for (int i = 0; i < 1000; i++) {
+        nix_pool__submit(pool, NULL, count, &counter);
+    }
+
+    nix_wait_group__free(&group);
+    nix_pool__free(&pool);
+    TEST_ASSERT_EQUAL_UINT(6000, atomic_load(&counter));
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_pool_submit);
+    RUN_TEST(test_pool_nested);
+    RUN_TEST(test_pool_deque_grow);
+    RUN_TEST(test_pool_wait_inside);
+    return UNITY_END();
+}
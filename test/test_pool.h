@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_pool_h__
+#define INCLUDE_test_pool_h__
+
+void test_pool_submit();
+
+#endif
@@ -0,0 +1,227 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/source_cache.h"
+#include "unity/src/unity.h"
+#include "test_source_cache.h"
+
+static char *write_file(const char *name, const char *data) {
+    char *path = combine_path(test_path, (char *)name);
+    TEST_ASSERT_MESSAGE(path != NULL, "Out of memory");
+
+    FILE *file = fopen(path, "wb");
+    TEST_ASSERT_MESSAGE(file != NULL, "Failed to write file");
+
+    fwrite(data, 1, strlen(data), file);
+    fclose(file);
+
+    return path;
+}
+
+// Write a new file and move it over the old one, as editors do
+static void replace_file(const char *path, const char *data) {
+    char *temp = write_file("source_cache_replacement", data);
+    TEST_ASSERT_MESSAGE(rename(temp, path) == 0, "Failed to replace file");
+
+    free(temp);
+}
+
+static void assert_view(const struct nix_source_view *view, const char *data) {
+    TEST_ASSERT_MESSAGE(view->size == strlen(data), "Wrong size");
+    TEST_ASSERT_MESSAGE(memcmp(view->data, data, view->size) == 0,
+            "Wrong contents");
+}
+
+void test_source_cache_hits() {
+    const char *data = "{ lib, ... }: lib.id\n";
+    char *path = write_file("source_cache_hits", data);
+    char *empty = write_file("source_cache_empty", "");
+
+    struct nix_source_cache *cache;
+    nix_source_cache__construct(&cache, 1 << 20);
+
+    const struct nix_source_view *first, *second, *view;
+    TEST_ASSERT_MESSAGE(nix_source_cache__open(cache, path, &first) ==
+            NIXERR_NONE, "Failed to open");
+    TEST_ASSERT_MESSAGE(nix_source_cache__open(cache, path, &second) ==
+            NIXERR_NONE, "Failed to open again");
+
+    // The second open shares the first one's contents
+    TEST_ASSERT_MESSAGE(first == second, "File was loaded twice");
+    TEST_ASSERT_MESSAGE(cache->hits == 1 && cache->count == 1,
+            "Wrong cache counts");
+    TEST_ASSERT_EQUAL_STRING(path, first->path);
+    assert_view(first, data);
+
+    nix_source_view__release(&first);
+    nix_source_view__release(&second);
+    TEST_ASSERT_MESSAGE(second == NULL, "Released view not cleared");
+
+    TEST_ASSERT_MESSAGE(nix_source_cache__open(cache, empty, &view) ==
+            NIXERR_NONE, "Failed to open an empty file");
+    TEST_ASSERT_MESSAGE(view->size == 0 && view->data != NULL,
+            "Wrong empty view");
+    nix_source_view__release(&view);
+
+    TEST_ASSERT_MESSAGE(nix_source_cache__open(cache, "/nonexistent/file",
+                &view) == NIXERR_BUF_FILE, "Opened a missing file");
+
+    nix_source_cache__free(&cache);
+    free(path);
+    free(empty);
+}
+
+void test_source_cache_changed() {
+    const char *before = "let x = 1; in x\n";
+    const char *after = "let x = 2; y = 3; in x + y\n";
+    char *path = write_file("source_cache_changed", before);
+
+    struct nix_source_cache *cache;
+    nix_source_cache__construct(&cache, 1 << 20);
+
+    const struct nix_source_view *old, *view;
+    nix_source_cache__open(cache, path, &old);
+    replace_file(path, after);
+
+    // A changed file is loaded again, while the old view stays readable
+    nix_source_cache__open(cache, path, &view);
+    TEST_ASSERT_MESSAGE(view != old, "Stale view was given");
+    assert_view(view, after);
+    assert_view(old, before);
+    TEST_ASSERT_MESSAGE(cache->count == 1 && cache->hits == 0,
+            "Wrong cache counts");
+    TEST_ASSERT_MESSAGE(cache->size == strlen(after), "Wrong cache size");
+
+    nix_source_view__release(&old);
+    nix_source_view__release(&view);
+
+    nix_source_cache__free(&cache);
+    free(path);
+}
+
+void test_source_cache_budget() {
+    char data[61];
+    memset(data, 'a', 60);
+    data[60] = '\0';
+
+    char *a = write_file("source_cache_budget_a", data);
+    char *b = write_file("source_cache_budget_b", data);
+    char *c = write_file("source_cache_budget_c", data);
+
+    struct nix_source_cache *cache;
+    nix_source_cache__construct(&cache, 130);
+
+    const struct nix_source_view *va, *vb, *vc;
+    nix_source_cache__open(cache, a, &va);
+    nix_source_cache__open(cache, b, &vb);
+    nix_source_view__release(&va);
+    nix_source_view__release(&vb);
+
+    // Touching a makes b the least recently used
+    nix_source_cache__open(cache, a, &va);
+    nix_source_view__release(&va);
+    nix_source_cache__open(cache, c, &vc);
+    nix_source_view__release(&vc);
+
+    TEST_ASSERT_MESSAGE(cache->count == 2 && cache->size == 120,
+            "Cache exceeded its budget");
+
+    nix_source_cache__open(cache, a, &va);
+    TEST_ASSERT_MESSAGE(cache->hits == 2, "Recently used file was dropped");
+
+    // Files in use stay however far over budget that goes
+    nix_source_cache__open(cache, b, &vb);
+    nix_source_cache__open(cache, c, &vc);
+    TEST_ASSERT_MESSAGE(cache->count == 3, "A file in use was dropped");
+
+    nix_source_view__release(&va);
+    nix_source_view__release(&vb);
+    nix_source_view__release(&vc);
+    TEST_ASSERT_MESSAGE(cache->size <= 130, "Released files kept over budget");
+
+    nix_source_cache__free(&cache);
+    free(a);
+    free(b);
+    free(c);
+}
+
+struct reader {
+    struct nix_source_cache *cache;
+    char **paths;
+    const char *data;
+    int failures;
+};
+
+static void *read_files(void *arg) {
+    struct reader *r = arg;
+
+    for (int i = 0; i < 500; i++) {
+        const struct nix_source_view *view;
+        if (nix_source_cache__open(r->cache, r->paths[rand() % 3], &view) !=
+                NIXERR_NONE) {
+            r->failures++;
+            continue;
+        }
+
+        if (view->size != strlen(r->data) ||
+                memcmp(view->data, r->data, view->size) != 0) {
+            r->failures++;
+        }
+
+        nix_source_view__release(&view);
+    }
+
+    return NULL;
+}
+
+void test_source_cache_concurrent() {
+    const char *data = "with import <nixpkgs> {}; hello\n";
+    char *paths[3] = {
+        write_file("source_cache_concurrent_a", data),
+        write_file("source_cache_concurrent_b", data),
+        write_file("source_cache_concurrent_c", data)
+    };
+
+    // Room for two of the three, so files are dropped as they're shared
+    struct nix_source_cache *cache;
+    nix_source_cache__construct(&cache, strlen(data) * 2);
+
+    struct reader readers[4];
+    pthread_t threads[4];
+
+    for (size_t i = 0; i < 4; i++) {
+        readers[i].cache = cache;
+        readers[i].paths = paths;
+        readers[i].data = data;
+        readers[i].failures = 0;
+        pthread_create(&threads[i], NULL, read_files, &readers[i]);
+    }
+
+    for (size_t i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT_MESSAGE(readers[i].failures == 0,
+                "A concurrent read failed");
+    }
+
+    nix_source_cache__free(&cache);
+    for (size_t i = 0; i < 3; i++) {
+        free(paths[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_source_cache_hits);
+    RUN_TEST(test_source_cache_changed);
+    RUN_TEST(test_source_cache_budget);
+    RUN_TEST(test_source_cache_concurrent);
+    return UNITY_END();
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/buffer.h"
+#include "libnix/lexeme.h"
+#include "libnix/lexer.h"
+#include "libnix/source_map.h"
+#include "unity/src/unity.h"
+#include "test_source_map.h"
+
+static void assert_location(
+    struct nix_source_map *map,
+    uint32_t address,
+    size_t file,
+    size_t row,
+    size_t col)
+{
+    struct nix_source_location loc;
+    TEST_ASSERT_MESSAGE(nix_source_map__resolve(map, address, &loc) ==
+            NIXERR_NONE, "Failed to resolve");
+
+    TEST_ASSERT_EQUAL_UINT(file, loc.file);
+    TEST_ASSERT_EQUAL_UINT(row, loc.row);
+    TEST_ASSERT_EQUAL_UINT(col, loc.col);
+}
+
+void test_source_map_resolve() {
+    const char *first = "let\n  x = \"\xc3\xa9t\xc3\xa9\";\r\nin\rx";
+    const char *second = "\xEF\xBB\xBF{ }\n";
+
+    struct nix_source_map *map;
+    nix_source_map__construct(&map);
+
+    uint32_t a, b, c;
+    TEST_ASSERT_MESSAGE(nix_source_map__add(map, "a.nix", first,
+                strlen(first), &a) == NIXERR_NONE, "Failed to add");
+    nix_source_map__add(map, "b.nix", second, strlen(second), &b);
+    nix_source_map__add(map, "empty.nix", "", 0, &c);
+
+    // Counted in code points, with room for the end of each file
+    TEST_ASSERT_EQUAL_UINT32(0, a);
+    TEST_ASSERT_EQUAL_UINT32(23, b);
+    TEST_ASSERT_EQUAL_UINT32(28, c);
+    TEST_ASSERT_EQUAL_UINT32(29, map->size);
+    TEST_ASSERT_EQUAL_UINT(3, map->file_count);
+
+    assert_location(map, a + 0, 0, 1, 1);
+    assert_location(map, a + 3, 0, 1, 4);
+    assert_location(map, a + 4, 0, 2, 1);
+    assert_location(map, a + 13, 0, 2, 10);
+    assert_location(map, a + 16, 0, 2, 13);
+    assert_location(map, a + 17, 0, 2, 14);
+    assert_location(map, a + 18, 0, 3, 1);
+    assert_location(map, a + 21, 0, 4, 1);
+    assert_location(map, a + 22, 0, 4, 2);
+
+    // The byte-order mark isn't counted
+    assert_location(map, b + 0, 1, 1, 1);
+    assert_location(map, b + 4, 1, 2, 1);
+    assert_location(map, c, 2, 1, 1);
+
+    struct nix_source_location loc;
+    nix_source_map__resolve(map, b + 2, &loc);
+    TEST_ASSERT_EQUAL_STRING("b.nix", loc.name);
+
+    TEST_ASSERT_MESSAGE(nix_source_map__resolve(map, 29, &loc) ==
+            NIXERR_MAP_INVADDR, "Resolved past the last file");
+
+    nix_source_map__free(&map);
+}
+
+void test_source_map_lexemes() {
+    const char *source = "{\n  a = b;\n  c = \"d\";\n}\n";
+
+    struct nix_source_map *map;
+    nix_source_map__construct(&map);
+
+    uint32_t padding, base;
+    nix_source_map__add(map, "padding.nix", "x\ny\n", 4, &padding);
+    nix_source_map__add(map, "lexemes.nix", source, strlen(source), &base);
+
+    FILE *file = fmemopen((void *)source, strlen(source), "r");
+
+    struct nix_buffer *buf;
+    struct nix_lexer *lexer;
+    nix_buffer__construct(&buf, file, 64);
+    nix_lexer__construct(&lexer, buf);
+
+    // Spans of lexemes resolve to the rows the lexer saw them on
+    struct nix_token tok;
+    size_t seen = 0;
+    while (nix_lexer__next(lexer, &tok) == NIXERR_NONE &&
+            tok.kind != NIX_TOKEN_EOF) {
+        struct nix_lexeme lexeme = { &tok.start, &tok.end, NULL };
+        struct nix_span span;
+        nix_span__from_lexeme(base, &lexeme, &span);
+
+        TEST_ASSERT_EQUAL_UINT32(tok.end.abs - tok.start.abs, span.length);
+
+        struct nix_source_location loc;
+        nix_source_map__resolve(map, span.start, &loc);
+        TEST_ASSERT_EQUAL_UINT(1, loc.file);
+        TEST_ASSERT_EQUAL_UINT(tok.start.row, loc.row);
+
+        seen++;
+    }
+
+    TEST_ASSERT_MESSAGE(seen > 10, "Too few tokens");
+    TEST_ASSERT_EQUAL_UINT(8, sizeof(struct nix_span));
+
+    nix_lexer__free(&lexer);
+    nix_buffer__free(&buf);
+    fclose(file);
+    nix_source_map__free(&map);
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_source_map_resolve);
+    RUN_TEST(test_source_map_lexemes);
+    return UNITY_END();
+}
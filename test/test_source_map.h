@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_source_map_h__
+#define INCLUDE_test_source_map_h__
+
+void test_source_map_resolve();
+
+#endif
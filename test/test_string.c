@@ -0,0 +1,374 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/buffer.h"
+#include "libnix/lexer.h"
+#include "libnix/string.h"
+#include "unity/src/unity.h"
+#include "test_string.h"
+
+#define MAX_PARTS 8
+
+// Split text at each '@', which stands for an interpolation, and decode it
+static void decode(
+    enum nix_string_kind kind,
+    const char *text,
+    char *out,
+    size_t size,
+    char *joined)
+{
+    struct nix_string_part parts[MAX_PARTS];
+    size_t count = 0;
+
+    const char *p = text;
+    for (;;) {
+        const char *at = strchr(p, '@');
+        parts[count].text = p;
+        parts[count].length = at != NULL ? (size_t)(at - p) : strlen(p);
+        count++;
+
+        if (at == NULL) {
+            break;
+        }
+
+        p = at + 1;
+    }
+
+    TEST_ASSERT_MESSAGE(nix_string__decode(kind, parts, count, out, size) ==
+            NIXERR_NONE, "String was not decoded");
+
+    // Join the parts back up with '@' to compare them all at once
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            joined[n++] = '@';
+        }
+
+        memcpy(joined + n, parts[i].decoded, parts[i].decoded_length);
+        n += parts[i].decoded_length;
+    }
+
+    joined[n] = '\0';
+}
+
+static void assert_decoded(
+    enum nix_string_kind kind,
+    const char *text,
+    const char *expected)
+{
+    char out[256];
+    char joined[256];
+
+    decode(kind, text, out, sizeof(out), joined);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(expected, joined, text);
+}
+
+void test_string_normal() {
+    assert_decoded(NIX_STRING_NORMAL, "plain text", "plain text");
+    assert_decoded(NIX_STRING_NORMAL, "a\\nb\\tc\\rd", "a\nb\tc\rd");
+    assert_decoded(NIX_STRING_NORMAL, "\\\\ \\\" \\$ \\x", "\\ \" $ x");
+    assert_decoded(NIX_STRING_NORMAL, "a\r\nb\rc", "a\nb\nc");
+    assert_decoded(NIX_STRING_NORMAL, "$${x} $$", "$${x} $$");
+    assert_decoded(NIX_STRING_NORMAL, "x = @; y = \\q!", "x = @; y = q!");
+
+    // Long enough for the scan to go a block at a time
+    assert_decoded(NIX_STRING_NORMAL,
+            "0123456789abcdef0123456789\\nabcdef0123456789abcdef\\t",
+            "0123456789abcdef0123456789\nabcdef0123456789abcdef\t");
+}
+
+void test_string_indented() {
+    assert_decoded(NIX_STRING_INDENTED, "  a\n    b\n  c\n", "a\n  b\nc\n");
+    assert_decoded(NIX_STRING_INDENTED, "  a\n\n    b\n", "a\n\n  b\n");
+    assert_decoded(NIX_STRING_INDENTED, "  a\n    b\n  ", "a\n  b\n");
+    assert_decoded(NIX_STRING_INDENTED, "  a\n b", " a\nb");
+    assert_decoded(NIX_STRING_INDENTED, "    \n  a\n", "  \na\n");
+    assert_decoded(NIX_STRING_INDENTED, "\ta\n  b", "\ta\n  b");
+
+    assert_decoded(NIX_STRING_INDENTED, "  ''$ ''' ''\\t ''\\x",
+            "$ '' \t x");
+
+    // An escaped line break starts a new line, as far as dropping the
+    // indentation goes
+    assert_decoded(NIX_STRING_INDENTED, "  a''\\n  b", "a\nb");
+    assert_decoded(NIX_STRING_INDENTED, "  it's\n  a'b", "it's\na'b");
+    assert_decoded(NIX_STRING_INDENTED, "    a\n  ''$\n", "  a\n$\n");
+
+    // Interpolations count as content, and after one the final line stays
+    assert_decoded(NIX_STRING_INDENTED, "    a\n  @\n    b\n",
+            "  a\n@\n  b\n");
+    assert_decoded(NIX_STRING_INDENTED, "  a\n  @  ", "a\n@  ");
+    assert_decoded(NIX_STRING_INDENTED, "  a\n  ''$  ", "a\n$  ");
+    assert_decoded(NIX_STRING_INDENTED, "  a\n  @", "a\n@");
+    assert_decoded(NIX_STRING_INDENTED, "      ", "");
+}
+
+void test_string_in_place() {
+    char text[] = "    one\\n\n      two ''$\n    @ three\n    ";
+    size_t length = strlen(text);
+    char *at = strchr(text, '@');
+
+    struct nix_string_part parts[2] = {
+        { text, (size_t)(at - text), NULL, 0 },
+        { at + 1, length - (size_t)(at + 1 - text), NULL, 0 }
+    };
+
+    TEST_ASSERT_MESSAGE(nix_string__decode(NIX_STRING_INDENTED, parts, 2,
+            text, length) == NIXERR_NONE, "String was not decoded in place");
+    TEST_ASSERT_MESSAGE(parts[0].decoded == text, "Wrong first part");
+    TEST_ASSERT_MESSAGE(parts[0].decoded_length == 14 &&
+            memcmp(parts[0].decoded, "one\\n\n  two $\n", 14) == 0,
+            "Wrong first part text");
+    TEST_ASSERT_MESSAGE(parts[1].decoded_length == 7 &&
+            memcmp(parts[1].decoded, " three\n", 7) == 0,
+            "Wrong second part text");
+
+    char out[4];
+    struct nix_string_part part = { "abcdef", 6, NULL, 0 };
+    TEST_ASSERT_MESSAGE(nix_string__decode(NIX_STRING_NORMAL, &part, 1,
+            out, sizeof(out)) == NIXERR_BUF_INVLEN,
+            "Short output was not detected");
+}
+
+void test_string_lexemes() {
+    FILE *file;
+    const char *source = "''\n  h\xC3\xA9llo\n  ''\\t${x}!\n''";
+    FILE_FROM_STRING(file, "test_string_lexemes", (uint8_t *)source,
+            strlen(source));
+
+    struct nix_buffer *buf;
+    nix_buffer__construct(&buf, file, 64);
+
+    struct nix_lexer *lex;
+    nix_lexer__construct(&lex, buf);
+
+    // Collect the text parts, with a NULL part for the empty one that would
+    // sit between an interpolation and the closing quotes
+    struct nix_lexeme *lexemes[MAX_PARTS] = { NULL };
+    size_t count = 0;
+
+    struct nix_token tok;
+    bool after_interpolation = false;
+    do {
+        nix_lexer__next(lex, &tok);
+
+        if (tok.kind == NIX_TOKEN_IND_STR) {
+            nix_buffer__get_lexeme(buf, &lexemes[count], 0);
+            count++;
+            after_interpolation = false;
+        } else if (tok.kind == NIX_TOKEN_RBRACE) {
+            if (!after_interpolation && count == 0) {
+                count++;
+            }
+
+            after_interpolation = true;
+        } else if (tok.kind == NIX_TOKEN_DOLLAR_CURLY) {
+            after_interpolation = false;
+        }
+    } while (tok.kind != NIX_TOKEN_EOF && tok.kind != NIX_TOKEN_ERROR);
+
+    TEST_ASSERT_MESSAGE(count == 2, "Expected two string parts");
+
+    char out[64];
+    struct nix_string_part parts[MAX_PARTS];
+    TEST_ASSERT_MESSAGE(nix_string__decode_lexemes(NIX_STRING_INDENTED,
+            lexemes, parts, count, out, sizeof(out)) == NIXERR_NONE,
+            "Lexemes were not decoded");
+
+    TEST_ASSERT_MESSAGE(parts[0].decoded_length == 8 &&
+            memcmp(parts[0].decoded, "h\xC3\xA9llo\n\t", 8) == 0,
+            "Wrong first lexeme text");
+    TEST_ASSERT_MESSAGE(parts[1].decoded_length == 2 &&
+            memcmp(parts[1].decoded, "!\n", 2) == 0,
+            "Wrong second lexeme text");
+
+    for (size_t i = 0; i < count; i++) {
+        nix_lexeme__free(&lexemes[i]);
+    }
+
+    nix_lexer__free(&lex);
+    nix_buffer__free(&buf);
+    fclose(file);
+}
+
+// Nix's own two passes over an indented string, where each escape is an
+// element of its own, for comparing against
+static void reference_indented(const char *text, char *out) {
+    char elements[64][64];
+    bool plain[64];
+    size_t count = 0;
+
+    const char *p = text;
+    while (*p != '\0') {
+        size_t n = 0;
+
+        if (*p == '@') {
+            elements[count][0] = '\0';
+            plain[count++] = false;
+            p++;
+            continue;
+        }
+
+        if (p[0] == '\'' && p[1] == '\'') {
+            if (p[2] == '\\') {
+                char c = p[3] == 'n' ? '\n' : p[3] == 't' ? '\t' : p[3];
+                elements[count][n++] = c;
+                p += 4;
+            } else {
+                elements[count][n++] = p[2];
+                if (p[2] == '\'') {
+                    elements[count][n++] = '\'';
+                }
+
+                p += 3;
+            }
+
+            elements[count][n] = '\0';
+            plain[count++] = false;
+            continue;
+        }
+
+        while (*p != '\0' && *p != '@' && !(p[0] == '\'' && p[1] == '\'')) {
+            elements[count][n++] = *p++;
+        }
+
+        elements[count][n] = '\0';
+        plain[count++] = true;
+    }
+
+    bool at_start = true;
+    size_t min_indent = 1000000;
+    size_t current = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!plain[i]) {
+            if (at_start) {
+                at_start = false;
+                min_indent = current < min_indent ? current : min_indent;
+            }
+
+            continue;
+        }
+
+        for (char *c = elements[i]; *c != '\0'; c++) {
+            if (at_start) {
+                if (*c == ' ') {
+                    current++;
+                } else if (*c == '\n') {
+                    current = 0;
+                } else {
+                    at_start = false;
+                    min_indent = current < min_indent ? current : min_indent;
+                }
+            } else if (*c == '\n') {
+                at_start = true;
+                current = 0;
+            }
+        }
+    }
+
+    size_t dropped = 0;
+    size_t n = 0;
+    at_start = true;
+
+    for (size_t i = 0; i < count; i++) {
+        bool interpolation = !plain[i] && elements[i][0] == '\0';
+        if (interpolation) {
+            at_start = false;
+            dropped = 0;
+            out[n++] = '@';
+            continue;
+        }
+
+        size_t start = n;
+        for (char *c = elements[i]; *c != '\0'; c++) {
+            if (at_start) {
+                if (*c == ' ') {
+                    if (dropped++ >= min_indent) {
+                        out[n++] = *c;
+                    }
+                } else if (*c == '\n') {
+                    dropped = 0;
+                    out[n++] = *c;
+                } else {
+                    at_start = false;
+                    dropped = 0;
+                    out[n++] = *c;
+                }
+            } else {
+                out[n++] = *c;
+                if (*c == '\n') {
+                    at_start = true;
+                }
+            }
+        }
+
+        // Drop a last line of only spaces
+        if (i == count - 1) {
+            size_t last = n;
+            while (last > start && out[last - 1] == ' ') {
+                last--;
+            }
+
+            if (last > start && out[last - 1] == '\n') {
+                n = last;
+            }
+        }
+    }
+
+    out[n] = '\0';
+}
+
+void test_string_indented_random() {
+    static const char *pieces[] = {
+        " ", " ", " ", "  ", "\n", "\n", "a", "b c", "\t", "'a", "''$",
+        "'''", "''\\n", "''\\ ", "''\\t", "@"
+    };
+
+    char text[128];
+    char expected[256];
+    char out[256];
+    char joined[256];
+
+    for (int n = 0; n < 20000; n++) {
+        size_t length = 0;
+        int interpolations = 0;
+
+        int count = rand() % 24;
+        for (int i = 0; i < count; i++) {
+            const char *piece = pieces[rand() % (sizeof(pieces) /
+                sizeof(pieces[0]))];
+
+            if (piece[0] == '@' && ++interpolations >= MAX_PARTS) {
+                continue;
+            }
+
+            strcpy(text + length, piece);
+            length += strlen(piece);
+        }
+
+        text[length] = '\0';
+
+        reference_indented(text, expected);
+        decode(NIX_STRING_INDENTED, text, out, sizeof(out), joined);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(expected, joined, text);
+    }
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_string_normal);
+    RUN_TEST(test_string_indented);
+    RUN_TEST(test_string_in_place);
+    RUN_TEST(test_string_lexemes);
+    RUN_TEST(test_string_indented_random);
+    return UNITY_END();
+}
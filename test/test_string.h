@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_string_h__
+#define INCLUDE_test_string_h__
+
+void test_string_normal();
+
+#endif
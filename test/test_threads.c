@@ -0,0 +1,184 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/buffer.h"
+#include "libnix/lexer.h"
+#include "unity/src/unity.h"
+#include "test_threads.h"
+
+#define THREADS 8
+#define ROUNDS 2000
+#define TRACE_SIZE 256
+
+// Each script runs the library into a different mix of errors, and records
+// what it was told in a trace that has to come out the same every time
+typedef size_t (*script)(uint32_t *trace);
+
+static char LONG_TEXT[65];
+
+static const char *SOURCE =
+    "{ a = \"x${toString 1.5e3}\"; b = ./p/q; c = [ 1 2 ]; # done\n"
+    "  d = ''\n    ${e} ''\\n\n  ''; f = a: a.b or c; }\n";
+
+static size_t __trace(uint32_t *trace, size_t n, uint32_t value) {
+    if (n < TRACE_SIZE) {
+        trace[n] = value;
+    }
+
+    return n + 1;
+}
+
+// Reading more than fits gives NIXERR_BUF_EXHAUST over and over
+static size_t exhaust(uint32_t *trace) {
+    size_t n = 0;
+
+    FILE *file = fmemopen(LONG_TEXT, strlen(LONG_TEXT), "r");
+    struct nix_buffer *buf;
+    nix_buffer__construct(&buf, file, 4);
+
+    for (int i = 0; i < 24; i++) {
+        uint32_t c;
+        n = __trace(trace, n, nix_buffer__read(buf, &c));
+    }
+
+    nix_buffer__free(&buf);
+    fclose(file);
+
+    return n;
+}
+
+// Reading past the end gives the end of file errors
+static size_t past_end(uint32_t *trace) {
+    size_t n = 0;
+
+    FILE *file = fmemopen("ab", 2, "r");
+    struct nix_buffer *buf;
+    nix_buffer__construct(&buf, file, 4);
+
+    for (int i = 0; i < 24; i++) {
+        uint32_t c;
+        n = __trace(trace, n, nix_buffer__read(buf, &c));
+        n = __trace(trace, n, nix_buffer__peek(buf, &c));
+    }
+
+    nix_buffer__free(&buf);
+    fclose(file);
+
+    return n;
+}
+
+// Lexing goes through most of the library's error paths along the way
+static size_t lex(uint32_t *trace) {
+    size_t n = 0;
+
+    FILE *file = fmemopen((void *)SOURCE, strlen(SOURCE), "r");
+    struct nix_buffer *buf;
+    struct nix_lexer *lexer;
+    nix_buffer__construct(&buf, file, 16);
+    nix_lexer__construct(&lexer, buf);
+
+    struct nix_token tok;
+    enum nix_err r;
+    do {
+        r = nix_lexer__next(lexer, &tok);
+        n = __trace(trace, n, r);
+        n = __trace(trace, n, tok.kind);
+        n = __trace(trace, n, tok.end.abs);
+    } while (r == NIXERR_NONE && tok.kind != NIX_TOKEN_EOF);
+
+    nix_lexer__free(&lexer);
+    nix_buffer__free(&buf);
+    fclose(file);
+
+    return n;
+}
+
+static const script SCRIPTS[] = { exhaust, past_end, lex };
+#define SCRIPT_COUNT (sizeof(SCRIPTS) / sizeof(SCRIPTS[0]))
+
+struct expected {
+    uint32_t trace[TRACE_SIZE];
+    size_t length;
+};
+
+struct worker {
+    const struct expected *expected;
+    size_t first;
+    int failures;
+};
+
+static void *run_scripts(void *arg) {
+    struct worker *w = arg;
+    uint32_t trace[TRACE_SIZE];
+
+    // Neighbouring workers run different scripts at the same time
+    for (size_t round = 0; round < ROUNDS; round++) {
+        size_t i = (w->first + round) % SCRIPT_COUNT;
+        size_t length = SCRIPTS[i](trace);
+
+        if (length != w->expected[i].length || memcmp(trace,
+                    w->expected[i].trace, sizeof(uint32_t) *
+                    (length < TRACE_SIZE ? length : TRACE_SIZE)) != 0) {
+            w->failures++;
+        }
+    }
+
+    return NULL;
+}
+
+void test_threads_errors() {
+    memset(LONG_TEXT, 'a', sizeof(LONG_TEXT) - 1);
+
+    struct expected expected[SCRIPT_COUNT];
+    for (size_t i = 0; i < SCRIPT_COUNT; i++) {
+        expected[i].length = SCRIPTS[i](expected[i].trace);
+    }
+
+    // Make sure the scripts do meet the errors they're meant to
+    bool exhausted = false, ended = false;
+    for (size_t i = 0; i < expected[0].length; i++) {
+        exhausted |= expected[0].trace[i] == NIXERR_BUF_EXHAUST;
+    }
+
+    for (size_t i = 0; i < expected[1].length; i++) {
+        ended |= expected[1].trace[i] == NIXERR_BUF_EOF;
+    }
+
+    TEST_ASSERT_MESSAGE(exhausted, "Buffer was never exhausted");
+    TEST_ASSERT_MESSAGE(ended, "End of file was never reached");
+
+    struct worker workers[THREADS];
+    pthread_t threads[THREADS];
+
+    for (size_t i = 0; i < THREADS; i++) {
+        workers[i].expected = expected;
+        workers[i].first = i;
+        workers[i].failures = 0;
+        pthread_create(&threads[i], NULL, run_scripts, &workers[i]);
+    }
+
+    int failures = 0;
+    for (size_t i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        failures += workers[i].failures;
+    }
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, failures,
+            "Threads saw each other's errors");
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_threads_errors);
+    return UNITY_END();
+}
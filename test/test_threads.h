@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_threads_h__
+#define INCLUDE_test_threads_h__
+
+void test_threads_errors();
+
+#endif
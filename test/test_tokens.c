@@ -0,0 +1,365 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "libnix/intern.h"
+#include "libnix/lexer.h"
+#include "libnix/tokens.h"
+#include "unity/src/unity.h"
+#include "test_tokens.h"
+
+static const char *snippets[] = {
+    "let a = 1; in a\n",
+    "  s = \"multi\nline ${x} \\\" string\n\";\n",
+    "''\n  indented /* not a comment\n  ${ { a = 1; }.a } ''${x}\n''\n",
+    "/* block\ncomment */ b = c // { d = e; };\n",
+    "# comment \xC3\xA9\n",
+    "x = ./path/to ~/home <nixpkgs> https://a.b/c 1.5e3;\n",
+    "f = { a ? 1, ... }@args: a ++ [ \"\xE2\x82\xAC\" ];\n"
+};
+
+static void append(char *out, size_t *length, const char *text) {
+    size_t n = strlen(text);
+    memcpy(out + *length, text, n);
+    *length += n;
+}
+
+// Check that both tables hold the same tokens with the same symbol text
+static void assert_same_tables(
+    struct nix_token_table *a,
+    struct nix_intern *a_intern,
+    struct nix_token_table *b,
+    struct nix_intern *b_intern)
+{
+    TEST_ASSERT_EQUAL_MESSAGE(a->count, b->count, "Token counts differ");
+
+    for (size_t i = 0; i < a->count; i++) {
+        TEST_ASSERT_MESSAGE(a->kinds[i] == b->kinds[i], "Token kinds differ");
+        TEST_ASSERT_MESSAGE(a->starts[i] == b->starts[i],
+                "Token starts differ");
+        TEST_ASSERT_MESSAGE(a->lengths[i] == b->lengths[i],
+                "Token lengths differ");
+        TEST_ASSERT_MESSAGE(a->flags[i] == b->flags[i], "Token flags differ");
+
+        if (a->ids[i] == NIX_INTERN_NONE) {
+            TEST_ASSERT_MESSAGE(b->ids[i] == NIX_INTERN_NONE,
+                    "Token ids differ");
+            continue;
+        }
+
+        const char *a_text, *b_text;
+        nix_intern__lookup(a_intern, a->ids[i], &a_text, NULL);
+        nix_intern__lookup(b_intern, b->ids[i], &b_text, NULL);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(a_text, b_text,
+                "Token symbols differ");
+    }
+}
+
+// Tokenize the text on one and several threads and compare the results
+static void assert_parallel_matches(char *name, char *text, size_t length) {
+    FILE *file;
+    FILE_FROM_STRING(file, name, (uint8_t *)text, length);
+
+    struct nix_intern *seq_intern, *par_intern;
+    nix_intern__construct(&seq_intern, 0);
+    nix_intern__construct(&par_intern, NIX_INTERN_CONCURRENT);
+
+    struct nix_token_table *seq, *par;
+    enum nix_err r = nix_tokenize_file(&seq, file, seq_intern, 1);
+    TEST_ASSERT_MESSAGE(r == NIXERR_NONE, "Sequential tokenizing failed");
+
+    rewind(file);
+    r = nix_tokenize_file(&par, file, par_intern, 4);
+    TEST_ASSERT_MESSAGE(r == NIXERR_NONE, "Parallel tokenizing failed");
+
+    assert_same_tables(seq, seq_intern, par, par_intern);
+
+    nix_token_table__free(&seq);
+    nix_token_table__free(&par);
+    nix_intern__free(&seq_intern);
+    nix_intern__free(&par_intern);
+    fclose(file);
+}
+
+static struct nix_token_table *tokenize_text(
+    char *text,
+    size_t length,
+    struct nix_intern *intern)
+{
+    FILE *file = fmemopen(text, length, "r");
+    TEST_ASSERT_MESSAGE(file != NULL, "Failed to open text");
+
+    struct nix_token_table *t;
+    enum nix_err r = nix_tokenize_file(&t, file, intern, 1);
+    TEST_ASSERT_MESSAGE(r == NIXERR_NONE, "Tokenizing failed");
+
+    fclose(file);
+    return t;
+}
+
+void test_tokens_sequential() {
+    char *text = "let x = \"\xC3\xA9${y}\"; in x";
+
+    FILE *file;
+    FILE_FROM_STRING(file, "test_tokens_sequential", (uint8_t *)text,
+            strlen(text));
+
+    struct nix_intern *in;
+    nix_intern__construct(&in, 0);
+
+    struct nix_token_table *t;
+    enum nix_err r = nix_tokenize_file(&t, file, in, 1);
+    TEST_ASSERT_MESSAGE(r == NIXERR_NONE, "Tokenizing failed");
+
+    uint8_t kinds[] = {
+        NIX_TOKEN_KW_LET, NIX_TOKEN_WHITESPACE, NIX_TOKEN_ID,
+        NIX_TOKEN_WHITESPACE, NIX_TOKEN_ASSIGN, NIX_TOKEN_WHITESPACE,
+        NIX_TOKEN_STRING_OPEN, NIX_TOKEN_STR, NIX_TOKEN_DOLLAR_CURLY,
+        NIX_TOKEN_ID, NIX_TOKEN_RBRACE, NIX_TOKEN_STRING_CLOSE,
+        NIX_TOKEN_SEMICOLON, NIX_TOKEN_WHITESPACE, NIX_TOKEN_KW_IN,
+        NIX_TOKEN_WHITESPACE, NIX_TOKEN_ID
+    };
+
+    TEST_ASSERT_EQUAL_MESSAGE(sizeof(kinds), t->count, "Wrong token count");
+    TEST_ASSERT_EQUAL_UINT8_ARRAY_MESSAGE(kinds, t->kinds, sizeof(kinds),
+            "Wrong token kinds");
+
+    // Offsets count code points, so the two-byte character is one
+    TEST_ASSERT_MESSAGE(t->starts[7] == 9 && t->lengths[7] == 1,
+            "Wrong string fragment span");
+    TEST_ASSERT_MESSAGE(t->starts[16] == 20 && t->lengths[16] == 1,
+            "Wrong final token span");
+
+    TEST_ASSERT_MESSAGE(t->ids[2] == t->ids[16], "Same names got new ids");
+    TEST_ASSERT_MESSAGE(t->ids[0] == NIX_INTERN_NONE,
+            "Keyword was interned");
+
+    TEST_ASSERT_MESSAGE((t->flags[7] & NIX_TOKEN_FLAG_CLEAN) == 0,
+            "String content marked clean");
+    TEST_ASSERT_MESSAGE((t->flags[12] & NIX_TOKEN_FLAG_CLEAN) != 0,
+            "Code after a string not marked clean");
+
+    nix_token_table__free(&t);
+    nix_intern__free(&in);
+    fclose(file);
+}
+
+void test_tokens_parallel_random() {
+    size_t capacity = 600000;
+    char *text = malloc(capacity);
+    size_t length = 0;
+
+    size_t count = sizeof(snippets) / sizeof(snippets[0]);
+    while (length < capacity - 100) {
+        append(text, &length, snippets[rand() % count]);
+    }
+
+    assert_parallel_matches("test_tokens_parallel_random", text, length);
+    free(text);
+}
+
+void test_tokens_parallel_resync() {
+    // A long string covers some of the split points, so the pieces lexed
+    // from there as code have to be lexed again
+    size_t capacity = 600000;
+    char *text = malloc(capacity);
+    size_t length = 0;
+
+    append(text, &length, "\xEF\xBB\xBF");
+    while (length < 100000) {
+        append(text, &length, snippets[0]);
+    }
+
+    append(text, &length, "''\n");
+    while (length < 300000) {
+        append(text, &length, "  { \"a /* b\n");
+    }
+
+    append(text, &length, "''\n");
+    while (length < 480000) {
+        append(text, &length, snippets[3]);
+    }
+
+    assert_parallel_matches("test_tokens_parallel_resync", text, length);
+    free(text);
+}
+
+void test_tokens_long_comments() {
+    // Comments longer than the lexing buffer, lexed whole when the file is
+    // split and in pieces when it isn't
+    size_t length = 0;
+    char *text = malloc(300000);
+
+    append(text, &length, "a = 1; #");
+    memset(text + length, 'x', 100000);
+    length += 100000;
+
+    append(text, &length, "\n/*");
+    for (size_t i = 0; i < 100000; i++) {
+        text[length++] = i % 3 == 0 ? '*' : 'y';
+    }
+
+    append(text, &length, "*/ b\n");
+    for (size_t i = 0; i < 2000; i++) {
+        append(text, &length, snippets[0]);
+    }
+
+    assert_parallel_matches("test_tokens_long_comments", text, length);
+
+    struct nix_token_table *t = tokenize_text(text, length, NULL);
+    TEST_ASSERT_MESSAGE(t->kinds[7] == NIX_TOKEN_COMMENT &&
+            t->lengths[7] == 100001, "Line comment wasn't one token");
+    TEST_ASSERT_MESSAGE(t->kinds[9] == NIX_TOKEN_COMMENT &&
+            t->lengths[9] == 100004, "Block comment wasn't one token");
+    TEST_ASSERT_MESSAGE(t->kinds[10] == NIX_TOKEN_WHITESPACE &&
+            t->kinds[11] == NIX_TOKEN_ID, "Wrong tokens after the comments");
+
+    nix_token_table__free(&t);
+    free(text);
+}
+
+void test_tokens_relex_random() {
+    static const char *fragments[] = {
+        "", " ", "\n", "\"", "''", "${", "}", "{", "/*", "*/", "#", "a",
+        "let", ".", "/", "1", "\xC3\xA9", "\\", "$", "'", "x.y/z", "<"
+    };
+
+    size_t capacity = 8192;
+    char *text = malloc(capacity);
+    char *next = malloc(capacity);
+    size_t length = 0;
+
+    size_t count = sizeof(snippets) / sizeof(snippets[0]);
+    while (length < 2048) {
+        append(text, &length, snippets[rand() % count]);
+    }
+
+    struct nix_intern *in;
+    nix_intern__construct(&in, 0);
+
+    struct nix_token_table *t = tokenize_text(text, length, in);
+
+    for (int i = 0; i < 500 && length < capacity - 64; i++) {
+        // Pick a code point boundary and the code points to replace
+        size_t offset = rand() % (length + 1);
+        while (offset < length && ((uint8_t)text[offset] & 0xC0) == 0x80) {
+            offset++;
+        }
+
+        size_t end = offset;
+        for (int n = rand() % 4; n > 0 && end < length; n--) {
+            do {
+                end++;
+            } while (end < length && ((uint8_t)text[end] & 0xC0) == 0x80);
+        }
+
+        const char *fragment = fragments[rand() %
+            (sizeof(fragments) / sizeof(fragments[0]))];
+
+        struct nix_token_edit edit = {
+            .offset = offset,
+            .text = fragment,
+            .length = strlen(fragment)
+        };
+
+        for (size_t k = 0; k < offset; k++) {
+            edit.start += ((uint8_t)text[k] & 0xC0) != 0x80;
+        }
+
+        edit.end = edit.start;
+        for (size_t k = offset; k < end; k++) {
+            edit.end += ((uint8_t)text[k] & 0xC0) != 0x80;
+        }
+
+        size_t next_length = 0;
+        memcpy(next, text, offset);
+        next_length += offset;
+        append(next, &next_length, fragment);
+        memcpy(next + next_length, text + end, length - end);
+        next_length += length - end;
+
+        struct nix_token_diff diff;
+        enum nix_err r = nix_token_table__relex(t, in, next, next_length,
+                &edit, &diff);
+        TEST_ASSERT_MESSAGE(r == NIXERR_NONE, "Relexing failed");
+
+        struct nix_token_table *expected = tokenize_text(next, next_length,
+                in);
+        assert_same_tables(expected, in, t, in);
+        nix_token_table__free(&expected);
+
+        char *swap = text;
+        text = next;
+        next = swap;
+        length = next_length;
+    }
+
+    nix_token_table__free(&t);
+    nix_intern__free(&in);
+    free(text);
+    free(next);
+}
+
+void test_tokens_relex_local() {
+    size_t capacity = 200000;
+    char *text = malloc(capacity);
+    size_t length = 0;
+
+    while (length < capacity - 100) {
+        append(text, &length, snippets[3]);
+    }
+
+    struct nix_token_table *t = tokenize_text(text, length, NULL);
+    size_t count = t->count;
+
+    // Rename an identifier in the middle of the file
+    size_t offset = length / 2;
+    while (text[offset] != 'b' || text[offset + 1] != ' ') {
+        offset++;
+    }
+
+    struct nix_token_edit edit = {
+        .start = offset,
+        .end = offset + 1,
+        .offset = offset,
+        .text = "bb",
+        .length = 2
+    };
+
+    char *next = malloc(length + 1);
+    memcpy(next, text, offset);
+    next[offset] = 'b';
+    memcpy(next + offset + 1, text + offset, length - offset);
+
+    struct nix_token_diff diff;
+    enum nix_err r = nix_token_table__relex(t, NULL, next, length + 1,
+            &edit, &diff);
+    TEST_ASSERT_MESSAGE(r == NIXERR_NONE, "Relexing failed");
+
+    TEST_ASSERT_MESSAGE(diff.removed < 8 && diff.inserted == diff.removed,
+            "Relexed too much of the file");
+    TEST_ASSERT_MESSAGE(t->count == count, "Token count changed");
+    TEST_ASSERT_MESSAGE(t->starts[count - 1] ==
+            (uint32_t)length - t->lengths[count - 1] + 1,
+            "Later tokens were not moved");
+
+    nix_token_table__free(&t);
+    free(text);
+    free(next);
+}
+
+int main(int argc, char **argv) {
+    TEST_PATH();
+
+    srand(time(NULL));
+
+    UNITY_BEGIN();
+    RUN_TEST(test_tokens_sequential);
+    RUN_TEST(test_tokens_parallel_random);
+    RUN_TEST(test_tokens_parallel_resync);
+    RUN_TEST(test_tokens_long_comments);
+    RUN_TEST(test_tokens_relex_random);
+    RUN_TEST(test_tokens_relex_local);
+    return UNITY_END();
+}
@@ -0,0 +1,6 @@
+#ifndef INCLUDE_test_tokens_h__
+#define INCLUDE_test_tokens_h__
+
+void test_tokens_sequential();
+
+#endif